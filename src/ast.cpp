@@ -1,6 +1,7 @@
 #include "ast.h"
 #include <sstream>
 #include "assert.h"
+#include "diagnostics.h"
 
 // -----------------------------------------------------
 // PARSING
@@ -25,6 +26,10 @@ enum class Precedence {
 	Highest,
 };
 
+// thrown after an error has been reported, to unwind to the top level
+// where the parser skips ahead to the next item. never leaves parse().
+struct ParserRecovery {};
+
 class ParserCursor {
 	std::vector<Token>& tokens;
 	PositionIndex       index;
@@ -32,22 +37,23 @@ class ParserCursor {
 
 public:
 
-	ParserCursor(std::vector<Token>& tokens, std::string& file_data) : tokens(
+	DiagnosticEngine& diagnostics;
+
+	ParserCursor(std::vector<Token>& tokens, SourceRange file_range,
+				 DiagnosticEngine& diagnostics) : tokens(
 		tokens), index(0),
 		eof_token(TokenType::Eof,
-		PositionRange(file_data.size(), file_data.size(),
-		file_data)) {}
+		SourceRange(file_range.end, file_range.end)), diagnostics(diagnostics) {}
 
 	const Token& expect(TokenType type, std::string error_info = "") {
 		const Token& t = this->get();
 
 		if (t.type != type) {
-			std::stringstream error;
-			error << "expected token type: " << type << " | found: " << t <<
-				" at " <<
-				t.pos;
-			error << error_info;
-			throw std::runtime_error(error.str());
+			std::stringstream found;
+			found << t;
+			this->diagnostics.report(DiagnosticCode::ExpectedToken, t.pos,
+									 { type, found.str(), error_info });
+			throw ParserRecovery();
 		}
 
 		// assert(t.type == type);
@@ -70,9 +76,22 @@ public:
 		return this->tokens[this->index];
 	}
 
-	const PositionRange get_current_range() {
+	const SourceRange get_current_range() {
 		return this->get().pos;
 	}
+
+	// skips to the next thing that looks like the start of a top level item
+	void synchronize() {
+		while (this->get().type != TokenType::Eof) {
+			this->index++;
+
+			TokenType type = this->get().type;
+			if (type == TokenType::Fn || type == TokenType::Export || type == TokenType::Extern ||
+				type == TokenType::Const) {
+				break;
+			}
+		}
+	}
 };
 class IParserPrefix {
 public:
@@ -88,6 +107,11 @@ public:
 									   std::shared_ptr<IAST>& left) = 0;
 	virtual bool should_apply(const Token& t) const = 0;
 	virtual Precedence get_precedence() const = 0;
+
+	// whether the operator can follow left at all
+	virtual bool should_apply_to(const IAST& left) const {
+		return true;
+	}
 };
 
 
@@ -100,8 +124,8 @@ public:
 	// cursor is visible to anyone who has access to parser.
 	ParserCursor cursor;
 
-	Parser(std::vector<Token>& tokens, std::string& file_data) : cursor(tokens,
-																		file_data)
+	Parser(std::vector<Token>& tokens, SourceRange file_range,
+		   DiagnosticEngine& diagnostics) : cursor(tokens, file_range, diagnostics)
 	{}
 
 	void add_prefix_parser(IParserPrefix *parser) {
@@ -126,12 +150,11 @@ public:
 		}
 
 		if (prefix == nullptr) {
-			std::stringstream error;
-			error << "unable to find prefix parser for token: ";
-			error << t_prefix.pos;
-			throw std::runtime_error(error.str());
-			assert(false
-				   && "unable to find prefix parser");
+			std::stringstream token;
+			token << t_prefix;
+			cursor.diagnostics.report(DiagnosticCode::NoPrefixParser,
+									  t_prefix.pos, { token.str() });
+			throw ParserRecovery();
 		}
 
 		// parse using the prefix parser
@@ -145,7 +168,7 @@ public:
 			IParserInfix *infix = nullptr;
 
 			for (IParserInfix *parser : infix_parsers) {
-				if (parser->should_apply(t_infix)) {
+				if (parser->should_apply(t_infix) && parser->should_apply_to(*left_ast)) {
 					infix = parser;
 					break;
 				}
@@ -191,7 +214,7 @@ public:
 
 		// bind the prefix operators the tightest
 		std::shared_ptr<IAST>inner = parser.parse(Precedence::Highest);
-		PositionRange         position = inner->position.extend_end(
+		SourceRange         position = inner->position.extend_end(
 			parser.cursor.get_current_range());
 
 
@@ -244,7 +267,7 @@ class BlockParserPrefix : public IParserPrefix {
 	std::shared_ptr<IAST>parse(Parser& parser) {
 		const Token& open_bracket_token = parser.cursor.advance();
 
-		PositionRange position = open_bracket_token.pos;
+		SourceRange position = open_bracket_token.pos;
 
 		std::vector<std::shared_ptr<IAST> >statements;
 
@@ -254,31 +277,56 @@ class BlockParserPrefix : public IParserPrefix {
 			position.end = statement->position.end;
 		}
 
-		parser.cursor.expect(TokenType::CloseCurlyBracket,
-							 "expected } to close block");
+		const Token& close_bracket_token = parser.cursor.expect(TokenType::CloseCurlyBracket,
+																"expected } to close block");
+		position.end = close_bracket_token.pos.end;
 
-		return std::shared_ptr<IAST>(new ASTBlock(statements, nullptr,
+		//an expression without a ; before the } is the block's value
+		std::shared_ptr<IAST>return_expr = nullptr;
+		if (!statements.empty() && statements.back()->type != ASTType::Statement) {
+			return_expr = statements.back();
+			statements.pop_back();
+		}
+
+		return std::shared_ptr<IAST>(new ASTBlock(statements, return_expr,
 			position));
 	}
 };
 
 class FunctionDefinitionPrefix : public IParserPrefix {
 	bool should_apply(const Token& t) const {
-		return t.type == TokenType::Fn;
+		return t.type == TokenType::Fn || t.type == TokenType::Export || t.type == TokenType::Extern ||
+			t.type == TokenType::Const;
 	}
 
 	std::shared_ptr<IAST>parse(Parser& parser) {
-		const Token& fn_token = parser.cursor.advance();
-		PositionRange position = fn_token.pos;
+		SourceRange position = parser.cursor.get_current_range();
+		ASTLinkage linkage = ASTLinkage::Internal;
+
+		if (parser.cursor.get().type == TokenType::Export) {
+			parser.cursor.advance();
+			linkage = ASTLinkage::Export;
+		}
+		else if (parser.cursor.get().type == TokenType::Extern) {
+			parser.cursor.advance();
+			linkage = ASTLinkage::Extern;
+		}
+
+		bool is_const = parser.cursor.get().type == TokenType::Const;
+		if (is_const) {
+			parser.cursor.advance();
+		}
+
+		parser.cursor.expect(TokenType::Fn, "expected fn");
 
 		const Token& fn_name = parser.cursor.advance();
 
 		if (fn_name.type != TokenType::Identifier) {
-			std::stringstream error;
-			error << "expected identifier after fn. found: " << fn_name <<
-				" at " <<
-				fn_name.pos;
-			throw std::runtime_error(error.str());
+			std::stringstream found;
+			found << fn_name;
+			parser.cursor.diagnostics.report(DiagnosticCode::ExpectedFnIdentifier,
+											 fn_name.pos, { found.str() });
+			throw ParserRecovery();
 		}
 
 		parser.cursor.expect(TokenType::OpenBracket, "expect ( after fn identifier");
@@ -319,13 +367,28 @@ class FunctionDefinitionPrefix : public IParserPrefix {
 			block = parser.parse(Precedence::Statement);
 		}
 
-		position.end = parser.cursor.get_current_range().end;
+		//up to the } of the body, or the return type of a declaration. the
+		//token after it is already part of whatever comes next.
+		position.end = block ? block->position.end : return_type->position.end;
+
+		if (linkage == ASTLinkage::Extern && block) {
+			parser.cursor.diagnostics.report(DiagnosticCode::ExternFunctionWithBody, fn_name.pos,
+											 { *fn_name.value.ptr_s });
+		}
+
+		if (is_const && linkage == ASTLinkage::Extern) {
+			parser.cursor.diagnostics.report(DiagnosticCode::ExternConstFunction, fn_name.pos,
+											 { *fn_name.value.ptr_s });
+		}
 
-		return std::shared_ptr<IAST>(new ASTFunctionDefinition(fn_name,
+		std::shared_ptr<ASTFunctionDefinition> fn_defn(new ASTFunctionDefinition(fn_name,
 			args,
 			return_type,
 			block,
+			linkage,
 			position));
+		fn_defn->is_const = is_const;
+		return fn_defn;
 	}
 };
 
@@ -335,7 +398,7 @@ class VariableDefinitionPrefix : public IParserPrefix {
 	}
 
 	std::shared_ptr<IAST>parse(Parser& parser) {
-		PositionRange position = parser.cursor.get_current_range();
+		SourceRange position = parser.cursor.get_current_range();
 		const Token& let_token = parser.cursor.expect(TokenType::Let);
 
 
@@ -360,6 +423,123 @@ class VariableDefinitionPrefix : public IParserPrefix {
 };
 
 
+class ForLoopPrefix : public IParserPrefix {
+	bool should_apply(const Token& t) const {
+		return t.type == TokenType::For;
+	}
+
+	static bool is_loop_hint(const std::string& name) {
+		return name == "vectorize" || name == "interleave" || name == "unroll";
+	}
+
+	std::vector<ASTLoopHint> parse_hints(Parser& parser) {
+		std::vector<ASTLoopHint>hints;
+
+		while (true) {
+			const Token& name = parser.cursor.expect(TokenType::Identifier, "expected loop hint");
+
+			if (!is_loop_hint(*name.value.ptr_s)) {
+				parser.cursor.diagnostics.report(DiagnosticCode::UnknownLoopHint, name.pos,
+												 { *name.value.ptr_s });
+				throw ParserRecovery();
+			}
+
+			unsigned value = 0;
+			if (parser.cursor.get().type == TokenType::OpenBracket) {
+				parser.cursor.advance();
+				const Token& count = parser.cursor.expect(TokenType::LiteralInt, "expected loop hint count");
+				value = *count.value.ptr_i;
+				parser.cursor.expect(TokenType::CloseBracket);
+			}
+			hints.push_back(ASTLoopHint(name, value));
+
+			if (parser.cursor.get().type != TokenType::Comma) {
+				break;
+			}
+			parser.cursor.advance();
+		}
+		return hints;
+	}
+
+	std::shared_ptr<IAST>parse(Parser& parser) {
+		SourceRange position = parser.cursor.get_current_range();
+		parser.cursor.expect(TokenType::For);
+
+		const Token& var_token = parser.cursor.expect(TokenType::Identifier, "expected loop variable after for");
+		std::shared_ptr<IAST>induction_var(new ASTLiteral(var_token, var_token.pos));
+
+		//the bounds are parsed above assignment, so that the = and , are
+		//left for us
+		parser.cursor.expect(TokenType::Equals, "expected = after loop variable");
+		std::shared_ptr<IAST>start = parser.parse(Precedence::Assignment);
+
+		parser.cursor.expect(TokenType::Comma, "expected , between loop start and end");
+		std::shared_ptr<IAST>end = parser.parse(Precedence::Assignment);
+
+		std::shared_ptr<IAST>step = nullptr;
+		if (parser.cursor.get().type == TokenType::Comma) {
+			parser.cursor.advance();
+			step = parser.parse(Precedence::Assignment);
+		}
+
+		std::vector<ASTLoopHint>hints;
+		if (parser.cursor.get().type == TokenType::Colon) {
+			parser.cursor.advance();
+			hints = this->parse_hints(parser);
+		}
+
+		if (parser.cursor.get().type != TokenType::OpenCurlyBracket) {
+			parser.cursor.expect(TokenType::OpenCurlyBracket, "expected { to start loop body");
+		}
+
+		//as with fn, the (;) after the body belongs to the entire loop
+		std::shared_ptr<IAST>body = parser.parse(Precedence::Statement);
+		position.end = body->position.end;
+
+		return std::shared_ptr<IAST>(new ASTForLoop(induction_var, start, end, step,
+			body, hints, position));
+	}
+};
+
+class IfPrefix : public IParserPrefix {
+	bool should_apply(const Token& t) const {
+		return t.type == TokenType::If;
+	}
+
+	//as with fn, the (;) after a block belongs to the entire if
+	std::shared_ptr<IAST>parse_block(Parser& parser, const std::string& error_info) {
+		if (parser.cursor.get().type != TokenType::OpenCurlyBracket) {
+			parser.cursor.expect(TokenType::OpenCurlyBracket, error_info);
+		}
+		return parser.parse(Precedence::Statement);
+	}
+
+	std::shared_ptr<IAST>parse(Parser& parser) {
+		SourceRange position = parser.cursor.get_current_range();
+		parser.cursor.expect(TokenType::If);
+
+		//parsed above assignment, so that the { is left for us
+		std::shared_ptr<IAST>condition = parser.parse(Precedence::Assignment);
+		std::shared_ptr<IAST>then_block = this->parse_block(parser, "expected { after if condition");
+		position.end = then_block->position.end;
+
+		std::shared_ptr<IAST>else_branch = nullptr;
+		if (parser.cursor.get().type == TokenType::Else) {
+			parser.cursor.advance();
+
+			if (parser.cursor.get().type == TokenType::If) {
+				else_branch = this->parse(parser);
+			}
+			else {
+				else_branch = this->parse_block(parser, "expected { or if after else");
+			}
+			position.end = else_branch->position.end;
+		}
+
+		return std::shared_ptr<IAST>(new ASTIf(condition, then_block, else_branch, position));
+	}
+};
+
 class OperatorParserInfix : public IParserInfix {
 	TokenType  op_type;
 	Precedence precedence;
@@ -381,7 +561,7 @@ public:
 		const Token& op_t = parser.cursor.expect(this->op_type);
 		std::shared_ptr<IAST> right = parser.parse(this->precedence);
 
-		PositionRange position = left->position.extend_end(
+		SourceRange position = left->position.extend_end(
 			right->position);
 
 		std::shared_ptr<IAST>ast(new ASTInfixExpr(left, op_t, right, position));
@@ -401,6 +581,12 @@ public:
 		return Precedence::Highest;
 	}
 
+	// the ; ends the expression: in { 1; (2) } the (2) is the block's value,
+	// not a call of the statement before it
+	bool should_apply_to(const IAST& left) const {
+		return left.type != ASTType::Statement;
+	}
+
 	std::shared_ptr<IAST>parse(Parser& parser, std::shared_ptr<IAST>& left) {
 		parser.cursor.expect(TokenType::OpenBracket);
 
@@ -442,7 +628,7 @@ public:
 	std::shared_ptr<IAST>parse(Parser& parser, std::shared_ptr<IAST>& left) {
 		const Token&  t = parser.cursor.expect(TokenType::Semicolon);
 
-		PositionRange position = left->position.extend_end(
+		SourceRange position = left->position.extend_end(
 			parser.cursor.get_current_range());
 
 
@@ -452,14 +638,17 @@ public:
 
 //-----------------------------------------------------
 // CORE PARSING FUNCTION
-std::shared_ptr<IAST>parse(std::vector<Token>& tokens, std::string& file_data) {
-	Parser p(tokens, file_data);
+std::shared_ptr<IAST>parse(std::vector<Token>& tokens, SourceRange file_range,
+						   DiagnosticEngine& diagnostics) {
+	Parser p(tokens, file_range, diagnostics);
 
 	p.add_prefix_parser(new LiteralParserPrefix);
 	p.add_prefix_parser(new BracketsParserPrefix);
 	p.add_prefix_parser(new BlockParserPrefix);
 	p.add_prefix_parser(new FunctionDefinitionPrefix);
 	p.add_prefix_parser(new VariableDefinitionPrefix);
+	p.add_prefix_parser(new ForLoopPrefix);
+	p.add_prefix_parser(new IfPrefix);
 	p.add_prefix_parser(new OperatorParserPrefix(TokenType::Minus));
 	p.add_prefix_parser(new OperatorParserPrefix(TokenType::CondNot));
 
@@ -507,13 +696,19 @@ std::shared_ptr<IAST>parse(std::vector<Token>& tokens, std::string& file_data) {
 
 	std::vector<std::shared_ptr<IAST> >children;
 
-	while (p.cursor.get().type != TokenType::Eof) {
-		std::shared_ptr<IAST>ast = p.parse(Precedence::Lowest);
-		children.push_back(ast);
+	while (p.cursor.get().type != TokenType::Eof && !diagnostics.should_stop()) {
+		try {
+			std::shared_ptr<IAST>ast = p.parse(Precedence::Lowest);
+			children.push_back(ast);
+		}
+		catch (ParserRecovery&) {
+			// the error is already reported. drop the broken item and keep
+			// going so that later errors are found in the same run.
+			p.cursor.synchronize();
+		}
 	}
 
-	PositionRange total_range = PositionRange(0, file_data.size(), file_data);
-	return std::shared_ptr<IAST>(new ASTRoot(children, total_range));
+	return std::shared_ptr<IAST>(new ASTRoot(children, file_range));
 }
 
 // -----------------------------------------------------
@@ -556,6 +751,14 @@ void IASTVisitor::inspect_variable_definition(
 	variable_defn.traverse_inner(*this);
 }
 
+void IASTVisitor::inspect_for_loop(ASTForLoop& for_loop) {
+	for_loop.traverse_inner(*this);
+}
+
+void IASTVisitor::inspect_if(ASTIf& if_expr) {
+	if_expr.traverse_inner(*this);
+}
+
 void IASTGenericVisitor::inspect_root(ASTRoot& root) {
 	this->inspect_ast(root);
 }
@@ -592,3 +795,42 @@ void IASTGenericVisitor::inspect_variable_definition(
 	ASTVariableDefinition& variable_defn) {
 	this->inspect_ast(variable_defn);
 }
+
+void IASTGenericVisitor::inspect_for_loop(ASTForLoop& for_loop) {
+	this->inspect_ast(for_loop);
+}
+
+void IASTGenericVisitor::inspect_if(ASTIf& if_expr) {
+	this->inspect_ast(if_expr);
+}
+
+ASTFunctionDefinition* get_top_level_fn_defn(IAST &ast) {
+	if (ast.type == ASTType::FunctionDefinition) {
+		return dynamic_cast<ASTFunctionDefinition*>(&ast);
+	}
+
+	if (ast.type == ASTType::Statement) {
+		ASTStatement &stmt = dynamic_cast<ASTStatement&>(ast);
+
+		if (stmt.inner->type == ASTType::FunctionDefinition) {
+			return dynamic_cast<ASTFunctionDefinition*>(stmt.inner.get());
+		}
+	}
+	return nullptr;
+}
+
+IAST* get_block_value_expr(ASTBlock &block) {
+	if (block.return_expr) {
+		return block.return_expr.get();
+	}
+
+	if (block.statements.empty()) {
+		return nullptr;
+	}
+
+	IAST &last = *block.statements.back();
+	if (last.type == ASTType::Statement) {
+		return dynamic_cast<ASTStatement&>(last).inner.get();
+	}
+	return &last;
+}
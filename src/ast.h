@@ -15,7 +15,10 @@ class ASTStatement;
 class ASTFunctionDefinition;
 class ASTFunctionCall;
 class ASTVariableDefinition;
+class ASTForLoop;
+class ASTIf;
 class LLVMASTData;
+class DiagnosticEngine;
 
 enum class ASTType {
 	PrefixExpr,
@@ -28,19 +31,21 @@ enum class ASTType {
 	VariableDefinition,
 	FunctionCall,
 	Attribute,
+	ForLoop,
+	If,
 	Root,
 };
 
 class IAST {
 protected:
 
-	IAST(ASTType ast_type, PositionRange position) : type(ast_type), position(
+	IAST(ASTType ast_type, SourceRange position) : type(ast_type), position(
 		position),
 		ts_data(nullptr), llvm_data(nullptr) {}
 
 public:
 
-	PositionRange position;
+	SourceRange position;
 	std::shared_ptr<TSASTData>ts_data;
 	std::shared_ptr<LLVMASTData>llvm_data;
 	ASTType type;
@@ -66,6 +71,8 @@ public:
 	virtual void inspect_fn_call(ASTFunctionCall& fn_call);
 	virtual void inspect_variable_definition(
 		ASTVariableDefinition& variable_defn);
+	virtual void inspect_for_loop(ASTForLoop& for_loop);
+	virtual void inspect_if(ASTIf& if_expr);
 };
 
 // provides a inspect_ast that lets you map over any generic ast type;
@@ -85,6 +92,8 @@ public:
 	virtual void inspect_fn_call(ASTFunctionCall& fn_call);
 	virtual void inspect_variable_definition(
 		ASTVariableDefinition& variable_defn);
+	virtual void inspect_for_loop(ASTForLoop& for_loop);
+	virtual void inspect_if(ASTIf& if_expr);
 };
 
 class ASTPrefixExpr : public IAST {
@@ -95,7 +104,7 @@ public:
 
 	ASTPrefixExpr(const Token & op,
 				  std::shared_ptr<IAST>expr,
-				  PositionRange position) : op(op), expr(expr), IAST(ASTType::PrefixExpr, position) {}
+				  SourceRange position) : op(op), expr(expr), IAST(ASTType::PrefixExpr, position) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
 		visitor.inspect_prefix_expr(*this);
@@ -116,7 +125,7 @@ public:
 	ASTInfixExpr(std::shared_ptr<IAST>left,
 				 const Token          & op,
 				 std::shared_ptr<IAST>right,
-				 PositionRange        position) :
+				 SourceRange        position) :
 				 left(left), op(op), right(right), IAST(ASTType::InfixExpr, position) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
@@ -134,7 +143,7 @@ public:
 
 	std::shared_ptr<IAST>inner;
 
-	ASTStatement(std::shared_ptr<IAST>inner, PositionRange position) :
+	ASTStatement(std::shared_ptr<IAST>inner, SourceRange position) :
 		inner(inner), IAST(ASTType::Statement, position) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
@@ -154,7 +163,7 @@ public:
 
 	ASTBlock(std::vector<std::shared_ptr<IAST> >statements,
 			 std::shared_ptr<IAST>              return_expr,
-			 PositionRange                      position) :
+			 SourceRange                      position) :
 			 statements(statements), return_expr(return_expr), IAST(ASTType::Block,
 			 position) {}
 
@@ -166,6 +175,10 @@ public:
 		for (auto statement : this->statements) {
 			statement->dispatch(visitor);
 		}
+
+		if (this->return_expr) {
+			this->return_expr->dispatch(visitor);
+		}
 	}
 };
 
@@ -174,7 +187,7 @@ public:
 
 	const Token& token;
 
-	ASTLiteral(const Token& token, PositionRange position) :
+	ASTLiteral(const Token& token, SourceRange position) :
 		token(token), IAST(ASTType::Literal, position) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
@@ -184,6 +197,17 @@ public:
 	virtual void traverse_inner(IASTVisitor& visitor) {}
 };
 
+// who can call a function, besides the program itself
+enum class ASTLinkage {
+	// nobody. main is the exception, the C runtime calls it.
+	Internal,
+	// export fn: part of the program's interface, callable from C
+	Export,
+	// extern fn: defined outside the program, eg. by the C library. has no
+	// body.
+	Extern,
+};
+
 class ASTFunctionDefinition : public IAST {
 public:
 
@@ -194,15 +218,28 @@ public:
 	std::shared_ptr<IAST>body;
 	std::shared_ptr<IAST>return_type;
 
+	// a fn without a body and without extern is a forward declaration, the
+	// linkage of its definition counts
+	ASTLinkage linkage;
+
+	// const fn: only computes its result from its arguments, so calls to it
+	// with constant arguments are evaluated at compile time, see
+	// ConstEvaluator. it can only call other const fns and the math
+	// builtins.
+	bool is_const;
+
 	ASTFunctionDefinition(const Token &fn_name,
 						  std::vector<Argument> args,
 						  std::shared_ptr<IAST> return_type,
 						  std::shared_ptr<IAST> body,
-						  PositionRange position) :
+						  ASTLinkage linkage,
+						  SourceRange position) :
 						  fn_name(fn_name),
 						  args(args),
 						  return_type(return_type),
 						  body(body),
+						  linkage(linkage),
+						  is_const(false),
 						  IAST(ASTType::FunctionDefinition, position) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
@@ -232,7 +269,7 @@ public:
 
 	ASTFunctionCall(std::shared_ptr<IAST> name,
 					std::vector<std::shared_ptr<IAST>>params,
-					PositionRange position) :
+					SourceRange position) :
 					name(name), params(params), IAST(ASTType::FunctionCall, position) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
@@ -256,7 +293,7 @@ public:
 
 	ASTVariableDefinition(std::shared_ptr<IAST>name,
 						  std::shared_ptr<IAST>type,
-						  PositionRange position) :
+						  SourceRange position) :
 						  name(name), type(type), IAST(
 						  ASTType::VariableDefinition,
 						  position) {}
@@ -275,13 +312,100 @@ public:
 	}
 };
 
+// for <name> = <start>, <end> [, <step>] [: <hint>, ...] { <body> }
+//
+// counts <name> (an i32, local to the loop) from start while it is below
+// end. end and step are evaluated once, before the first iteration. the
+// hints are passed on to LLVM's loop optimizations:
+//     vectorize       vectorize(<width>)   (width 1 turns it off)
+//     interleave(<count>)
+//     unroll          unroll(<count>)      (count 1 turns it off)
+struct ASTLoopHint {
+	const Token& name;
+
+	// 0 when no (<count>) was given
+	unsigned value;
+
+	ASTLoopHint(const Token& name, unsigned value) : name(name), value(value) {}
+};
+
+class ASTForLoop : public IAST {
+public:
+
+	std::shared_ptr<IAST>induction_var;
+	std::shared_ptr<IAST>start;
+	std::shared_ptr<IAST>end;
+	// nullptr steps by 1
+	std::shared_ptr<IAST>step;
+	std::shared_ptr<IAST>body;
+	std::vector<ASTLoopHint>hints;
+
+	ASTForLoop(std::shared_ptr<IAST>induction_var,
+			   std::shared_ptr<IAST>start,
+			   std::shared_ptr<IAST>end,
+			   std::shared_ptr<IAST>step,
+			   std::shared_ptr<IAST>body,
+			   std::vector<ASTLoopHint>hints,
+			   SourceRange position) :
+			   induction_var(induction_var), start(start), end(end), step(step),
+			   body(body), hints(hints), IAST(ASTType::ForLoop, position) {}
+
+	virtual void dispatch(IASTVisitor& visitor) {
+		visitor.inspect_for_loop(*this);
+	}
+
+	virtual void traverse_inner(IASTVisitor& visitor) {
+		this->induction_var->dispatch(visitor);
+		this->start->dispatch(visitor);
+		this->end->dispatch(visitor);
+
+		if (this->step) {
+			this->step->dispatch(visitor);
+		}
+		this->body->dispatch(visitor);
+	}
+};
+
+// if <condition> { <then> } [else { <else> } | else if ...]
+//
+// evaluates to the value of the branch that was taken. without an else it
+// evaluates to nothing.
+class ASTIf : public IAST {
+public:
+
+	std::shared_ptr<IAST>condition;
+	std::shared_ptr<IAST>then_block;
+	// a block, another ASTIf for else if, or nullptr without an else
+	std::shared_ptr<IAST>else_branch;
+
+	ASTIf(std::shared_ptr<IAST>condition,
+		  std::shared_ptr<IAST>then_block,
+		  std::shared_ptr<IAST>else_branch,
+		  SourceRange position) :
+		  condition(condition), then_block(then_block), else_branch(else_branch),
+		  IAST(ASTType::If, position) {}
+
+	virtual void dispatch(IASTVisitor& visitor) {
+		visitor.inspect_if(*this);
+	}
+
+	virtual void traverse_inner(IASTVisitor& visitor) {
+		this->condition->dispatch(visitor);
+		this->then_block->dispatch(visitor);
+
+		if (this->else_branch) {
+			this->else_branch->dispatch(visitor);
+		}
+	}
+};
+
 class ASTRoot : public IAST {
 public:
 
 	std::vector<std::shared_ptr<IAST> >children;
 
 	ASTRoot(std::vector<std::shared_ptr<IAST> >children,
-			PositionRange position) :
+			SourceRange position) :
 			IAST(ASTType::Root, position), children(children) {}
 
 	virtual void dispatch(IASTVisitor& visitor) {
@@ -295,5 +419,16 @@ public:
 	}
 };
 
+// top level functions are either bare or wrapped in a statement, depending on
+// whether they were terminated with a ;. nullptr if ast is not a function.
+ASTFunctionDefinition* get_top_level_fn_defn(IAST &ast);
+
+// what a block evaluates to: the expression after its last ;, or else the
+// expression in its last statement. nullptr for an empty block.
+IAST* get_block_value_expr(ASTBlock &block);
+
+// parse errors are reported to diagnostics. the returned tree contains
+// every top level item that parsed without errors.
 std::shared_ptr<IAST>parse(std::vector<Token> &tokens,
-						   std::string &file_data);
+						   SourceRange file_range,
+						   DiagnosticEngine &diagnostics);
@@ -0,0 +1,1182 @@
+#include "bytecode.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <dlfcn.h>
+#include <math.h>
+
+// -----------------------------------------------------
+// MODULES
+
+int BCModule::find_function(const std::string& name) const {
+	for (unsigned i = 0; i < this->functions.size(); ++i) {
+		if (this->functions[i].name == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// -----------------------------------------------------
+// PRINTING
+
+std::ostream& operator<<(std::ostream& out, BCOp op) {
+	static const char *const names[] = {
+		"const", "move",
+		"add.i32", "sub.i32", "mul.i32", "div.i32", "add.f32", "sub.f32", "mul.f32", "div.f32",
+		"neg.i32", "neg.f32", "not", "i32tof32",
+		"lt.i32", "gt.i32", "le.i32", "ge.i32", "eq.i32", "ne.i32",
+		"lt.f32", "gt.f32", "le.f32", "ge.f32", "eq.f32", "ne.f32",
+		"jump", "jumpif", "jumpifnot",
+		"call", "tailcall", "callnative",
+		"ret", "retvoid",
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == (size_t)BCOp::Count, "a name for every op");
+
+	return out << names[(size_t)op];
+}
+
+std::ostream& operator<<(std::ostream& out, const BCFunction& fn) {
+	if (fn.native_kind != BCNativeKind::None) {
+		return out << "native fn " << fn.name << "\n";
+	}
+
+	out << "fn " << fn.name << " (" << fn.num_registers << " registers) {\n";
+
+	for (uint32_t i = 0; i < fn.code.size(); ++i) {
+		const BCInstruction &instruction = fn.code[i];
+		out << "    " << i << ": " << instruction.op;
+
+		switch (instruction.op) {
+		case BCOp::Const:
+			out << " r" << instruction.a << ", 0x" << std::hex << instruction.get_immediate() << std::dec;
+			break;
+
+		case BCOp::Move:
+		case BCOp::NegI32:
+		case BCOp::NegF32:
+		case BCOp::Not:
+		case BCOp::I32ToF32:
+			out << " r" << instruction.a << ", r" << instruction.b;
+			break;
+
+		// jumps are relative to the jump
+		case BCOp::Jump:
+			out << " " << i + (int32_t)instruction.get_immediate();
+			break;
+
+		case BCOp::JumpIf:
+		case BCOp::JumpIfNot:
+			out << " r" << instruction.a << ", " << i + (int32_t)instruction.get_immediate();
+			break;
+
+		case BCOp::Call:
+		case BCOp::CallNative:
+			out << " r" << instruction.a << ", " << instruction.b << ", r" << instruction.c;
+			break;
+
+		case BCOp::TailCall:
+			out << " " << instruction.b << ", r" << instruction.c;
+			break;
+
+		case BCOp::Return:
+			out << " r" << instruction.a;
+			break;
+
+		case BCOp::ReturnVoid:
+			break;
+
+		default:
+			out << " r" << instruction.a << ", r" << instruction.b << ", r" << instruction.c;
+			break;
+		}
+		out << "\n";
+	}
+	return out << "}\n";
+}
+
+std::ostream& operator<<(std::ostream& out, const BCModule& module) {
+	for (unsigned i = 0; i < module.functions.size(); ++i) {
+		out << i << ": " << module.functions[i];
+	}
+	return out;
+}
+
+// -----------------------------------------------------
+// NATIVE CALLS
+
+// the f32 functions of the C library the math builtins are, the same ones
+// the other backends call
+static void* get_builtin_address(const std::string& name) {
+	static const std::map<std::string, void *> functions = {
+		{ "sin", (void *)&::sinf }, { "cos", (void *)&::cosf }, { "sqrt", (void *)&::sqrtf },
+		{ "exp", (void *)&::expf }, { "exp2", (void *)&::exp2f }, { "log", (void *)&::logf },
+		{ "log2", (void *)&::log2f }, { "log10", (void *)&::log10f }, { "fabs", (void *)&::fabsf },
+		{ "floor", (void *)&::floorf }, { "ceil", (void *)&::ceilf }, { "trunc", (void *)&::truncf },
+		{ "round", (void *)&::roundf }, { "pow", (void *)&::powf }, { "fmin", (void *)&::fminf },
+		{ "fmax", (void *)&::fmaxf }, { "copysign", (void *)&::copysignf }, { "fma", (void *)&::fmaf },
+	};
+
+	auto it = functions.find(name);
+	return it == functions.end() ? nullptr : it->second;
+}
+
+static BCNativeKind get_native_kind(const IRFunction& fn) {
+	bool all_f32 = std::all_of(fn.arg_types.begin(), fn.arg_types.end(), [](IRType type) {
+		return type == IRType::F32;
+	});
+
+	if (fn.return_type == IRType::F32 && all_f32) {
+		switch (fn.arg_types.size()) {
+		case 1: return BCNativeKind::F32Unary;
+		case 2: return BCNativeKind::F32Binary;
+		case 3: return BCNativeKind::F32Ternary;
+		}
+	}
+	return BCNativeKind::Generic;
+}
+
+// on x86-64 and AArch64 (but not Windows), integer and floating point
+// arguments are passed in two separate sets of registers, in order. a
+// function taking up to 6 integers and 8 floats in any order can therefore
+// be called through a pointer to one that takes 6 integers and then 8
+// floats: every argument ends up where the callee looks for it, and the
+// rest are ignored. that avoids generating a thunk per signature.
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32)
+#define ACHILLES_GENERIC_NATIVE_CALLS 1
+#endif
+
+static const unsigned max_native_int_args = 6;
+static const unsigned max_native_f32_args = 8;
+
+#define ACHILLES_NATIVE_ARGS int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, \
+	float, float, float, float, float, float, float, float
+
+static BCValue call_native(const BCFunction& fn, const BCValue *args) {
+	BCValue result;
+	result.u = 0;
+
+#ifdef ACHILLES_GENERIC_NATIVE_CALLS
+	int64_t ints[max_native_int_args] = {};
+	float floats[max_native_f32_args] = {};
+	unsigned num_ints = 0;
+	unsigned num_floats = 0;
+
+	for (unsigned i = 0; i < fn.arg_types.size(); ++i) {
+		if (fn.arg_types[i] == IRType::F32) {
+			floats[num_floats++] = args[i].f;
+		}
+		else {
+			ints[num_ints++] = args[i].i;
+		}
+	}
+
+#define ACHILLES_CALL_NATIVE(return_type) \
+	((return_type (*)(ACHILLES_NATIVE_ARGS))fn.native)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], \
+		floats[0], floats[1], floats[2], floats[3], floats[4], floats[5], floats[6], floats[7])
+
+	switch (fn.return_type) {
+	case IRType::Void:
+		ACHILLES_CALL_NATIVE(void);
+		break;
+
+	case IRType::I32:
+		result.i = ACHILLES_CALL_NATIVE(int32_t);
+		break;
+
+	case IRType::F32:
+		result.f = ACHILLES_CALL_NATIVE(float);
+		break;
+
+	case IRType::Bool:
+		result.i = ACHILLES_CALL_NATIVE(bool) ? 1 : 0;
+		break;
+	}
+
+#undef ACHILLES_CALL_NATIVE
+#else
+	(void)fn;
+	(void)args;
+#endif
+
+	return result;
+}
+
+// null if it is not in the process, which is only an error if it is called
+static void resolve_native(const IRFunction& fn, BCFunction& bc) {
+	bc.native_kind = get_native_kind(fn);
+	bc.native = fn.is_builtin ? get_builtin_address(fn.name) : dlsym(RTLD_DEFAULT, fn.name.c_str());
+}
+
+// throws if the interpreter can not make a call to fn
+static void check_native_call(const BCFunction& fn) {
+	if (!fn.native) {
+		throw std::runtime_error("interpreter: unable to find extern fn " + fn.name + " in the process");
+	}
+
+	if (fn.native_kind != BCNativeKind::Generic) {
+		return;
+	}
+
+#ifdef ACHILLES_GENERIC_NATIVE_CALLS
+	unsigned num_f32_args = std::count(fn.arg_types.begin(), fn.arg_types.end(), IRType::F32);
+
+	if (num_f32_args > max_native_f32_args || fn.arg_types.size() - num_f32_args > max_native_int_args) {
+		throw std::runtime_error("interpreter: extern fn " + fn.name + " takes too many arguments, at most 6 "
+								 "i32 / bool and 8 f32 can be passed");
+	}
+#else
+	throw std::runtime_error("interpreter: calling extern fn " + fn.name + " is only supported on x86-64 "
+							 "and AArch64");
+#endif
+}
+
+// -----------------------------------------------------
+// COMPILER
+
+class BCCompiler {
+public:
+
+	BCCompiler(const IRModule& module, const BCModule& bc_module) :
+		module(module), bc_module(bc_module), fn(nullptr), bc(nullptr), scratch(0), args_base(0) {}
+
+	void compile_function(const IRFunction& fn, BCFunction& bc) {
+		this->fn = &fn;
+		this->bc = &bc;
+		this->labels.assign(fn.blocks.size(), UINT32_MAX);
+		this->jumps.clear();
+		this->stubs.clear();
+
+		this->allocate_registers();
+
+		// constants keep their register for the whole call, so they are
+		// loaded once on entry, instead of every time a loop comes by them
+		for (auto& block : fn.blocks) {
+			for (IRValue value : block.instructions) {
+				if (fn.instructions[value].op == IROp::Const) {
+					this->compile_constant(value);
+				}
+			}
+		}
+
+		// the order of the IR, which puts a loop's body after its header
+		for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+			if (fn.blocks[block].instructions.empty()) {
+				continue;
+			}
+
+			this->labels[block] = bc.code.size();
+			this->next_block = this->get_next_block(block);
+
+			for (uint32_t i = 0; i < fn.blocks[block].instructions.size(); ++i) {
+				this->compile_instruction(block, i);
+			}
+		}
+
+		// the moves into the phis of a block with more than one way in,
+		// taken from a conditional branch
+		for (uint32_t i = 0; i < this->stubs.size(); ++i) {
+			this->labels.push_back(bc.code.size());
+			this->emit_phi_moves(this->stubs[i].first, this->stubs[i].second);
+			this->emit_jump(BCOp::Jump, 0, this->stubs[i].second);
+		}
+
+		for (auto& jump : this->jumps) {
+			bc.code[jump.first].set_immediate(this->labels[jump.second] - jump.first);
+		}
+	}
+
+private:
+
+	const IRModule &module;
+	// the natives are resolved before any function is compiled
+	const BCModule &bc_module;
+	const IRFunction *fn;
+	BCFunction *bc;
+
+	// per IR value, UINT32_MAX for the ones without a value
+	std::vector<uint32_t> registers;
+	// free between instructions, used to break cycles of phi moves and
+	// as the result of void calls
+	uint32_t scratch;
+	// where the arguments of calls go, at the end of the frame
+	uint32_t args_base;
+
+	// the first instruction of every block, then of every stub
+	std::vector<uint32_t> labels;
+	// (instruction, label) for every jump
+	std::vector<std::pair<uint32_t, uint32_t> > jumps;
+	// (predecessor, block) edges that need a stub
+	std::vector<std::pair<uint32_t, uint32_t> > stubs;
+	uint32_t next_block;
+
+	uint32_t get_next_block(uint32_t block) const {
+		for (uint32_t next = block + 1; next < this->fn->blocks.size(); ++next) {
+			if (!this->fn->blocks[next].instructions.empty()) {
+				return next;
+			}
+		}
+		return UINT32_MAX;
+	}
+
+	void allocate_registers() {
+		const IRFunction &fn = *this->fn;
+		uint32_t next_register = fn.arg_types.size();
+		uint32_t max_call_args = 0;
+
+		this->registers.assign(fn.instructions.size(), UINT32_MAX);
+
+		for (auto& block : fn.blocks) {
+			for (IRValue value : block.instructions) {
+				const IRInstruction &instruction = fn.instructions[value];
+
+				if (instruction.op == IROp::Arg) {
+					this->registers[value] = instruction.constant.index;
+					continue;
+				}
+
+				if (instruction.op == IROp::Call) {
+					max_call_args = std::max(max_call_args, instruction.num_operands);
+				}
+
+				if (instruction.type != IRType::Void && !is_terminator(instruction.op)) {
+					this->registers[value] = next_register++;
+				}
+			}
+		}
+
+		this->scratch = next_register++;
+		this->args_base = next_register;
+		this->bc->num_registers = next_register + max_call_args;
+
+		if (this->bc->num_registers > UINT16_MAX + 1) {
+			std::stringstream error;
+			error << "interpreter: fn " << fn.name << " needs " << this->bc->num_registers
+				<< " registers, at most " << UINT16_MAX + 1 << " are supported";
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	static bool is_terminator(IROp op) {
+		return op == IROp::Br || op == IROp::CondBr || op == IROp::Ret;
+	}
+
+	void emit(BCOp op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+		BCInstruction instruction;
+		instruction.op = op;
+		instruction.a = a;
+		instruction.b = b;
+		instruction.c = c;
+		this->bc->code.push_back(instruction);
+	}
+
+	void emit_jump(BCOp op, uint32_t condition, uint32_t label) {
+		this->jumps.push_back(std::make_pair(this->bc->code.size(), label));
+		this->emit(op, condition);
+	}
+
+	uint32_t get_register(IRValue value) const {
+		assert(this->registers[value] != UINT32_MAX);
+		return this->registers[value];
+	}
+
+	IRType get_type(IRValue value) const {
+		return this->fn->instructions[value].type;
+	}
+
+	bool has_phis(uint32_t block) const {
+		const std::vector<IRValue> &instructions = this->fn->blocks[block].instructions;
+		return !instructions.empty() && this->fn->instructions[instructions[0]].op == IROp::Phi;
+	}
+
+	// the phis of block all take their value at once, so a phi that reads
+	// another one of them has to read it before it is overwritten
+	void emit_phi_moves(uint32_t predecessor, uint32_t block) {
+		// (destination, source)
+		std::vector<std::pair<uint32_t, uint32_t> > moves;
+
+		for (IRValue value : this->fn->blocks[block].instructions) {
+			if (this->fn->instructions[value].op != IROp::Phi) {
+				break;
+			}
+
+			const uint32_t *operands = this->fn->get_operands(value);
+			for (uint32_t i = 0; i < this->fn->instructions[value].num_operands; i += 2) {
+				if (operands[i] == predecessor) {
+					if (this->get_register(operands[i + 1]) != this->get_register(value)) {
+						moves.push_back(std::make_pair(this->get_register(value), this->get_register(operands[i + 1])));
+					}
+					break;
+				}
+			}
+		}
+
+		while (!moves.empty()) {
+			bool emitted = false;
+
+			for (unsigned i = 0; i < moves.size() && !emitted; ++i) {
+				uint32_t destination = moves[i].first;
+				bool is_read = std::any_of(moves.begin(), moves.end(), [destination](std::pair<uint32_t, uint32_t> move) {
+					return move.second == destination;
+				});
+
+				if (!is_read) {
+					this->emit(BCOp::Move, destination, moves[i].second);
+					moves.erase(moves.begin() + i);
+					emitted = true;
+				}
+			}
+
+			// only cycles are left. saving one destination breaks its cycle.
+			if (!emitted) {
+				uint32_t destination = moves[0].first;
+				this->emit(BCOp::Move, this->scratch, destination);
+
+				for (auto& move : moves) {
+					if (move.second == destination) {
+						move.second = this->scratch;
+					}
+				}
+			}
+		}
+	}
+
+	// the label for the edge from predecessor to block
+	uint32_t get_edge_label(uint32_t predecessor, uint32_t block) {
+		if (!this->has_phis(block)) {
+			return block;
+		}
+
+		this->stubs.push_back(std::make_pair(predecessor, block));
+		return this->fn->blocks.size() + this->stubs.size() - 1;
+	}
+
+	static BCOp get_binary_op(IROp op, IRType type) {
+		bool is_f32 = type == IRType::F32;
+
+		switch (op) {
+		case IROp::Add: return is_f32 ? BCOp::AddF32 : BCOp::AddI32;
+		case IROp::Sub: return is_f32 ? BCOp::SubF32 : BCOp::SubI32;
+		case IROp::Mul: return is_f32 ? BCOp::MulF32 : BCOp::MulI32;
+		case IROp::Div: return is_f32 ? BCOp::DivF32 : BCOp::DivI32;
+		case IROp::CmpL: return is_f32 ? BCOp::LessF32 : BCOp::LessI32;
+		case IROp::CmpG: return is_f32 ? BCOp::GreaterF32 : BCOp::GreaterI32;
+		case IROp::CmpLEQ: return is_f32 ? BCOp::LessEqualF32 : BCOp::LessEqualI32;
+		case IROp::CmpGEQ: return is_f32 ? BCOp::GreaterEqualF32 : BCOp::GreaterEqualI32;
+		case IROp::CmpEQ: return is_f32 ? BCOp::EqualF32 : BCOp::EqualI32;
+		case IROp::CmpNEQ: return is_f32 ? BCOp::NotEqualF32 : BCOp::NotEqualI32;
+		default:
+			assert(false && "not a binary op");
+			return BCOp::Move;
+		}
+	}
+
+	static bool is_ordered_comparison(IROp op) {
+		return op == IROp::CmpL || op == IROp::CmpG || op == IROp::CmpLEQ || op == IROp::CmpGEQ;
+	}
+
+	// a call to a function with bytecode whose result is returned right
+	// away. the instruction after it either returns it, or branches to a
+	// block that returns it through a phi, which is how the IR returns
+	// from inside an if.
+	bool is_tail_call(uint32_t block, uint32_t index) const {
+		const IRFunction &fn = *this->fn;
+		const std::vector<IRValue> &instructions = fn.blocks[block].instructions;
+
+		if (index + 1 >= instructions.size()) {
+			return false;
+		}
+
+		IRValue call = instructions[index];
+		IRValue next = instructions[index + 1];
+
+		if (fn.instructions[call].op != IROp::Call ||
+			this->module.functions[fn.instructions[call].constant.index].is_declaration()) {
+			return false;
+		}
+
+		IRValue ret = next;
+		if (fn.instructions[next].op == IROp::Br) {
+			const std::vector<IRValue> &target = fn.blocks[fn.get_operands(next)[0]].instructions;
+			auto it = std::find_if(target.begin(), target.end(), [&fn](IRValue value) {
+				return fn.instructions[value].op != IROp::Phi;
+			});
+			ret = *it;
+		}
+
+		if (fn.instructions[ret].op != IROp::Ret) {
+			return false;
+		}
+
+		if (fn.instructions[ret].num_operands == 0) {
+			return fn.instructions[call].type == IRType::Void;
+		}
+		return this->get_incoming_value(fn.get_operands(ret)[0], block) == call;
+	}
+
+	// the value a phi takes coming from block, or value if it is not a phi
+	IRValue get_incoming_value(IRValue value, uint32_t block) const {
+		if (this->fn->instructions[value].op != IROp::Phi) {
+			return value;
+		}
+
+		const uint32_t *operands = this->fn->get_operands(value);
+		for (uint32_t i = 0; i < this->fn->instructions[value].num_operands; i += 2) {
+			if (operands[i] == block) {
+				return operands[i + 1];
+			}
+		}
+		return ir_no_value;
+	}
+
+	void compile_constant(IRValue value) {
+		const IRInstruction &instruction = this->fn->instructions[value];
+		BCValue constant;
+		constant.u = 0;
+
+		switch (instruction.type) {
+		case IRType::I32: constant.i = instruction.constant.i; break;
+		case IRType::F32: constant.f = instruction.constant.f; break;
+		case IRType::Bool: constant.i = instruction.constant.b ? 1 : 0; break;
+		case IRType::Void: break;
+		}
+
+		this->emit(BCOp::Const, this->get_register(value));
+		this->bc->code.back().set_immediate(constant.u);
+	}
+
+	void compile_instruction(uint32_t block, uint32_t index) {
+		const IRFunction &fn = *this->fn;
+		IRValue value = fn.blocks[block].instructions[index];
+		const IRInstruction &instruction = fn.instructions[value];
+		const uint32_t *operands = fn.get_operands(value);
+
+		switch (instruction.op) {
+		case IROp::Arg:
+		case IROp::Const:
+		case IROp::Phi:
+		case IROp::Nop:
+			return;
+
+		case IROp::Copy:
+			this->emit(BCOp::Move, this->get_register(value), this->get_register(operands[0]));
+			return;
+
+		case IROp::Add:
+		case IROp::Sub:
+		case IROp::Mul:
+		case IROp::Div:
+		case IROp::CmpL:
+		case IROp::CmpG:
+		case IROp::CmpLEQ:
+		case IROp::CmpGEQ:
+		case IROp::CmpEQ:
+		case IROp::CmpNEQ: {
+			IRType type = this->get_type(operands[0]);
+			uint32_t left = this->get_register(operands[0]);
+			uint32_t right = this->get_register(operands[1]);
+
+			if (type == IRType::Bool && is_ordered_comparison(instruction.op)) {
+				std::swap(left, right);
+			}
+
+			this->emit(get_binary_op(instruction.op, type), this->get_register(value), left, right);
+			return;
+		}
+
+		case IROp::Neg:
+			this->emit(instruction.type == IRType::F32 ? BCOp::NegF32 : BCOp::NegI32,
+					   this->get_register(value), this->get_register(operands[0]));
+			return;
+
+		case IROp::Not:
+			this->emit(BCOp::Not, this->get_register(value), this->get_register(operands[0]));
+			return;
+
+		case IROp::IntToFloat:
+			this->emit(BCOp::I32ToF32, this->get_register(value), this->get_register(operands[0]));
+			return;
+
+		case IROp::Call: {
+			for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+				this->emit(BCOp::Move, this->args_base + i, this->get_register(operands[i]));
+			}
+
+			uint32_t callee = instruction.constant.index;
+			uint32_t result = instruction.type == IRType::Void ? this->scratch : this->get_register(value);
+
+			if (this->module.functions[callee].is_declaration()) {
+				check_native_call(this->bc_module.functions[callee]);
+				this->emit(BCOp::CallNative, result, callee, this->args_base);
+			}
+			else if (this->is_tail_call(block, index)) {
+				this->emit(BCOp::TailCall, 0, callee, this->args_base);
+			}
+			else {
+				this->emit(BCOp::Call, result, callee, this->args_base);
+			}
+			return;
+		}
+
+		case IROp::Br:
+			// the tail call before it already returned
+			if (index > 0 && this->is_tail_call(block, index - 1)) {
+				return;
+			}
+
+			this->emit_phi_moves(block, operands[0]);
+
+			if (operands[0] != this->next_block) {
+				this->emit_jump(BCOp::Jump, 0, operands[0]);
+			}
+			return;
+
+		case IROp::CondBr: {
+			uint32_t condition = this->get_register(operands[0]);
+			uint32_t then_label = this->get_edge_label(block, operands[1]);
+			uint32_t else_label = this->get_edge_label(block, operands[2]);
+
+			if (else_label == this->next_block) {
+				this->emit_jump(BCOp::JumpIf, condition, then_label);
+			}
+			else if (then_label == this->next_block) {
+				this->emit_jump(BCOp::JumpIfNot, condition, else_label);
+			}
+			else {
+				this->emit_jump(BCOp::JumpIf, condition, then_label);
+				this->emit_jump(BCOp::Jump, 0, else_label);
+			}
+			return;
+		}
+
+		case IROp::Ret:
+			// the tail call before it already returned
+			if (index > 0 && this->is_tail_call(block, index - 1)) {
+				return;
+			}
+
+			if (instruction.num_operands == 0) {
+				this->emit(BCOp::ReturnVoid);
+			}
+			else {
+				this->emit(BCOp::Return, this->get_register(operands[0]));
+			}
+			return;
+
+		default:
+			assert(false && "op can not be compiled to bytecode");
+			return;
+		}
+	}
+};
+
+BCModule compile_to_bytecode(const IRModule& module) {
+	BCModule bc_module;
+	bc_module.functions.resize(module.functions.size());
+
+	for (uint32_t i = 0; i < module.functions.size(); ++i) {
+		const IRFunction &fn = module.functions[i];
+		BCFunction &bc = bc_module.functions[i];
+
+		bc.name = fn.name;
+		bc.return_type = fn.return_type;
+		bc.arg_types = fn.arg_types;
+
+		if (fn.is_declaration()) {
+			resolve_native(fn, bc);
+		}
+	}
+
+	BCCompiler compiler(module, bc_module);
+
+	for (uint32_t i = 0; i < module.functions.size(); ++i) {
+		if (!module.functions[i].is_declaration()) {
+			compiler.compile_function(module.functions[i], bc_module.functions[i]);
+		}
+	}
+
+	return bc_module;
+}
+
+// -----------------------------------------------------
+// INTERPRETER
+
+// the arguments are in consecutive registers. bools are bytes to the
+// trampoline, which is the low byte of the register on little endian
+// targets.
+static BCValue call_native_entry(BCNativeEntry entry, const BCFunction& fn, BCValue *args) {
+	void *arg_ptrs[max_native_entry_args];
+	for (unsigned i = 0; i < fn.arg_types.size(); ++i) {
+		arg_ptrs[i] = args + i;
+	}
+
+	BCValue result;
+	result.u = 0;
+	entry(arg_ptrs, &result);
+	return result;
+}
+
+BCInterpreter::BCInterpreter(const BCModule& module, size_t stack_size) :
+	module(module), stack(new BCValue[stack_size]), stack_size(stack_size),
+	counters(module.functions.size(), Counters{ 0, 0 }),
+	native_entries(new std::atomic<BCNativeEntry>[module.functions.size()]),
+	tier_up_handler(nullptr), tier_up_threshold(0) {
+	this->frames.reserve(1024);
+
+	for (unsigned i = 0; i < module.functions.size(); ++i) {
+		this->native_entries[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+BCValue BCInterpreter::call(uint32_t function, const std::vector<BCValue>& args) {
+	const BCFunction &fn = this->module.functions[function];
+	assert(args.size() == fn.arg_types.size());
+
+	if (fn.native_kind != BCNativeKind::None) {
+		check_native_call(fn);
+		return call_native(fn, args.data());
+	}
+
+	if (fn.num_registers > this->stack_size) {
+		throw std::runtime_error("interpreter: stack overflow in " + fn.name);
+	}
+
+	std::copy(args.begin(), args.end(), this->stack.get());
+
+	BCNativeEntry native = this->native_entries[function].load(std::memory_order_acquire);
+	if (native) {
+		return call_native_entry(native, fn, this->stack.get());
+	}
+
+	this->count_call(function);
+	this->frames.clear();
+	return this->run(function, this->stack.get());
+}
+
+extern "C" void bc_division_trap(int32_t overflow) {
+	if (overflow) {
+		throw std::runtime_error("interpreter: integer division overflow");
+	}
+	throw std::runtime_error("interpreter: integer division by zero");
+}
+
+void BCInterpreter::set_tier_up(BCTierUpHandler *handler, uint32_t threshold) {
+	this->tier_up_handler = handler;
+	// the counters are checked after they are incremented
+	this->tier_up_threshold = std::max<uint32_t>(threshold, 1);
+}
+
+void BCInterpreter::set_native_entry(uint32_t function, BCNativeEntry entry) {
+	this->native_entries[function].store(entry, std::memory_order_release);
+}
+
+void BCInterpreter::tier_up(uint32_t function) {
+	if (this->tier_up_handler && this->module.functions[function].arg_types.size() <= max_native_entry_args) {
+		this->tier_up_handler->function_is_hot(function);
+	}
+}
+
+// a threaded interpreter: every handler ends in a jump to the handler of
+// the next instruction, through a table of label addresses (a GNU
+// extension). the branch predictor gets a separate indirect jump per
+// handler to learn from, instead of the one of a switch in a loop.
+BCValue BCInterpreter::run(uint32_t function, BCValue *base) {
+	static const void *const handlers[] = {
+		&&handle_const, &&handle_move,
+		&&handle_add_i32, &&handle_sub_i32, &&handle_mul_i32, &&handle_div_i32,
+		&&handle_add_f32, &&handle_sub_f32, &&handle_mul_f32, &&handle_div_f32,
+		&&handle_neg_i32, &&handle_neg_f32, &&handle_not, &&handle_i32_to_f32,
+		&&handle_less_i32, &&handle_greater_i32, &&handle_less_equal_i32, &&handle_greater_equal_i32,
+		&&handle_equal_i32, &&handle_not_equal_i32,
+		&&handle_less_f32, &&handle_greater_f32, &&handle_less_equal_f32, &&handle_greater_equal_f32,
+		&&handle_equal_f32, &&handle_not_equal_f32,
+		&&handle_jump, &&handle_jump_if, &&handle_jump_if_not,
+		&&handle_call, &&handle_tail_call, &&handle_call_native,
+		&&handle_return, &&handle_return_void,
+	};
+	static_assert(sizeof(handlers) / sizeof(handlers[0]) == (size_t)BCOp::Count, "a handler for every op");
+
+	const BCFunction *functions = this->module.functions.data();
+	const BCValue *stack_end = this->stack.get() + this->stack_size;
+	const BCInstruction *ip = functions[function].code.data();
+	BCValue result;
+
+#define DISPATCH() goto *handlers[(size_t)ip->op]
+#define NEXT() ++ip; DISPATCH()
+
+#define BINARY_I32(name, op) \
+	name: \
+		base[ip->a].i = (int32_t)((uint32_t)base[ip->b].i op (uint32_t)base[ip->c].i); \
+		NEXT();
+
+#define BINARY_F32(name, op) \
+	name: \
+		base[ip->a].f = base[ip->b].f op base[ip->c].f; \
+		NEXT();
+
+#define COMPARE(name, field, op) \
+	name: \
+		base[ip->a].i = base[ip->b].field op base[ip->c].field; \
+		NEXT();
+
+	DISPATCH();
+
+handle_const:
+	base[ip->a].u = ip->get_immediate();
+	NEXT();
+
+handle_move:
+	base[ip->a] = base[ip->b];
+	NEXT();
+
+BINARY_I32(handle_add_i32, +)
+BINARY_I32(handle_sub_i32, -)
+BINARY_I32(handle_mul_i32, *)
+
+handle_div_i32: {
+	int32_t left = base[ip->b].i;
+	int32_t right = base[ip->c].i;
+
+	// undefined in the other backends, a trap here
+	if (right == 0 || (left == INT32_MIN && right == -1)) {
+		bc_division_trap(right != 0);
+	}
+
+	base[ip->a].i = left / right;
+	NEXT();
+}
+
+BINARY_F32(handle_add_f32, +)
+BINARY_F32(handle_sub_f32, -)
+BINARY_F32(handle_mul_f32, *)
+BINARY_F32(handle_div_f32, /)
+
+handle_neg_i32:
+	base[ip->a].i = (int32_t)(0u - (uint32_t)base[ip->b].i);
+	NEXT();
+
+handle_neg_f32:
+	base[ip->a].f = -base[ip->b].f;
+	NEXT();
+
+handle_not:
+	base[ip->a].i = !base[ip->b].i;
+	NEXT();
+
+handle_i32_to_f32:
+	base[ip->a].f = (float)base[ip->b].i;
+	NEXT();
+
+COMPARE(handle_less_i32, i, <)
+COMPARE(handle_greater_i32, i, >)
+COMPARE(handle_less_equal_i32, i, <=)
+COMPARE(handle_greater_equal_i32, i, >=)
+COMPARE(handle_equal_i32, i, ==)
+COMPARE(handle_not_equal_i32, i, !=)
+COMPARE(handle_less_f32, f, <)
+COMPARE(handle_greater_f32, f, >)
+COMPARE(handle_less_equal_f32, f, <=)
+COMPARE(handle_greater_equal_f32, f, >=)
+COMPARE(handle_equal_f32, f, ==)
+// true for NaN, like fcmp une
+COMPARE(handle_not_equal_f32, f, !=)
+
+// jumping backwards is going around a loop
+#define JUMP(offset) \
+	do { \
+		int32_t jump_offset = (offset); \
+		if (jump_offset < 0) { \
+			this->count_backedge(function); \
+		} \
+		ip += jump_offset; \
+	} while (0)
+
+handle_jump:
+	JUMP((int32_t)ip->get_immediate());
+	DISPATCH();
+
+handle_jump_if:
+	JUMP(base[ip->a].i ? (int32_t)ip->get_immediate() : 1);
+	DISPATCH();
+
+handle_jump_if_not:
+	JUMP(base[ip->a].i ? 1 : (int32_t)ip->get_immediate());
+	DISPATCH();
+
+handle_call: {
+	const BCFunction *callee = functions + ip->b;
+	BCValue *callee_base = base + ip->c;
+	BCNativeEntry native = this->native_entries[ip->b].load(std::memory_order_acquire);
+
+	if (native) {
+		base[ip->a] = call_native_entry(native, *callee, callee_base);
+		NEXT();
+	}
+
+	if (callee_base + callee->num_registers > stack_end) {
+		throw std::runtime_error("interpreter: stack overflow in " + callee->name);
+	}
+
+	this->count_call(ip->b);
+	this->frames.push_back({ ip + 1, base, function, ip->a });
+	function = ip->b;
+	base = callee_base;
+	ip = callee->code.data();
+	DISPATCH();
+}
+
+// the arguments are above the frame, so they can be copied down in order
+handle_tail_call: {
+	const BCFunction *callee = functions + ip->b;
+	BCNativeEntry native = this->native_entries[ip->b].load(std::memory_order_acquire);
+
+	if (native) {
+		result = call_native_entry(native, *callee, base + ip->c);
+		goto return_to_caller;
+	}
+
+	if (base + callee->num_registers > stack_end) {
+		throw std::runtime_error("interpreter: stack overflow in " + callee->name);
+	}
+
+	this->count_call(ip->b);
+	std::copy(base + ip->c, base + ip->c + callee->arg_types.size(), base);
+	function = ip->b;
+	ip = callee->code.data();
+	DISPATCH();
+}
+
+handle_call_native: {
+	const BCFunction *callee = functions + ip->b;
+	const BCValue *args = base + ip->c;
+
+	switch (callee->native_kind) {
+	case BCNativeKind::F32Unary:
+		base[ip->a].f = ((float (*)(float))callee->native)(args[0].f);
+		break;
+
+	case BCNativeKind::F32Binary:
+		base[ip->a].f = ((float (*)(float, float))callee->native)(args[0].f, args[1].f);
+		break;
+
+	case BCNativeKind::F32Ternary:
+		base[ip->a].f = ((float (*)(float, float, float))callee->native)(args[0].f, args[1].f, args[2].f);
+		break;
+
+	default:
+		base[ip->a] = call_native(*callee, args);
+		break;
+	}
+	NEXT();
+}
+
+handle_return:
+	result = base[ip->a];
+	goto return_to_caller;
+
+handle_return_void:
+	result.u = 0;
+
+return_to_caller:
+	if (this->frames.empty()) {
+		return result;
+	}
+
+	ip = this->frames.back().return_ip;
+	base = this->frames.back().base;
+	function = this->frames.back().function;
+	base[this->frames.back().result] = result;
+	this->frames.pop_back();
+	DISPATCH();
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BINARY_I32
+#undef BINARY_F32
+#undef COMPARE
+}
+
+// -----------------------------------------------------
+// DRIVER
+
+// the whole of str has to be the number, and fit
+static bool parse_bc_i32(const std::string& str, int32_t& i) {
+	const char *start = str.c_str();
+	char *end = nullptr;
+
+	errno = 0;
+	long value = std::strtol(start, &end, 10);
+
+	if (end == start || *end != '\0' || errno == ERANGE || value < INT32_MIN || value > INT32_MAX) {
+		return false;
+	}
+	i = (int32_t)value;
+	return true;
+}
+
+bool parse_bc_value(IRType type, const std::string& str, BCValue& value) {
+	value.u = 0;
+
+	switch (type) {
+	case IRType::I32:
+		return parse_bc_i32(str, value.i);
+
+	case IRType::F32: {
+		const char *start = str.c_str();
+		char *end = nullptr;
+
+		errno = 0;
+		value.f = std::strtof(start, &end);
+		return end != start && *end == '\0' && errno != ERANGE;
+	}
+
+	case IRType::Bool:
+		if (str == "true" || str == "false") {
+			value.i = str == "true";
+			return true;
+		}
+		if (!parse_bc_i32(str, value.i)) {
+			return false;
+		}
+		value.i = value.i != 0;
+		return true;
+
+	case IRType::Void:
+		assert(false && "can not parse a void value");
+	}
+	return false;
+}
+
+void print_bc_value(std::ostream& out, IRType type, BCValue value) {
+	switch (type) {
+	case IRType::Void: out << "void"; break;
+	case IRType::I32: out << value.i; break;
+	case IRType::F32: out << value.f; break;
+	case IRType::Bool: out << (value.i ? "true" : "false"); break;
+	}
+}
+
+std::ostream& operator<<(std::ostream& out, const BCCompileStats& stats) {
+	out << stats.get_total() << " us | lower " << stats.lower << " us | ir passes " << stats.ir_passes
+		<< " us | bytecode " << stats.bytecode << " us";
+	return out;
+}
+
+BCModule compile_program_to_bytecode(ASTRoot& root, bool optimize, BCCompileStats& stats) {
+	typedef std::chrono::high_resolution_clock Clock;
+	auto microseconds = [](Clock::time_point from, Clock::time_point to) {
+		return std::chrono::duration<double, std::micro>(to - from).count();
+	};
+
+	Clock::time_point start = Clock::now();
+	IRModule ir = lower_to_ir(root);
+	Clock::time_point lowered = Clock::now();
+
+	if (optimize) {
+		IRPassManager ir_passes;
+		add_default_ir_passes(ir_passes);
+		ir_passes.run(ir);
+	}
+	Clock::time_point optimized = Clock::now();
+
+	BCModule module = compile_to_bytecode(ir);
+	Clock::time_point compiled = Clock::now();
+
+	stats.lower = microseconds(start, lowered);
+	stats.ir_passes = microseconds(lowered, optimized);
+	stats.bytecode = microseconds(optimized, compiled);
+	return module;
+}
+
+int prepare_bc_entry(const BCModule& module, const InterpreterRunOptions& options, const char *tier,
+					 std::vector<BCValue>& args) {
+	int entry = module.find_function(options.entry_name);
+
+	if (entry < 0 || module.functions[entry].native_kind != BCNativeKind::None) {
+		std::cerr << "\n" << tier << ": no function with a body named: " << options.entry_name << "\n";
+		return -1;
+	}
+
+	const BCFunction &fn = module.functions[entry];
+
+	if (fn.arg_types.size() != options.args.size()) {
+		std::cerr << "\n" << tier << ": " << options.entry_name << " takes " << fn.arg_types.size()
+			<< " arguments, " << options.args.size() << " given\n";
+		return -1;
+	}
+
+	for (unsigned i = 0; i < options.args.size(); ++i) {
+		BCValue arg;
+
+		if (!parse_bc_value(fn.arg_types[i], options.args[i], arg)) {
+			std::cerr << "\n" << tier << ": argument " << i << " to " << options.entry_name << " is not a valid "
+				<< fn.arg_types[i] << ": " << options.args[i] << "\n";
+			return -1;
+		}
+		args.push_back(arg);
+	}
+	return entry;
+}
+
+void print_bc_entry_call(const BCModule& module, uint32_t entry, const std::vector<BCValue>& args,
+						 BCValue result, const char *tier) {
+	const BCFunction &fn = module.functions[entry];
+
+	std::cout << "\n-------\n\n" << tier << ": " << fn.name << "(";
+	for (unsigned i = 0; i < args.size(); ++i) {
+		std::cout << (i == 0 ? "" : ", ");
+		print_bc_value(std::cout, fn.arg_types[i], args[i]);
+	}
+	std::cout << ") = ";
+	print_bc_value(std::cout, fn.return_type, result);
+	std::cout << "\n";
+}
+
+int run_interpreter(ASTRoot& root, const InterpreterRunOptions& options) {
+	BCCompileStats compile_stats;
+	BCModule module = compile_program_to_bytecode(root, options.optimize, compile_stats);
+
+	std::cout << "\n-------\n\nbytecode:\n" << module;
+
+	std::vector<BCValue> args;
+	int entry = prepare_bc_entry(module, options, "interpreter", args);
+
+	if (entry < 0) {
+		return 1;
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	BCInterpreter interpreter(module);
+	Clock::time_point call_start = Clock::now();
+	BCValue result = interpreter.call(entry, args);
+	Clock::time_point call_end = Clock::now();
+
+	print_bc_entry_call(module, entry, args, result, "interpreter");
+
+	if (options.bench_calls > 0) {
+		Clock::time_point calls_start = Clock::now();
+
+		for (uint64_t i = 0; i < options.bench_calls; ++i) {
+			interpreter.call(entry, args);
+		}
+
+		Clock::time_point calls_end = Clock::now();
+		double calls_ns = std::chrono::duration<double, std::nano>(calls_end - calls_start).count();
+
+		std::cout << "interpreter startup latency: " << compile_stats << "\n";
+		std::cout << "interpreter first call: "
+			<< std::chrono::duration<double, std::micro>(call_end - call_start).count() << " us\n";
+		std::cout << "interpreter calls: " << options.bench_calls << " | " <<
+			calls_ns / options.bench_calls << " ns per call\n";
+	}
+
+	return 0;
+}
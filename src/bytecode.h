@@ -0,0 +1,306 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "ast.h"
+#include "intermediate.h"
+
+// a register based bytecode, compiled from the IR, and an interpreter for
+// it. a program starts running as soon as it is lowered, without creating
+// an LLVM module, which is what dominates the run time of short lived
+// evaluations.
+//
+// every IR value gets a register in the frame of its function. the
+// arguments of a function are its first registers, and a call passes the
+// registers it put the arguments in as the start of the callee's frame, so
+// nothing is copied on a call.
+
+// -----------------------------------------------------
+// INSTRUCTIONS
+
+// the suffix is the type of the operands
+enum class BCOp : uint8_t {
+	// a = immediate
+	Const,
+	// a = b
+	Move,
+
+	// a = b op c. i32 wraps around, dividing by 0 or INT32_MIN / -1 stops
+	// the program.
+	AddI32,
+	SubI32,
+	MulI32,
+	DivI32,
+	AddF32,
+	SubF32,
+	MulF32,
+	DivF32,
+
+	// a = op b
+	NegI32,
+	NegF32,
+	Not,
+	I32ToF32,
+
+	// a = b op c, a bool. bools are compared as i32s, with their operands
+	// swapped for the ordered comparisons, since true is -1 as an i1.
+	LessI32,
+	GreaterI32,
+	LessEqualI32,
+	GreaterEqualI32,
+	EqualI32,
+	NotEqualI32,
+	LessF32,
+	GreaterF32,
+	LessEqualF32,
+	GreaterEqualF32,
+	EqualF32,
+	NotEqualF32,
+
+	// the immediate is the instruction to continue at
+	Jump,
+	// if a, or if not a
+	JumpIf,
+	JumpIfNot,
+
+	// a = the function b called with the registers from c on. its frame
+	// starts at register c.
+	Call,
+	// the function b with the registers from c on, in place of this one
+	TailCall,
+	// a = the native function b called with the registers from c on
+	CallNative,
+
+	// returns a, or nothing
+	Return,
+	ReturnVoid,
+
+	Count,
+};
+
+struct BCInstruction {
+	BCOp op;
+	uint16_t a;
+	// b and c together are the immediate
+	uint16_t b;
+	uint16_t c;
+
+	uint32_t get_immediate() const {
+		return (uint32_t)this->c << 16 | this->b;
+	}
+
+	void set_immediate(uint32_t immediate) {
+		this->b = immediate & 0xffff;
+		this->c = immediate >> 16;
+	}
+};
+
+// a register. bools are 0 or 1.
+union BCValue {
+	int32_t i;
+	float f;
+	uint32_t u;
+};
+
+// how a native function is called. the math builtins have their own
+// kinds, so calling them is a direct call.
+enum class BCNativeKind : uint8_t {
+	// has bytecode
+	None,
+	F32Unary,
+	F32Binary,
+	F32Ternary,
+	// anything else, see call_native
+	Generic,
+};
+
+struct BCFunction {
+	std::string name;
+	IRType return_type;
+	std::vector<IRType> arg_types;
+
+	std::vector<BCInstruction> code;
+	// the frame size, including the arguments of the calls it makes
+	uint32_t num_registers;
+
+	// the address of an extern fn or builtin
+	BCNativeKind native_kind;
+	void *native;
+
+	BCFunction() : return_type(IRType::Void), num_registers(0), native_kind(BCNativeKind::None), native(nullptr) {}
+};
+
+struct BCModule {
+	std::vector<BCFunction> functions;
+
+	// the index of the function called name, or -1
+	int find_function(const std::string& name) const;
+};
+
+std::ostream& operator<<(std::ostream& out, BCOp op);
+std::ostream& operator<<(std::ostream& out, const BCFunction& fn);
+std::ostream& operator<<(std::ostream& out, const BCModule& module);
+
+// throws if a function needs more registers than an instruction can name,
+// or an extern fn can not be found in the process or called from the
+// interpreter
+BCModule compile_to_bytecode(const IRModule& module);
+
+// -----------------------------------------------------
+// INTERPRETER
+
+// compiled code for a function, called through an entry trampoline that
+// reads its arguments through args and writes its result to ret, see
+// llvm_create_jit_entry_trampoline
+typedef void (*BCNativeEntry)(void **args, void *ret);
+
+// a native entry can only take this many arguments
+static const unsigned max_native_entry_args = 32;
+
+// told about functions that are called, or loop, often enough to be worth
+// compiling, see BCInterpreter::set_tier_up
+class BCTierUpHandler {
+public:
+
+	virtual ~BCTierUpHandler() {}
+
+	// called on the interpreter's thread, once per function. should not
+	// take long, the program waits.
+	virtual void function_is_hot(uint32_t function) = 0;
+};
+
+// throws the error the interpreter reports for an i32 division it can not
+// do, by zero or of the smallest i32 by -1. code compiled for the
+// interpreter calls it too, so that it fails the same way.
+extern "C" void bc_division_trap(int32_t overflow);
+
+class BCInterpreter {
+public:
+
+	// stack_size is the number of registers all frames together can use
+	BCInterpreter(const BCModule& module, size_t stack_size = 1 << 20);
+
+	// runs the function with the given arguments, and returns what it
+	// returns. throws if the program divides by zero or runs out of stack.
+	BCValue call(uint32_t function, const std::vector<BCValue>& args);
+
+	// every call of a function and every backwards jump in it counts, and
+	// the function is handed to handler once it gets to threshold. 0 hands
+	// it over on its first call, like 1.
+	void set_tier_up(BCTierUpHandler *handler, uint32_t threshold);
+
+	// from now on, calls to function run entry instead of its bytecode. an
+	// invocation that is already running stays in the interpreter. can be
+	// called from any thread.
+	void set_native_entry(uint32_t function, BCNativeEntry entry);
+
+	bool has_native_entry(uint32_t function) const {
+		return this->native_entries[function].load(std::memory_order_acquire) != nullptr;
+	}
+
+private:
+
+	struct Frame {
+		const BCInstruction *return_ip;
+		BCValue *base;
+		// the function that made the call
+		uint32_t function;
+		// the register of the caller that gets the result
+		uint16_t result;
+	};
+
+	struct Counters {
+		uint32_t calls;
+		uint32_t backedges;
+	};
+
+	const BCModule& module;
+	// not initialized, so that only the part that is used is paged in
+	std::unique_ptr<BCValue[]> stack;
+	size_t stack_size;
+	std::vector<Frame> frames;
+
+	// per function
+	std::vector<Counters> counters;
+	std::unique_ptr<std::atomic<BCNativeEntry>[]> native_entries;
+
+	BCTierUpHandler *tier_up_handler;
+	uint32_t tier_up_threshold;
+
+	BCValue run(uint32_t function, BCValue *base);
+
+	void count_call(uint32_t function) {
+		Counters &counters = this->counters[function];
+		if (++counters.calls + counters.backedges == this->tier_up_threshold) {
+			this->tier_up(function);
+		}
+	}
+
+	void count_backedge(uint32_t function) {
+		Counters &counters = this->counters[function];
+		if (counters.calls + ++counters.backedges == this->tier_up_threshold) {
+			this->tier_up(function);
+		}
+	}
+
+	void tier_up(uint32_t function);
+};
+
+// -----------------------------------------------------
+// DRIVER
+
+struct InterpreterRunOptions {
+	std::string entry_name;
+
+	// one per argument of the entry function
+	std::vector<std::string> args;
+
+	// if non zero, time this many calls after the first one
+	uint64_t bench_calls;
+
+	// run the default IR passes before compiling to bytecode
+	bool optimize;
+
+	InterpreterRunOptions() : entry_name("main"), bench_calls(0), optimize(true) {}
+};
+
+// in microseconds
+struct BCCompileStats {
+	double lower;
+	double ir_passes;
+	double bytecode;
+
+	BCCompileStats() : lower(0), ir_passes(0), bytecode(0) {}
+
+	double get_total() const {
+		return this->lower + this->ir_passes + this->bytecode;
+	}
+};
+
+std::ostream& operator<<(std::ostream& out, const BCCompileStats& stats);
+
+// lowers the program to the IR, runs the IR passes if optimize is set and
+// compiles it to bytecode
+BCModule compile_program_to_bytecode(ASTRoot& root, bool optimize, BCCompileStats& stats);
+
+// false if str is not a value of the type
+bool parse_bc_value(IRType type, const std::string& str, BCValue& value);
+void print_bc_value(std::ostream& out, IRType type, BCValue value);
+
+// the entry function of options, with its arguments parsed into args.
+// prints why, prefixed by tier, and returns -1 if it can not be called.
+int prepare_bc_entry(const BCModule& module, const InterpreterRunOptions& options, const char *tier,
+					 std::vector<BCValue>& args);
+
+// prints <tier>: <entry>(<args>) = <result>
+void print_bc_entry_call(const BCModule& module, uint32_t entry, const std::vector<BCValue>& args,
+						 BCValue result, const char *tier);
+
+// lowers, compiles and interprets the program, calls the entry function
+// once and prints the result. with bench_calls set, also reports the
+// startup latency and the cost of a call.
+int run_interpreter(ASTRoot& root, const InterpreterRunOptions& options);
@@ -1,2 +1,937 @@
 #pragma once
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "ast.h"
+#include "type_system.h"
+#include "tokenizer.h"
+#include "pretty_print.h"
+#include "file_handling.h"
+
+// a backend that writes C99 and leaves machine code to the system's C
+// compiler, for hosts that have a C compiler but no LLVM toolchain, and to
+// test the LLVM backend against a second, independent one. nothing here
+// depends on LLVM.
+
+// -----------------------------------------------------
+// OPTIONS
+
+enum class COutputKind {
+	// only the .c file
+	Source,
+	Object,
+	Assembly,
+	Executable,
+};
+
+struct CBackendOptions {
+	// the C compiler, looked up in PATH
+	std::string compiler;
+
+	// passed to the compiler before the source, eg. -O2, -march=native
+	std::vector<std::string> compiler_args;
+
+	// treated as if declared export, the same as CodegenOptions
+	std::set<std::string> exported_names;
+
+	// -g: #line directives that point at the .acl source, which the C
+	// compiler turns into line tables. needs the source_manager the tree
+	// was parsed with.
+	bool debug_info;
+	const SourceManager *source_manager;
+
+	CBackendOptions() : compiler("cc"), compiler_args({ "-O2" }), debug_info(false), source_manager(nullptr) {}
+
+	bool is_exported(ASTFunctionDefinition &fn_defn) const {
+		const std::string &name = *fn_defn.fn_name.value.ptr_s;
+		return fn_defn.linkage != ASTLinkage::Internal || name == "main" ||
+			this->exported_names.count(name) != 0;
+	}
+};
+
+// -----------------------------------------------------
+// NAMES AND TYPES
+
+const char* c_get_type_name(const TSType &type) {
+	switch (type.variant) {
+	case TSType::Variant::Int32:
+		return "int32_t";
+	case TSType::Variant::Float32:
+		return "float";
+	case TSType::Variant::Bool:
+		return "bool";
+	case TSType::Variant::Void:
+		return "void";
+	default:
+		break;
+	}
+
+	std::stringstream error;
+	error << "unable to convert achilles type to a C type: " << type;
+	throw std::runtime_error(error.str());
+}
+
+// the C library's f32 version of a math builtin, the same functions the
+// LLVM backend lowers its intrinsics to. empty for anything that is not a
+// math builtin.
+std::string c_get_builtin_function(const std::string &name) {
+	const std::map<std::string, std::string> &functions = ts_get_math_library_functions();
+
+	auto it = functions.find(name);
+	return it == functions.end() ? "" : it->second;
+}
+
+// achilles identifiers never start with _, so C keywords and the names the
+// generated code uses itself, including the math functions it declares,
+// get one in front. see get_function_identifier for functions.
+std::string c_get_identifier(const std::string &name) {
+	static const std::set<std::string> reserved = []() {
+		std::set<std::string> reserved = {
+			"auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else",
+			"enum", "extern", "float", "for", "goto", "if", "inline", "int", "long", "register",
+			"restrict", "return", "short", "signed", "sizeof", "static", "struct", "switch",
+			"typedef", "union", "unsigned", "void", "volatile", "while",
+			// stdbool.h and stdint.h
+			"bool", "true", "false", "int32_t", "uint32_t", "INT32_MIN",
+		};
+
+		for (auto& function : ts_get_math_library_functions()) {
+			reserved.insert(function.second);
+		}
+		return reserved;
+	}();
+
+	return reserved.count(name) ? "_" + name : name;
+}
+
+// <return type> <name>(<args>), with the args named if arg_names is given
+std::string c_get_prototype(const std::string &name, const TSType &fn_type,
+							const std::vector<std::string> *arg_names = nullptr) {
+	std::stringstream prototype;
+	prototype << c_get_type_name(*fn_type.func_data->return_type) << " " << name << "(";
+
+	if (fn_type.func_data->args.empty()) {
+		prototype << "void";
+	}
+
+	for (unsigned i = 0; i < fn_type.func_data->args.size(); ++i) {
+		prototype << (i ? ", " : "") << c_get_type_name(*fn_type.func_data->args[i]);
+
+		if (arg_names) {
+			prototype << " " << (*arg_names)[i];
+		}
+	}
+
+	prototype << ")";
+	return prototype.str();
+}
+
+// the literal for every f32, exactly. hex floats are C99.
+std::string c_get_float_literal(float value) {
+	if (std::isnan(value)) {
+		return "(0.0f / 0.0f)";
+	}
+	if (std::isinf(value)) {
+		return value > 0 ? "(1.0f / 0.0f)" : "(-1.0f / 0.0f)";
+	}
+
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%af", value);
+	return buffer;
+}
+
+std::string c_get_int_literal(int32_t value) {
+	// -2147483648 is - applied to a literal that does not fit in an int
+	if (value == INT32_MIN) {
+		return "INT32_MIN";
+	}
+	return std::to_string(value);
+}
+
+// -----------------------------------------------------
+// CODE GENERATION
+
+// C has no statement expressions, so every expression is lowered to
+// statements that leave its value in a fresh temporary, in the order the
+// LLVM backend evaluates them, and the temporary stands in for the value.
+// blocks and ifs with a value assign to a temporary declared in front of
+// them. the C compiler's optimizer removes the copies.
+//
+// i32 arithmetic wraps around, as in the LLVM backend, so it is done in
+// uint32_t where signed overflow would be undefined.
+class CCodeGenerator : public IASTVisitor {
+public:
+
+	CCodeGenerator(std::ostream &out, const CBackendOptions& options) :
+		out(out), options(options), indent(0), num_temporaries(0), fn_type(nullptr) {
+		if (options.debug_info) {
+			assert(options.source_manager && "debug info needs the source manager");
+		}
+	}
+
+	virtual void inspect_root(ASTRoot& root) {
+		this->generate_top_level(root.children);
+	}
+
+	void generate_top_level(const std::vector<std::shared_ptr<IAST> >& top_level) {
+		std::vector<ASTFunctionDefinition *> fn_defns;
+
+		for (auto child : top_level) {
+			ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+			if (!fn_defn) {
+				std::stringstream error;
+				error << "the C backend only supports functions at the top level:\n";
+				pretty_print_to_stream(*child, error);
+				throw std::runtime_error(error.str());
+			}
+			fn_defns.push_back(fn_defn);
+		}
+
+		this->out << "/* generated by achilles */\n";
+		this->out << "#include <stdbool.h>\n";
+		this->out << "#include <stdint.h>\n\n";
+
+		// clang turns a musttail return into a jump at every optimization
+		// level, like the LLVM backend's musttail calls. other compilers only
+		// do it as an optimization, at -O2.
+		this->out << "#if defined(__has_attribute)\n";
+		this->out << "#if __has_attribute(musttail)\n";
+		this->out << "#define ACHILLES_MUSTTAIL __attribute__((musttail))\n";
+		this->out << "#endif\n";
+		this->out << "#endif\n";
+		this->out << "#ifndef ACHILLES_MUSTTAIL\n";
+		this->out << "#define ACHILLES_MUSTTAIL\n";
+		this->out << "#endif\n\n";
+
+		this->generate_builtin_declarations(top_level);
+		this->generate_prototypes(fn_defns);
+
+		for (ASTFunctionDefinition *fn_defn : fn_defns) {
+			if (fn_defn->body) {
+				this->generate_function(*fn_defn);
+			}
+		}
+	}
+
+private:
+
+	std::ostream &out;
+	CBackendOptions options;
+
+	// of the function being generated
+	std::stringstream body;
+	unsigned indent;
+	unsigned num_temporaries;
+	const TSType *fn_type;
+
+	// every function that is defined here, by name
+	std::map<std::string, ASTFunctionDefinition *> definitions;
+
+	void line(const std::string &text) {
+		this->body << std::string(this->indent * 4, ' ') << text << "\n";
+	}
+
+	// a #line that makes the next line of C belong to ast's line in the
+	// .acl source. empty without -g.
+	std::string get_line_directive(IAST &ast) {
+		if (!this->options.debug_info || !ast.position.is_valid()) {
+			return "";
+		}
+
+		const SourceManager &sources = *this->options.source_manager;
+		FileID file = sources.get_file_id(ast.position.start);
+		PositionIndex offset = sources.get_file_offset(ast.position.start);
+
+		std::string path;
+		for (char c : sources.get_file_path(file)) {
+			if (c == '\\' || c == '"') {
+				path += '\\';
+			}
+			path += c;
+		}
+
+		return "#line " + std::to_string(sources.get_line_table(file).get_line_col(offset).first) +
+			" \"" + path + "\"\n";
+	}
+
+	void line_directive(IAST &ast) {
+		this->body << this->get_line_directive(ast);
+	}
+
+	// declares a temporary, initialized to value if it is given
+	std::string create_temporary(const TSType &type, const std::string &value = "") {
+		std::string name = "_t" + std::to_string(this->num_temporaries++);
+		this->line(std::string(c_get_type_name(type)) + " " + name + (value.empty() ? "" : " = " + value) + ";");
+		return name;
+	}
+
+	// the math functions are declared by hand instead of including math.h,
+	// which would also declare names that achilles functions may have
+	void generate_builtin_declarations(const std::vector<std::shared_ptr<IAST> >& top_level) {
+		struct BuiltinCollector : public IASTGenericVisitor {
+			std::map<std::string, const TSType *> builtins;
+
+			virtual void inspect_ast(IAST &ast) {
+				if (ast.type == ASTType::FunctionCall) {
+					ASTFunctionCall &fn_call = dynamic_cast<ASTFunctionCall&>(ast);
+					const std::string &name = *dynamic_cast<ASTLiteral&>(*fn_call.name).token.value.ptr_s;
+					const TSVariable *fn = fn_call.ts_data->scope->get_variable(name);
+
+					if (!fn->decl_pos.is_valid() && !c_get_builtin_function(name).empty()) {
+						this->builtins[c_get_builtin_function(name)] = fn->type;
+					}
+				}
+				ast.traverse_inner(*this);
+			}
+		};
+
+		BuiltinCollector collector;
+		for (auto child : top_level) {
+			child->dispatch(collector);
+		}
+
+		for (auto& builtin : collector.builtins) {
+			this->out << c_get_prototype(builtin.first, *builtin.second) << ";\n";
+		}
+
+		if (!collector.builtins.empty()) {
+			this->out << "\n";
+		}
+	}
+
+	// every function is declared up front, so they can call each other in
+	// any order. functions that are not exported are static. a forward
+	// declaration without a definition here is defined elsewhere.
+	void generate_prototypes(const std::vector<ASTFunctionDefinition *>& fn_defns) {
+		for (ASTFunctionDefinition *fn_defn : fn_defns) {
+			if (fn_defn->body) {
+				this->definitions[*fn_defn->fn_name.value.ptr_s] = fn_defn;
+			}
+		}
+
+		std::set<std::string> declared;
+
+		for (ASTFunctionDefinition *fn_defn : fn_defns) {
+			const std::string &name = *fn_defn->fn_name.value.ptr_s;
+
+			if (!declared.insert(name).second) {
+				continue;
+			}
+
+			auto definition = this->definitions.find(name);
+			bool is_static = definition != this->definitions.end() && !this->options.is_exported(*definition->second);
+
+			this->out << (is_static ? "static " : "")
+				<< c_get_prototype(this->get_function_identifier(name), *fn_defn->ts_data->type) << ";\n";
+		}
+	}
+
+	// exported functions, and the ones defined elsewhere, keep their names:
+	// they are the interface to C, eg. an extern fn sinf is the C library's.
+	// only the static ones can be renamed.
+	std::string get_function_identifier(const std::string &name) {
+		auto definition = this->definitions.find(name);
+
+		if (definition == this->definitions.end() || this->options.is_exported(*definition->second)) {
+			return name;
+		}
+		return c_get_identifier(name);
+	}
+
+	void generate_function(ASTFunctionDefinition &fn_defn) {
+		const std::string &name = *fn_defn.fn_name.value.ptr_s;
+		const TSType &fn_type = *fn_defn.ts_data->type;
+
+		std::vector<std::string> arg_names;
+		for (auto& arg : fn_defn.args) {
+			arg_names.push_back(c_get_identifier(*dynamic_cast<ASTLiteral&>(*arg.first).token.value.ptr_s));
+		}
+
+		this->body.str("");
+		this->indent = 1;
+		this->num_temporaries = 0;
+		this->fn_type = &fn_type;
+
+		this->generate_return(*fn_defn.body);
+
+		this->out << "\n" << this->get_line_directive(fn_defn);
+		this->out << (this->options.is_exported(fn_defn) ? "" : "static ")
+			<< c_get_prototype(this->get_function_identifier(name), fn_type, &arg_names) << " {\n";
+		this->out << this->body.str() << "}\n";
+	}
+
+	// -------------------------------------------------
+	// VALUES
+
+	// emits the code for ast and returns a C expression for its value,
+	// converted if the type system asked for it. empty for void values.
+	std::string get_value_for_ast(IAST& ast) {
+		std::string value = this->get_unconverted_value_for_ast(ast);
+
+		if (!ast.ts_data || !ast.ts_data->implicit_conversion) {
+			return value;
+		}
+
+		assert(ast.ts_data->type == i32_type && ast.ts_data->implicit_conversion == f32_type);
+		return this->create_temporary(*f32_type, "(float)" + value);
+	}
+
+	std::string get_unconverted_value_for_ast(IAST& ast) {
+		switch (ast.type) {
+		case ASTType::Literal:
+			return this->get_value_for_literal(dynamic_cast<ASTLiteral&>(ast));
+
+		case ASTType::InfixExpr:
+			return this->get_value_for_infix_expr(dynamic_cast<ASTInfixExpr&>(ast));
+
+		case ASTType::FunctionCall:
+			return this->get_value_for_func_call(dynamic_cast<ASTFunctionCall&>(ast));
+
+		case ASTType::Statement: {
+			ASTStatement &stmt = dynamic_cast<ASTStatement&>(ast);
+			this->line_directive(stmt);
+			return this->get_value_for_ast(*stmt.inner);
+		}
+
+		case ASTType::Block:
+			return this->get_value_for_block(dynamic_cast<ASTBlock&>(ast));
+
+		// a let without a value starts out as 0, like in the LLVM backend.
+		// C would read an indeterminate value.
+		case ASTType::VariableDefinition: {
+			std::string name = this->declare_variable(dynamic_cast<ASTVariableDefinition&>(ast), "0");
+			return this->create_temporary(*ast.ts_data->type, name);
+		}
+
+		case ASTType::PrefixExpr:
+			return this->get_value_for_prefix_expr(dynamic_cast<ASTPrefixExpr&>(ast));
+
+		case ASTType::ForLoop:
+			return this->get_value_for_for_loop(dynamic_cast<ASTForLoop&>(ast));
+
+		case ASTType::If:
+			return this->get_value_for_if(dynamic_cast<ASTIf&>(ast));
+
+		default:
+			std::stringstream error;
+			error << "unknown ast type to generate C for:\n";
+			pretty_print_to_stream(ast, error);
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	// the type a value expression has once it is converted
+	static const TSType* get_converted_type(IAST &ast) {
+		return ast.ts_data->implicit_conversion ? ast.ts_data->implicit_conversion : ast.ts_data->type;
+	}
+
+	// the statements of block, in the current C block. its value is
+	// assigned to target, if there is one.
+	void generate_block_into(ASTBlock& block, const std::string &target) {
+		std::string value;
+
+		for (auto stmt : block.statements) {
+			value = this->get_value_for_ast(*stmt);
+		}
+
+		if (block.return_expr) {
+			value = this->get_value_for_ast(*block.return_expr);
+		}
+
+		if (!target.empty()) {
+			this->line(target + " = " + value + ";");
+		}
+	}
+
+	// a block evaluates to its last expression, nothing if it has none.
+	// variables in it go out of scope at its end, as in achilles.
+	std::string get_value_for_block(ASTBlock& block) {
+		IAST *value_expr = get_block_value_expr(block);
+		const TSType *type = value_expr ? get_converted_type(*value_expr) : void_type;
+		std::string value = type == void_type ? "" : this->create_temporary(*type);
+
+		this->line("{");
+		this->indent++;
+		this->generate_block_into(block, value);
+		this->indent--;
+		this->line("}");
+
+		return value;
+	}
+
+	// a branch of an if, inside the braces of its if or else
+	void generate_branch_into(IAST& branch, const std::string &target) {
+		if (branch.type == ASTType::Block && !branch.ts_data->implicit_conversion) {
+			this->generate_block_into(dynamic_cast<ASTBlock&>(branch), target);
+			return;
+		}
+
+		std::string value = this->get_value_for_ast(branch);
+		if (!target.empty()) {
+			this->line(target + " = " + value + ";");
+		}
+	}
+
+	std::string get_value_for_if(ASTIf& if_expr) {
+		std::string condition = this->get_value_for_ast(*if_expr.condition);
+		const TSType *type = if_expr.ts_data->type;
+		std::string value = type == void_type ? "" : this->create_temporary(*type);
+
+		this->line("if (" + condition + ") {");
+		this->indent++;
+		this->generate_branch_into(*if_expr.then_block, value);
+		this->indent--;
+
+		if (if_expr.else_branch) {
+			this->line("} else {");
+			this->indent++;
+			this->generate_branch_into(*if_expr.else_branch, value);
+			this->indent--;
+		}
+
+		this->line("}");
+		return value;
+	}
+
+	// start, end and step are evaluated once, before the loop, and i < end
+	// is checked before every iteration, as in the LLVM backend. i wraps
+	// like every other i32 add, so a loop that counts past the largest i32
+	// behaves as in the interpreter instead of being undefined. unroll
+	// hints become the #pragma GCC unroll that gcc and clang understand.
+	// vectorize and interleave have no portable spelling and are left to
+	// the compiler.
+	std::string get_value_for_for_loop(ASTForLoop& for_loop) {
+		std::string start = this->get_value_for_ast(*for_loop.start);
+		std::string end = this->create_temporary(*i32_type, this->get_value_for_ast(*for_loop.end));
+		std::string step = for_loop.step ?
+			this->create_temporary(*i32_type, this->get_value_for_ast(*for_loop.step)) : "1";
+
+		ASTLiteral &induction_var = dynamic_cast<ASTLiteral&>(*for_loop.induction_var);
+		std::string name = c_get_identifier(*induction_var.token.value.ptr_s);
+
+		for (const ASTLoopHint &hint : for_loop.hints) {
+			if (*hint.name.value.ptr_s == "unroll" && hint.value != 0) {
+				this->body << "#pragma GCC unroll " << hint.value << "\n";
+			}
+		}
+
+		this->line("for (int32_t " + name + " = " + start + "; " + name + " < " + end + "; " +
+				   name + " = (int32_t)((uint32_t)" + name + " + (uint32_t)" + step + ")) {");
+		this->indent++;
+
+		if (for_loop.body->type == ASTType::Block) {
+			this->generate_block_into(dynamic_cast<ASTBlock&>(*for_loop.body), "");
+		}
+		else {
+			this->get_value_for_ast(*for_loop.body);
+		}
+
+		this->indent--;
+		this->line("}");
+		return "";
+	}
+
+	// declares the variable of a let, and returns its C name
+	std::string declare_variable(ASTVariableDefinition& variable_defn, const std::string &value) {
+		ASTLiteral &name_ast = dynamic_cast<ASTLiteral&>(*variable_defn.name);
+		const TSVariable *variable = name_ast.ts_data->scope->get_variable(*name_ast.token.value.ptr_s);
+		std::string name = c_get_identifier(*name_ast.token.value.ptr_s);
+
+		this->line(std::string(c_get_type_name(*variable->type)) + " " + name + " = " + value + ";");
+		return name;
+	}
+
+	// evaluates to the stored value
+	std::string get_value_for_assignment(ASTInfixExpr& assignment) {
+		std::string value = this->get_value_for_ast(*assignment.right);
+		IAST &target = *assignment.left;
+
+		if (target.type == ASTType::VariableDefinition) {
+			this->declare_variable(dynamic_cast<ASTVariableDefinition&>(target), value);
+			return value;
+		}
+
+		if (target.type == ASTType::Literal) {
+			ASTLiteral &literal = dynamic_cast<ASTLiteral&>(target);
+
+			if (literal.token.type == TokenType::Identifier) {
+				this->line(c_get_identifier(*literal.token.value.ptr_s) + " = " + value + ";");
+				return value;
+			}
+		}
+
+		std::stringstream error;
+		error << "can only assign to variables:\n";
+		pretty_print_to_stream(target, error);
+		throw std::runtime_error(error.str());
+	}
+
+	std::string get_value_for_infix_expr(ASTInfixExpr& expr) {
+		if (expr.op.type == TokenType::Equals) {
+			return this->get_value_for_assignment(expr);
+		}
+
+		if (expr.op.type == TokenType::CondAnd || expr.op.type == TokenType::CondOr) {
+			return this->get_value_for_logical_expr(expr);
+		}
+
+		std::string left = this->get_value_for_ast(*expr.left);
+		std::string right = this->get_value_for_ast(*expr.right);
+		std::string op;
+
+		switch (expr.op.type) {
+		case TokenType::Plus: op = "+"; break;
+		case TokenType::Minus: op = "-"; break;
+		case TokenType::Multiply: op = "*"; break;
+		case TokenType::Divide: op = "/"; break;
+		case TokenType::CondL: op = "<"; break;
+		case TokenType::CondG: op = ">"; break;
+		case TokenType::CondLEQ: op = "<="; break;
+		case TokenType::CondGEQ: op = ">="; break;
+		case TokenType::CondEQ: op = "=="; break;
+		case TokenType::CondNEQ: op = "!="; break;
+		default:
+			assert(false && "unknown infix expression");
+		}
+
+		// C's float comparisons are ordered, except != which is true for
+		// NaN, the same predicates the LLVM backend uses
+		if (expr.ts_data->type == bool_type) {
+			return this->create_temporary(*bool_type, left + " " + op + " " + right);
+		}
+
+		// the division can not overflow in a way that wraps, INT32_MIN / -1
+		// is undefined in LLVM too
+		if (expr.ts_data->type == i32_type && expr.op.type != TokenType::Divide) {
+			return this->create_temporary(*i32_type,
+				"(int32_t)((uint32_t)" + left + " " + op + " (uint32_t)" + right + ")");
+		}
+
+		return this->create_temporary(*expr.ts_data->type, left + " " + op + " " + right);
+	}
+
+	// && and || only evaluate their right side if the left one does not
+	// decide the result already. the right side may need statements of its
+	// own, so it is an if rather than C's && and ||.
+	std::string get_value_for_logical_expr(ASTInfixExpr& expr) {
+		bool is_and = expr.op.type == TokenType::CondAnd;
+		std::string value = this->create_temporary(*bool_type, this->get_value_for_ast(*expr.left));
+
+		this->line(std::string("if (") + (is_and ? "" : "!") + value + ") {");
+		this->indent++;
+		std::string right = this->get_value_for_ast(*expr.right);
+		this->line(value + " = " + right + ";");
+		this->indent--;
+		this->line("}");
+
+		return value;
+	}
+
+	std::string get_value_for_prefix_expr(ASTPrefixExpr& prefix_expr) {
+		std::string operand = this->get_value_for_ast(*prefix_expr.expr);
+
+		switch (prefix_expr.op.type) {
+		case TokenType::Minus:
+			if (prefix_expr.ts_data->type == i32_type) {
+				return this->create_temporary(*i32_type, "(int32_t)(0u - (uint32_t)" + operand + ")");
+			}
+			return this->create_temporary(*f32_type, "-" + operand);
+
+		case TokenType::CondNot:
+			return this->create_temporary(*bool_type, "!" + operand);
+
+		default:
+			assert(false && "unknown prefix expr");
+			return "";
+		}
+	}
+
+	// the C function for a call, and its achilles type
+	std::string get_called_function(ASTFunctionCall& func_call, const TSType *&fn_type) {
+		if (func_call.name->type != ASTType::Literal) {
+			std::stringstream error;
+			error << "function call name is not a string";
+			error << pretty_print(func_call);
+			throw std::runtime_error(error.str());
+		}
+
+		const std::string &name = *dynamic_cast<ASTLiteral&>(*func_call.name).token.value.ptr_s;
+		const TSVariable *fn = func_call.ts_data->scope->get_variable(name);
+		fn_type = fn->type;
+
+		std::string builtin = fn->decl_pos.is_valid() ? "" : c_get_builtin_function(name);
+		return builtin.empty() ? this->get_function_identifier(name) : builtin;
+	}
+
+	std::string get_args_for_func_call(ASTFunctionCall& func_call) {
+		std::string args;
+
+		for (unsigned i = 0; i < func_call.params.size(); ++i) {
+			args += (i ? ", " : "") + this->get_value_for_ast(*func_call.params[i]);
+		}
+		return args;
+	}
+
+	std::string get_value_for_func_call(ASTFunctionCall& func_call) {
+		const TSType *fn_type = nullptr;
+		std::string fn_name = this->get_called_function(func_call, fn_type);
+		std::string call = fn_name + "(" + this->get_args_for_func_call(func_call) + ")";
+
+		if (fn_type->func_data->return_type == void_type) {
+			this->line(call + ";");
+			return "";
+		}
+		return this->create_temporary(*fn_type->func_data->return_type, call);
+	}
+
+	std::string get_value_for_literal(ASTLiteral& literal) {
+		switch (literal.token.type) {
+		case TokenType::LiteralInt:
+			return c_get_int_literal((int32_t)*literal.token.value.ptr_i);
+
+		case TokenType::LiteralFloat:
+			return c_get_float_literal(*literal.token.value.ptr_f);
+
+		// a copy, so that later assignments do not change the value
+		case TokenType::Identifier: {
+			const std::string &name = *literal.token.value.ptr_s;
+			const TSVariable *variable = literal.ts_data->scope->get_variable(name);
+			return this->create_temporary(*variable->type, c_get_identifier(name));
+		}
+
+		default:
+			assert(false && "cannot generate C for literal");
+			return "";
+		}
+	}
+
+	// -------------------------------------------------
+	// RETURNS
+
+	// generates ast as the body of the current function, like the LLVM
+	// backend's generate_return. a call in tail position to a function of
+	// the same type is returned with ACHILLES_MUSTTAIL.
+	void generate_return(IAST& ast) {
+		bool is_converted = ast.ts_data && ast.ts_data->implicit_conversion;
+
+		if (!is_converted) {
+			switch (ast.type) {
+			case ASTType::Block:
+				this->generate_block_return(dynamic_cast<ASTBlock&>(ast));
+				return;
+
+			case ASTType::Statement:
+				this->line_directive(ast);
+				this->generate_return(*dynamic_cast<ASTStatement&>(ast).inner);
+				return;
+
+			case ASTType::If: {
+				ASTIf &if_expr = dynamic_cast<ASTIf&>(ast);
+
+				if (if_expr.else_branch) {
+					this->generate_if_return(if_expr);
+					return;
+				}
+				break;
+			}
+
+			case ASTType::FunctionCall: {
+				ASTFunctionCall &func_call = dynamic_cast<ASTFunctionCall&>(ast);
+				const TSType *fn_type = nullptr;
+				std::string fn_name = this->get_called_function(func_call, fn_type);
+
+				// clang's musttail needs the callee to have the caller's
+				// signature. function types are interned.
+				if (fn_type == this->fn_type && fn_type->func_data->return_type != void_type) {
+					std::string call = fn_name + "(" + this->get_args_for_func_call(func_call) + ")";
+					this->line("ACHILLES_MUSTTAIL return " + call + ";");
+					return;
+				}
+				break;
+			}
+
+			default:
+				break;
+			}
+		}
+
+		std::string value = this->get_value_for_ast(ast);
+
+		// a void function throws its body's value away
+		if (this->fn_type->func_data->return_type == void_type) {
+			this->line("return;");
+		}
+		else {
+			this->line("return " + value + ";");
+		}
+	}
+
+	void generate_block_return(ASTBlock& block) {
+		IAST *value_expr = get_block_value_expr(block);
+
+		if (!value_expr) {
+			this->line("return;");
+			return;
+		}
+
+		for (auto stmt : block.statements) {
+			if (block.return_expr || stmt != block.statements.back()) {
+				this->get_value_for_ast(*stmt);
+			}
+		}
+
+		this->generate_return(block.return_expr ? *block.return_expr : *block.statements.back());
+	}
+
+	void generate_if_return(ASTIf& if_expr) {
+		std::string condition = this->get_value_for_ast(*if_expr.condition);
+
+		this->line("if (" + condition + ") {");
+		this->indent++;
+		this->generate_return(*if_expr.then_block);
+		this->indent--;
+		this->line("} else {");
+		this->indent++;
+		this->generate_return(*if_expr.else_branch);
+		this->indent--;
+		this->line("}");
+	}
+};
+
+// -----------------------------------------------------
+// DRIVER
+
+std::string generate_c_code(IAST &root, const CBackendOptions& options) {
+	std::stringstream code;
+	CCodeGenerator code_genner(code, options);
+
+	root.dispatch(code_genner);
+	return code.str();
+}
+
+// runs args[0] (looked up in PATH) with args and waits for it. throws if
+// it can not be run or fails.
+void run_c_compiler(const std::vector<std::string>& args) {
+	std::vector<char *> argv;
+	for (auto& arg : args) {
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		throw std::runtime_error("unable to start " + args[0]);
+	}
+
+	if (pid == 0) {
+		execvp(argv[0], argv.data());
+		// only returns if there is no such program
+		_exit(127);
+	}
+
+	int status = 0;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+		throw std::runtime_error(args[0] + " did not finish");
+	}
+
+	if (WEXITSTATUS(status) == 127) {
+		throw std::runtime_error("unable to run the C compiler " + args[0]);
+	}
+
+	if (WEXITSTATUS(status) != 0) {
+		throw std::runtime_error("compiling the generated C failed with exit status " +
+								 std::to_string(WEXITSTATUS(status)));
+	}
+}
+
+// a fresh, empty .c file for the generated code. the caller removes it.
+std::string create_temporary_c_path() {
+	const char *temp_dir = getenv("TMPDIR");
+	std::string path = std::string(temp_dir ? temp_dir : "/tmp") + "/achilles-XXXXXX.c";
+
+	int fd = mkstemps(&path[0], 2);
+	if (fd < 0) {
+		throw std::runtime_error("unable to create a temporary C file");
+	}
+
+	close(fd);
+	return path;
+}
+
+// generates C for the program and writes it to output_path, or compiles it
+// with options.compiler into an object, assembly or an executable there.
+void emit_c(IAST &root, const CBackendOptions& options, COutputKind kind, const std::string& output_path) {
+	if (kind == COutputKind::Executable) {
+		ts_check_executable_main(ts_get_main_type(dynamic_cast<ASTRoot&>(root).children));
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	std::string code = generate_c_code(root, options);
+	std::string source_path = kind == COutputKind::Source ? output_path : create_temporary_c_path();
+
+	{
+		std::ofstream source(source_path);
+		source << code;
+
+		if (!source) {
+			throw std::runtime_error("unable to write " + source_path);
+		}
+	}
+
+	Clock::time_point generated = Clock::now();
+
+	if (kind != COutputKind::Source) {
+		std::vector<std::string> args = { options.compiler, "-std=c99" };
+		args.insert(args.end(), options.compiler_args.begin(), options.compiler_args.end());
+
+		if (options.debug_info) {
+			args.push_back("-g");
+		}
+
+		if (kind == COutputKind::Object) {
+			args.push_back("-c");
+		}
+		else if (kind == COutputKind::Assembly) {
+			args.push_back("-S");
+		}
+
+		args.push_back(source_path);
+		args.push_back("-o");
+		args.push_back(output_path);
+
+		if (kind == COutputKind::Executable) {
+			args.push_back("-lm");
+		}
+
+		try {
+			run_c_compiler(args);
+		}
+		catch (std::runtime_error&) {
+			unlink(source_path.c_str());
+			throw;
+		}
+		unlink(source_path.c_str());
+	}
+
+	Clock::time_point compiled = Clock::now();
+
+	std::cout << "\n-------\n\nc backend: generate "
+		<< std::chrono::duration<double, std::milli>(generated - start).count() << " ms | " << options.compiler << " "
+		<< std::chrono::duration<double, std::milli>(compiled - generated).count() << " ms\n";
+}
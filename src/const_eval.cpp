@@ -0,0 +1,431 @@
+#include "const_eval.h"
+#include <cmath>
+#include <limits>
+
+std::ostream& operator<<(std::ostream& out, const ConstEvalStats& stats) {
+	out << "const fn calls: " << stats.evaluated_calls;
+	out << " (memoized: " << stats.memoized_calls << ")";
+	out << " | left for runtime: " << stats.failed_calls;
+	out << " | steps: " << stats.steps;
+	return out;
+}
+
+// every const fn call reaches a few levels of C++ recursion per ast node,
+// so deep recursion is left for runtime instead of overflowing the stack
+static const unsigned max_const_eval_depth = 512;
+
+// thrown when a call can not be evaluated
+struct ConstEvalFailure {};
+
+static const TSVariable* get_variable(ASTLiteral &literal) {
+	assert(literal.token.type == TokenType::Identifier);
+	return literal.ts_data->scope->get_variable(*literal.token.value.ptr_s);
+}
+
+static const std::string& get_fn_name(ASTFunctionCall &fn_call) {
+	return *dynamic_cast<ASTLiteral&>(*fn_call.name).token.value.ptr_s;
+}
+
+static bool is_number_literal(IAST &ast) {
+	if (ast.type != ASTType::Literal) {
+		return false;
+	}
+
+	TokenType type = dynamic_cast<ASTLiteral&>(ast).token.type;
+	return type == TokenType::LiteralInt || type == TokenType::LiteralFloat;
+}
+
+// the type an expression is used as
+static const TSType* get_value_type(IAST &ast) {
+	return ast.ts_data->implicit_conversion ? ast.ts_data->implicit_conversion : ast.ts_data->type;
+}
+
+static ConstValue make_i32(int32_t i) {
+	ConstValue value;
+	value.i = i;
+	return value;
+}
+
+static ConstValue make_f32(float f) {
+	ConstValue value;
+	value.f = f;
+	return value;
+}
+
+static ConstValue make_bool(bool b) {
+	return make_i32(b ? 1 : 0);
+}
+
+// the same f32 functions of the C library the other backends call
+static ConstValue call_builtin(const std::string& name, const std::vector<ConstValue>& args) {
+	static const std::map<std::string, float (*)(float)> unary = {
+		{ "sin", ::sinf }, { "cos", ::cosf }, { "sqrt", ::sqrtf }, { "exp", ::expf }, { "exp2", ::exp2f },
+		{ "log", ::logf }, { "log2", ::log2f }, { "log10", ::log10f }, { "fabs", ::fabsf },
+		{ "floor", ::floorf }, { "ceil", ::ceilf }, { "trunc", ::truncf }, { "round", ::roundf },
+	};
+	static const std::map<std::string, float (*)(float, float)> binary = {
+		{ "pow", ::powf }, { "fmin", ::fminf }, { "fmax", ::fmaxf }, { "copysign", ::copysignf },
+	};
+
+	auto unary_it = unary.find(name);
+	if (unary_it != unary.end() && args.size() == 1) {
+		return make_f32(unary_it->second(args[0].f));
+	}
+
+	auto binary_it = binary.find(name);
+	if (binary_it != binary.end() && args.size() == 2) {
+		return make_f32(binary_it->second(args[0].f, args[1].f));
+	}
+
+	if (name == "fma" && args.size() == 3) {
+		return make_f32(::fmaf(args[0].f, args[1].f, args[2].f));
+	}
+
+	throw ConstEvalFailure();
+}
+
+void ConstEvaluator::set_program(IAST& root) {
+	this->functions.clear();
+	this->results.clear();
+	this->failed.clear();
+	this->stats = ConstEvalStats();
+
+	if (root.type != ASTType::Root) {
+		return;
+	}
+
+	for (auto child : dynamic_cast<ASTRoot&>(root).children) {
+		ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+		if (fn_defn && fn_defn->is_const && fn_defn->body) {
+			this->functions[*fn_defn->fn_name.value.ptr_s] = fn_defn;
+		}
+	}
+}
+
+bool ConstEvaluator::evaluate_call(ASTFunctionCall& fn_call, ConstValue& result) {
+	auto it = this->functions.find(get_fn_name(fn_call));
+	if (it == this->functions.end() || !fn_call.ts_data) {
+		return false;
+	}
+
+	// only results that can be written as a literal
+	const TSType *type = fn_call.ts_data->type;
+	if (type != i32_type && type != f32_type) {
+		return false;
+	}
+
+	for (auto& param : fn_call.params) {
+		if (!is_number_literal(*param)) {
+			return false;
+		}
+	}
+
+	CallKey key(it->second, std::vector<uint32_t>());
+	std::vector<ConstValue> args;
+	this->steps = 0;
+
+	// literals do not need any variables
+	for (auto& param : fn_call.params) {
+		args.push_back(this->eval(*param));
+		key.second.push_back(args.back().u);
+	}
+
+	if (this->failed.count(key)) {
+		this->stats.failed_calls++;
+		return false;
+	}
+
+	auto result_it = this->results.find(key);
+	if (result_it != this->results.end()) {
+		this->stats.evaluated_calls++;
+		this->stats.memoized_calls++;
+		result = result_it->second;
+		return true;
+	}
+
+	try {
+		result = this->call(*it->second, args);
+	}
+	catch (ConstEvalFailure&) {
+		this->variables = nullptr;
+		this->depth = 0;
+		this->failed.insert(key);
+
+		this->stats.steps += this->steps;
+		this->stats.failed_calls++;
+		return false;
+	}
+
+	this->stats.steps += this->steps;
+	this->stats.evaluated_calls++;
+	return true;
+}
+
+ConstValue ConstEvaluator::call(ASTFunctionDefinition& fn_defn, const std::vector<ConstValue>& args) {
+	CallKey key(&fn_defn, std::vector<uint32_t>());
+	for (auto& arg : args) {
+		key.second.push_back(arg.u);
+	}
+
+	auto it = this->results.find(key);
+	if (it != this->results.end()) {
+		return it->second;
+	}
+
+	if (this->depth == max_const_eval_depth) {
+		throw ConstEvalFailure();
+	}
+
+	Variables variables;
+	for (unsigned i = 0; i < fn_defn.args.size(); ++i) {
+		variables[get_variable(dynamic_cast<ASTLiteral&>(*fn_defn.args[i].first))] = args[i];
+	}
+
+	Variables *caller_variables = this->variables;
+	this->variables = &variables;
+	this->depth++;
+
+	ConstValue result = this->eval(*fn_defn.body);
+
+	this->depth--;
+	this->variables = caller_variables;
+
+	this->results[key] = result;
+	return result;
+}
+
+void ConstEvaluator::step() {
+	if (++this->steps > this->step_budget) {
+		throw ConstEvalFailure();
+	}
+}
+
+ConstValue ConstEvaluator::eval(IAST& ast) {
+	ConstValue value = this->eval_unconverted(ast);
+
+	if (!ast.ts_data || !ast.ts_data->implicit_conversion) {
+		return value;
+	}
+
+	assert(ast.ts_data->type == i32_type && ast.ts_data->implicit_conversion == f32_type);
+	return make_f32((float)value.i);
+}
+
+ConstValue ConstEvaluator::eval_unconverted(IAST& ast) {
+	this->step();
+
+	switch (ast.type) {
+	case ASTType::Literal: {
+		const Token &token = dynamic_cast<ASTLiteral&>(ast).token;
+
+		switch (token.type) {
+		case TokenType::LiteralInt:
+			return make_i32((int32_t)*token.value.ptr_i);
+
+		case TokenType::LiteralFloat:
+			return make_f32((float)*token.value.ptr_f);
+
+		case TokenType::Identifier: {
+			auto it = this->variables->find(get_variable(dynamic_cast<ASTLiteral&>(ast)));
+			assert(it != this->variables->end());
+			return it->second;
+		}
+
+		default:
+			throw ConstEvalFailure();
+		}
+	}
+
+	case ASTType::InfixExpr:
+		return this->eval_infix_expr(dynamic_cast<ASTInfixExpr&>(ast));
+
+	case ASTType::PrefixExpr:
+		return this->eval_prefix_expr(dynamic_cast<ASTPrefixExpr&>(ast));
+
+	case ASTType::FunctionCall:
+		return this->eval_fn_call(dynamic_cast<ASTFunctionCall&>(ast));
+
+	case ASTType::Statement:
+		return this->eval(*dynamic_cast<ASTStatement&>(ast).inner);
+
+	case ASTType::Block: {
+		ASTBlock &block = dynamic_cast<ASTBlock&>(ast);
+		ConstValue value = make_i32(0);
+
+		for (auto stmt : block.statements) {
+			value = this->eval(*stmt);
+		}
+		if (block.return_expr) {
+			value = this->eval(*block.return_expr);
+		}
+		return value;
+	}
+
+	// a let without a value starts out as 0, like in the other backends
+	case ASTType::VariableDefinition: {
+		ASTVariableDefinition &variable_defn = dynamic_cast<ASTVariableDefinition&>(ast);
+		ConstValue value = make_i32(0);
+		(*this->variables)[get_variable(dynamic_cast<ASTLiteral&>(*variable_defn.name))] = value;
+		return value;
+	}
+
+	case ASTType::ForLoop:
+		return this->eval_for_loop(dynamic_cast<ASTForLoop&>(ast));
+
+	case ASTType::If:
+		return this->eval_if(dynamic_cast<ASTIf&>(ast));
+
+	default:
+		throw ConstEvalFailure();
+	}
+}
+
+ConstValue ConstEvaluator::eval_infix_expr(ASTInfixExpr& infix) {
+	if (infix.op.type == TokenType::Equals) {
+		ConstValue value = this->eval(*infix.right);
+		IAST *target = infix.left.get();
+
+		if (target->type == ASTType::VariableDefinition) {
+			target = dynamic_cast<ASTVariableDefinition&>(*target).name.get();
+		}
+
+		if (target->type != ASTType::Literal ||
+			dynamic_cast<ASTLiteral&>(*target).token.type != TokenType::Identifier) {
+			throw ConstEvalFailure();
+		}
+
+		(*this->variables)[get_variable(dynamic_cast<ASTLiteral&>(*target))] = value;
+		return value;
+	}
+
+	// the right side only runs if it decides the result
+	if (infix.op.type == TokenType::CondAnd || infix.op.type == TokenType::CondOr) {
+		bool left = this->eval(*infix.left).i != 0;
+
+		if (left == (infix.op.type == TokenType::CondOr)) {
+			return make_bool(left);
+		}
+		return make_bool(this->eval(*infix.right).i != 0);
+	}
+
+	ConstValue left = this->eval(*infix.left);
+	ConstValue right = this->eval(*infix.right);
+	const TSType *type = get_value_type(*infix.left);
+
+	if (type == f32_type) {
+		float l = left.f;
+		float r = right.f;
+
+		// ordered comparisons, except for != which is true for NaNs
+		switch (infix.op.type) {
+		case TokenType::Plus: return make_f32(l + r);
+		case TokenType::Minus: return make_f32(l - r);
+		case TokenType::Multiply: return make_f32(l * r);
+		case TokenType::Divide: return make_f32(l / r);
+		case TokenType::CondL: return make_bool(l < r);
+		case TokenType::CondG: return make_bool(l > r);
+		case TokenType::CondLEQ: return make_bool(l <= r);
+		case TokenType::CondGEQ: return make_bool(l >= r);
+		case TokenType::CondEQ: return make_bool(l == r);
+		case TokenType::CondNEQ: return make_bool(!(l == r));
+		default: throw ConstEvalFailure();
+		}
+	}
+
+	// i32 and bool. i32 wraps around, so do the math on unsigned values
+	int32_t l = left.i;
+	int32_t r = right.i;
+
+	switch (infix.op.type) {
+	case TokenType::Plus: return make_i32((int32_t)((uint32_t)l + (uint32_t)r));
+	case TokenType::Minus: return make_i32((int32_t)((uint32_t)l - (uint32_t)r));
+	case TokenType::Multiply: return make_i32((int32_t)((uint32_t)l * (uint32_t)r));
+
+	case TokenType::Divide:
+		// traps at runtime
+		if (r == 0 || (l == std::numeric_limits<int32_t>::min() && r == -1)) {
+			throw ConstEvalFailure();
+		}
+		return make_i32(l / r);
+
+	case TokenType::CondL: return make_bool(l < r);
+	case TokenType::CondG: return make_bool(l > r);
+	case TokenType::CondLEQ: return make_bool(l <= r);
+	case TokenType::CondGEQ: return make_bool(l >= r);
+	case TokenType::CondEQ: return make_bool(l == r);
+	case TokenType::CondNEQ: return make_bool(l != r);
+	default: throw ConstEvalFailure();
+	}
+}
+
+ConstValue ConstEvaluator::eval_prefix_expr(ASTPrefixExpr& prefix) {
+	ConstValue operand = this->eval(*prefix.expr);
+
+	switch (prefix.op.type) {
+	case TokenType::Minus:
+		if (prefix.ts_data->type == f32_type) {
+			return make_f32(-operand.f);
+		}
+		return make_i32((int32_t)(0u - (uint32_t)operand.i));
+
+	case TokenType::CondNot:
+		return make_bool(operand.i == 0);
+
+	default:
+		throw ConstEvalFailure();
+	}
+}
+
+ConstValue ConstEvaluator::eval_fn_call(ASTFunctionCall& fn_call) {
+	std::vector<ConstValue> args;
+	for (auto& param : fn_call.params) {
+		args.push_back(this->eval(*param));
+	}
+
+	const std::string &name = get_fn_name(fn_call);
+	const TSVariable *fn = fn_call.ts_data->scope->get_variable(name);
+
+	// builtins do not have a position
+	if (!fn->decl_pos.is_valid()) {
+		return call_builtin(name, args);
+	}
+
+	auto it = this->functions.find(name);
+	if (it == this->functions.end()) {
+		throw ConstEvalFailure();
+	}
+	return this->call(*it->second, args);
+}
+
+// like the generated code: start, end and step are evaluated once, and the
+// body can assign to the induction variable
+ConstValue ConstEvaluator::eval_for_loop(ASTForLoop& for_loop) {
+	int32_t start = this->eval(*for_loop.start).i;
+	int32_t end = this->eval(*for_loop.end).i;
+	int32_t step = for_loop.step ? this->eval(*for_loop.step).i : 1;
+
+	const TSVariable *induction_var = get_variable(dynamic_cast<ASTLiteral&>(*for_loop.induction_var));
+	(*this->variables)[induction_var] = make_i32(start);
+
+	while ((*this->variables)[induction_var].i < end) {
+		this->eval(*for_loop.body);
+
+		ConstValue &i = (*this->variables)[induction_var];
+		i.i = (int32_t)((uint32_t)i.i + (uint32_t)step);
+	}
+
+	this->variables->erase(induction_var);
+	return make_i32(0);
+}
+
+ConstValue ConstEvaluator::eval_if(ASTIf& if_expr) {
+	if (this->eval(*if_expr.condition).i != 0) {
+		return this->eval(*if_expr.then_block);
+	}
+
+	if (if_expr.else_branch) {
+		return this->eval(*if_expr.else_branch);
+	}
+	return make_i32(0);
+}
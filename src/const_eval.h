@@ -0,0 +1,96 @@
+#pragma once
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "ast.h"
+#include "type_system.h"
+
+// evaluates calls to const fns at compile time, by walking their type
+// checked bodies. the results follow the semantics of the generated code:
+// i32 wraps around, f32 math is done in single precision and the math
+// builtins are the C library's f32 functions.
+//
+// a call that divides by zero, recurses too deep or runs out of steps is
+// left for runtime, where it behaves the way it always did.
+
+// ast nodes one call (with everything it calls) may evaluate
+static const uint64_t default_const_eval_steps = 1000000;
+
+struct ConstEvalStats {
+	// calls that were evaluated
+	unsigned evaluated_calls;
+	// of those, the ones with arguments that were seen before
+	unsigned memoized_calls;
+	// calls that are left for runtime
+	unsigned failed_calls;
+
+	// ast nodes evaluated, over all calls
+	uint64_t steps;
+
+	ConstEvalStats() : evaluated_calls(0), memoized_calls(0), failed_calls(0), steps(0) {}
+};
+
+std::ostream& operator<<(std::ostream& out, const ConstEvalStats& stats);
+
+// the value of an i32, f32 or bool expression. bools are 0 or 1.
+union ConstValue {
+	int32_t i;
+	float f;
+	uint32_t u;
+};
+
+class ConstEvaluator {
+public:
+
+	ConstEvaluator(uint64_t step_budget = default_const_eval_steps) :
+		step_budget(step_budget), variables(nullptr), depth(0), steps(0) {}
+
+	// forgets everything about the previous program, and finds the const
+	// fns of this one
+	void set_program(IAST& root);
+
+	// evaluates fn_call if it calls a const fn with literal arguments, and
+	// returns its i32 or f32 result, before any implicit conversion of the
+	// call itself. false if the call has to stay.
+	bool evaluate_call(ASTFunctionCall& fn_call, ConstValue& result);
+
+	const ConstEvalStats& get_stats() const {
+		return this->stats;
+	}
+
+private:
+
+	typedef std::map<const TSVariable *, ConstValue> Variables;
+	typedef std::pair<const ASTFunctionDefinition *, std::vector<uint32_t> > CallKey;
+
+	uint64_t step_budget;
+	std::map<std::string, ASTFunctionDefinition *> functions;
+
+	// the results of every call that was evaluated, including the ones made
+	// by other const fns, and the calls from outside that failed
+	std::map<CallKey, ConstValue> results;
+	std::set<CallKey> failed;
+
+	// of the call that is being evaluated
+	Variables *variables;
+	unsigned depth;
+	uint64_t steps;
+
+	ConstEvalStats stats;
+
+	ConstValue call(ASTFunctionDefinition& fn_defn, const std::vector<ConstValue>& args);
+
+	void step();
+
+	ConstValue eval(IAST& ast);
+	ConstValue eval_unconverted(IAST& ast);
+	ConstValue eval_infix_expr(ASTInfixExpr& infix);
+	ConstValue eval_prefix_expr(ASTPrefixExpr& prefix);
+	ConstValue eval_fn_call(ASTFunctionCall& fn_call);
+	ConstValue eval_for_loop(ASTForLoop& for_loop);
+	ConstValue eval_if(ASTIf& if_expr);
+};
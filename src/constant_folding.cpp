@@ -0,0 +1,348 @@
+#include "constant_folding.h"
+#include <limits>
+#include <stdint.h>
+
+std::ostream& operator<<(std::ostream& out, const ConstantFoldingStats& stats) {
+	out << "folded expressions: " << stats.folded_exprs;
+	out << " | propagated constants: " << stats.propagated_uses;
+	out << " | removed nodes: " << stats.removed_nodes;
+	out << " | " << stats.const_eval;
+	return out;
+}
+
+struct ASTNodeCounter : public IASTGenericVisitor {
+	unsigned count;
+
+	ASTNodeCounter() : count(0) {}
+
+	virtual void inspect_ast(IAST &ast) {
+		this->count++;
+		ast.traverse_inner(*this);
+	}
+};
+
+static unsigned count_nodes(IAST &ast) {
+	ASTNodeCounter counter;
+	ast.dispatch(counter);
+	return counter.count;
+}
+
+static const TSVariable* get_variable(ASTLiteral &literal) {
+	assert(literal.token.type == TokenType::Identifier);
+	return literal.ts_data->scope->get_variable(*literal.token.value.ptr_s);
+}
+
+static bool is_number_literal(IAST &ast) {
+	if (ast.type != ASTType::Literal) {
+		return false;
+	}
+
+	TokenType type = dynamic_cast<ASTLiteral&>(ast).token.type;
+	return type == TokenType::LiteralInt || type == TokenType::LiteralFloat;
+}
+
+static long double get_float_value(const Token &token) {
+	if (token.type == TokenType::LiteralInt) {
+		return (float)*token.value.ptr_i;
+	}
+	return (float)*token.value.ptr_f;
+}
+
+//finds every variable that is the target of a "=" that is not its own
+//definition. those can not be propagated.
+struct AssignedVariableCollector : public IASTGenericVisitor {
+	std::set<const TSVariable *> &assigned_variables;
+
+	AssignedVariableCollector(std::set<const TSVariable *> &assigned_variables) :
+		assigned_variables(assigned_variables) {}
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::InfixExpr) {
+			ASTInfixExpr &infix = dynamic_cast<ASTInfixExpr&>(ast);
+
+			if (infix.op.type == TokenType::Equals && infix.left->type == ASTType::Literal) {
+				ASTLiteral &target = dynamic_cast<ASTLiteral&>(*infix.left);
+
+				if (target.token.type == TokenType::Identifier) {
+					this->assigned_variables.insert(get_variable(target));
+				}
+			}
+		}
+		ast.traverse_inner(*this);
+	}
+};
+
+ConstantFoldingStats ConstantFolder::fold(std::shared_ptr<IAST> root) {
+	this->stats = ConstantFoldingStats();
+	this->constants.clear();
+	this->assigned_variables.clear();
+
+	AssignedVariableCollector collector(this->assigned_variables);
+	root->dispatch(collector);
+	this->evaluator.set_program(*root);
+
+	this->fold_ast(root);
+	this->stats.const_eval = this->evaluator.get_stats();
+	return this->stats;
+}
+
+std::shared_ptr<ASTLiteral> ConstantFolder::make_literal(const TSType *type,
+														 long long i,
+														 long double f,
+														 IAST& replaced) {
+	if (type == i32_type) {
+		this->folded_tokens.push_back(Token(TokenType::LiteralInt, i, replaced.position));
+	}
+	else {
+		assert(type == f32_type);
+		this->folded_tokens.push_back(Token(TokenType::LiteralFloat, f, replaced.position));
+	}
+
+	std::shared_ptr<ASTLiteral> literal(new ASTLiteral(this->folded_tokens.back(), replaced.position));
+	literal->ts_data = std::make_shared<TSASTData>(replaced.ts_data->scope, type);
+	literal->ts_data->implicit_conversion = replaced.ts_data->implicit_conversion;
+
+	this->stats.folded_exprs++;
+	this->stats.removed_nodes += count_nodes(replaced) - 1;
+	return literal;
+}
+
+std::shared_ptr<IAST> ConstantFolder::fold_ast(std::shared_ptr<IAST> ast) {
+	switch (ast->type) {
+	case ASTType::Literal:
+		return this->fold_literal(std::dynamic_pointer_cast<ASTLiteral>(ast));
+
+	case ASTType::InfixExpr:
+		return this->fold_infix_expr(std::dynamic_pointer_cast<ASTInfixExpr>(ast));
+
+	case ASTType::PrefixExpr:
+		return this->fold_prefix_expr(std::dynamic_pointer_cast<ASTPrefixExpr>(ast));
+
+	case ASTType::Statement: {
+		ASTStatement &stmt = dynamic_cast<ASTStatement&>(*ast);
+		stmt.inner = this->fold_ast(stmt.inner);
+		return ast;
+	}
+
+	case ASTType::Block: {
+		ASTBlock &block = dynamic_cast<ASTBlock&>(*ast);
+
+		for (auto &stmt : block.statements) {
+			stmt = this->fold_ast(stmt);
+		}
+
+		if (block.return_expr) {
+			block.return_expr = this->fold_ast(block.return_expr);
+		}
+		return ast;
+	}
+
+	case ASTType::FunctionDefinition: {
+		ASTFunctionDefinition &fn_defn = dynamic_cast<ASTFunctionDefinition&>(*ast);
+
+		if (fn_defn.body) {
+			fn_defn.body = this->fold_ast(fn_defn.body);
+		}
+		return ast;
+	}
+
+	case ASTType::FunctionCall:
+		return this->fold_fn_call(std::dynamic_pointer_cast<ASTFunctionCall>(ast));
+
+	case ASTType::Root: {
+		ASTRoot &root = dynamic_cast<ASTRoot&>(*ast);
+
+		for (auto &child : root.children) {
+			child = this->fold_ast(child);
+		}
+		return ast;
+	}
+
+	case ASTType::ForLoop: {
+		ASTForLoop &for_loop = dynamic_cast<ASTForLoop&>(*ast);
+		for_loop.start = this->fold_ast(for_loop.start);
+		for_loop.end = this->fold_ast(for_loop.end);
+
+		if (for_loop.step) {
+			for_loop.step = this->fold_ast(for_loop.step);
+		}
+		for_loop.body = this->fold_ast(for_loop.body);
+		return ast;
+	}
+
+	case ASTType::If: {
+		ASTIf &if_expr = dynamic_cast<ASTIf&>(*ast);
+		if_expr.condition = this->fold_ast(if_expr.condition);
+		if_expr.then_block = this->fold_ast(if_expr.then_block);
+
+		if (if_expr.else_branch) {
+			if_expr.else_branch = this->fold_ast(if_expr.else_branch);
+		}
+		return ast;
+	}
+
+	case ASTType::VariableDefinition:
+		return ast;
+
+	default:
+		assert(false && "unknown ast type to fold");
+	}
+	return ast;
+}
+
+std::shared_ptr<IAST> ConstantFolder::fold_literal(std::shared_ptr<ASTLiteral> literal) {
+	if (literal->token.type != TokenType::Identifier) {
+		return literal;
+	}
+
+	auto it = this->constants.find(get_variable(*literal));
+	if (it == this->constants.end()) {
+		return literal;
+	}
+
+	//a copy of the value, so that every use keeps its own position
+	std::shared_ptr<ASTLiteral> value(new ASTLiteral(it->second->token, literal->position));
+	value->ts_data = std::make_shared<TSASTData>(literal->ts_data->scope, it->second->ts_data->type);
+	value->ts_data->implicit_conversion = literal->ts_data->implicit_conversion;
+	this->stats.propagated_uses++;
+	return value;
+}
+
+std::shared_ptr<IAST> ConstantFolder::fold_infix_expr(std::shared_ptr<ASTInfixExpr> infix) {
+	//the left of an assignment is a place, not a value
+	if (infix->op.type == TokenType::Equals) {
+		infix->right = this->fold_ast(infix->right);
+
+		//let <name> : <type> = <constant>, and <name> is never assigned again
+		if (infix->left->type == ASTType::VariableDefinition && is_number_literal(*infix->right)) {
+			ASTVariableDefinition &defn = dynamic_cast<ASTVariableDefinition&>(*infix->left);
+			const TSVariable *variable = get_variable(dynamic_cast<ASTLiteral&>(*defn.name));
+
+			if (this->assigned_variables.find(variable) == this->assigned_variables.end()) {
+				this->constants[variable] = std::dynamic_pointer_cast<ASTLiteral>(infix->right);
+			}
+		}
+		return infix;
+	}
+
+	infix->left = this->fold_ast(infix->left);
+	infix->right = this->fold_ast(infix->right);
+
+	bool is_arith = infix->op.type == TokenType::Plus ||
+		infix->op.type == TokenType::Minus ||
+		infix->op.type == TokenType::Multiply ||
+		infix->op.type == TokenType::Divide;
+
+	if (!is_arith || !infix->ts_data || !is_number_literal(*infix->left) || !is_number_literal(*infix->right)) {
+		return infix;
+	}
+
+	const Token &left = dynamic_cast<ASTLiteral&>(*infix->left).token;
+	const Token &right = dynamic_cast<ASTLiteral&>(*infix->right).token;
+	const TSType *type = infix->ts_data->type;
+
+	if (type == i32_type) {
+		if (left.type != TokenType::LiteralInt || right.type != TokenType::LiteralInt) {
+			return infix;
+		}
+
+		//i32 wraps around, so do the math on unsigned values
+		int32_t l = (int32_t)*left.value.ptr_i;
+		int32_t r = (int32_t)*right.value.ptr_i;
+		int32_t result;
+
+		switch (infix->op.type) {
+		case TokenType::Plus:
+			result = (int32_t)((uint32_t)l + (uint32_t)r);
+			break;
+
+		case TokenType::Minus:
+			result = (int32_t)((uint32_t)l - (uint32_t)r);
+			break;
+
+		case TokenType::Multiply:
+			result = (int32_t)((uint32_t)l * (uint32_t)r);
+			break;
+
+		case TokenType::Divide:
+			//these trap at runtime, so leave them for runtime
+			if (r == 0 || (l == std::numeric_limits<int32_t>::min() && r == -1)) {
+				return infix;
+			}
+			result = l / r;
+			break;
+
+		default:
+			assert(false && "unknown arith operator");
+			return infix;
+		}
+		return this->make_literal(i32_type, result, 0, *infix);
+	}
+
+	if (type == f32_type) {
+		float l = get_float_value(left);
+		float r = get_float_value(right);
+		float result;
+
+		switch (infix->op.type) {
+		case TokenType::Plus:
+			result = l + r;
+			break;
+
+		case TokenType::Minus:
+			result = l - r;
+			break;
+
+		case TokenType::Multiply:
+			result = l * r;
+			break;
+
+		case TokenType::Divide:
+			result = l / r;
+			break;
+
+		default:
+			assert(false && "unknown arith operator");
+			return infix;
+		}
+		return this->make_literal(f32_type, 0, result, *infix);
+	}
+
+	return infix;
+}
+
+std::shared_ptr<IAST> ConstantFolder::fold_prefix_expr(std::shared_ptr<ASTPrefixExpr> prefix) {
+	prefix->expr = this->fold_ast(prefix->expr);
+
+	if (prefix->op.type != TokenType::Minus || !is_number_literal(*prefix->expr)) {
+		return prefix;
+	}
+
+	const ASTLiteral &operand = dynamic_cast<ASTLiteral&>(*prefix->expr);
+	const TSType *type = prefix->ts_data->type;
+
+	if (type == i32_type && operand.token.type == TokenType::LiteralInt) {
+		int32_t value = (int32_t)*operand.token.value.ptr_i;
+		return this->make_literal(i32_type, (int32_t)(0u - (uint32_t)value), 0, *prefix);
+	}
+
+	if (type == f32_type) {
+		return this->make_literal(f32_type, 0, -(float)get_float_value(operand.token), *prefix);
+	}
+
+	return prefix;
+}
+
+std::shared_ptr<IAST> ConstantFolder::fold_fn_call(std::shared_ptr<ASTFunctionCall> fn_call) {
+	for (auto &param : fn_call->params) {
+		param = this->fold_ast(param);
+	}
+
+	ConstValue result;
+	if (!this->evaluator.evaluate_call(*fn_call, result)) {
+		return fn_call;
+	}
+
+	const TSType *type = fn_call->ts_data->type;
+	return this->make_literal(type, type == i32_type ? result.i : 0, type == f32_type ? result.f : 0, *fn_call);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <deque>
+#include <map>
+#include <set>
+#include <memory>
+#include "ast.h"
+#include "const_eval.h"
+#include "type_system.h"
+
+struct ConstantFoldingStats {
+	// infix / prefix expressions and const fn calls that were evaluated at
+	// compile time
+	unsigned folded_exprs;
+
+	// uses of constant let bindings that were replaced by their value
+	unsigned propagated_uses;
+
+	// AST nodes that no longer exist after folding
+	unsigned removed_nodes;
+
+	ConstEvalStats const_eval;
+
+	ConstantFoldingStats() : folded_exprs(0), propagated_uses(0), removed_nodes(0) {}
+};
+
+std::ostream& operator<<(std::ostream& out, const ConstantFoldingStats& stats);
+
+// evaluates arithmetic on literals with i32 / f32 semantics (following the
+// type the type checker gave the expression), and replaces uses of let
+// bindings that are initialized with a constant and never assigned to.
+// calls to const fns with constant arguments are replaced by their result,
+// see ConstEvaluator. runs on a type checked tree.
+//
+// ASTLiterals refer to their token, so the tokens of folded values live in
+// the folder. it has to outlive the tree it folded.
+class ConstantFolder {
+public:
+
+	// const_eval_steps limits the evaluation of every const fn call
+	ConstantFolder(uint64_t const_eval_steps = default_const_eval_steps) : evaluator(const_eval_steps) {}
+
+	ConstantFoldingStats fold(std::shared_ptr<IAST> root);
+
+private:
+
+	std::deque<Token> folded_tokens;
+	ConstEvaluator evaluator;
+	std::map<const TSVariable *, std::shared_ptr<ASTLiteral> > constants;
+	std::set<const TSVariable *> assigned_variables;
+	ConstantFoldingStats stats;
+
+	std::shared_ptr<IAST> fold_ast(std::shared_ptr<IAST> ast);
+	std::shared_ptr<IAST> fold_literal(std::shared_ptr<ASTLiteral> literal);
+	std::shared_ptr<IAST> fold_infix_expr(std::shared_ptr<ASTInfixExpr> infix);
+	std::shared_ptr<IAST> fold_prefix_expr(std::shared_ptr<ASTPrefixExpr> prefix);
+	std::shared_ptr<IAST> fold_fn_call(std::shared_ptr<ASTFunctionCall> fn_call);
+
+	std::shared_ptr<ASTLiteral> make_literal(const TSType *type,
+											 long long i,
+											 long double f,
+											 IAST& replaced);
+};
@@ -0,0 +1,190 @@
+#include "diagnostics.h"
+#include "tokenizer.h"
+#include "type_system.h"
+
+DiagnosticArg::DiagnosticArg(const std::string& str) :
+	kind(Kind::String), str(str), type(nullptr), token_type(TokenType::Undecided) {}
+
+DiagnosticArg::DiagnosticArg(const char *str) :
+	kind(Kind::String), str(str), type(nullptr), token_type(TokenType::Undecided) {}
+
+DiagnosticArg::DiagnosticArg(const TSType *type) :
+	kind(Kind::Type), type(type), token_type(TokenType::Undecided) {}
+
+DiagnosticArg::DiagnosticArg(TokenType token_type) :
+	kind(Kind::TokenType), type(nullptr), token_type(token_type) {}
+
+std::ostream& operator<<(std::ostream& out, const DiagnosticArg& arg) {
+	switch (arg.kind) {
+	case DiagnosticArg::Kind::String:
+		out << arg.str;
+		break;
+
+	case DiagnosticArg::Kind::Type:
+		out << *arg.type;
+		break;
+
+	case DiagnosticArg::Kind::TokenType:
+		out << arg.token_type;
+		break;
+	}
+	return out;
+}
+
+// %N is replaced by the Nth argument
+static const char* get_format(DiagnosticCode code) {
+	switch (code) {
+	case DiagnosticCode::ExpectedToken:
+		return "expected token type: %0 | found: %1 %2";
+
+	case DiagnosticCode::NoPrefixParser:
+		return "unable to find prefix parser for token: %0";
+
+	case DiagnosticCode::ExpectedFnIdentifier:
+		return "expected identifier after fn. found: %0";
+
+	case DiagnosticCode::UnknownLoopHint:
+		return "unknown loop hint: %0 | expected vectorize, interleave or unroll";
+
+	case DiagnosticCode::ExternFunctionWithBody:
+		return "extern fn %0 can not have a body | it is defined outside the program";
+
+	case DiagnosticCode::ExternConstFunction:
+		return "extern fn %0 can not be const | only fns with a body can be evaluated at compile time";
+
+	case DiagnosticCode::UndefinedVariable:
+		return "undefined variable: %0";
+
+	case DiagnosticCode::MultipleVariableDefinition:
+		return "multiple variable definition: %0";
+
+	case DiagnosticCode::MultipleFunctionDefinition:
+		return "multiple function definition: %0";
+
+	case DiagnosticCode::ReservedFunctionName:
+		return "fn %0 can not be defined | it is the C library function the builtin %1 calls";
+
+	case DiagnosticCode::UnknownType:
+		return "unable to find type: %0";
+
+	case DiagnosticCode::UnknownFunction:
+		return "unknown function: %0";
+
+	case DiagnosticCode::NotAFunction:
+		return "called variable is not a function: %0 | type: %1";
+
+	case DiagnosticCode::CalleeNotAFunction:
+		return "called expression is not a function | only fns can be called, by their name";
+
+	case DiagnosticCode::ExpectedNumberOperand:
+		return "expected a number as the %0 operand to %1 | received: %2";
+
+	case DiagnosticCode::ExpectedNumberPrefix:
+		return "expected number for unary %0 | received: %1";
+
+	case DiagnosticCode::AssignmentTypeMismatch:
+		return "types do not match on \"=\" | left: %0 | right: %1";
+
+	case DiagnosticCode::InvalidAssignmentTarget:
+		return "can only assign to variables | the left side of = has to be a name or a let";
+
+	case DiagnosticCode::ArgumentCountMismatch:
+		return "wrong number of arguments to %0 | expected: %1 | received: %2";
+
+	case DiagnosticCode::ArgumentTypeMismatch:
+		return "argument %0 to %1 has the wrong type | expected: %2 | received: %3";
+
+	case DiagnosticCode::ReturnTypeMismatch:
+		return "body of %0 has the wrong type | expected: %1 | received: %2";
+
+	case DiagnosticCode::ExpectedIntLoopBound:
+		return "loop %0 has to be an i32 | received: %1";
+
+	case DiagnosticCode::NonPositiveLoopStep:
+		return "loop step has to be positive | received: %0";
+
+	case DiagnosticCode::ComparisonTypeMismatch:
+		return "can not compare with %0 | left: %1 | right: %2";
+
+	case DiagnosticCode::ExpectedBoolOperand:
+		return "expected a bool as the %0 operand to %1 | received: %2";
+
+	case DiagnosticCode::ExpectedBoolPrefix:
+		return "expected bool for unary %0 | received: %1";
+
+	case DiagnosticCode::ExpectedBoolCondition:
+		return "if condition has to be a bool | received: %0";
+
+	case DiagnosticCode::ConstFunctionCallsNonConst:
+		return "const fn %0 can only call const fns and math builtins | calls: %1";
+
+	case DiagnosticCode::NoteOriginalDefinition:
+		return "original definition";
+	}
+
+	assert(false && "unknown diagnostic code");
+	return "";
+}
+
+bool Diagnostic::is_note() const {
+	return this->code == DiagnosticCode::NoteOriginalDefinition;
+}
+
+DiagnosticEngine::DiagnosticEngine(unsigned error_limit) :
+	error_limit(error_limit), num_errors(0), dropped_errors(false),
+	dropping_notes(false) {}
+
+void DiagnosticEngine::report(DiagnosticCode code,
+							  SourceRange position,
+							  std::vector<DiagnosticArg> args) {
+	Diagnostic diagnostic(code, position, args);
+
+	if (diagnostic.is_note()) {
+		if (!this->dropping_notes) {
+			this->diagnostics.push_back(diagnostic);
+		}
+		return;
+	}
+
+	if (this->should_stop()) {
+		this->dropped_errors = true;
+		this->dropping_notes = true;
+		return;
+	}
+
+	this->dropping_notes = false;
+	this->num_errors++;
+	this->diagnostics.push_back(diagnostic);
+}
+
+void DiagnosticEngine::merge(const DiagnosticEngine& other) {
+	for (auto& diagnostic : other.diagnostics) {
+		this->report(diagnostic.code, diagnostic.position, diagnostic.args);
+	}
+	this->dropped_errors = this->dropped_errors || other.dropped_errors;
+}
+
+void DiagnosticEngine::render(std::ostream& out, const SourceManager& source_manager) const {
+	for (auto& diagnostic : this->diagnostics) {
+		out << (diagnostic.is_note() ? "note: " : "\nerror: ");
+
+		for (const char *c = get_format(diagnostic.code); *c != '\0'; ++c) {
+			if (c[0] == '%' && c[1] >= '0' && c[1] <= '9') {
+				unsigned index = c[1] - '0';
+				assert(index < diagnostic.args.size());
+				out << diagnostic.args[index];
+				++c;
+			}
+			else {
+				out << *c;
+			}
+		}
+
+		print_source_range(out, diagnostic.position, source_manager);
+		out << "\n";
+	}
+
+	if (this->dropped_errors) {
+		out << "\ntoo many errors emitted (limit: " << this->error_limit << "), stopping now\n";
+	}
+}
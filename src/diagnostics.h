@@ -0,0 +1,124 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+#include "file_handling.h"
+
+struct TSType;
+enum class TokenType;
+
+enum class DiagnosticCode {
+	// parsing
+	ExpectedToken,
+	NoPrefixParser,
+	ExpectedFnIdentifier,
+	UnknownLoopHint,
+	ExternFunctionWithBody,
+	ExternConstFunction,
+
+	// type system
+	UndefinedVariable,
+	MultipleVariableDefinition,
+	MultipleFunctionDefinition,
+	ReservedFunctionName,
+	UnknownType,
+	UnknownFunction,
+	NotAFunction,
+	CalleeNotAFunction,
+	ExpectedNumberOperand,
+	ExpectedNumberPrefix,
+	AssignmentTypeMismatch,
+	InvalidAssignmentTarget,
+	ArgumentCountMismatch,
+	ArgumentTypeMismatch,
+	ReturnTypeMismatch,
+	ExpectedIntLoopBound,
+	NonPositiveLoopStep,
+	ComparisonTypeMismatch,
+	ExpectedBoolOperand,
+	ExpectedBoolPrefix,
+	ExpectedBoolCondition,
+	ConstFunctionCallsNonConst,
+
+	// notes attached to the error before them
+	NoteOriginalDefinition,
+};
+
+// arguments are kept as they are, and only turned into text when the
+// diagnostic is rendered
+struct DiagnosticArg {
+	enum class Kind {
+		String,
+		Type,
+		TokenType,
+	} kind;
+
+	std::string str;
+	const TSType *type;
+	TokenType token_type;
+
+	DiagnosticArg(const std::string& str);
+	DiagnosticArg(const char *str);
+	DiagnosticArg(const TSType *type);
+	DiagnosticArg(TokenType token_type);
+};
+
+struct Diagnostic {
+	DiagnosticCode code;
+	SourceRange position;
+	std::vector<DiagnosticArg> args;
+
+	Diagnostic(DiagnosticCode code,
+			   SourceRange position,
+			   std::vector<DiagnosticArg> args) :
+			   code(code), position(position), args(args) {}
+
+	bool is_note() const;
+};
+
+// collects diagnostics instead of throwing on the first one. nothing is
+// formatted until render() is called.
+class DiagnosticEngine {
+public:
+
+	// error_limit == 0 means no limit
+	DiagnosticEngine(unsigned error_limit = 0);
+
+	void report(DiagnosticCode code,
+				SourceRange position,
+				std::vector<DiagnosticArg> args = {});
+
+	// appends other's diagnostics after ours (used to merge the diagnostics
+	// of work that was done in parallel in a deterministic order)
+	void merge(const DiagnosticEngine& other);
+
+	bool has_errors() const {
+		return this->num_errors > 0;
+	}
+
+	unsigned get_num_errors() const {
+		return this->num_errors;
+	}
+
+	unsigned get_error_limit() const {
+		return this->error_limit;
+	}
+
+	// true once the error limit was hit. further reports are dropped.
+	bool should_stop() const {
+		return this->error_limit != 0 && this->num_errors >= this->error_limit;
+	}
+
+	void render(std::ostream& out, const SourceManager& source_manager) const;
+
+private:
+
+	unsigned error_limit;
+	unsigned num_errors;
+	bool dropped_errors;
+
+	// notes of a dropped error are dropped with it
+	bool dropping_notes;
+
+	std::vector<Diagnostic> diagnostics;
+};
@@ -4,79 +4,133 @@
 #include <algorithm>
 #include <sstream>
 
-std::pair<PositionIndex, PositionIndex>index_to_line_col(
-	const PositionIndex& idx,
-	std::string        & file_data) {
-	PositionIndex line = 1;
-	PositionIndex col = 0;
+LineTable::LineTable(const std::string& file_data) : file_data(file_data) {
+	this->line_starts.push_back(0);
 
-	PositionIndex current_index = 0;
-
-	for (auto ch : file_data) {
-		if (current_index == idx) {
-			break;
+	for (PositionIndex i = 0; i < (PositionIndex)file_data.size(); ++i) {
+		if (file_data[i] == '\n') {
+			this->line_starts.push_back(i + 1);
 		}
+	}
+}
 
-		if (ch == '\n') {
-			line++;
-			col = 0;
-		}
-		else {
-			col++;
-		}
+std::pair<PositionIndex, PositionIndex>LineTable::get_line_col(PositionIndex idx) const {
+	// the last line start that is <= idx
+	auto it = std::upper_bound(this->line_starts.begin(), this->line_starts.end(), idx);
+	PositionIndex line = it - this->line_starts.begin();
+	PositionIndex col = idx - this->line_starts[line - 1];
 
-		current_index++;
+	return std::make_pair(line, col);
+}
+
+std::string LineTable::get_line(PositionIndex line_number) const {
+	assert(line_number >= 1 && line_number <= (PositionIndex)this->line_starts.size());
+	PositionIndex begin_index = this->line_starts[line_number - 1];
+	PositionIndex end_index = this->file_data.find('\n', begin_index);
+
+	if (end_index == (PositionIndex)std::string::npos) {
+		end_index = this->file_data.size();
 	}
 
-	return std::make_pair(line, col);
+	// tabs will screw pretty printing up (since tab with is unknown)
+	std::string raw_str = this->file_data.substr(begin_index, end_index - begin_index);
+	std::replace(raw_str.begin(), raw_str.end(), '\t', ' ');
+	return raw_str;
+}
+
+SourceRange SourceRange::extend_end(SourceRange extended) const {
+	assert(this->end.offset <= extended.start.offset);
+	return SourceRange(this->start, extended.end);
 }
 
-PositionRange& PositionRange::operator=(const PositionRange& other) {
-	this->file_data = other.file_data;
-	this->start = other.start;
-	this->end = other.end;
+bool SourceRange::operator==(const SourceRange& other) const {
+	return this->start.offset == other.start.offset
+		&& this->end.offset == other.end.offset;
+}
+
+// -----------------------------------------------------
+// SOURCE MANAGER
+
+// offset 0 is the invalid location
+SourceManager::SourceManager() : next_base(1) {}
+
+FileID SourceManager::add_file(const std::string& path, std::string file_data) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	std::unique_ptr<File> file(new File());
+	file->path = path;
+	file->data = std::move(file_data);
+	file->base = this->next_base;
 
-	return *this;
+	// +1 so that the end of file location does not alias the next file
+	assert(this->next_base + (uint64_t)file->data.size() + 1 <= UINT32_MAX
+		   && "ran out of source locations");
+	this->next_base += file->data.size() + 1;
+
+	this->files.push_back(std::move(file));
+	return this->files.size() - 1;
 }
 
-PositionRange PositionRange::extend_end(PositionRange extended) {
-	assert(this->end <= extended.start);
-	return PositionRange(this->start, extended.end, this->file_data);
+const SourceManager::File& SourceManager::get_file(FileID file) const {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	assert(file < this->files.size());
+	return *this->files[file];
 }
 
-std::string get_line(std::string& file_data, int line_number) {
-	int begin_index = 0;
-	int current_line_number = 1;
+const std::string& SourceManager::get_file_data(FileID file) const {
+	return this->get_file(file).data;
+}
 
-	while (true) {
-		if (line_number == current_line_number) {
-			break;
-		}
+const std::string& SourceManager::get_file_path(FileID file) const {
+	return this->get_file(file).path;
+}
 
-		if (file_data[begin_index] == '\n') {
-			current_line_number++;
-		}
+SourceRange SourceManager::get_file_range(FileID file) const {
+	const File& f = this->get_file(file);
+	return SourceRange(SourceLoc(f.base), SourceLoc(f.base + f.data.size()));
+}
 
-		begin_index++;
-	}
+FileID SourceManager::get_file_id(SourceLoc loc) const {
+	assert(loc.is_valid());
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	// the last file starting at or before loc
+	auto it = std::upper_bound(this->files.begin(), this->files.end(), loc.offset,
+							   [](uint32_t offset, const std::unique_ptr<File>& file) {
+		return offset < file->base;
+	});
+	assert(it != this->files.begin());
+	return (it - this->files.begin()) - 1;
+}
 
-	int end_index = begin_index;
+PositionIndex SourceManager::get_file_offset(SourceLoc loc) const {
+	return loc.offset - this->get_file(this->get_file_id(loc)).base;
+}
 
-	while (file_data[end_index] != '\n') {
-		end_index++;
-	}
+const LineTable& SourceManager::get_line_table(FileID file) const {
+	const File& f = this->get_file(file);
+	std::lock_guard<std::mutex> lock(this->mutex);
 
-	// tabs will screw pretty printing up (since tab with is unknown)
-	std::string raw_str = file_data.substr(begin_index, end_index - begin_index);
-	std::replace(raw_str.begin(), raw_str.end(), '\t', ' ');
-	return raw_str;
+	if (!f.line_table) {
+		f.line_table.reset(new LineTable(f.data));
+	}
+	return *f.line_table;
 }
 
-std::ostream& operator<<(std::ostream& out, const PositionRange& range) {
-	auto start_line_col = index_to_line_col(range.start, range.file_data);
-	auto end_line_col = index_to_line_col(range.end, range.file_data);
+void print_source_range(std::ostream& out,
+						const SourceRange& range,
+						const SourceManager& source_manager) {
+	FileID file = source_manager.get_file_id(range.start);
+	const std::string& file_data = source_manager.get_file_data(file);
+	const LineTable& line_table = source_manager.get_line_table(file);
+
+	PositionIndex start = source_manager.get_file_offset(range.start);
+	PositionIndex end = source_manager.get_file_offset(range.end);
 
-	out << "\nposition: ";
+	auto start_line_col = line_table.get_line_col(start);
+	auto end_line_col = line_table.get_line_col(end);
+
+	out << "\nposition: " << source_manager.get_file_path(file) << " ";
 	out << "(" << start_line_col.first << ":" << start_line_col.second << ")";
 	out << " to ";
 	out << "(" << end_line_col.first << ":" << end_line_col.second << ")";
@@ -89,9 +143,7 @@ std::ostream& operator<<(std::ostream& out, const PositionRange& range) {
 	/*
 	   if (start_line_col.first + 1 == end_line_col.first && end_line_col.second
 	   == 0) {
-	   PositionRange new_end_range = range;
-	   new_end_range.end -= 1;
-	   end_line_col  = index_to_line_col(new_end_range.end, range.file_data);
+	   end_line_col  = line_table.get_line_col(end - 1);
 	   };
 	   */
 
@@ -99,7 +151,7 @@ std::ostream& operator<<(std::ostream& out, const PositionRange& range) {
 	// right
 	// position
 	if (start_line_col.first == end_line_col.first) {
-		out << get_line(range.file_data, start_line_col.first) << "\n";
+		out << line_table.get_line(start_line_col.first) << "\n";
 
 		int current_col = 1;
 
@@ -116,24 +168,11 @@ std::ostream& operator<<(std::ostream& out, const PositionRange& range) {
 	}
 	else {
 
-		for (int i = range.start; i <= range.end; ++i) {
-			if (range.file_data[i] == '\n') {
-				out << range.file_data[i];
-			}
-			else {
-				out << range.file_data[i];
-			}
+		for (PositionIndex i = start; i <= end && i < (PositionIndex)file_data.size(); ++i) {
+			out << file_data[i];
 		}
 
 		// out << "\n";
 		// out << range.file_data.substr(range.start, range.end - range.start);
 	}
-
-
-	return out;
-}
-
-bool PositionRange::operator==(const PositionRange& other) {
-	return this->start == other.start
-		&& this->end == other.end;
 }
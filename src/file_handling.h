@@ -1,26 +1,105 @@
 #pragma once
 #include <ostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <utility>
 #include <stdint.h>
 #include <assert.h>
 
 typedef int64_t PositionIndex;
 
-struct PositionRange {
-	PositionIndex start;
-	PositionIndex end;
-	std::string&  file_data;
+// an offset into the SourceManager's offset space. every file owns a
+// contiguous slice of that space, so the offset alone tells us which file
+// we are in. offset 0 is never handed out, and means "no location".
+struct SourceLoc {
+	uint32_t offset;
 
-	PositionRange(PositionIndex start, PositionIndex end,
-				  std::string& file_data) : 
-				  file_data(file_data), start(start), end(end) {
-		assert(start <= end);
+	SourceLoc() : offset(0) {}
+	explicit SourceLoc(uint32_t offset) : offset(offset) {}
+
+	bool is_valid() const {
+		return this->offset != 0;
+	}
+
+	SourceLoc get_loc_with_offset(uint32_t delta) const {
+		return SourceLoc(this->offset + delta);
+	}
+};
+
+struct SourceRange {
+	SourceLoc start;
+	SourceLoc end;
+
+	SourceRange() {}
+
+	SourceRange(SourceLoc start, SourceLoc end) : start(start), end(end) {
+		assert(start.offset <= end.offset);
+	}
+
+	bool is_valid() const {
+		return this->start.is_valid();
 	}
 
-	PositionRange extend_end(PositionRange extended);
-	PositionRange& operator=(const PositionRange& other);
+	SourceRange extend_end(SourceRange extended) const;
+
+	bool operator==(const SourceRange& other) const;
+};
+
+// start index of every line in a file, so that many positions can be turned
+// into line:col without scanning the file for each of them.
+struct LineTable {
+	std::vector<PositionIndex> line_starts;
+	const std::string& file_data;
+
+	LineTable(const std::string& file_data);
+
+	// 1 based line, 0 based column
+	std::pair<PositionIndex, PositionIndex> get_line_col(PositionIndex idx) const;
+	std::string get_line(PositionIndex line_number) const;
+};
+
+typedef uint32_t FileID;
+
+// owns the contents of every file in the compilation, and turns SourceLocs
+// back into file:line:col. the line tables are only built when a location
+// is actually printed. safe to use from multiple threads.
+class SourceManager {
+public:
+
+	SourceManager();
+
+	FileID add_file(const std::string& path, std::string file_data);
+
+	const std::string& get_file_data(FileID file) const;
+	const std::string& get_file_path(FileID file) const;
+
+	// the range covering the whole file, end being one past its last char
+	SourceRange get_file_range(FileID file) const;
+
+	FileID get_file_id(SourceLoc loc) const;
+	PositionIndex get_file_offset(SourceLoc loc) const;
+
+	const LineTable& get_line_table(FileID file) const;
+
+private:
+
+	struct File {
+		std::string path;
+		std::string data;
+		uint32_t base;
+		mutable std::unique_ptr<LineTable> line_table;
+	};
+
+	// pointers, so that references into a file stay valid as files are added
+	std::vector<std::unique_ptr<File> > files;
+	uint32_t next_base;
+	mutable std::mutex mutex;
 
-	bool operator==(const PositionRange& other);
+	const File& get_file(FileID file) const;
 };
 
-std::ostream& operator<<(std::ostream &out,
-						 const PositionRange&range);
+void print_source_range(std::ostream& out,
+						const SourceRange& range,
+						const SourceManager& source_manager);
@@ -0,0 +1,1882 @@
+#include "intermediate.h"
+#include "pretty_print.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+// -----------------------------------------------------
+// FUNCTIONS
+
+IRValue IRFunction::create_instruction(uint32_t block, IROp op, IRType type, const std::vector<uint32_t>& operands) {
+	IRInstruction instruction;
+	instruction.op = op;
+	instruction.type = type;
+	instruction.block = block;
+	instruction.first_operand = this->operands.size();
+	instruction.num_operands = operands.size();
+	instruction.constant.i = 0;
+
+	this->operands.insert(this->operands.end(), operands.begin(), operands.end());
+	this->instructions.push_back(instruction);
+	return this->instructions.size() - 1;
+}
+
+IRValue IRFunction::add_instruction(uint32_t block, IROp op, IRType type, const std::vector<uint32_t>& operands) {
+	IRValue value = this->create_instruction(block, op, type, operands);
+	this->blocks[block].instructions.push_back(value);
+	return value;
+}
+
+// the old operands stay in the array, unused
+void IRFunction::set_operands(IRValue value, const std::vector<uint32_t>& operands) {
+	IRInstruction &instruction = this->instructions[value];
+
+	if (operands.size() <= instruction.num_operands) {
+		std::copy(operands.begin(), operands.end(), this->get_operands(value));
+	}
+	else {
+		instruction.first_operand = this->operands.size();
+		this->operands.insert(this->operands.end(), operands.begin(), operands.end());
+	}
+	instruction.num_operands = operands.size();
+}
+
+std::vector<uint32_t> IRFunction::get_successors(uint32_t block) const {
+	const std::vector<IRValue> &instructions = this->blocks[block].instructions;
+
+	if (instructions.empty()) {
+		return {};
+	}
+
+	IRValue terminator = instructions.back();
+	const uint32_t *operands = this->get_operands(terminator);
+
+	switch (this->instructions[terminator].op) {
+	case IROp::Br:
+		return { operands[0] };
+	case IROp::CondBr:
+		return { operands[1], operands[2] };
+	default:
+		return {};
+	}
+}
+
+std::vector<std::vector<uint32_t> > IRFunction::get_predecessors() const {
+	std::vector<std::vector<uint32_t> > predecessors(this->blocks.size());
+
+	for (uint32_t block = 0; block < this->blocks.size(); ++block) {
+		for (uint32_t successor : this->get_successors(block)) {
+			predecessors[successor].push_back(block);
+		}
+	}
+	return predecessors;
+}
+
+int IRModule::find_function(const std::string& name) const {
+	for (unsigned i = 0; i < this->functions.size(); ++i) {
+		if (this->functions[i].name == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool is_terminator(IROp op) {
+	return op == IROp::Br || op == IROp::CondBr || op == IROp::Ret;
+}
+
+// no side effects, and the value only depends on the operands
+static bool is_pure(IROp op) {
+	switch (op) {
+	case IROp::Const:
+	case IROp::Arg:
+	case IROp::Copy:
+	case IROp::Add:
+	case IROp::Sub:
+	case IROp::Mul:
+	case IROp::Div:
+	case IROp::Neg:
+	case IROp::Not:
+	case IROp::CmpL:
+	case IROp::CmpG:
+	case IROp::CmpLEQ:
+	case IROp::CmpGEQ:
+	case IROp::CmpEQ:
+	case IROp::CmpNEQ:
+	case IROp::IntToFloat:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static unsigned count_instructions(const IRFunction& fn) {
+	unsigned count = 0;
+	for (auto& block : fn.blocks) {
+		count += block.instructions.size();
+	}
+	return count;
+}
+
+// passes may turn a phi into something else, which has to move behind the
+// phis that are left
+static void move_phis_first(IRFunction& fn) {
+	for (auto& block : fn.blocks) {
+		std::stable_partition(block.instructions.begin(), block.instructions.end(), [&fn](IRValue value) {
+			return fn.instructions[value].op == IROp::Phi;
+		});
+	}
+}
+
+static void remove_instruction(IRFunction& fn, IRValue value) {
+	fn.instructions[value].op = IROp::Nop;
+	fn.instructions[value].num_operands = 0;
+}
+
+// drops the (block, value) pairs of the phis in block whose block is not
+// one of its predecessors anymore
+static void remove_stale_phi_operands(IRFunction& fn, uint32_t block, const std::vector<uint32_t>& predecessors) {
+	for (IRValue value : fn.blocks[block].instructions) {
+		if (fn.instructions[value].op != IROp::Phi) {
+			break;
+		}
+
+		const uint32_t *operands = fn.get_operands(value);
+		std::vector<uint32_t> kept;
+
+		for (uint32_t i = 0; i < fn.instructions[value].num_operands; i += 2) {
+			if (std::find(predecessors.begin(), predecessors.end(), operands[i]) != predecessors.end()) {
+				kept.push_back(operands[i]);
+				kept.push_back(operands[i + 1]);
+			}
+		}
+		fn.set_operands(value, kept);
+	}
+}
+
+// removes the blocks that can not be reached from the entry, and renumbers
+// the rest. returns the number of instructions removed.
+static unsigned remove_unreachable_blocks(IRFunction& fn) {
+	std::vector<bool> reachable(fn.blocks.size(), false);
+	std::vector<uint32_t> worklist = { 0 };
+	reachable[0] = true;
+
+	while (!worklist.empty()) {
+		uint32_t block = worklist.back();
+		worklist.pop_back();
+
+		for (uint32_t successor : fn.get_successors(block)) {
+			if (!reachable[successor]) {
+				reachable[successor] = true;
+				worklist.push_back(successor);
+			}
+		}
+	}
+
+	std::vector<uint32_t> new_index(fn.blocks.size(), UINT32_MAX);
+	std::vector<IRBlock> blocks;
+	unsigned removed = 0;
+
+	for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+		if (reachable[block]) {
+			new_index[block] = blocks.size();
+			blocks.push_back(fn.blocks[block]);
+			continue;
+		}
+
+		for (IRValue value : fn.blocks[block].instructions) {
+			remove_instruction(fn, value);
+			removed++;
+		}
+	}
+
+	if (blocks.size() == fn.blocks.size()) {
+		return 0;
+	}
+
+	fn.blocks = blocks;
+
+	for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+		for (IRValue value : fn.blocks[block].instructions) {
+			IRInstruction &instruction = fn.instructions[value];
+			uint32_t *operands = fn.get_operands(value);
+			instruction.block = block;
+
+			if (instruction.op == IROp::Br) {
+				operands[0] = new_index[operands[0]];
+			}
+			else if (instruction.op == IROp::CondBr) {
+				operands[1] = new_index[operands[1]];
+				operands[2] = new_index[operands[2]];
+			}
+			else if (instruction.op == IROp::Phi) {
+				// pairs from removed blocks are dropped, the rest renumbered
+				std::vector<uint32_t> kept;
+
+				for (uint32_t i = 0; i < instruction.num_operands; i += 2) {
+					if (new_index[operands[i]] != UINT32_MAX) {
+						kept.push_back(new_index[operands[i]]);
+						kept.push_back(operands[i + 1]);
+					}
+				}
+				fn.set_operands(value, kept);
+			}
+		}
+	}
+
+	return removed;
+}
+
+// appends a block to its only predecessor, if the predecessor always
+// branches to it. the phis of the block merge one value each, so they
+// become copies. returns the number of blocks merged away, which are left
+// empty, and unreachable.
+static unsigned merge_straight_line_blocks(IRFunction& fn) {
+	std::vector<std::vector<uint32_t> > predecessors = fn.get_predecessors();
+	unsigned merged = 0;
+
+	for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+		while (!fn.blocks[block].instructions.empty()) {
+			IRValue terminator = fn.blocks[block].instructions.back();
+
+			if (fn.instructions[terminator].op != IROp::Br) {
+				break;
+			}
+
+			uint32_t successor = fn.get_operands(terminator)[0];
+			if (successor == block || successor == 0 || predecessors[successor].size() != 1) {
+				break;
+			}
+
+			fn.blocks[block].instructions.pop_back();
+			remove_instruction(fn, terminator);
+
+			for (IRValue value : fn.blocks[successor].instructions) {
+				IRInstruction &instruction = fn.instructions[value];
+
+				if (instruction.op == IROp::Phi) {
+					instruction.op = IROp::Copy;
+					fn.set_operands(value, { fn.get_operands(value)[1] });
+				}
+
+				instruction.block = block;
+				fn.blocks[block].instructions.push_back(value);
+			}
+			fn.blocks[successor].instructions.clear();
+
+			// the successors of the merged block are now reached from block
+			for (uint32_t next : fn.get_successors(block)) {
+				std::replace(predecessors[next].begin(), predecessors[next].end(), successor, block);
+
+				for (IRValue value : fn.blocks[next].instructions) {
+					if (fn.instructions[value].op != IROp::Phi) {
+						break;
+					}
+
+					uint32_t *operands = fn.get_operands(value);
+					for (uint32_t i = 0; i < fn.instructions[value].num_operands; i += 2) {
+						if (operands[i] == successor) {
+							operands[i] = block;
+						}
+					}
+				}
+			}
+
+			predecessors[successor].clear();
+			merged++;
+		}
+	}
+
+	return merged;
+}
+
+// -----------------------------------------------------
+// PRINTING
+
+std::ostream& operator<<(std::ostream& out, IRType type) {
+	switch (type) {
+	case IRType::Void: return out << "void";
+	case IRType::I32: return out << "i32";
+	case IRType::F32: return out << "f32";
+	case IRType::Bool: return out << "bool";
+	}
+	return out;
+}
+
+std::ostream& operator<<(std::ostream& out, IROp op) {
+	static const char *const names[] = {
+		"const", "arg", "copy", "phi", "add", "sub", "mul", "div", "neg", "not",
+		"cmplt", "cmpgt", "cmple", "cmpge", "cmpeq", "cmpne", "itof", "call",
+		"br", "condbr", "ret", "nop",
+	};
+	return out << names[(int)op];
+}
+
+static void print_constant(std::ostream& out, const IRInstruction& instruction) {
+	switch (instruction.type) {
+	case IRType::I32:
+		out << instruction.constant.i;
+		break;
+	case IRType::F32:
+		out << std::setprecision(9) << instruction.constant.f;
+		break;
+	case IRType::Bool:
+		out << (instruction.constant.b ? "true" : "false");
+		break;
+	case IRType::Void:
+		break;
+	}
+}
+
+static void print_function_type(std::ostream& out, const IRFunction& fn) {
+	out << fn.name << "(";
+	for (unsigned i = 0; i < fn.arg_types.size(); ++i) {
+		out << (i ? ", " : "") << fn.arg_types[i];
+	}
+	out << ") -> " << fn.return_type;
+}
+
+static void print_instruction(std::ostream& out, const IRFunction& fn, IRValue value, const IRModule *module) {
+	const IRInstruction &instruction = fn.instructions[value];
+	const uint32_t *operands = fn.get_operands(value);
+
+	if (!is_terminator(instruction.op) && instruction.type != IRType::Void) {
+		out << "%" << value << " = ";
+	}
+
+	out << instruction.op;
+	if (!is_terminator(instruction.op)) {
+		out << " " << instruction.type;
+	}
+
+	switch (instruction.op) {
+	case IROp::Const:
+		out << " ";
+		print_constant(out, instruction);
+		return;
+
+	case IROp::Arg:
+		out << " " << instruction.constant.index;
+		return;
+
+	case IROp::Phi:
+		for (uint32_t i = 0; i < instruction.num_operands; i += 2) {
+			out << (i ? ", " : " ") << "[b" << operands[i] << ": %" << operands[i + 1] << "]";
+		}
+		return;
+
+	case IROp::Call:
+		out << " ";
+		if (module) {
+			out << module->functions[instruction.constant.index].name;
+		}
+		else {
+			out << "@" << instruction.constant.index;
+		}
+		out << "(";
+		for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+			out << (i ? ", " : "") << "%" << operands[i];
+		}
+		out << ")";
+		return;
+
+	case IROp::Br:
+		out << " b" << operands[0];
+		return;
+
+	case IROp::CondBr:
+		out << " %" << operands[0] << ", b" << operands[1] << ", b" << operands[2];
+		return;
+
+	default:
+		for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+			out << (i ? ", " : " ") << "%" << operands[i];
+		}
+		return;
+	}
+}
+
+static void print_function(std::ostream& out, const IRFunction& fn, const IRModule *module) {
+	if (fn.is_declaration()) {
+		out << "declare fn ";
+		print_function_type(out, fn);
+		out << (fn.is_builtin ? " builtin" : "") << "\n";
+		return;
+	}
+
+	out << (fn.is_exported ? "export fn " : "fn ");
+	print_function_type(out, fn);
+	out << " {\n";
+
+	for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+		out << "b" << block << ":\n";
+
+		for (IRValue value : fn.blocks[block].instructions) {
+			out << "    ";
+			print_instruction(out, fn, value, module);
+			out << "\n";
+		}
+	}
+	out << "}\n";
+}
+
+std::ostream& operator<<(std::ostream& out, const IRFunction& fn) {
+	print_function(out, fn, nullptr);
+	return out;
+}
+
+std::ostream& operator<<(std::ostream& out, const IRModule& module) {
+	for (auto& fn : module.functions) {
+		print_function(out, fn, &module);
+	}
+	return out;
+}
+
+// -----------------------------------------------------
+// CONSTRUCTION
+
+static IRType get_ir_type(const TSType *type) {
+	if (type == i32_type) { return IRType::I32; }
+	if (type == f32_type) { return IRType::F32; }
+	if (type == bool_type) { return IRType::Bool; }
+	if (type == void_type) { return IRType::Void; }
+
+	std::stringstream error;
+	error << "unable to lower type to the IR: " << *type;
+	throw std::runtime_error(error.str());
+}
+
+static const TSVariable* get_variable(ASTLiteral &literal) {
+	assert(literal.token.type == TokenType::Identifier);
+	return literal.ts_data->scope->get_variable(*literal.token.value.ptr_s);
+}
+
+// every variable that is the target of a "=" somewhere in a tree
+struct IRAssignedVariableCollector : public IASTGenericVisitor {
+	std::set<const TSVariable *> variables;
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::InfixExpr) {
+			ASTInfixExpr &infix = dynamic_cast<ASTInfixExpr&>(ast);
+
+			if (infix.op.type == TokenType::Equals && infix.left->type == ASTType::Literal) {
+				this->variables.insert(get_variable(dynamic_cast<ASTLiteral&>(*infix.left)));
+			}
+		}
+		ast.traverse_inner(*this);
+	}
+};
+
+// the math builtins a tree calls
+struct IRBuiltinCollector : public IASTGenericVisitor {
+	std::map<std::string, const TSType *> builtins;
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::FunctionCall) {
+			ASTFunctionCall &fn_call = dynamic_cast<ASTFunctionCall&>(ast);
+			const std::string &name = *dynamic_cast<ASTLiteral&>(*fn_call.name).token.value.ptr_s;
+			const TSVariable *fn = fn_call.ts_data->scope->get_variable(name);
+
+			if (!fn->decl_pos.is_valid()) {
+				this->builtins[name] = fn->type;
+			}
+		}
+		ast.traverse_inner(*this);
+	}
+};
+
+// control flow in achilles is structured, so SSA is built directly: the
+// current value of every variable is tracked while lowering, and where
+// control flow joins, a phi is created for every variable that has
+// different values on the way in. loops get a phi in their header for
+// every variable that is assigned in them.
+class IRGenerator {
+public:
+
+	IRGenerator(IRModule& module) : module(module), fn(nullptr), block(0) {}
+
+	void generate_function(ASTFunctionDefinition& fn_defn, IRFunction& fn) {
+		this->fn = &fn;
+		this->variables.clear();
+		this->block = this->create_block();
+
+		for (unsigned i = 0; i < fn_defn.args.size(); ++i) {
+			ASTLiteral &arg = dynamic_cast<ASTLiteral&>(*fn_defn.args[i].first);
+			IRValue value = this->emit(IROp::Arg, fn.arg_types[i]);
+			fn.instructions[value].constant.index = i;
+			this->variables[get_variable(arg)] = value;
+		}
+
+		IRValue value = this->get_value(*fn_defn.body);
+
+		if (fn.return_type == IRType::Void || value == ir_no_value) {
+			this->emit(IROp::Ret, IRType::Void);
+		}
+		else {
+			this->emit(IROp::Ret, IRType::Void, { value });
+		}
+	}
+
+private:
+
+	typedef std::map<const TSVariable *, IRValue> Variables;
+
+	IRModule &module;
+	IRFunction *fn;
+	uint32_t block;
+	Variables variables;
+
+	uint32_t create_block() {
+		this->fn->blocks.emplace_back();
+		return this->fn->blocks.size() - 1;
+	}
+
+	IRValue emit(IROp op, IRType type, const std::vector<uint32_t>& operands = {}) {
+		return this->fn->add_instruction(this->block, op, type, operands);
+	}
+
+	IRValue emit_const_i32(int32_t i) {
+		IRValue value = this->emit(IROp::Const, IRType::I32);
+		this->fn->instructions[value].constant.i = i;
+		return value;
+	}
+
+	IRValue emit_const_bool(bool b) {
+		IRValue value = this->emit(IROp::Const, IRType::Bool);
+		this->fn->instructions[value].constant.b = b;
+		return value;
+	}
+
+	// the variables after a join of the incoming (block, variables) edges.
+	// block has to be empty, its phis come first. variables that only
+	// exist on some of the edges went out of scope.
+	Variables merge_variables(uint32_t block, const std::vector<std::pair<uint32_t, Variables> >& incoming) {
+		Variables merged;
+
+		for (auto& variable : incoming[0].second) {
+			std::vector<uint32_t> operands;
+			bool is_same = true;
+			bool is_defined = true;
+
+			for (auto& edge : incoming) {
+				auto it = edge.second.find(variable.first);
+
+				if (it == edge.second.end()) {
+					is_defined = false;
+					break;
+				}
+
+				is_same &= it->second == variable.second;
+				operands.push_back(edge.first);
+				operands.push_back(it->second);
+			}
+
+			if (!is_defined) {
+				continue;
+			}
+
+			if (is_same) {
+				merged[variable.first] = variable.second;
+			}
+			else {
+				IRType type = this->fn->instructions[variable.second].type;
+				merged[variable.first] = this->fn->add_instruction(block, IROp::Phi, type, operands);
+			}
+		}
+		return merged;
+	}
+
+	// the value of ast, converted if the type system asked for it.
+	// ir_no_value for void expressions.
+	IRValue get_value(IAST& ast) {
+		IRValue value = this->get_unconverted_value(ast);
+
+		if (!ast.ts_data || !ast.ts_data->implicit_conversion) {
+			return value;
+		}
+
+		assert(ast.ts_data->type == i32_type && ast.ts_data->implicit_conversion == f32_type);
+		return this->emit(IROp::IntToFloat, IRType::F32, { value });
+	}
+
+	IRValue get_unconverted_value(IAST& ast) {
+		switch (ast.type) {
+		case ASTType::Literal:
+			return this->get_value_for_literal(dynamic_cast<ASTLiteral&>(ast));
+
+		case ASTType::InfixExpr:
+			return this->get_value_for_infix_expr(dynamic_cast<ASTInfixExpr&>(ast));
+
+		case ASTType::PrefixExpr:
+			return this->get_value_for_prefix_expr(dynamic_cast<ASTPrefixExpr&>(ast));
+
+		case ASTType::FunctionCall:
+			return this->get_value_for_func_call(dynamic_cast<ASTFunctionCall&>(ast));
+
+		case ASTType::Statement:
+			return this->get_value(*dynamic_cast<ASTStatement&>(ast).inner);
+
+		case ASTType::Block: {
+			ASTBlock &block = dynamic_cast<ASTBlock&>(ast);
+			IRValue value = ir_no_value;
+
+			for (auto stmt : block.statements) {
+				value = this->get_value(*stmt);
+			}
+			if (block.return_expr) {
+				value = this->get_value(*block.return_expr);
+			}
+			return value;
+		}
+
+		// a let without a value starts out as 0, like in the other backends
+		case ASTType::VariableDefinition: {
+			ASTVariableDefinition &variable_defn = dynamic_cast<ASTVariableDefinition&>(ast);
+			const TSVariable *variable = get_variable(dynamic_cast<ASTLiteral&>(*variable_defn.name));
+			IRValue value = this->emit(IROp::Const, get_ir_type(variable->type));
+			this->variables[variable] = value;
+			return value;
+		}
+
+		case ASTType::ForLoop:
+			return this->get_value_for_for_loop(dynamic_cast<ASTForLoop&>(ast));
+
+		case ASTType::If:
+			return this->get_value_for_if(dynamic_cast<ASTIf&>(ast));
+
+		default:
+			std::stringstream error;
+			error << "unknown ast type to lower to the IR:\n";
+			pretty_print_to_stream(ast, error);
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	IRValue get_value_for_literal(ASTLiteral& literal) {
+		switch (literal.token.type) {
+		case TokenType::LiteralInt:
+			return this->emit_const_i32((int32_t)*literal.token.value.ptr_i);
+
+		case TokenType::LiteralFloat: {
+			IRValue value = this->emit(IROp::Const, IRType::F32);
+			this->fn->instructions[value].constant.f = *literal.token.value.ptr_f;
+			return value;
+		}
+
+		case TokenType::Identifier: {
+			auto it = this->variables.find(get_variable(literal));
+			assert(it != this->variables.end());
+			return it->second;
+		}
+
+		default:
+			throw std::runtime_error("unable to lower literal to the IR: " + pretty_print(literal));
+		}
+	}
+
+	IRValue get_value_for_infix_expr(ASTInfixExpr& expr) {
+		if (expr.op.type == TokenType::Equals) {
+			IRValue value = this->get_value(*expr.right);
+			IAST *target = expr.left.get();
+
+			if (target->type == ASTType::VariableDefinition) {
+				target = dynamic_cast<ASTVariableDefinition&>(*target).name.get();
+			}
+
+			if (target->type != ASTType::Literal ||
+				dynamic_cast<ASTLiteral&>(*target).token.type != TokenType::Identifier) {
+				throw std::runtime_error("can only assign to variables:\n" + pretty_print(*target));
+			}
+
+			this->variables[get_variable(dynamic_cast<ASTLiteral&>(*target))] = value;
+			return value;
+		}
+
+		if (expr.op.type == TokenType::CondAnd || expr.op.type == TokenType::CondOr) {
+			return this->get_value_for_logical_expr(expr);
+		}
+
+		IRValue left = this->get_value(*expr.left);
+		IRValue right = this->get_value(*expr.right);
+		IROp op;
+
+		switch (expr.op.type) {
+		case TokenType::Plus: op = IROp::Add; break;
+		case TokenType::Minus: op = IROp::Sub; break;
+		case TokenType::Multiply: op = IROp::Mul; break;
+		case TokenType::Divide: op = IROp::Div; break;
+		case TokenType::CondL: op = IROp::CmpL; break;
+		case TokenType::CondG: op = IROp::CmpG; break;
+		case TokenType::CondLEQ: op = IROp::CmpLEQ; break;
+		case TokenType::CondGEQ: op = IROp::CmpGEQ; break;
+		case TokenType::CondEQ: op = IROp::CmpEQ; break;
+		case TokenType::CondNEQ: op = IROp::CmpNEQ; break;
+		default:
+			throw std::runtime_error("unknown infix expression:\n" + pretty_print(expr));
+		}
+
+		return this->emit(op, get_ir_type(expr.ts_data->type), { left, right });
+	}
+
+	//        condbr left, rhs, end (or end, rhs for ||)
+	//   rhs: ...
+	//        br end
+	//   end: phi [left block: false / true], [rhs: right]
+	IRValue get_value_for_logical_expr(ASTInfixExpr& expr) {
+		bool is_and = expr.op.type == TokenType::CondAnd;
+
+		IRValue left = this->get_value(*expr.left);
+		uint32_t left_end = this->block;
+		Variables left_variables = this->variables;
+
+		// what the expression is if the right side is skipped
+		IRValue short_cut = this->emit_const_bool(!is_and);
+
+		uint32_t right_block = this->create_block();
+		uint32_t end_block = this->create_block();
+		this->emit(IROp::CondBr, IRType::Void, { left, is_and ? right_block : end_block,
+												 is_and ? end_block : right_block });
+
+		this->block = right_block;
+		IRValue right = this->get_value(*expr.right);
+		uint32_t right_end = this->block;
+		this->emit(IROp::Br, IRType::Void, { end_block });
+
+		this->block = end_block;
+		this->variables = this->merge_variables(end_block, { { left_end, left_variables },
+															 { right_end, this->variables } });
+		return this->emit(IROp::Phi, IRType::Bool, { left_end, short_cut, right_end, right });
+	}
+
+	IRValue get_value_for_prefix_expr(ASTPrefixExpr& prefix_expr) {
+		IRValue operand = this->get_value(*prefix_expr.expr);
+
+		switch (prefix_expr.op.type) {
+		case TokenType::Minus:
+			return this->emit(IROp::Neg, get_ir_type(prefix_expr.ts_data->type), { operand });
+		case TokenType::CondNot:
+			return this->emit(IROp::Not, IRType::Bool, { operand });
+		default:
+			throw std::runtime_error("unknown prefix expression:\n" + pretty_print(prefix_expr));
+		}
+	}
+
+	IRValue get_value_for_func_call(ASTFunctionCall& func_call) {
+		const std::string &name = *dynamic_cast<ASTLiteral&>(*func_call.name).token.value.ptr_s;
+		int callee = this->module.find_function(name);
+		assert(callee >= 0 && "every function is declared before lowering bodies");
+
+		std::vector<uint32_t> args;
+		for (auto& param : func_call.params) {
+			args.push_back(this->get_value(*param));
+		}
+
+		IRValue value = this->emit(IROp::Call, this->module.functions[callee].return_type, args);
+		this->fn->instructions[value].constant.index = callee;
+		return this->module.functions[callee].return_type == IRType::Void ? ir_no_value : value;
+	}
+
+	//         br header
+	// header: phi for i and every variable assigned in the loop
+	//         condbr (i < end), body, exit
+	//   body: ...
+	//         br latch
+	//  latch: i = i + step
+	//         br header
+	//   exit:
+	IRValue get_value_for_for_loop(ASTForLoop& for_loop) {
+		IRValue start = this->get_value(*for_loop.start);
+		IRValue end = this->get_value(*for_loop.end);
+		IRValue step = for_loop.step ? this->get_value(*for_loop.step) : this->emit_const_i32(1);
+
+		uint32_t preheader = this->block;
+		uint32_t header = this->create_block();
+		uint32_t body = this->create_block();
+		uint32_t latch = this->create_block();
+		uint32_t exit = this->create_block();
+		this->emit(IROp::Br, IRType::Void, { header });
+
+		IRAssignedVariableCollector assigned;
+		for_loop.body->dispatch(assigned);
+
+		// the latch values are filled in once the body is lowered
+		const TSVariable *induction_var = get_variable(dynamic_cast<ASTLiteral&>(*for_loop.induction_var));
+		std::map<const TSVariable *, IRValue> phis;
+
+		this->block = header;
+		phis[induction_var] = this->emit(IROp::Phi, IRType::I32, { preheader, start, latch, start });
+
+		for (auto& variable : this->variables) {
+			if (assigned.variables.count(variable.first) && variable.first != induction_var) {
+				IRType type = this->fn->instructions[variable.second].type;
+				phis[variable.first] = this->emit(IROp::Phi, type, { preheader, variable.second, latch, variable.second });
+			}
+		}
+
+		for (auto& phi : phis) {
+			this->variables[phi.first] = phi.second;
+		}
+		Variables header_variables = this->variables;
+
+		IRValue in_range = this->emit(IROp::CmpL, IRType::Bool, { phis[induction_var], end });
+		this->emit(IROp::CondBr, IRType::Void, { in_range, body, exit });
+
+		this->block = body;
+		this->get_value(*for_loop.body);
+		this->emit(IROp::Br, IRType::Void, { latch });
+
+		this->block = latch;
+		this->variables[induction_var] = this->emit(IROp::Add, IRType::I32, { this->variables[induction_var], step });
+		this->emit(IROp::Br, IRType::Void, { header });
+
+		for (auto& phi : phis) {
+			this->fn->get_operands(phi.second)[3] = this->variables[phi.first];
+		}
+
+		// the induction variable is only in scope inside the loop
+		header_variables.erase(induction_var);
+		this->variables = header_variables;
+		this->block = exit;
+		return ir_no_value;
+	}
+
+	//         condbr (condition), then, else (or end)
+	//   then: ...
+	//         br end
+	//   else: ...
+	//         br end
+	//    end: phi [then: then value], [else: else value]
+	IRValue get_value_for_if(ASTIf& if_expr) {
+		IRValue condition = this->get_value(*if_expr.condition);
+		uint32_t condition_end = this->block;
+		Variables before = this->variables;
+
+		uint32_t then_block = this->create_block();
+		uint32_t else_block = if_expr.else_branch ? this->create_block() : 0;
+		uint32_t end_block = this->create_block();
+		this->emit(IROp::CondBr, IRType::Void, { condition, then_block, if_expr.else_branch ? else_block : end_block });
+
+		this->block = then_block;
+		IRValue then_value = this->get_value(*if_expr.then_block);
+		uint32_t then_end = this->block;
+		this->emit(IROp::Br, IRType::Void, { end_block });
+		Variables then_variables = this->variables;
+
+		IRValue else_value = ir_no_value;
+		uint32_t else_end = condition_end;
+		Variables else_variables = before;
+
+		if (if_expr.else_branch) {
+			this->variables = before;
+			this->block = else_block;
+			else_value = this->get_value(*if_expr.else_branch);
+			else_end = this->block;
+			this->emit(IROp::Br, IRType::Void, { end_block });
+			else_variables = this->variables;
+		}
+
+		this->block = end_block;
+		this->variables = this->merge_variables(end_block, { { then_end, then_variables },
+															 { else_end, else_variables } });
+
+		if (if_expr.ts_data->type == void_type) {
+			return ir_no_value;
+		}
+
+		return this->emit(IROp::Phi, get_ir_type(if_expr.ts_data->type), { then_end, then_value, else_end, else_value });
+	}
+};
+
+static IRFunction create_ir_function(const std::string& name, const TSType& type) {
+	IRFunction fn;
+	fn.name = name;
+	fn.return_type = get_ir_type(type.func_data->return_type);
+
+	for (auto arg : type.func_data->args) {
+		fn.arg_types.push_back(get_ir_type(arg));
+	}
+	return fn;
+}
+
+IRModule lower_to_ir(ASTRoot& root, const std::set<std::string>& exported_names) {
+	IRModule module;
+	std::vector<std::pair<ASTFunctionDefinition *, unsigned> > definitions;
+
+	for (auto child : root.children) {
+		ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+		if (!fn_defn) {
+			throw std::runtime_error("only functions can be lowered to the IR:\n" + pretty_print(*child));
+		}
+
+		const std::string &name = *fn_defn->fn_name.value.ptr_s;
+		int index = module.find_function(name);
+
+		if (index < 0) {
+			index = module.functions.size();
+			module.functions.push_back(create_ir_function(name, *fn_defn->ts_data->type));
+			module.functions[index].is_exported = true;
+		}
+
+		// a forward declaration is exported until its definition says
+		// otherwise
+		if (fn_defn->body) {
+			module.functions[index].is_exported = fn_defn->linkage != ASTLinkage::Internal || name == "main" ||
+				exported_names.count(name) != 0;
+			definitions.push_back(std::make_pair(fn_defn, index));
+		}
+	}
+
+	IRBuiltinCollector builtins;
+	root.dispatch(builtins);
+
+	for (auto& builtin : builtins.builtins) {
+		module.functions.push_back(create_ir_function(builtin.first, *builtin.second));
+		module.functions.back().is_builtin = true;
+		module.functions.back().is_exported = true;
+	}
+
+	IRGenerator generator(module);
+	for (auto& definition : definitions) {
+		generator.generate_function(*definition.first, module.functions[definition.second]);
+	}
+
+	return module;
+}
+
+// -----------------------------------------------------
+// DOMINATORS
+
+// Cooper, Harvey and Kennedy's "A Simple, Fast Dominance Algorithm".
+// only covers the blocks that can be reached from the entry.
+struct IRDominatorTree {
+	// reachable blocks in reverse post order, the entry first
+	std::vector<uint32_t> order;
+	// UINT32_MAX for blocks that can not be reached
+	std::vector<uint32_t> order_index;
+	// the entry is its own
+	std::vector<uint32_t> idom;
+	std::vector<std::vector<uint32_t> > children;
+
+	IRDominatorTree(const IRFunction& fn) {
+		uint32_t num_blocks = fn.blocks.size();
+		this->order_index.assign(num_blocks, UINT32_MAX);
+		this->idom.assign(num_blocks, UINT32_MAX);
+		this->children.resize(num_blocks);
+
+		if (num_blocks == 0) {
+			return;
+		}
+
+		// post order, without recursion
+		std::vector<bool> visited(num_blocks, false);
+		std::vector<std::pair<uint32_t, unsigned> > stack = { { 0, 0 } };
+		visited[0] = true;
+
+		while (!stack.empty()) {
+			uint32_t block = stack.back().first;
+			std::vector<uint32_t> successors = fn.get_successors(block);
+
+			if (stack.back().second < successors.size()) {
+				uint32_t successor = successors[stack.back().second++];
+
+				if (!visited[successor]) {
+					visited[successor] = true;
+					stack.push_back(std::make_pair(successor, 0));
+				}
+				continue;
+			}
+
+			this->order.push_back(block);
+			stack.pop_back();
+		}
+
+		std::reverse(this->order.begin(), this->order.end());
+		for (uint32_t i = 0; i < this->order.size(); ++i) {
+			this->order_index[this->order[i]] = i;
+		}
+
+		std::vector<std::vector<uint32_t> > predecessors = fn.get_predecessors();
+		this->idom[0] = 0;
+		bool changed = true;
+
+		while (changed) {
+			changed = false;
+
+			for (uint32_t i = 1; i < this->order.size(); ++i) {
+				uint32_t block = this->order[i];
+				uint32_t new_idom = UINT32_MAX;
+
+				for (uint32_t predecessor : predecessors[block]) {
+					if (this->idom[predecessor] == UINT32_MAX) {
+						continue;
+					}
+					new_idom = new_idom == UINT32_MAX ? predecessor : this->intersect(predecessor, new_idom);
+				}
+
+				if (new_idom != this->idom[block]) {
+					this->idom[block] = new_idom;
+					changed = true;
+				}
+			}
+		}
+
+		for (uint32_t i = 1; i < this->order.size(); ++i) {
+			this->children[this->idom[this->order[i]]].push_back(this->order[i]);
+		}
+	}
+
+	bool is_reachable(uint32_t block) const {
+		return this->order_index[block] != UINT32_MAX;
+	}
+
+	bool dominates(uint32_t dominator, uint32_t block) const {
+		while (block != dominator && block != 0) {
+			block = this->idom[block];
+		}
+		return block == dominator;
+	}
+
+private:
+
+	uint32_t intersect(uint32_t a, uint32_t b) const {
+		while (a != b) {
+			while (this->order_index[a] > this->order_index[b]) {
+				a = this->idom[a];
+			}
+			while (this->order_index[b] > this->order_index[a]) {
+				b = this->idom[b];
+			}
+		}
+		return a;
+	}
+};
+
+// -----------------------------------------------------
+// VERIFIER
+
+void verify_ir(const IRFunction& fn) {
+	if (fn.is_declaration()) {
+		return;
+	}
+
+	auto fail = [&fn](const std::string& message) {
+		std::stringstream error;
+		error << "invalid IR in " << fn.name << ": " << message << "\n" << fn;
+		throw std::runtime_error(error.str());
+	};
+
+	IRDominatorTree dominators(fn);
+	std::vector<std::vector<uint32_t> > predecessors = fn.get_predecessors();
+
+	// where every value is defined
+	std::vector<uint32_t> positions(fn.instructions.size(), UINT32_MAX);
+
+	for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+		const std::vector<IRValue> &instructions = fn.blocks[block].instructions;
+
+		if (!dominators.is_reachable(block)) {
+			fail("b" + std::to_string(block) + " can not be reached");
+		}
+
+		if (instructions.empty() || !is_terminator(fn.instructions[instructions.back()].op)) {
+			fail("b" + std::to_string(block) + " does not end in a terminator");
+		}
+
+		for (uint32_t i = 0; i < instructions.size(); ++i) {
+			const IRInstruction &instruction = fn.instructions[instructions[i]];
+
+			if (instruction.block != block || instruction.op == IROp::Nop || positions[instructions[i]] != UINT32_MAX) {
+				fail("%" + std::to_string(instructions[i]) + " is in the wrong block");
+			}
+			if (is_terminator(instruction.op) && i + 1 != instructions.size()) {
+				fail("terminator %" + std::to_string(instructions[i]) + " in the middle of a block");
+			}
+			if (instruction.op == IROp::Phi && i > 0 && fn.instructions[instructions[i - 1]].op != IROp::Phi) {
+				fail("phi %" + std::to_string(instructions[i]) + " after other instructions");
+			}
+			positions[instructions[i]] = i;
+		}
+	}
+
+	for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+		for (IRValue value : fn.blocks[block].instructions) {
+			const IRInstruction &instruction = fn.instructions[value];
+			const uint32_t *operands = fn.get_operands(value);
+			std::string name = "%" + std::to_string(value);
+
+			if (instruction.op == IROp::Phi) {
+				if (instruction.num_operands != predecessors[block].size() * 2) {
+					fail(name + " does not have a value for every predecessor");
+				}
+
+				for (uint32_t i = 0; i < instruction.num_operands; i += 2) {
+					uint32_t incoming = operands[i];
+					IRValue operand = operands[i + 1];
+
+					if (std::find(predecessors[block].begin(), predecessors[block].end(), incoming) ==
+						predecessors[block].end()) {
+						fail(name + " has a value for b" + std::to_string(incoming) + ", which is no predecessor");
+					}
+					if (operand >= fn.instructions.size() || positions[operand] == UINT32_MAX ||
+						!dominators.dominates(fn.instructions[operand].block, incoming)) {
+						fail(name + " uses %" + std::to_string(operand) + ", which does not dominate b" +
+							 std::to_string(incoming));
+					}
+				}
+				continue;
+			}
+
+			fn.for_each_value_operand(value, [&](uint32_t operand) {
+				if (operand >= fn.instructions.size() || positions[operand] == UINT32_MAX) {
+					fail(name + " uses %" + std::to_string(operand) + ", which is not defined");
+				}
+
+				uint32_t definition_block = fn.instructions[operand].block;
+				bool dominates = definition_block == block ? positions[operand] < positions[value] :
+					dominators.dominates(definition_block, block);
+
+				if (!dominates) {
+					fail(name + " uses %" + std::to_string(operand) + ", which does not dominate it");
+				}
+			});
+
+			if (instruction.op == IROp::Br || instruction.op == IROp::CondBr) {
+				for (uint32_t successor : fn.get_successors(block)) {
+					if (successor >= fn.blocks.size()) {
+						fail(name + " branches to a block that does not exist");
+					}
+				}
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------
+// CONSTANTS
+
+typedef decltype(IRInstruction::constant) IRConstant;
+
+// bool compares like LLVM's signed i1, where true is -1
+static int32_t get_comparable_int(IRType type, IRConstant constant) {
+	return type == IRType::Bool ? (constant.b ? -1 : 0) : constant.i;
+}
+
+template<typename T>
+static bool compare(IROp op, T left, T right) {
+	switch (op) {
+	case IROp::CmpL: return left < right;
+	case IROp::CmpG: return left > right;
+	case IROp::CmpLEQ: return left <= right;
+	case IROp::CmpGEQ: return left >= right;
+	case IROp::CmpEQ: return left == right;
+	// true for NaN
+	case IROp::CmpNEQ: return left != right;
+	default:
+		assert(false && "not a comparison");
+		return false;
+	}
+}
+
+// evaluates a pure instruction on constant operands, with the semantics
+// the backends give it. returns false if the result is undefined, eg. a
+// division by zero, which has to be left to run time.
+static bool evaluate(const IRFunction& fn, IRValue value, const IRConstant *operands, IRConstant& result) {
+	const IRInstruction &instruction = fn.instructions[value];
+	result.i = 0;
+
+	switch (instruction.op) {
+	case IROp::Const:
+		result = instruction.constant;
+		return true;
+
+	case IROp::Copy:
+		result = operands[0];
+		return true;
+
+	case IROp::IntToFloat:
+		result.f = (float)operands[0].i;
+		return true;
+
+	case IROp::Not:
+		result.b = !operands[0].b;
+		return true;
+
+	case IROp::Neg:
+		if (instruction.type == IRType::I32) {
+			result.i = (int32_t)(0u - (uint32_t)operands[0].i);
+		}
+		else {
+			result.f = -operands[0].f;
+		}
+		return true;
+
+	case IROp::CmpL:
+	case IROp::CmpG:
+	case IROp::CmpLEQ:
+	case IROp::CmpGEQ:
+	case IROp::CmpEQ:
+	case IROp::CmpNEQ: {
+		IRType operand_type = fn.instructions[fn.get_operands(value)[0]].type;
+
+		if (operand_type == IRType::F32) {
+			result.b = compare(instruction.op, operands[0].f, operands[1].f);
+		}
+		else {
+			result.b = compare(instruction.op, get_comparable_int(operand_type, operands[0]),
+							   get_comparable_int(operand_type, operands[1]));
+		}
+		return true;
+	}
+
+	case IROp::Add:
+	case IROp::Sub:
+	case IROp::Mul:
+	case IROp::Div:
+		break;
+
+	default:
+		return false;
+	}
+
+	if (instruction.type == IRType::F32) {
+		float left = operands[0].f, right = operands[1].f;
+
+		switch (instruction.op) {
+		case IROp::Add: result.f = left + right; break;
+		case IROp::Sub: result.f = left - right; break;
+		case IROp::Mul: result.f = left * right; break;
+		default: result.f = left / right; break;
+		}
+		return true;
+	}
+
+	uint32_t left = operands[0].i, right = operands[1].i;
+
+	switch (instruction.op) {
+	case IROp::Add: result.i = (int32_t)(left + right); break;
+	case IROp::Sub: result.i = (int32_t)(left - right); break;
+	case IROp::Mul: result.i = (int32_t)(left * right); break;
+	default:
+		if (operands[1].i == 0 || (operands[0].i == INT32_MIN && operands[1].i == -1)) {
+			return false;
+		}
+		result.i = operands[0].i / operands[1].i;
+		break;
+	}
+	return true;
+}
+
+// -----------------------------------------------------
+// COPY PROPAGATION
+
+class CopyPropagationPass : public IRPass {
+public:
+
+	virtual const char* get_name() const {
+		return "copy propagation";
+	}
+
+	virtual unsigned run(IRFunction& fn) {
+		unsigned changes = 0;
+
+		// a phi that merges one value (and maybe itself, in a loop) is that
+		// value. turning one into a copy can make others trivial.
+		for (bool changed = true; changed;) {
+			changed = false;
+
+			for (auto& block : fn.blocks) {
+				for (IRValue value : block.instructions) {
+					if (fn.instructions[value].op != IROp::Phi) {
+						continue;
+					}
+
+					IRValue unique = ir_no_value;
+					bool is_trivial = true;
+					const uint32_t *operands = fn.get_operands(value);
+
+					for (uint32_t i = 1; i < fn.instructions[value].num_operands; i += 2) {
+						IRValue operand = resolve(fn, operands[i]);
+
+						if (operand == value || operand == unique) {
+							continue;
+						}
+						is_trivial &= unique == ir_no_value;
+						unique = operand;
+					}
+
+					if (is_trivial && unique != ir_no_value) {
+						fn.instructions[value].op = IROp::Copy;
+						fn.set_operands(value, { unique });
+						changed = true;
+						changes++;
+					}
+				}
+			}
+		}
+
+		for (auto& block : fn.blocks) {
+			for (IRValue value : block.instructions) {
+				fn.for_each_value_operand(value, [&fn, &changes](uint32_t& operand) {
+					IRValue source = resolve(fn, operand);
+
+					if (source != operand) {
+						operand = source;
+						changes++;
+					}
+				});
+			}
+		}
+
+		// nothing uses the copies anymore
+		for (auto& block : fn.blocks) {
+			auto is_copy = [&fn](IRValue value) {
+				return fn.instructions[value].op == IROp::Copy;
+			};
+
+			for (IRValue value : block.instructions) {
+				if (is_copy(value)) {
+					remove_instruction(fn, value);
+				}
+			}
+			block.instructions.erase(std::remove_if(block.instructions.begin(), block.instructions.end(),
+													[&fn](IRValue value) {
+				return fn.instructions[value].op == IROp::Nop;
+			}), block.instructions.end());
+		}
+
+		return changes;
+	}
+
+private:
+
+	static IRValue resolve(const IRFunction& fn, IRValue value) {
+		while (fn.instructions[value].op == IROp::Copy) {
+			value = fn.get_operands(value)[0];
+		}
+		return value;
+	}
+};
+
+std::unique_ptr<IRPass> create_copy_propagation_pass() {
+	return std::unique_ptr<IRPass>(new CopyPropagationPass());
+}
+
+// -----------------------------------------------------
+// SCCP
+
+class SCCPPass : public IRPass {
+public:
+
+	virtual const char* get_name() const {
+		return "sccp";
+	}
+
+	virtual unsigned run(IRFunction& fn) {
+		this->fn = &fn;
+		this->lattice.assign(fn.instructions.size(), LatticeValue());
+		this->executable_blocks.assign(fn.blocks.size(), false);
+		this->executable_edges.clear();
+		this->compute_users();
+
+		this->block_worklist.clear();
+		this->value_worklist.clear();
+		this->mark_edge(UINT32_MAX, 0);
+
+		while (!this->block_worklist.empty() || !this->value_worklist.empty()) {
+			while (!this->value_worklist.empty()) {
+				IRValue value = this->value_worklist.back();
+				this->value_worklist.pop_back();
+
+				if (this->executable_blocks[fn.instructions[value].block]) {
+					this->visit(value);
+				}
+			}
+
+			while (!this->block_worklist.empty()) {
+				std::pair<uint32_t, bool> block = this->block_worklist.back();
+				this->block_worklist.pop_back();
+
+				// a block is visited once, later edges into it only change
+				// its phis
+				for (IRValue value : fn.blocks[block.first].instructions) {
+					if (block.second || fn.instructions[value].op == IROp::Phi) {
+						this->visit(value);
+					}
+				}
+			}
+		}
+
+		return this->rewrite();
+	}
+
+private:
+
+	struct LatticeValue {
+		enum class State : uint8_t {
+			// not known yet, optimistically anything
+			Top,
+			Constant,
+			// not a constant
+			Bottom,
+		} state;
+
+		IRConstant constant;
+
+		LatticeValue() : state(State::Top) {
+			constant.i = 0;
+		}
+	};
+
+	IRFunction *fn;
+	std::vector<LatticeValue> lattice;
+	std::vector<std::vector<IRValue> > users;
+	std::vector<bool> executable_blocks;
+	std::set<std::pair<uint32_t, uint32_t> > executable_edges;
+
+	// (block, whether it was not executable before)
+	std::vector<std::pair<uint32_t, bool> > block_worklist;
+	std::vector<IRValue> value_worklist;
+
+	void compute_users() {
+		this->users.assign(this->fn->instructions.size(), {});
+
+		for (auto& block : this->fn->blocks) {
+			for (IRValue value : block.instructions) {
+				this->fn->for_each_value_operand(value, [this, value](uint32_t operand) {
+					this->users[operand].push_back(value);
+				});
+			}
+		}
+	}
+
+	void mark_edge(uint32_t from, uint32_t to) {
+		if (!this->executable_edges.insert(std::make_pair(from, to)).second) {
+			return;
+		}
+
+		bool is_new = !this->executable_blocks[to];
+		this->executable_blocks[to] = true;
+		this->block_worklist.push_back(std::make_pair(to, is_new));
+	}
+
+	static bool is_same_constant(IRConstant a, IRConstant b) {
+		return a.index == b.index;
+	}
+
+	// lattice values only ever go down: top, constant, bottom
+	void update(IRValue value, LatticeValue new_value) {
+		LatticeValue &old_value = this->lattice[value];
+
+		if (old_value.state == LatticeValue::State::Bottom || new_value.state == LatticeValue::State::Top) {
+			return;
+		}
+
+		if (old_value.state == LatticeValue::State::Constant) {
+			if (new_value.state == LatticeValue::State::Constant &&
+				is_same_constant(old_value.constant, new_value.constant)) {
+				return;
+			}
+			new_value.state = LatticeValue::State::Bottom;
+		}
+
+		old_value = new_value;
+
+		for (IRValue user : this->users[value]) {
+			this->value_worklist.push_back(user);
+		}
+	}
+
+	void update_bottom(IRValue value) {
+		LatticeValue bottom;
+		bottom.state = LatticeValue::State::Bottom;
+		this->update(value, bottom);
+	}
+
+	void visit(IRValue value) {
+		IRInstruction &instruction = this->fn->instructions[value];
+		const uint32_t *operands = this->fn->get_operands(value);
+
+		switch (instruction.op) {
+		case IROp::Br:
+			this->mark_edge(instruction.block, operands[0]);
+			return;
+
+		case IROp::CondBr: {
+			LatticeValue &condition = this->lattice[operands[0]];
+
+			if (condition.state == LatticeValue::State::Constant) {
+				this->mark_edge(instruction.block, condition.constant.b ? operands[1] : operands[2]);
+			}
+			else if (condition.state == LatticeValue::State::Bottom) {
+				this->mark_edge(instruction.block, operands[1]);
+				this->mark_edge(instruction.block, operands[2]);
+			}
+			return;
+		}
+
+		case IROp::Ret:
+		case IROp::Nop:
+			return;
+
+		case IROp::Arg:
+		case IROp::Call:
+			this->update_bottom(value);
+			return;
+
+		case IROp::Phi: {
+			LatticeValue merged;
+
+			for (uint32_t i = 0; i < instruction.num_operands; i += 2) {
+				if (!this->executable_edges.count(std::make_pair(operands[i], instruction.block))) {
+					continue;
+				}
+
+				LatticeValue &incoming = this->lattice[operands[i + 1]];
+
+				if (incoming.state == LatticeValue::State::Bottom ||
+					(incoming.state == LatticeValue::State::Constant &&
+					 merged.state == LatticeValue::State::Constant &&
+					 !is_same_constant(incoming.constant, merged.constant))) {
+					merged.state = LatticeValue::State::Bottom;
+					break;
+				}
+
+				if (incoming.state == LatticeValue::State::Constant) {
+					merged = incoming;
+				}
+			}
+
+			this->update(value, merged);
+			return;
+		}
+
+		default:
+			break;
+		}
+
+		IRConstant constants[2];
+		for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+			LatticeValue &operand = this->lattice[operands[i]];
+
+			if (operand.state == LatticeValue::State::Bottom) {
+				this->update_bottom(value);
+				return;
+			}
+			if (operand.state == LatticeValue::State::Top) {
+				return;
+			}
+			constants[i] = operand.constant;
+		}
+
+		LatticeValue result;
+		if (evaluate(*this->fn, value, constants, result.constant)) {
+			result.state = LatticeValue::State::Constant;
+		}
+		else {
+			result.state = LatticeValue::State::Bottom;
+		}
+		this->update(value, result);
+	}
+
+	// constants become Const, constant branches Br, and what can not be
+	// reached goes
+	unsigned rewrite() {
+		IRFunction &fn = *this->fn;
+		unsigned changes = 0;
+
+		for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+			if (!this->executable_blocks[block]) {
+				continue;
+			}
+
+			for (IRValue value : fn.blocks[block].instructions) {
+				IRInstruction &instruction = fn.instructions[value];
+
+				if (instruction.op == IROp::CondBr) {
+					const uint32_t *operands = fn.get_operands(value);
+					bool takes_then = this->executable_edges.count(std::make_pair(block, operands[1])) != 0;
+					bool takes_else = this->executable_edges.count(std::make_pair(block, operands[2])) != 0;
+
+					// both are taken, or neither if the condition is undefined
+					if (takes_then == takes_else) {
+						continue;
+					}
+
+					uint32_t target = takes_then ? operands[1] : operands[2];
+					instruction.op = IROp::Br;
+					fn.set_operands(value, { target });
+					changes++;
+					continue;
+				}
+
+				if (instruction.op == IROp::Const || instruction.op == IROp::Call ||
+					this->lattice[value].state != LatticeValue::State::Constant) {
+					continue;
+				}
+
+				instruction.op = IROp::Const;
+				instruction.num_operands = 0;
+				instruction.constant = this->lattice[value].constant;
+				changes++;
+			}
+		}
+
+		// branches that became unconditional leave a predecessor behind in
+		// the block they no longer go to
+		std::vector<std::vector<uint32_t> > predecessors = fn.get_predecessors();
+		for (uint32_t block = 0; block < fn.blocks.size(); ++block) {
+			remove_stale_phi_operands(fn, block, predecessors[block]);
+		}
+
+		move_phis_first(fn);
+		changes += remove_unreachable_blocks(fn);
+
+		// the branches that were folded leave chains of blocks behind
+		if (merge_straight_line_blocks(fn) != 0) {
+			changes += remove_unreachable_blocks(fn);
+		}
+		return changes;
+	}
+};
+
+std::unique_ptr<IRPass> create_sccp_pass() {
+	return std::unique_ptr<IRPass>(new SCCPPass());
+}
+
+// -----------------------------------------------------
+// GVN
+
+class GVNPass : public IRPass {
+public:
+
+	virtual const char* get_name() const {
+		return "gvn";
+	}
+
+	virtual unsigned run(IRFunction& fn) {
+		this->changes = 0;
+		this->leaders.clear();
+
+		if (!fn.is_declaration()) {
+			IRDominatorTree dominators(fn);
+			this->number_block(fn, dominators, 0);
+		}
+		return this->changes;
+	}
+
+private:
+
+	// op, type, operands and constant
+	struct Key {
+		IROp op;
+		IRType type;
+		uint32_t operands[2];
+		uint32_t constant;
+
+		bool operator==(const Key& other) const {
+			return this->op == other.op && this->type == other.type && this->operands[0] == other.operands[0] &&
+				this->operands[1] == other.operands[1] && this->constant == other.constant;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			uint64_t hash = ((uint64_t)key.op << 8 | (uint64_t)key.type) * 0x9e3779b97f4a7c15ull;
+			hash = (hash ^ key.operands[0]) * 0x9e3779b97f4a7c15ull;
+			hash = (hash ^ key.operands[1]) * 0x9e3779b97f4a7c15ull;
+			hash = (hash ^ key.constant) * 0x9e3779b97f4a7c15ull;
+			return hash ^ (hash >> 32);
+		}
+	};
+
+	// the first instruction that computes a key, in the dominator tree
+	// above the block being numbered
+	std::unordered_map<Key, IRValue, KeyHash> leaders;
+	unsigned changes;
+
+	static bool is_commutative(IROp op) {
+		return op == IROp::Add || op == IROp::Mul || op == IROp::CmpEQ || op == IROp::CmpNEQ;
+	}
+
+	static IRValue resolve(const IRFunction& fn, IRValue value) {
+		while (fn.instructions[value].op == IROp::Copy) {
+			value = fn.get_operands(value)[0];
+		}
+		return value;
+	}
+
+	void number_block(IRFunction& fn, const IRDominatorTree& dominators, uint32_t block) {
+		std::vector<Key> added;
+
+		for (IRValue value : fn.blocks[block].instructions) {
+			IRInstruction &instruction = fn.instructions[value];
+
+			if (!is_pure(instruction.op) || instruction.op == IROp::Copy || instruction.num_operands > 2) {
+				continue;
+			}
+
+			uint32_t operands[2] = { UINT32_MAX, UINT32_MAX };
+			for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+				operands[i] = resolve(fn, fn.get_operands(value)[i]);
+			}
+
+			if (is_commutative(instruction.op) && operands[0] > operands[1]) {
+				std::swap(operands[0], operands[1]);
+			}
+
+			Key key = { instruction.op, instruction.type, { operands[0], operands[1] }, instruction.constant.index };
+			auto leader = this->leaders.emplace(key, value);
+
+			if (!leader.second) {
+				instruction.op = IROp::Copy;
+				fn.set_operands(value, { leader.first->second });
+				this->changes++;
+			}
+			else {
+				added.push_back(key);
+			}
+		}
+
+		for (uint32_t child : dominators.children[block]) {
+			this->number_block(fn, dominators, child);
+		}
+
+		// out of scope for the siblings
+		for (auto& key : added) {
+			this->leaders.erase(key);
+		}
+	}
+};
+
+std::unique_ptr<IRPass> create_gvn_pass() {
+	return std::unique_ptr<IRPass>(new GVNPass());
+}
+
+// -----------------------------------------------------
+// DCE
+
+class DCEPass : public IRPass {
+public:
+
+	virtual const char* get_name() const {
+		return "dce";
+	}
+
+	virtual unsigned run(IRFunction& fn) {
+		std::vector<bool> live(fn.instructions.size(), false);
+		std::vector<IRValue> worklist;
+
+		for (auto& block : fn.blocks) {
+			for (IRValue value : block.instructions) {
+				IROp op = fn.instructions[value].op;
+
+				if (is_terminator(op) || op == IROp::Call) {
+					live[value] = true;
+					worklist.push_back(value);
+				}
+			}
+		}
+
+		while (!worklist.empty()) {
+			IRValue value = worklist.back();
+			worklist.pop_back();
+
+			fn.for_each_value_operand(value, [&live, &worklist](uint32_t operand) {
+				if (!live[operand]) {
+					live[operand] = true;
+					worklist.push_back(operand);
+				}
+			});
+		}
+
+		unsigned removed = 0;
+
+		for (auto& block : fn.blocks) {
+			for (IRValue value : block.instructions) {
+				if (!live[value]) {
+					remove_instruction(fn, value);
+					removed++;
+				}
+			}
+
+			block.instructions.erase(std::remove_if(block.instructions.begin(), block.instructions.end(),
+													[&live](IRValue value) {
+				return !live[value];
+			}), block.instructions.end());
+		}
+
+		return removed;
+	}
+};
+
+std::unique_ptr<IRPass> create_dce_pass() {
+	return std::unique_ptr<IRPass>(new DCEPass());
+}
+
+// -----------------------------------------------------
+// PASS MANAGER
+
+std::ostream& operator<<(std::ostream& out, const IRPipelineStats& stats) {
+	out << "instructions: " << stats.instructions_before << " -> " << stats.instructions_after;
+
+	for (auto& pass : stats.passes) {
+		out << " | " << pass.name << ": " << pass.changes << " (" << pass.milliseconds << " ms)";
+	}
+	return out;
+}
+
+IRPipelineStats IRPassManager::run(IRModule& module, bool verify) {
+	typedef std::chrono::high_resolution_clock Clock;
+	IRPipelineStats stats;
+
+	for (auto& pass : this->passes) {
+		stats.passes.push_back({ pass->get_name(), 0, 0.0 });
+	}
+
+	for (auto& fn : module.functions) {
+		if (fn.is_declaration()) {
+			continue;
+		}
+
+		stats.instructions_before += count_instructions(fn);
+
+		for (unsigned iteration = 0; iteration < this->max_iterations; ++iteration) {
+			unsigned changes = 0;
+
+			for (unsigned i = 0; i < this->passes.size(); ++i) {
+				Clock::time_point start = Clock::now();
+				unsigned pass_changes = this->passes[i]->run(fn);
+
+				stats.passes[i].milliseconds += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+				stats.passes[i].changes += pass_changes;
+				changes += pass_changes;
+
+				if (verify) {
+					verify_ir(fn);
+				}
+			}
+
+			if (changes == 0) {
+				break;
+			}
+		}
+
+		stats.instructions_after += count_instructions(fn);
+	}
+
+	return stats;
+}
+
+void add_default_ir_passes(IRPassManager& pass_manager) {
+	pass_manager.add(create_copy_propagation_pass());
+	pass_manager.add(create_sccp_pass());
+	pass_manager.add(create_gvn_pass());
+	pass_manager.add(create_copy_propagation_pass());
+	pass_manager.add(create_dce_pass());
+}
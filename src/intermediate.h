@@ -1 +1,278 @@
 #pragma once
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "ast.h"
+#include "type_system.h"
+
+// a small SSA IR between the typed AST and the backends. every function
+// is a flat array of instructions, each of which defines one virtual
+// register: the value of instruction n is %n. operands are indices into a
+// second flat array, so walking a function touches two arrays and nothing
+// else. blocks list their instructions in order, phis first and the
+// terminator last.
+
+// -----------------------------------------------------
+// INSTRUCTIONS
+
+enum class IRType : uint8_t {
+	Void,
+	I32,
+	F32,
+	Bool,
+};
+
+enum class IROp : uint8_t {
+	// the value is IRInstruction::constant
+	Const,
+	// the argument number constant.index of the function
+	Arg,
+	// operands: value. left behind by passes, copy propagation removes it.
+	Copy,
+	// operands: (block, value), one pair per predecessor
+	Phi,
+
+	// operands: left, right. i32 wraps around, except that Div by 0 and
+	// INT32_MIN / -1 are undefined. f32 is IEEE.
+	Add,
+	Sub,
+	Mul,
+	Div,
+	// operands: value
+	Neg,
+	Not,
+
+	// operands: left, right, both of the same type. the result is bool.
+	// f32 comparisons are ordered, except CmpNEQ which is true for NaN.
+	CmpL,
+	CmpG,
+	CmpLEQ,
+	CmpGEQ,
+	CmpEQ,
+	CmpNEQ,
+
+	// operands: an i32
+	IntToFloat,
+
+	// operands: the arguments. constant.index is the callee in the module.
+	Call,
+
+	// terminators. operands: the target block
+	Br,
+	// operands: condition, then block, else block
+	CondBr,
+	// operands: the value, none in void functions
+	Ret,
+
+	// removed from its block, by DCE for example. its number stays taken.
+	Nop,
+};
+
+// an instruction, and the virtual register it defines
+typedef uint32_t IRValue;
+
+// no value, eg. what a void call evaluates to in the AST lowering
+static const IRValue ir_no_value = UINT32_MAX;
+
+struct IRInstruction {
+	IROp op;
+	IRType type;
+
+	// the block the instruction is in
+	uint32_t block;
+
+	// IRFunction::operands[first_operand, first_operand + num_operands)
+	uint32_t first_operand;
+	uint32_t num_operands;
+
+	union {
+		int32_t i;
+		float f;
+		bool b;
+		uint32_t index;
+	} constant;
+};
+
+struct IRBlock {
+	std::vector<IRValue> instructions;
+};
+
+struct IRFunction {
+	std::string name;
+	IRType return_type;
+	std::vector<IRType> arg_types;
+
+	// export fns, extern fns and main. everything else is only called from
+	// inside the program.
+	bool is_exported;
+	// a math builtin, like sin. it has no blocks.
+	bool is_builtin;
+
+	std::vector<IRInstruction> instructions;
+	std::vector<uint32_t> operands;
+
+	// the first one is the entry block. empty for extern fns and builtins.
+	std::vector<IRBlock> blocks;
+
+	IRFunction() : return_type(IRType::Void), is_exported(false), is_builtin(false) {}
+
+	bool is_declaration() const {
+		return this->blocks.empty();
+	}
+
+	// appends a new instruction to the end of block
+	IRValue add_instruction(uint32_t block, IROp op, IRType type, const std::vector<uint32_t>& operands = {});
+
+	// a new instruction that is not in any block yet
+	IRValue create_instruction(uint32_t block, IROp op, IRType type, const std::vector<uint32_t>& operands = {});
+
+	uint32_t* get_operands(IRValue value) {
+		return this->operands.data() + this->instructions[value].first_operand;
+	}
+
+	const uint32_t* get_operands(IRValue value) const {
+		return this->operands.data() + this->instructions[value].first_operand;
+	}
+
+	// points value at a fresh list of operands
+	void set_operands(IRValue value, const std::vector<uint32_t>& operands);
+
+	// the blocks a terminator branches to
+	std::vector<uint32_t> get_successors(uint32_t block) const;
+	std::vector<std::vector<uint32_t> > get_predecessors() const;
+
+	// calls fn(operand) for every operand that is a value, not a block
+	template<typename F>
+	void for_each_value_operand(IRValue value, F fn) {
+		IRInstruction &instruction = this->instructions[value];
+		uint32_t *operands = this->get_operands(value);
+
+		for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+			if (!is_block_operand(instruction.op, i)) {
+				fn(operands[i]);
+			}
+		}
+	}
+
+	template<typename F>
+	void for_each_value_operand(IRValue value, F fn) const {
+		const IRInstruction &instruction = this->instructions[value];
+		const uint32_t *operands = this->get_operands(value);
+
+		for (uint32_t i = 0; i < instruction.num_operands; ++i) {
+			if (!is_block_operand(instruction.op, i)) {
+				fn(operands[i]);
+			}
+		}
+	}
+
+	static bool is_block_operand(IROp op, uint32_t i) {
+		return op == IROp::Br || (op == IROp::CondBr && i > 0) || (op == IROp::Phi && i % 2 == 0);
+	}
+};
+
+struct IRModule {
+	std::vector<IRFunction> functions;
+
+	// the index of the function called name, or -1
+	int find_function(const std::string& name) const;
+};
+
+std::ostream& operator<<(std::ostream& out, IRType type);
+std::ostream& operator<<(std::ostream& out, IROp op);
+std::ostream& operator<<(std::ostream& out, const IRFunction& fn);
+std::ostream& operator<<(std::ostream& out, const IRModule& module);
+
+// -----------------------------------------------------
+// CONSTRUCTION
+
+// lowers a type checked (and usually constant folded) tree. every let is
+// turned into SSA values, with phis where control flow joins. exported_names
+// are treated as if declared export.
+IRModule lower_to_ir(ASTRoot& root, const std::set<std::string>& exported_names = {});
+
+// throws if fn is not well formed SSA: every operand defined by an
+// instruction that dominates its use, terminators last, phis first with a
+// value per predecessor.
+void verify_ir(const IRFunction& fn);
+
+// -----------------------------------------------------
+// PASSES
+
+class IRPass {
+public:
+
+	virtual ~IRPass() {}
+
+	virtual const char* get_name() const = 0;
+
+	// returns the number of instructions it changed or removed
+	virtual unsigned run(IRFunction& fn) = 0;
+};
+
+// forwards the sources of copies to their uses, and turns phis whose
+// incoming values are all the same into copies
+std::unique_ptr<IRPass> create_copy_propagation_pass();
+
+// sparse conditional constant propagation (Wegman and Zadeck): constants
+// are propagated only along edges that can be taken, so a constant branch
+// condition also makes the values of the other side disappear. values that
+// are constant become Const, constant branches become Br and blocks that
+// can not be reached are removed. blocks that are left with one
+// predecessor, which always branches to them, are merged into it.
+std::unique_ptr<IRPass> create_sccp_pass();
+
+// global value numbering over the dominator tree: a pure instruction that
+// computes the same as one that dominates it becomes a copy of it.
+// commutative operands are ordered first, so a + b and b + a are the same.
+std::unique_ptr<IRPass> create_gvn_pass();
+
+// removes every instruction whose value is not used by a terminator or a
+// call, including cycles of phis that only use each other
+std::unique_ptr<IRPass> create_dce_pass();
+
+struct IRPassStats {
+	std::string name;
+	unsigned changes;
+	double milliseconds;
+};
+
+struct IRPipelineStats {
+	// per pass, summed over every function and iteration
+	std::vector<IRPassStats> passes;
+
+	// in blocks, before and after
+	unsigned instructions_before;
+	unsigned instructions_after;
+
+	IRPipelineStats() : instructions_before(0), instructions_after(0) {}
+};
+
+std::ostream& operator<<(std::ostream& out, const IRPipelineStats& stats);
+
+// runs its passes over every function, in order, until none of them
+// changes anything or max_iterations is reached
+class IRPassManager {
+public:
+
+	IRPassManager(unsigned max_iterations = 4) : max_iterations(max_iterations) {}
+
+	void add(std::unique_ptr<IRPass> pass) {
+		this->passes.push_back(std::move(pass));
+	}
+
+	// verify_ir runs after every pass if verify is set
+	IRPipelineStats run(IRModule& module, bool verify = false);
+
+private:
+
+	unsigned max_iterations;
+	std::vector<std::unique_ptr<IRPass> > passes;
+};
+
+// copy propagation, sccp, gvn, copy propagation, dce
+void add_default_ir_passes(IRPassManager& pass_manager);
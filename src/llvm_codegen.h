@@ -6,15 +6,20 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
 
+#include <cstdint>
+#include <set>
 #include <sstream>
 
 #include "ast.h"
 #include "type_system.h"
 #include "tokenizer.h"
 #include "pretty_print.h"
+#include "llvm_debug_info.h"
 
 
 using namespace llvm;
@@ -23,8 +28,7 @@ using namespace llvm;
 llvm::Type* llvm_achilles_to_llvm_type(const TSType &type, LLVMContext &ctx) {
 	switch (type.variant) {
 		case TSType::Variant::Float32:
-			return Type::getDoubleTy(ctx);
-			//return Type::getFloatTy(ctx);
+			return Type::getFloatTy(ctx);
 			break;
 	case TSType::Variant::Int32:
 		return Type::getInt32Ty(ctx);
@@ -32,6 +36,9 @@ llvm::Type* llvm_achilles_to_llvm_type(const TSType &type, LLVMContext &ctx) {
 	case TSType::Variant::Void:
 		return Type::getVoidTy(ctx);
 		break;
+	case TSType::Variant::Bool:
+		return Type::getInt1Ty(ctx);
+		break;
 
 	case TSType::Variant::Function: {
 		std::vector<Type*> llvm_arg_types;
@@ -52,14 +59,220 @@ llvm::Type* llvm_achilles_to_llvm_type(const TSType &type, LLVMContext &ctx) {
 	return nullptr;
 }
 
-llvm::Function* llvm_create_extern_linkage(ASTFunctionDefinition &fn_defn, llvm::LLVMContext &ctx, llvm::Module *module) {
+//returns the existing declaration if the function was already called
+//before its definition was generated
+llvm::Function* llvm_create_extern_linkage(const std::string &name, const TSType &fn_type,
+										   llvm::LLVMContext &ctx, llvm::Module *module) {
+	if (Function *existing = module->getFunction(name)) {
+		return existing;
+	}
 
-	const std::string &name = *fn_defn.fn_name.value.ptr_s;
-	llvm::FunctionType* type = reinterpret_cast<llvm::FunctionType*>(llvm_achilles_to_llvm_type(*fn_defn.ts_data->type, ctx));
+	llvm::FunctionType* type = reinterpret_cast<llvm::FunctionType*>(llvm_achilles_to_llvm_type(fn_type, ctx));
     return Function::Create(type, Function::ExternalLinkage, name, module);
+}
+
+//the intrinsic behind a math builtin. unlike a call to an opaque external,
+//LLVM can constant fold intrinsics, hoist them out of loops and vectorize
+//them, either to instructions or to a vector math library. the backend
+//lowers whatever is left to calls to the C library's f32 versions (sinf,
+//...). not_intrinsic for anything that is not a math builtin.
+llvm::Intrinsic::ID llvm_get_builtin_intrinsic(const std::string &name) {
+	static const std::map<std::string, llvm::Intrinsic::ID> intrinsics = {
+		{ "sin", llvm::Intrinsic::sin },
+		{ "cos", llvm::Intrinsic::cos },
+		{ "sqrt", llvm::Intrinsic::sqrt },
+		{ "exp", llvm::Intrinsic::exp },
+		{ "exp2", llvm::Intrinsic::exp2 },
+		{ "log", llvm::Intrinsic::log },
+		{ "log2", llvm::Intrinsic::log2 },
+		{ "log10", llvm::Intrinsic::log10 },
+		{ "fabs", llvm::Intrinsic::fabs },
+		{ "floor", llvm::Intrinsic::floor },
+		{ "ceil", llvm::Intrinsic::ceil },
+		{ "trunc", llvm::Intrinsic::trunc },
+		{ "round", llvm::Intrinsic::round },
+		{ "pow", llvm::Intrinsic::pow },
+		{ "fmin", llvm::Intrinsic::minnum },
+		{ "fmax", llvm::Intrinsic::maxnum },
+		{ "copysign", llvm::Intrinsic::copysign },
+		{ "fma", llvm::Intrinsic::fma },
+	};
+
+	auto it = intrinsics.find(name);
+	return it == intrinsics.end() ? llvm::Intrinsic::not_intrinsic : it->second;
+}
+
+struct CodegenOptions {
+	//every float operation and math builtin gets all fast-math flags, which
+	//allows reassociation, reciprocals and assuming there are no NaNs or
+	//infinities. results can differ from the strict IEEE ones.
+	bool fast_math;
+
+	//every function with a body is in the module being generated. functions
+	//that are not exported are then internal: LLVM may change their
+	//signature, calling convention and drop them once they are inlined
+	//everywhere. when the program is split over several modules, other
+	//modules call them, so they are only hidden from outside the program.
+	bool whole_program;
+
+	//treated as if declared export, eg. the jit's entry point
+	std::set<std::string> exported_names;
+
+	//-g: DWARF line tables that map the code back to the .acl source, see
+	//LLVMDebugInfo. needs the source_manager the tree was parsed with.
+	bool debug_info;
+	const SourceManager *source_manager;
+
+	//an i32 division by zero, or of the smallest i32 by -1, calls the
+	//function named llvm_division_trap_name instead of being undefined.
+	//whoever runs the code has to define it.
+	bool checked_division;
+
+	CodegenOptions() : fast_math(false), whole_program(true), debug_info(false), source_manager(nullptr),
+		checked_division(false) {}
+
+	bool is_exported(ASTFunctionDefinition &fn_defn) const {
+		const std::string &name = *fn_defn.fn_name.value.ptr_s;
+		return fn_defn.linkage != ASTLinkage::Internal || name == "main" ||
+			this->exported_names.count(name) != 0;
+	}
+};
+
+//changes the calling convention of fn and every call to it that was
+//generated before, they have to agree
+void llvm_set_calling_convention(llvm::Function &fn, llvm::CallingConv::ID calling_convention) {
+	fn.setCallingConv(calling_convention);
+
+	for (llvm::User *user : fn.users()) {
+		if (llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(user)) {
+			if (call->getCalledFunction() == &fn) {
+				call->setCallingConv(calling_convention);
+			}
+		}
+	}
+}
 
+llvm::Function* llvm_create_extern_linkage(ASTFunctionDefinition &fn_defn, llvm::LLVMContext &ctx, llvm::Module *module) {
+	const std::string &name = *fn_defn.fn_name.value.ptr_s;
+	return llvm_create_extern_linkage(name, *fn_defn.ts_data->type, ctx, module);
 };
 
+//called with 1 for an overflow and 0 for a division by zero, see
+//CodegenOptions::checked_division. not a valid identifier, so no program
+//can define it.
+static const char *llvm_division_trap_name = "achilles.division_trap";
+
+//true when i = i + step can not overflow in a loop that runs while i < end:
+//the step is a positive constant, and either 1 or small enough for a
+//constant end
+bool llvm_loop_counts_up(llvm::Value *step, llvm::Value *end) {
+	llvm::ConstantInt *constant_step = llvm::dyn_cast<llvm::ConstantInt>(step);
+
+	if (!constant_step || constant_step->getSExtValue() <= 0) {
+		return false;
+	}
+	if (constant_step->getSExtValue() == 1) {
+		return true;
+	}
+
+	llvm::ConstantInt *constant_end = llvm::dyn_cast<llvm::ConstantInt>(end);
+	return constant_end && constant_end->getSExtValue() <= INT32_MAX - constant_step->getSExtValue() + 1;
+}
+
+llvm::MDNode* llvm_create_loop_property(llvm::LLVMContext &ctx, const std::string &name, llvm::Constant *value) {
+	std::vector<llvm::Metadata*> operands = { llvm::MDString::get(ctx, name) };
+
+	if (value) {
+		operands.push_back(llvm::ConstantAsMetadata::get(value));
+	}
+	return llvm::MDNode::get(ctx, operands);
+}
+
+//the !llvm.loop node for a loop's backedge. a loop that is known to count
+//up to its end always finishes, so it is marked mustprogress. the hints
+//become the same metadata that clang's #pragma clang loop produces.
+llvm::MDNode* llvm_create_loop_metadata(llvm::LLVMContext &ctx, const std::vector<ASTLoopHint> &hints,
+										bool must_progress) {
+	llvm::Type *i32 = llvm::Type::getInt32Ty(ctx);
+	llvm::Constant *true_value = llvm::ConstantInt::getTrue(ctx);
+
+	//the first operand is the node itself, filled in below
+	llvm::TempMDTuple self = llvm::MDNode::getTemporary(ctx, llvm::None);
+	std::vector<llvm::Metadata*> properties = { self.get() };
+	if (must_progress) {
+		properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.mustprogress", nullptr));
+	}
+
+	for (const ASTLoopHint &hint : hints) {
+		const std::string &name = *hint.name.value.ptr_s;
+
+		if (name == "vectorize") {
+			if (hint.value != 1) {
+				properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.vectorize.enable", true_value));
+			}
+			if (hint.value != 0) {
+				properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.vectorize.width",
+															   llvm::ConstantInt::get(i32, hint.value)));
+			}
+		}
+		else if (name == "interleave") {
+			if (hint.value != 0) {
+				properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.interleave.count",
+															   llvm::ConstantInt::get(i32, hint.value)));
+			}
+		}
+		else if (name == "unroll") {
+			if (hint.value == 0) {
+				properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.unroll.enable", nullptr));
+			}
+			else if (hint.value == 1) {
+				properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.unroll.disable", nullptr));
+			}
+			else {
+				properties.push_back(llvm_create_loop_property(ctx, "llvm.loop.unroll.count",
+															   llvm::ConstantInt::get(i32, hint.value)));
+			}
+		}
+		else {
+			assert(false && "unknown loop hint");
+		}
+	}
+
+	llvm::MDNode *loop_id = llvm::MDNode::getDistinct(ctx, properties);
+	loop_id->replaceOperandWith(0, loop_id);
+	return loop_id;
+}
+
+//a tail call becomes musttail when the callee has the caller's type and
+//calling convention, and the caller returns the call's value as is. unlike
+//tail, musttail is not a hint: the backend has to turn the call into a
+//jump at every optimization level, so recursion in tail position runs in
+//constant stack space. calling conventions are only final once the whole
+//module is generated, so this runs last.
+void llvm_guarantee_tail_calls(llvm::Module &module) {
+	for (llvm::Function &fn : module) {
+		for (llvm::BasicBlock &block : fn) {
+			llvm::ReturnInst *ret = llvm::dyn_cast_or_null<llvm::ReturnInst>(block.getTerminator());
+			if (!ret) {
+				continue;
+			}
+
+			llvm::CallInst *call = llvm::dyn_cast_or_null<llvm::CallInst>(ret->getPrevNode());
+			if (!call || !call->isTailCall() || (ret->getReturnValue() && ret->getReturnValue() != call)) {
+				continue;
+			}
+
+			llvm::Function *callee = call->getCalledFunction();
+			if (!callee || callee->isIntrinsic() || callee->getFunctionType() != fn.getFunctionType() ||
+				callee->getCallingConv() != fn.getCallingConv()) {
+				continue;
+			}
+
+			call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+		}
+	}
+}
+
 struct LLVMASTData {
 	llvm::Value* val;
 	llvm::Function *fn;
@@ -71,23 +284,80 @@ struct LLVMCodeGenerator : public IASTVisitor {
 	llvm::Module *module;
 	llvm::LLVMContext &ctx;
 	IRBuilder<>Builder;
+	CodegenOptions options;
     
-    //map variables to values
-	std::map<const TSVariable *, llvm::Value *> var_to_value_map;
+    //map variables to their stack slots. every variable lives in an
+    //alloca in its function's entry block, which mem2reg / SROA turn into
+    //registers.
+	std::map<const TSVariable *, llvm::AllocaInst *> var_to_value_map;
+
+	//nullptr without -g
+	std::unique_ptr<LLVMDebugInfo> debug_info;
+	//the function being generated, if it has debug info
+	llvm::DISubprogram *subprogram;
 
 
 public:
 
-	LLVMCodeGenerator(LLVMContext& context, Module *module) : ctx(context), Builder(context),
-		module(module) {}
+	LLVMCodeGenerator(LLVMContext& context, Module *module, const CodegenOptions& options) :
+		ctx(context), Builder(context), module(module), options(options), subprogram(nullptr) {
+		if (options.debug_info) {
+			assert(options.source_manager && "debug info needs the source manager");
+			this->debug_info.reset(new LLVMDebugInfo(*module, *options.source_manager));
+		}
+
+
+		//IRBuilder puts its flags on every floating point instruction and call
+		//it creates
+		if (options.fast_math) {
+			FastMathFlags flags;
+			flags.setFast();
+			Builder.setFastMathFlags(flags);
+		}
+	}
 
 	virtual void inspect_root(ASTRoot& root) {
-		for (auto statement : root.children) {
+		this->generate_top_level(root.children);
+	}
+
+	void generate_top_level(const std::vector<std::shared_ptr<IAST> >& top_level) {
+		for (auto statement : top_level) {
 			this->get_value_for_ast(*statement);
 		}
+
+		llvm_guarantee_tail_calls(*this->module);
+
+		if (this->debug_info) {
+			this->debug_info->finalize();
+		}
+	}
+
+	//the instructions created from here on belong to ast's line
+	void set_debug_location(IAST& ast) {
+		if (this->subprogram && ast.position.is_valid()) {
+			Builder.SetCurrentDebugLocation(this->debug_info->get_location(ast.position, this->subprogram));
+		}
 	}
 
+	//the value of ast, converted if the type system asked for it
 	llvm::Value* get_value_for_ast(IAST& ast) {
+		//the operation of the parent expression comes after its operands, and
+		//is on the parent's line
+		DebugLoc parent_location = Builder.getCurrentDebugLocation();
+		this->set_debug_location(ast);
+
+		llvm::Value *value = this->get_unconverted_value_for_ast(ast);
+		Builder.SetCurrentDebugLocation(parent_location);
+
+		if (!ast.ts_data || !ast.ts_data->implicit_conversion) {
+			return value;
+		}
+
+		assert(ast.ts_data->type == i32_type && ast.ts_data->implicit_conversion == f32_type);
+		return Builder.CreateSIToFP(value, llvm_achilles_to_llvm_type(*f32_type, this->ctx), "convtmp");
+	}
+
+	llvm::Value* get_unconverted_value_for_ast(IAST& ast) {
 		switch (ast.type) {
 		case ASTType::Literal:
 			return get_value_for_literal(dynamic_cast<ASTLiteral&>(ast));
@@ -103,21 +373,29 @@ public:
 			return this->get_value_for_ast(*stmt.inner);
 		}
 
-		case ASTType::Block: {
-			ASTBlock &block = dynamic_cast<ASTBlock&>(ast);
-			for (auto stmt : block.statements) {
-				//HACK: this will only work for the _fist_ call.
-				return this->get_value_for_ast(*stmt);
-			}
-			//return this->get_value_for_ast(*stmt.inner);
-			break;
+		case ASTType::Block:
+			return this->get_value_for_block(dynamic_cast<ASTBlock&>(ast));
+
+		//a let without a value starts out as 0, every time it is reached,
+		//like in the C backend and the interpreter. mem2reg folds the store.
+		case ASTType::VariableDefinition: {
+			AllocaInst *slot = this->get_slot_for_variable_definition(dynamic_cast<ASTVariableDefinition&>(ast));
+			Value *zero = Constant::getNullValue(slot->getAllocatedType());
+			Builder.CreateStore(zero, slot);
+			return zero;
 		}
+
 		case ASTType::FunctionDefinition: {
 			return this->get_value_for_function_defn(dynamic_cast<ASTFunctionDefinition&>(ast));
 		}
 		case ASTType::PrefixExpr: {
 			return this->get_value_for_prefix_expr(dynamic_cast<ASTPrefixExpr&>(ast));
 		}
+		case ASTType::ForLoop:
+			return this->get_value_for_for_loop(dynamic_cast<ASTForLoop&>(ast));
+
+		case ASTType::If:
+			return this->get_value_for_if(dynamic_cast<ASTIf&>(ast));
 
 		default:
 			std::stringstream error;
@@ -129,38 +407,77 @@ public:
 		assert(false && "should not have gotten here");
 	}
 
+	//allocas in the entry block are the ones mem2reg promotes, so every
+	//slot goes there, wherever its let is
+	llvm::AllocaInst *create_entry_block_alloca(llvm::Function *fn, llvm::Type *type, const std::string &name) {
+		BasicBlock &entry = fn->getEntryBlock();
+		IRBuilder<> entry_builder(&entry, entry.begin());
+		return entry_builder.CreateAlloca(type, nullptr, name);
+	}
+
+	llvm::AllocaInst *create_variable_slot(ASTLiteral &name_ast) {
+		const std::string &name = *name_ast.token.value.ptr_s;
+		const TSVariable *variable = name_ast.ts_data->scope->get_variable(name);
+		assert(this->var_to_value_map.find(variable) == this->var_to_value_map.end());
+
+		Function *fn = Builder.GetInsertBlock()->getParent();
+		AllocaInst *slot = this->create_entry_block_alloca(fn, llvm_achilles_to_llvm_type(*variable->type, this->ctx), name);
+		this->var_to_value_map[variable] = slot;
+		return slot;
+	}
+
+	//calls to f may have been generated already, if it is defined after
+	//its first caller
+	void setup_linkage(llvm::Function &f, ASTFunctionDefinition &fn_defn) {
+		if (this->options.is_exported(fn_defn)) {
+			return;
+		}
+
+		if (!this->options.whole_program) {
+			f.setVisibility(GlobalValue::HiddenVisibility);
+			return;
+		}
+
+		//fastcc is free to pass more in registers than the C convention
+		f.setLinkage(GlobalValue::InternalLinkage);
+		llvm_set_calling_convention(f, CallingConv::Fast);
+	}
+
 	llvm::Function *get_value_for_function_defn(ASTFunctionDefinition &fn_defn){
 		if (fn_defn.body) {
 			Function *f = llvm_create_extern_linkage(fn_defn, this->ctx, this->module);
-            BasicBlock *BB = BasicBlock::Create(getGlobalContext(), "entry", f);
+			this->setup_linkage(*f, fn_defn);
+            BasicBlock *BB = BasicBlock::Create(this->ctx, "entry", f);
             Builder.SetInsertPoint(BB);
+
+			if (this->debug_info) {
+				this->subprogram = this->debug_info->create_function(*f, fn_defn.position);
+				this->set_debug_location(fn_defn);
+			}
             
 			unsigned index = 0;
 			for (Function::arg_iterator arg_val_iter = f->arg_begin(); index != fn_defn.args.size();
 				 ++arg_val_iter, ++index) {
 
 				ASTLiteral &arg_ast = dynamic_cast<ASTLiteral&>(*fn_defn.args[index].first);
-				std::string arg_name = *arg_ast.token.value.ptr_s;
-				arg_val_iter->setName(arg_name);
-
-                //this typecast is mysterious
-				Value *arg_val = arg_val_iter;
-
-				const TSVariable *indexing_var = arg_ast.ts_data->scope->get_variable(arg_name);
-				assert(this->var_to_value_map.find(indexing_var) == this->var_to_value_map.end());
-				this->var_to_value_map[indexing_var] = arg_val;
+				arg_val_iter->setName(*arg_ast.token.value.ptr_s);
 
+				//args can be assigned to, so they get a slot like any let
+				AllocaInst *slot = this->create_variable_slot(arg_ast);
+				Builder.CreateStore(&*arg_val_iter, slot);
 			}
 
-			Value *return_value = this->get_value_for_ast(*fn_defn.body);
-            Builder.CreateRet(return_value);
+			this->generate_return(*fn_defn.body);
+
+			this->subprogram = nullptr;
+			Builder.SetCurrentDebugLocation(DebugLoc());
             
 			verifyFunction(*f);
 			return f;
 
 		}
-        //this is a forward decl.
-        //HACK: for now, assume *all* forward decls to be externs -_-
+		//an extern fn, or a forward declaration. the definition of a forward
+		//declared fn fixes up the linkage, if it is in this module.
 		else {
 			Function *f = llvm_create_extern_linkage(fn_defn, this->ctx, this->module);
 			return f;
@@ -168,10 +485,318 @@ public:
 	
 	}
 
+	//generates ast as the body of the current function, and returns its
+	//value. the value of a block and both branches of an if with an else
+	//are in tail position too: a branch returns on its own instead of
+	//merging into a phi. calls in tail position are marked tail, see
+	//llvm_guarantee_tail_calls. a value that is converted first is not in
+	//tail position.
+	void generate_return(IAST& ast) {
+		bool is_converted = ast.ts_data && ast.ts_data->implicit_conversion;
+
+		if (!is_converted) {
+			switch (ast.type) {
+			case ASTType::Block:
+				this->generate_block_return(dynamic_cast<ASTBlock&>(ast));
+				return;
+
+			case ASTType::Statement:
+				this->generate_return(*dynamic_cast<ASTStatement&>(ast).inner);
+				return;
+
+			case ASTType::If: {
+				ASTIf &if_expr = dynamic_cast<ASTIf&>(ast);
+
+				if (if_expr.else_branch) {
+					this->generate_if_return(if_expr);
+					return;
+				}
+				break;
+			}
+
+			default:
+				break;
+			}
+		}
+
+		Value *value = this->get_value_for_ast(ast);
+		this->set_debug_location(ast);
+
+		if (ast.type == ASTType::FunctionCall && !is_converted) {
+			llvm::cast<CallInst>(value)->setTailCall();
+		}
+
+		Function *fn = Builder.GetInsertBlock()->getParent();
+
+		//a void function throws its body's value away
+		if (fn->getReturnType()->isVoidTy()) {
+			Builder.CreateRetVoid();
+		}
+		else {
+			Builder.CreateRet(value);
+		}
+	}
+
+	//mirrors get_value_for_block and get_block_value_expr
+	void generate_block_return(ASTBlock& block) {
+		IAST *value_expr = get_block_value_expr(block);
+
+		if (!value_expr) {
+			Builder.CreateRetVoid();
+			return;
+		}
+
+		for (auto stmt : block.statements) {
+			if (block.return_expr || stmt != block.statements.back()) {
+				this->get_value_for_ast(*stmt);
+			}
+		}
+
+		this->generate_return(block.return_expr ? *block.return_expr : *block.statements.back());
+	}
+
+	void generate_if_return(ASTIf& if_expr) {
+		Function *fn = Builder.GetInsertBlock()->getParent();
+		Value *condition = this->get_value_for_ast(*if_expr.condition);
+
+		BasicBlock *then_bb = BasicBlock::Create(this->ctx, "if.then", fn);
+		BasicBlock *else_bb = BasicBlock::Create(this->ctx, "if.else", fn);
+		Builder.CreateCondBr(condition, then_bb, else_bb);
+
+		Builder.SetInsertPoint(then_bb);
+		this->generate_return(*if_expr.then_block);
+
+		Builder.SetInsertPoint(else_bb);
+		this->generate_return(*if_expr.else_branch);
+	}
+
+	//a block evaluates to its last expression, nullptr if it has none
+	Value* get_value_for_block(ASTBlock& block) {
+		Value *value = nullptr;
+
+		for (auto stmt : block.statements) {
+			value = this->get_value_for_ast(*stmt);
+		}
+
+		if (block.return_expr) {
+			value = this->get_value_for_ast(*block.return_expr);
+		}
+
+		return value;
+	}
+
+	//lowered the way clang lowers for (int i = start; i < end; i += step):
+	//
+	//        br cond
+	//  cond: br (i < end), body, exit
+	//  body: ...
+	//        br latch
+	// latch: i = i + step
+	//        br cond, !llvm.loop
+	//  exit:
+	//
+	//loop-rotate, indvars and LICM turn it into the canonical form the
+	//vectorizer wants. a loop evaluates to nothing.
+	Value* get_value_for_for_loop(ASTForLoop& for_loop) {
+		Function *fn = Builder.GetInsertBlock()->getParent();
+		Type *i32 = Type::getInt32Ty(this->ctx);
+
+		Value *start = this->get_value_for_ast(*for_loop.start);
+		Value *end = this->get_value_for_ast(*for_loop.end);
+		Value *step = for_loop.step ? this->get_value_for_ast(*for_loop.step) : ConstantInt::get(i32, 1);
+
+		ASTLiteral &induction_var = dynamic_cast<ASTLiteral&>(*for_loop.induction_var);
+		const std::string &name = *induction_var.token.value.ptr_s;
+		AllocaInst *slot = this->create_variable_slot(induction_var);
+		Builder.CreateStore(start, slot);
+
+		BasicBlock *cond_bb = BasicBlock::Create(this->ctx, "loop.cond", fn);
+		BasicBlock *body_bb = BasicBlock::Create(this->ctx, "loop.body", fn);
+		BasicBlock *latch_bb = BasicBlock::Create(this->ctx, "loop.latch", fn);
+		BasicBlock *exit_bb = BasicBlock::Create(this->ctx, "loop.exit", fn);
+		Builder.CreateBr(cond_bb);
+
+		Builder.SetInsertPoint(cond_bb);
+		Value *in_range = Builder.CreateICmpSLT(Builder.CreateLoad(i32, slot, name), end, "loop.in_range");
+		Builder.CreateCondBr(in_range, body_bb, exit_bb);
+
+		Builder.SetInsertPoint(body_bb);
+		this->get_value_for_ast(*for_loop.body);
+		Builder.CreateBr(latch_bb);
+
+		//i wraps like every other i32 add, so a step of 0 loops forever and
+		//a negative one counts down until it wraps, as in the interpreter.
+		//only a loop that can not wrap gets nsw, which gives SCEV an exact
+		//trip count, and is marked as always finishing.
+		Builder.SetInsertPoint(latch_bb);
+		bool counts_up = llvm_loop_counts_up(step, end);
+		Value *load = Builder.CreateLoad(i32, slot, name);
+		Value *next = counts_up ? Builder.CreateNSWAdd(load, step, "loop.next") : Builder.CreateAdd(load, step, "loop.next");
+		Builder.CreateStore(next, slot);
+
+		BranchInst *backedge = Builder.CreateBr(cond_bb);
+		backedge->setMetadata(LLVMContext::MD_loop, llvm_create_loop_metadata(this->ctx, for_loop.hints, counts_up));
+
+		Builder.SetInsertPoint(exit_bb);
+		return nullptr;
+	}
+
+	//        br (condition), then, else
+	//  then: ...
+	//        br end
+	//  else: ...
+	//        br end
+	//   end: phi [then value, then], [else value, else]
+	//
+	//without an else, the condition branches to end directly. only an if
+	//with a type has a phi.
+	Value* get_value_for_if(ASTIf& if_expr) {
+		Function *fn = Builder.GetInsertBlock()->getParent();
+		Value *condition = this->get_value_for_ast(*if_expr.condition);
+
+		BasicBlock *then_bb = BasicBlock::Create(this->ctx, "if.then", fn);
+		BasicBlock *else_bb = if_expr.else_branch ? BasicBlock::Create(this->ctx, "if.else", fn) : nullptr;
+		BasicBlock *end_bb = BasicBlock::Create(this->ctx, "if.end", fn);
+		Builder.CreateCondBr(condition, then_bb, else_bb ? else_bb : end_bb);
+
+		//a nested if leaves the builder in its own end block, which is the
+		//one that branches to ours
+		Builder.SetInsertPoint(then_bb);
+		Value *then_value = this->get_value_for_ast(*if_expr.then_block);
+		BasicBlock *then_end_bb = Builder.GetInsertBlock();
+		Builder.CreateBr(end_bb);
+
+		Value *else_value = nullptr;
+		BasicBlock *else_end_bb = nullptr;
+
+		if (else_bb) {
+			Builder.SetInsertPoint(else_bb);
+			else_value = this->get_value_for_ast(*if_expr.else_branch);
+			else_end_bb = Builder.GetInsertBlock();
+			Builder.CreateBr(end_bb);
+		}
+
+		Builder.SetInsertPoint(end_bb);
+
+		if (if_expr.ts_data->type == void_type) {
+			return nullptr;
+		}
+
+		PHINode *phi = Builder.CreatePHI(llvm_achilles_to_llvm_type(*if_expr.ts_data->type, this->ctx), 2, "iftmp");
+		phi->addIncoming(then_value, then_end_bb);
+		phi->addIncoming(else_value, else_end_bb);
+		return phi;
+	}
+
+	AllocaInst* get_slot_for_variable_definition(ASTVariableDefinition& variable_defn) {
+		return this->create_variable_slot(dynamic_cast<ASTLiteral&>(*variable_defn.name));
+	}
+
+	//the slot the left side of a = stores to
+	AllocaInst* get_slot_for_assignment_target(IAST& target) {
+		if (target.type == ASTType::VariableDefinition) {
+			return this->get_slot_for_variable_definition(dynamic_cast<ASTVariableDefinition&>(target));
+		}
+
+		if (target.type == ASTType::Literal) {
+			ASTLiteral &literal = dynamic_cast<ASTLiteral&>(target);
+
+			if (literal.token.type == TokenType::Identifier) {
+				const TSVariable *variable = literal.ts_data->scope->get_variable(*literal.token.value.ptr_s);
+				auto it = this->var_to_value_map.find(variable);
+				assert(it != this->var_to_value_map.end());
+				return it->second;
+			}
+		}
+
+		std::stringstream error;
+		error << "can only assign to variables:\n";
+		pretty_print_to_stream(target, error);
+		throw std::runtime_error(error.str());
+	}
+
+	//evaluates to the stored value
+	Value* get_value_for_assignment(ASTInfixExpr& assignment) {
+		Value *value = get_value_for_ast(*assignment.right);
+		AllocaInst *slot = this->get_slot_for_assignment_target(*assignment.left);
+
+		Builder.CreateStore(value, slot);
+		return value;
+	}
+
+	//        br (right == 0 || left == INT32_MIN && right == -1), trap, ok
+	//  trap: call trap(right != 0)
+	//        unreachable
+	//    ok: sdiv left, right
+	//
+	//the trap does not return, but may unwind, so calls to it are not
+	//nounwind
+	Value* create_checked_sdiv(Value *left, Value *right) {
+		Function *fn = Builder.GetInsertBlock()->getParent();
+		Type *i32 = Type::getInt32Ty(this->ctx);
+
+		FunctionCallee trap = this->module->getOrInsertFunction(llvm_division_trap_name,
+			FunctionType::get(Type::getVoidTy(this->ctx), { i32 }, false));
+		Function *trap_fn = cast<Function>(trap.getCallee());
+		trap_fn->addFnAttr(Attribute::NoReturn);
+		trap_fn->addFnAttr(Attribute::Cold);
+
+		Value *by_zero = Builder.CreateICmpEQ(right, ConstantInt::get(i32, 0), "div.by_zero");
+		Value *overflow = Builder.CreateAnd(Builder.CreateICmpEQ(left, ConstantInt::get(i32, INT32_MIN)),
+											Builder.CreateICmpEQ(right, ConstantInt::get(i32, -1)), "div.overflow");
+
+		BasicBlock *trap_bb = BasicBlock::Create(this->ctx, "div.trap", fn);
+		BasicBlock *ok_bb = BasicBlock::Create(this->ctx, "div.ok", fn);
+		Builder.CreateCondBr(Builder.CreateOr(by_zero, overflow), trap_bb, ok_bb);
+
+		Builder.SetInsertPoint(trap_bb);
+		Builder.CreateCall(trap, { Builder.CreateZExt(overflow, i32) });
+		Builder.CreateUnreachable();
+
+		Builder.SetInsertPoint(ok_bb);
+		return Builder.CreateSDiv(left, right, "divtmp");
+	}
+
 	Value* get_value_for_infix_expr(ASTInfixExpr& expr) {
+		if (expr.op.type == TokenType::Equals) {
+			return this->get_value_for_assignment(expr);
+		}
+
+		if (expr.op.type == TokenType::CondAnd || expr.op.type == TokenType::CondOr) {
+			return this->get_value_for_logical_expr(expr);
+		}
+
 		Value *left = get_value_for_ast(*expr.left);
 		Value *right = get_value_for_ast(*expr.right);
 
+		if (expr.ts_data->type == bool_type) {
+			return this->get_value_for_comparison(expr, left, right);
+		}
+
+		if (expr.ts_data->type == i32_type) {
+			switch (expr.op.type) {
+			case TokenType::Plus:
+				return Builder.CreateAdd(left, right, "addtmp");
+
+			case TokenType::Minus:
+				return Builder.CreateSub(left, right, "subtmp");
+
+			case TokenType::Multiply:
+				return Builder.CreateMul(left, right, "multmp");
+
+			case TokenType::Divide:
+				if (this->options.checked_division) {
+					return this->create_checked_sdiv(left, right);
+				}
+				return Builder.CreateSDiv(left, right, "divtmp");
+
+			default:
+				assert(false && "unknown infix expression");
+			}
+			return nullptr;
+		}
+
+		assert(expr.ts_data->type == f32_type);
 		switch (expr.op.type) {
 		case TokenType::Plus:
 			return Builder.CreateFAdd(left, right, "addtmp");
@@ -192,10 +817,89 @@ public:
 	}
 
 
+	//the operands have the same type once they are converted
+	Value* get_value_for_comparison(ASTInfixExpr& expr, Value *left, Value *right) {
+		const TSType *operand_type = expr.left->ts_data->implicit_conversion ?
+			expr.left->ts_data->implicit_conversion : expr.left->ts_data->type;
+
+		if (operand_type == f32_type) {
+			//ordered, like C, except != which is true for NaN
+			switch (expr.op.type) {
+			case TokenType::CondL:
+				return Builder.CreateFCmpOLT(left, right, "cmptmp");
+			case TokenType::CondG:
+				return Builder.CreateFCmpOGT(left, right, "cmptmp");
+			case TokenType::CondLEQ:
+				return Builder.CreateFCmpOLE(left, right, "cmptmp");
+			case TokenType::CondGEQ:
+				return Builder.CreateFCmpOGE(left, right, "cmptmp");
+			case TokenType::CondEQ:
+				return Builder.CreateFCmpOEQ(left, right, "cmptmp");
+			case TokenType::CondNEQ:
+				return Builder.CreateFCmpUNE(left, right, "cmptmp");
+			default:
+				assert(false && "unknown comparison");
+			}
+			return nullptr;
+		}
+
+		//i32 and bool
+		switch (expr.op.type) {
+		case TokenType::CondL:
+			return Builder.CreateICmpSLT(left, right, "cmptmp");
+		case TokenType::CondG:
+			return Builder.CreateICmpSGT(left, right, "cmptmp");
+		case TokenType::CondLEQ:
+			return Builder.CreateICmpSLE(left, right, "cmptmp");
+		case TokenType::CondGEQ:
+			return Builder.CreateICmpSGE(left, right, "cmptmp");
+		case TokenType::CondEQ:
+			return Builder.CreateICmpEQ(left, right, "cmptmp");
+		case TokenType::CondNEQ:
+			return Builder.CreateICmpNE(left, right, "cmptmp");
+		default:
+			assert(false && "unknown comparison");
+		}
+		return nullptr;
+	}
+
+	//&& and || only evaluate their right side if the left one does not
+	//decide the result already
+	Value* get_value_for_logical_expr(ASTInfixExpr& expr) {
+		Function *fn = Builder.GetInsertBlock()->getParent();
+		bool is_and = expr.op.type == TokenType::CondAnd;
+
+		Value *left = this->get_value_for_ast(*expr.left);
+		BasicBlock *left_end_bb = Builder.GetInsertBlock();
+
+		BasicBlock *right_bb = BasicBlock::Create(this->ctx, "logic.rhs", fn);
+		BasicBlock *end_bb = BasicBlock::Create(this->ctx, "logic.end", fn);
+		Builder.CreateCondBr(left, is_and ? right_bb : end_bb, is_and ? end_bb : right_bb);
+
+		Builder.SetInsertPoint(right_bb);
+		Value *right = this->get_value_for_ast(*expr.right);
+		BasicBlock *right_end_bb = Builder.GetInsertBlock();
+		Builder.CreateBr(end_bb);
+
+		Builder.SetInsertPoint(end_bb);
+		PHINode *phi = Builder.CreatePHI(Type::getInt1Ty(this->ctx), 2, "logictmp");
+		phi->addIncoming(is_and ? ConstantInt::getFalse(this->ctx) : ConstantInt::getTrue(this->ctx), left_end_bb);
+		phi->addIncoming(right, right_end_bb);
+		return phi;
+	}
+
 	Value *get_value_for_prefix_expr(ASTPrefixExpr& prefix_expr) {
 		switch (prefix_expr.op.type) {
-		case TokenType::Minus:
-			return nullptr;
+		case TokenType::Minus: {
+			Value *operand = get_value_for_ast(*prefix_expr.expr);
+
+			if (prefix_expr.ts_data->type == i32_type) {
+				return Builder.CreateNeg(operand, "negtmp");
+			}
+			return Builder.CreateFNeg(operand, "negtmp");
+		}
+		case TokenType::CondNot:
+			return Builder.CreateNot(get_value_for_ast(*prefix_expr.expr), "nottmp");
 		default:
 			assert(false && "unknown prefx expr");
 			return nullptr;
@@ -215,11 +919,27 @@ public:
 
 		Function *called_fn = module->getFunction(fn_name);
 
+		//builtins (and functions defined further down) are declared on
+		//first use
+		if (!called_fn && func_call.ts_data->scope->has_variable(fn_name)) {
+			const TSVariable *fn_var = func_call.ts_data->scope->get_variable(fn_name);
+			bool is_builtin = !fn_var->decl_pos.is_valid();
+			Intrinsic::ID intrinsic = is_builtin ? llvm_get_builtin_intrinsic(fn_name) : Intrinsic::not_intrinsic;
+
+			//the math intrinsics are overloaded on their float type
+			if (intrinsic != Intrinsic::not_intrinsic) {
+				called_fn = Intrinsic::getDeclaration(this->module, intrinsic, { Type::getFloatTy(this->ctx) });
+			}
+			else {
+				called_fn = llvm_create_extern_linkage(fn_name, *fn_var->type, this->ctx, this->module);
+			}
+		}
+
 		if (!called_fn) {
 			std::stringstream error;
 			error << "undefined function: ";
-			error << fn_name;
-			error << func_call.position;
+			error << fn_name << "\n";
+			error << pretty_print(func_call);
 			throw std::runtime_error(error.str());
 		}
 
@@ -235,7 +955,10 @@ public:
 			args.push_back(this->get_value_for_ast(*func_call.params[i]));
 		}
 
-		return Builder.CreateCall(called_fn, args, "calltmp");
+		//void values can not be named
+		CallInst *call = Builder.CreateCall(called_fn, args, called_fn->getReturnType()->isVoidTy() ? "" : "calltmp");
+		call->setCallingConv(called_fn->getCallingConv());
+		return call;
 		
 		return nullptr;
 	}
@@ -244,14 +967,14 @@ public:
 		switch (literal.token.type) {
 		case TokenType::LiteralInt:
 		{
-			float val = *literal.token.value.ptr_i;
-			return ConstantFP::get(getGlobalContext(), APFloat(val));
+			int32_t val = (int32_t)*literal.token.value.ptr_i;
+			return ConstantInt::get(Type::getInt32Ty(this->ctx), val, true);
 		}
 
 		case TokenType::LiteralFloat:
 		{
 			float val = *literal.token.value.ptr_f;
-			return ConstantFP::get(getGlobalContext(), APFloat(val));
+			return ConstantFP::get(this->ctx, APFloat(val));
 		}
 
 		case TokenType::Identifier:
@@ -262,8 +985,8 @@ public:
 
 			assert(it != this->var_to_value_map.end());
             
-			Value *val = it->second;
-			return val;
+			AllocaInst *slot = it->second;
+			return Builder.CreateLoad(slot->getAllocatedType(), slot, name);
 		}
 
 		default:
@@ -274,14 +997,40 @@ public:
 	}
 };
 
-llvm::Module* generate_llvm_code(IAST& root, TSContext& context) {
-	LLVMContext& ctx = getGlobalContext();
-	Module *module = new Module("marg_val_itern_module", ctx);
-	LLVMCodeGenerator code_genner(ctx, module);
+//generates a module for some of the top level nodes. functions they call
+//that live elsewhere are only declared, and get resolved at link time.
+std::unique_ptr<llvm::Module> generate_llvm_module(const std::vector<std::shared_ptr<IAST> >& top_level,
+												   const std::string& name, llvm::LLVMContext& ctx,
+												   const CodegenOptions& options) {
+	std::unique_ptr<Module> module(new Module(name, ctx));
+	LLVMCodeGenerator code_genner(ctx, module.get(), options);
+
+	code_genner.generate_top_level(top_level);
+	return module;
+}
 
-	code_genner.inspect_root(dynamic_cast<ASTRoot&>(root));
+//throws if the module does not verify
+void llvm_verify_module(llvm::Module& module) {
+	std::string verifier_errors;
+	llvm::raw_string_ostream verifier_stream(verifier_errors);
+
+	if (verifyModule(module, &verifier_stream)) {
+		std::stringstream error;
+		error << "generated invalid llvm module:\n" << verifier_stream.str();
+		throw std::runtime_error(error.str());
+	}
+}
+
+std::unique_ptr<llvm::Module> generate_llvm_code(IAST& root, TSContext& context, llvm::LLVMContext& ctx,
+												 const CodegenOptions& options) {
+	std::unique_ptr<Module> module = generate_llvm_module(dynamic_cast<ASTRoot&>(root).children,
+														  "marg_val_itern_module", ctx, options);
 
 	std::cout << "\n-------\n\nmodule dump: \n";
-	module->dump();
+	std::cout.flush();
+	module->print(llvm::outs(), nullptr);
+	llvm::outs().flush();
+
+	llvm_verify_module(*module);
 	return module;
 }
@@ -0,0 +1,103 @@
+#pragma once
+#include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "file_handling.h"
+
+// line tables for a module, the equivalent of clang's -gline-tables-only:
+// every function gets a DISubprogram and every instruction the location of
+// the expression it was generated for. enough for debuggers and profilers
+// to map machine code back to .acl lines, without describing variables or
+// types.
+class LLVMDebugInfo {
+public:
+
+	LLVMDebugInfo(llvm::Module& module, const SourceManager& source_manager) :
+		module(module), builder(new llvm::DIBuilder(module)), source_manager(source_manager),
+		compile_unit(nullptr) {
+		module.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+		module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+	}
+
+	// attaches a subprogram for a function defined at position to fn. the
+	// locations of its body are created in it.
+	llvm::DISubprogram* create_function(llvm::Function& fn, SourceRange position) {
+		llvm::DIFile *file = this->get_file(position.start);
+		unsigned line = this->get_line_col(position.start).first;
+
+		// line tables do not describe types, an empty signature will do
+		llvm::DISubroutineType *type = this->builder->createSubroutineType(
+			this->builder->getOrCreateTypeArray(llvm::None));
+
+		llvm::DISubprogram::DISPFlags flags = llvm::DISubprogram::SPFlagDefinition;
+		if (fn.hasLocalLinkage()) {
+			flags |= llvm::DISubprogram::SPFlagLocalToUnit;
+		}
+
+		llvm::DISubprogram *subprogram = this->builder->createFunction(
+			file, fn.getName(), fn.getName(), file, line, type, line, llvm::DINode::FlagPrototyped, flags);
+		fn.setSubprogram(subprogram);
+		return subprogram;
+	}
+
+	llvm::DILocation* get_location(SourceRange position, llvm::DISubprogram *scope) {
+		std::pair<unsigned, unsigned> line_col = this->get_line_col(position.start);
+		return llvm::DILocation::get(this->module.getContext(), line_col.first, line_col.second, scope);
+	}
+
+	// has to run once the module is complete
+	void finalize() {
+		this->builder->finalize();
+	}
+
+private:
+
+	llvm::Module& module;
+	std::unique_ptr<llvm::DIBuilder> builder;
+	const SourceManager& source_manager;
+
+	// created for the file of the first function
+	llvm::DICompileUnit *compile_unit;
+	std::map<FileID, llvm::DIFile *> files;
+
+	// 1 based line and column, like DWARF
+	std::pair<unsigned, unsigned> get_line_col(SourceLoc loc) {
+		FileID file = this->source_manager.get_file_id(loc);
+		std::pair<PositionIndex, PositionIndex> line_col =
+			this->source_manager.get_line_table(file).get_line_col(this->source_manager.get_file_offset(loc));
+		return std::make_pair((unsigned)line_col.first, (unsigned)line_col.second + 1);
+	}
+
+	llvm::DIFile* get_file(SourceLoc loc) {
+		FileID id = this->source_manager.get_file_id(loc);
+		auto it = this->files.find(id);
+
+		if (it != this->files.end()) {
+			return it->second;
+		}
+
+		// relative to the directory the compiler ran in otherwise
+		llvm::SmallString<128> path(this->source_manager.get_file_path(id));
+		llvm::sys::fs::make_absolute(path);
+
+		llvm::DIFile *file = this->builder->createFile(llvm::sys::path::filename(path),
+													   llvm::sys::path::parent_path(path));
+		this->files[id] = file;
+
+		if (!this->compile_unit) {
+			this->compile_unit = this->builder->createCompileUnit(
+				llvm::dwarf::DW_LANG_C, file, "achilles", false, "", 0, llvm::StringRef(),
+				llvm::DICompileUnit::LineTablesOnly);
+		}
+		return file;
+	}
+};
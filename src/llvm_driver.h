@@ -0,0 +1,300 @@
+#pragma once
+#include "llvm/Support/FileUtilities.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tokenizer.h"
+#include "file_handling.h"
+#include "ast.h"
+#include "type_system.h"
+#include "diagnostics.h"
+#include "constant_folding.h"
+#include "thread_pool.h"
+#include "llvm_codegen.h"
+#include "llvm_optimizer.h"
+#include "llvm_emit.h"
+#include "llvm_parallel.h"
+#include "llvm_lto.h"
+
+// compiles several input files at once. every file is a module of its own,
+// the way a C file is: it is lexed, parsed, type checked and compiled to an
+// object on its own, and calls to functions of other files go through
+// forward declarations (fn <name>(...) -> <type>;), resolved by the linker.
+// like everywhere else, only export fns are visible outside their file:
+// the rest are internal to it, so two files can each have their own
+// private fn of the same name.
+//
+// files are compiled on a WorkStealingPool. the front end of a file queues
+// its back end on the worker that ran it, and idle workers steal from the
+// others, so a few big files do not leave the rest of the machine idle.
+// what gets printed does not depend on the scheduling: diagnostics come in
+// the order of the input files, and within a file in source order.
+//
+// with --lto=thin, the back end of a file stops after the pre-link
+// pipeline, and a thin link over all of them imports what is worth
+// inlining across files before the objects are compiled, in parallel again.
+
+// -----------------------------------------------------
+// OPTIONS
+
+struct DriverOptions {
+	// -j, 0 = one per core
+	unsigned num_threads;
+
+	// for every file, and for all of them together
+	unsigned error_limit;
+
+	uint64_t const_eval_steps;
+	CodegenOptions codegen;
+	OptimizerOptions optimizer;
+	TargetSelection target;
+	LTOKind lto;
+
+	// passed on to link_executable
+	std::vector<std::string> link_args;
+
+	DriverOptions() : num_threads(0), error_limit(20), const_eval_steps(default_const_eval_steps),
+		lto(LTOKind::None) {}
+};
+
+// -----------------------------------------------------
+// COMPILE UNITS
+
+// one input file, from its source to its object. the tree refers to the
+// tokens, the scopes of the type checker and the tokens of the folder, so
+// they are kept together.
+struct DriverUnit {
+	std::string input_path;
+
+	std::vector<Token> tokens;
+	std::shared_ptr<IAST> ast;
+	std::unique_ptr<TSContext> ts_ctx;
+	std::unique_ptr< ::ConstantFolder> folder;
+	DiagnosticEngine diagnostics;
+
+	// a temporary file, empty until the back end ran
+	std::string object_path;
+	// instead of the object, with --lto=thin
+	std::string bitcode;
+
+	// the type of the fn main the file defines, or nullptr
+	const TSType *main_type;
+
+	// reading the file or the back end failed. the errors of the program
+	// itself are in diagnostics.
+	std::string error;
+
+	// in milliseconds, on the worker that ran it
+	double frontend_ms;
+	double backend_ms;
+
+	DriverUnit(const std::string& input_path, unsigned error_limit) :
+		input_path(input_path), diagnostics(error_limit), main_type(nullptr), frontend_ms(0), backend_ms(0) {}
+};
+
+// lex, parse, type check and fold. false if the file has errors.
+bool run_driver_frontend(DriverUnit& unit, SourceManager& source_manager, const DriverOptions& options) {
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	std::ifstream input_file(unit.input_path);
+
+	if (!input_file) {
+		unit.error = "unable to read " + unit.input_path;
+		return false;
+	}
+
+	// this runs on a worker of the pool, where an exception would end the
+	// whole process
+	try {
+		std::string file_data((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+
+		FileID file = source_manager.add_file(unit.input_path, file_data);
+		SourceRange file_range = source_manager.get_file_range(file);
+
+		unit.tokens = tokenize_string(source_manager.get_file_data(file), file_range.start);
+		unit.ast = parse(unit.tokens, file_range, unit.diagnostics);
+
+		// the files are already spread over the cores
+		unit.ts_ctx.reset(new TSContext(type_system_type_check(unit.ast, unit.diagnostics, 1)));
+		unit.main_type = ts_get_main_type(dynamic_cast<ASTRoot&>(*unit.ast).children);
+
+		if (!unit.diagnostics.has_errors()) {
+			unit.folder.reset(new ::ConstantFolder(options.const_eval_steps));
+			unit.folder->fold(unit.ast);
+		}
+	}
+	catch (std::exception& error) {
+		unit.error = error.what();
+	}
+	catch (...) {
+		unit.error = "internal error in the front end";
+	}
+
+	unit.frontend_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	return unit.error.empty() && !unit.diagnostics.has_errors();
+}
+
+// generate, optimize and compile to a temporary object, or with --lto=thin
+// to bitcode for the thin link
+void run_driver_backend(DriverUnit& unit, const DriverOptions& options, const OptimizerOptions& optimizer) {
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	try {
+		// every definition of the file is in its module
+		CodegenOptions codegen = options.codegen;
+		codegen.whole_program = true;
+		const std::vector<std::shared_ptr<IAST> >& top_level = dynamic_cast<ASTRoot&>(*unit.ast).children;
+
+		if (options.lto == LTOKind::Thin) {
+			unit.bitcode = compile_module_to_thin_lto_bitcode(top_level, unit.input_path, codegen, optimizer,
+															  options.target);
+		}
+		else {
+			unit.object_path = create_temporary_object_path();
+			compile_module_to_object(top_level, unit.input_path, codegen, optimizer, options.target,
+									 unit.object_path);
+		}
+	}
+	catch (std::exception& error) {
+		unit.error = error.what();
+	}
+
+	// a build of many files only needs one tree at a time per thread
+	unit.ast.reset();
+	unit.folder.reset();
+	unit.ts_ctx.reset();
+	unit.tokens.clear();
+
+	unit.backend_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// -----------------------------------------------------
+// DRIVER
+
+// compiles every input file and links the objects into output_path, an
+// object (ld -r) or an executable. prints the diagnostics of every file,
+// in the order of input_paths, and returns the exit status.
+int compile_files(const std::vector<std::string>& input_paths, SourceManager& source_manager,
+				  const DriverOptions& options, EmitKind kind, const std::string& output_path) {
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	// the timing report is not thread safe
+	OptimizerOptions optimizer = options.optimizer;
+	optimizer.time_passes = false;
+
+	std::vector<std::unique_ptr<DriverUnit> > units;
+	for (auto& input_path : input_paths) {
+		units.push_back(std::unique_ptr<DriverUnit>(new DriverUnit(input_path, options.error_limit)));
+	}
+
+	uint64_t num_steals;
+	unsigned num_threads;
+	{
+		WorkStealingPool pool(options.num_threads);
+		num_threads = pool.get_num_threads();
+
+		for (auto& unit : units) {
+			DriverUnit *unit_ptr = unit.get();
+
+			pool.submit([&pool, &source_manager, &options, &optimizer, unit_ptr]() {
+				if (run_driver_frontend(*unit_ptr, source_manager, options)) {
+					pool.submit([&options, &optimizer, unit_ptr]() {
+						run_driver_backend(*unit_ptr, options, optimizer);
+					});
+				}
+			});
+		}
+		pool.wait_idle();
+		num_steals = pool.get_num_steals();
+	}
+
+	Clock::time_point compiled = Clock::now();
+
+	std::vector<std::unique_ptr<llvm::FileRemover> > remove_objects;
+	std::vector<std::string> object_paths;
+	std::vector<std::string> bitcode;
+	DiagnosticEngine diagnostics(options.error_limit);
+	bool failed = false;
+
+	for (auto& unit : units) {
+		if (!unit->object_path.empty()) {
+			remove_objects.emplace_back(new llvm::FileRemover(unit->object_path));
+			object_paths.push_back(unit->object_path);
+		}
+		bitcode.push_back(std::move(unit->bitcode));
+
+		diagnostics.merge(unit->diagnostics);
+
+		if (!unit->error.empty()) {
+			std::cerr << "\n" << unit->input_path << ": " << unit->error << "\n";
+			failed = true;
+		}
+	}
+
+	if (diagnostics.has_errors()) {
+		diagnostics.render(std::cerr, source_manager);
+		return 1;
+	}
+
+	if (failed) {
+		return 1;
+	}
+
+	Clock::time_point thin_linked = compiled;
+
+	try {
+		if (kind == EmitKind::Executable) {
+			const TSType *main_type = nullptr;
+
+			for (auto& unit : units) {
+				main_type = main_type ? main_type : unit->main_type;
+			}
+			ts_check_executable_main(main_type);
+		}
+
+		if (options.lto == LTOKind::Thin) {
+			object_paths = thin_link_to_objects(bitcode, optimizer, options.target, num_threads);
+
+			for (auto& path : object_paths) {
+				remove_objects.emplace_back(new llvm::FileRemover(path));
+			}
+			thin_linked = Clock::now();
+		}
+
+		link_objects(object_paths, kind, output_path, options.link_args);
+	}
+	catch (std::runtime_error& error) {
+		std::cerr << "\n" << error.what() << "\n";
+		return 1;
+	}
+
+	Clock::time_point linked = Clock::now();
+
+	double frontend_ms = 0;
+	double backend_ms = 0;
+
+	for (auto& unit : units) {
+		frontend_ms += unit->frontend_ms;
+		backend_ms += unit->backend_ms;
+	}
+
+	std::cout << "driver: " << units.size() << " files | " << num_threads << " threads | " << num_steals
+		<< " steals\n";
+	std::cout << "driver: compile " << std::chrono::duration<double, std::milli>(compiled - start).count()
+		<< " ms (front end " << frontend_ms << " ms, back end " << backend_ms << " ms on all threads)";
+	if (options.lto == LTOKind::Thin) {
+		std::cout << " | thin link and backends "
+			<< std::chrono::duration<double, std::milli>(thin_linked - compiled).count() << " ms";
+	}
+	std::cout << " | link " << std::chrono::duration<double, std::milli>(linked - thin_linked).count() << " ms\n";
+	std::cout << "wrote: " << output_path << "\n";
+	return 0;
+}
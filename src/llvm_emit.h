@@ -0,0 +1,262 @@
+#pragma once
+#include "llvm/ADT/Triple.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------
+// OPTIONS
+
+enum class EmitKind {
+	None,
+	Object,
+	Assembly,
+	Bitcode,
+	// an object file, linked with the system's C compiler driver
+	Executable,
+	// C99 source, only written by the C backend in c_codegen.h
+	C,
+};
+
+// parses the value of --emit=. returns false for anything unknown.
+bool parse_emit_kind(const std::string& name, EmitKind& kind) {
+	if (name == "obj") { kind = EmitKind::Object; }
+	else if (name == "asm") { kind = EmitKind::Assembly; }
+	else if (name == "bc") { kind = EmitKind::Bitcode; }
+	else if (name == "exe") { kind = EmitKind::Executable; }
+	else if (name == "c") { kind = EmitKind::C; }
+	else { return false; }
+
+	return true;
+}
+
+// <input without extension>.o / .s / .bc / .c, or a.out for executables
+std::string get_default_output_path(const std::string& input_path, EmitKind kind) {
+	if (kind == EmitKind::Executable) {
+		return "a.out";
+	}
+
+	llvm::SmallString<128> path(input_path);
+
+	switch (kind) {
+	case EmitKind::Object:
+		llvm::sys::path::replace_extension(path, "o");
+		break;
+
+	case EmitKind::Assembly:
+		llvm::sys::path::replace_extension(path, "s");
+		break;
+
+	case EmitKind::Bitcode:
+		llvm::sys::path::replace_extension(path, "bc");
+		break;
+
+	case EmitKind::C:
+		llvm::sys::path::replace_extension(path, "c");
+		break;
+
+	default:
+		assert(false && "no output file for emit kind");
+	}
+
+	return path.str().str();
+}
+
+// -----------------------------------------------------
+// EMISSION
+
+// writes object code or assembly for module to output_path. the module
+// has to be set up for target_machine already, llvm_optimize_module does
+// that.
+void llvm_emit_machine_code(llvm::Module& module, llvm::TargetMachine& target_machine,
+							llvm::CodeGenFileType file_type, const std::string& output_path) {
+	std::error_code open_error;
+	llvm::raw_fd_ostream out(output_path, open_error, llvm::sys::fs::OF_None);
+
+	if (open_error) {
+		throw std::runtime_error("unable to open " + output_path + ": " + open_error.message());
+	}
+
+	// the backend still runs on the legacy pass manager
+	llvm::legacy::PassManager codegen_passes;
+
+	if (target_machine.addPassesToEmitFile(codegen_passes, out, nullptr, file_type)) {
+		throw std::runtime_error("target can not emit this kind of file: " + output_path);
+	}
+
+	codegen_passes.run(module);
+	out.flush();
+}
+
+void llvm_emit_bitcode(llvm::Module& module, const std::string& output_path) {
+	std::error_code open_error;
+	llvm::raw_fd_ostream out(output_path, open_error, llvm::sys::fs::OF_None);
+
+	if (open_error) {
+		throw std::runtime_error("unable to open " + output_path + ": " + open_error.message());
+	}
+
+	llvm::WriteBitcodeToFile(module, out);
+	out.flush();
+}
+
+// runs program (looked up in PATH) with object_paths, then extra_args.
+// throws if it can not be run or fails.
+void run_linker(const std::string& program, const std::vector<std::string>& object_paths,
+				const std::vector<std::string>& extra_args, const std::string& output_path) {
+	llvm::ErrorOr<std::string> program_path = llvm::sys::findProgramByName(program);
+
+	if (!program_path) {
+		throw std::runtime_error("unable to find the linker " + program + " in PATH");
+	}
+
+	std::vector<llvm::StringRef> args;
+	args.push_back(*program_path);
+
+	for (auto& object_path : object_paths) {
+		args.push_back(object_path);
+	}
+
+	for (auto& arg : extra_args) {
+		args.push_back(arg);
+	}
+
+	args.push_back("-o");
+	args.push_back(output_path);
+
+	std::string exec_error;
+	int status = llvm::sys::ExecuteAndWait(*program_path, args, llvm::None, {}, 0, 0, &exec_error);
+
+	if (status != 0) {
+		std::stringstream error;
+		error << "linking " << output_path << " failed";
+
+		if (!exec_error.empty()) {
+			error << ": " << exec_error;
+		}
+		else {
+			error << " with exit status " << status;
+		}
+		throw std::runtime_error(error.str());
+	}
+}
+
+// links object files into an executable with the system's cc, which knows
+// where the C runtime and libm live. one of the objects has to define main.
+// link_args go after the objects, eg. extra libraries.
+void link_executable(const std::vector<std::string>& object_paths, const std::string& output_path,
+					 const std::vector<std::string>& link_args = {}) {
+	std::vector<std::string> args = link_args;
+	args.push_back("-lm");
+	run_linker("cc", object_paths, args, output_path);
+}
+
+// combines object files into one relocatable object
+void link_relocatable_object(const std::vector<std::string>& object_paths, const std::string& output_path) {
+	run_linker("ld", object_paths, { "-r" }, output_path);
+}
+
+// compiler-rt's library that writes the counters of instrumented code to
+// disk when the program exits. it is not part of LLVM's libraries, clang
+// ships it in its resource directory, which is found relative to clang's
+// binary: <bin>/../lib/clang/<version>/lib/linux. returns an empty string
+// if there is no clang in PATH, or it comes without the profile runtime.
+std::string find_profile_runtime() {
+	llvm::ErrorOr<std::string> clang_path = llvm::sys::findProgramByName("clang");
+	llvm::SmallString<128> real_clang_path;
+
+	if (!clang_path || llvm::sys::fs::real_path(*clang_path, real_clang_path)) {
+		return "";
+	}
+
+	llvm::SmallString<128> resource_root = llvm::sys::path::parent_path(llvm::sys::path::parent_path(real_clang_path));
+	llvm::sys::path::append(resource_root, "lib", "clang");
+
+	std::string library = "libclang_rt.profile-" +
+		llvm::Triple(llvm::sys::getDefaultTargetTriple()).getArchName().str() + ".a";
+	std::error_code error;
+
+	for (llvm::sys::fs::directory_iterator it(resource_root, error), end; it != end && !error;
+		 it.increment(error)) {
+		llvm::SmallString<128> path(it->path());
+		llvm::sys::path::append(path, "lib", "linux", library);
+
+		if (llvm::sys::fs::exists(path)) {
+			return path.str().str();
+		}
+	}
+	return "";
+}
+
+// what clang adds to the link for -fprofile-generate. the runtime is only
+// pulled in through the undefined reference, instrumented code does not
+// reference it on linux.
+std::vector<std::string> get_profile_runtime_link_args(const std::string& profile_runtime_path) {
+	return { "-Wl,-u,__llvm_profile_runtime", profile_runtime_path };
+}
+
+// a fresh, empty file for an intermediate object. the caller removes it.
+std::string create_temporary_object_path() {
+	llvm::SmallString<128> object_path;
+	std::error_code temp_error = llvm::sys::fs::createTemporaryFile("achilles", "o", object_path);
+
+	if (temp_error) {
+		throw std::runtime_error("unable to create a temporary object file: " + temp_error.message());
+	}
+	return object_path.str().str();
+}
+
+// writes module to output_path in the requested form
+void llvm_emit_module(llvm::Module& module, llvm::TargetMachine& target_machine,
+					  EmitKind kind, const std::string& output_path,
+					  const std::vector<std::string>& link_args = {}) {
+	switch (kind) {
+	case EmitKind::None:
+		return;
+
+	case EmitKind::Object:
+		llvm_emit_machine_code(module, target_machine, llvm::CGFT_ObjectFile, output_path);
+		return;
+
+	case EmitKind::Assembly:
+		llvm_emit_machine_code(module, target_machine, llvm::CGFT_AssemblyFile, output_path);
+		return;
+
+	case EmitKind::Bitcode:
+		llvm_emit_bitcode(module, output_path);
+		return;
+
+	case EmitKind::C:
+		throw std::runtime_error("C is only emitted by the C backend, see emit_c");
+
+	case EmitKind::Executable: {
+		// the C runtime calls it as int main(void)
+		llvm::Function *main = module.getFunction("main");
+		llvm::FunctionType *main_type = llvm::FunctionType::get(llvm::Type::getInt32Ty(module.getContext()), false);
+
+		if (!main || main->isDeclaration() || main->getFunctionType() != main_type) {
+			throw std::runtime_error("an executable needs a fn main() -> i32");
+		}
+
+		std::string object_path = create_temporary_object_path();
+
+		// the object is deleted even if linking fails
+		llvm::FileRemover remove_object(object_path);
+
+		llvm_emit_machine_code(module, target_machine, llvm::CGFT_ObjectFile, object_path);
+		link_executable({ object_path }, output_path, link_args);
+		return;
+	}
+	}
+}
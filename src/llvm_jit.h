@@ -0,0 +1,631 @@
+#pragma once
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <stdint.h>
+
+#include "llvm_codegen.h"
+#include "llvm_emit.h"
+
+// -----------------------------------------------------
+// VALUES CROSSING THE HOST <-> JIT BOUNDARY
+
+enum class JITValueKind {
+	Void,
+	I32,
+	F32,
+	F64,
+	// an i1, stored in a byte
+	Bool,
+};
+
+const char* get_jit_value_kind_name(JITValueKind kind) {
+	switch (kind) {
+	case JITValueKind::Void: return "void";
+	case JITValueKind::I32: return "i32";
+	case JITValueKind::F32: return "f32";
+	case JITValueKind::F64: return "f64";
+	case JITValueKind::Bool: return "bool";
+	}
+	return "";
+}
+
+struct JITValue {
+	JITValueKind kind;
+
+	union {
+		int32_t i32;
+		float f32;
+		double f64;
+		bool b;
+	};
+
+	JITValue() : kind(JITValueKind::Void), f64(0) {}
+
+	// points at the storage the entry trampoline reads / writes
+	void* get_storage() {
+		return &this->i32;
+	}
+};
+
+std::ostream& operator<<(std::ostream& out, const JITValue& value) {
+	switch (value.kind) {
+	case JITValueKind::Void:
+		out << "void";
+		break;
+
+	case JITValueKind::I32:
+		out << value.i32;
+		break;
+
+	case JITValueKind::F32:
+		out << value.f32;
+		break;
+
+	case JITValueKind::F64:
+		out << value.f64;
+		break;
+
+	case JITValueKind::Bool:
+		out << (value.b ? "true" : "false");
+		break;
+	}
+	return out;
+}
+
+JITValueKind llvm_get_jit_value_kind(llvm::Type *type) {
+	if (type->isVoidTy()) {
+		return JITValueKind::Void;
+	}
+	if (type->isIntegerTy(32)) {
+		return JITValueKind::I32;
+	}
+	if (type->isIntegerTy(1)) {
+		return JITValueKind::Bool;
+	}
+	if (type->isFloatTy()) {
+		return JITValueKind::F32;
+	}
+	if (type->isDoubleTy()) {
+		return JITValueKind::F64;
+	}
+
+	assert(false && "type can not be passed to a jitted function");
+	return JITValueKind::Void;
+}
+
+// the whole of str has to be the number, and fit
+static bool parse_jit_i32(const std::string& str, int32_t& i) {
+	const char *start = str.c_str();
+	char *end = nullptr;
+
+	errno = 0;
+	long value = std::strtol(start, &end, 10);
+
+	if (end == start || *end != '\0' || errno == ERANGE || value < INT32_MIN || value > INT32_MAX) {
+		return false;
+	}
+	i = (int32_t)value;
+	return true;
+}
+
+static bool parse_jit_f32(const std::string& str, float& f) {
+	const char *start = str.c_str();
+	char *end = nullptr;
+
+	errno = 0;
+	f = std::strtof(start, &end);
+	return end != start && *end == '\0' && errno != ERANGE;
+}
+
+static bool parse_jit_f64(const std::string& str, double& f) {
+	const char *start = str.c_str();
+	char *end = nullptr;
+
+	errno = 0;
+	f = std::strtod(start, &end);
+	return end != start && *end == '\0' && errno != ERANGE;
+}
+
+// false if str is not a value of the kind
+bool parse_jit_value(JITValueKind kind, const std::string& str, JITValue& value) {
+	value.kind = kind;
+
+	switch (kind) {
+	case JITValueKind::I32:
+		return parse_jit_i32(str, value.i32);
+
+	case JITValueKind::F32:
+		return parse_jit_f32(str, value.f32);
+
+	case JITValueKind::F64:
+		return parse_jit_f64(str, value.f64);
+
+	case JITValueKind::Bool: {
+		int32_t i = 0;
+
+		if (str == "true" || str == "false") {
+			value.b = str == "true";
+			return true;
+		}
+		if (!parse_jit_i32(str, i)) {
+			return false;
+		}
+		value.b = i != 0;
+		return true;
+	}
+
+	case JITValueKind::Void:
+		assert(false && "can not parse a void value");
+	}
+	return false;
+}
+
+// the argument / return kinds of an entry function. taken from the module
+// before it is handed to the jit, since the jit owns it afterwards.
+struct JITSignature {
+	std::vector<JITValueKind> args;
+	JITValueKind return_kind;
+};
+
+// -----------------------------------------------------
+// ENTRY TRAMPOLINES
+
+// calling a jitted function needs its exact C type on the host side. we
+// do not know that at compile time, so every entry point gets a wrapper
+//     void <name>(i8 **args, i8 *ret)
+// that loads the arguments from args, makes the call, and stores the
+// result into ret. that one type works for every entry.
+typedef void (*JITEntryFn)(void **args, void *ret);
+
+std::string llvm_get_jit_entry_name(const std::string& fn_name) {
+	return "__achilles_jit_entry_" + fn_name;
+}
+
+llvm::Function* llvm_create_jit_entry_trampoline(llvm::Module& module, llvm::Function *fn) {
+	llvm::LLVMContext& ctx = module.getContext();
+	llvm::Type *i8_ptr = llvm::Type::getInt8PtrTy(ctx);
+
+	llvm::FunctionType *entry_type = llvm::FunctionType::get(
+		llvm::Type::getVoidTy(ctx), { i8_ptr->getPointerTo(), i8_ptr }, false);
+	llvm::Function *entry = llvm::Function::Create(entry_type, llvm::Function::ExternalLinkage,
+												   llvm_get_jit_entry_name(fn->getName().str()), &module);
+
+	llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "entry", entry));
+	llvm::Value *args_array = entry->getArg(0);
+	llvm::Value *ret_slot = entry->getArg(1);
+
+	std::vector<llvm::Value *> args;
+	for (unsigned i = 0; i < fn->arg_size(); ++i) {
+		llvm::Type *arg_type = fn->getFunctionType()->getParamType(i);
+
+		llvm::Value *arg_slot_ptr = builder.CreateConstGEP1_32(i8_ptr, args_array, i);
+		llvm::Value *arg_slot = builder.CreateLoad(i8_ptr, arg_slot_ptr);
+		llvm::Value *typed_slot = builder.CreateBitCast(arg_slot, arg_type->getPointerTo());
+		args.push_back(builder.CreateLoad(arg_type, typed_slot));
+	}
+
+	llvm::CallInst *result = builder.CreateCall(fn, args);
+	result->setCallingConv(fn->getCallingConv());
+
+	if (!fn->getReturnType()->isVoidTy()) {
+		llvm::Value *typed_ret = builder.CreateBitCast(ret_slot, fn->getReturnType()->getPointerTo());
+		builder.CreateStore(result, typed_ret);
+	}
+	builder.CreateRetVoid();
+
+	return entry;
+}
+
+// -----------------------------------------------------
+// PROFILER SUPPORT
+
+// jitted code is not in any file, so profilers can not name it on their
+// own. perf has two ways to learn about it.
+enum class PerfSupport {
+	None,
+	// /tmp/perf-<pid>.map: a line with start, size and name per function.
+	// perf report reads it by itself.
+	Map,
+	// a jitdump file with the code and, with -g, its line tables. has to go
+	// through perf inject --jit before perf report, see
+	// llvm::JITEventListener::createPerfJITEventListener.
+	JITDump,
+};
+
+// parses the value of --perf=: map or jitdump
+bool parse_perf_support(const std::string& name, PerfSupport& support) {
+	if (name == "map") { support = PerfSupport::Map; }
+	else if (name == "jitdump") { support = PerfSupport::JITDump; }
+	else { return false; }
+
+	return true;
+}
+
+// writes the perf map of the process, as objects are loaded
+class PerfMapEventListener : public llvm::JITEventListener {
+public:
+
+	PerfMapEventListener() {
+		this->path = "/tmp/perf-" + std::to_string(llvm::sys::Process::getProcessId()) + ".map";
+		std::error_code open_error;
+		this->out.reset(new llvm::raw_fd_ostream(this->path, open_error, llvm::sys::fs::OF_Text));
+
+		if (open_error) {
+			throw std::runtime_error("unable to open " + this->path + ": " + open_error.message());
+		}
+	}
+
+	const std::string& get_path() const {
+		return this->path;
+	}
+
+	// the object for debugging has its symbols at the addresses the code
+	// was loaded at
+	virtual void notifyObjectLoaded(ObjectKey key, const llvm::object::ObjectFile& object,
+									const llvm::RuntimeDyld::LoadedObjectInfo& info) {
+		llvm::object::OwningBinary<llvm::object::ObjectFile> debug_object = info.getObjectForDebug(object);
+
+		if (!debug_object.getBinary()) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+
+		for (auto& symbol_size : llvm::object::computeSymbolSizes(*debug_object.getBinary())) {
+			const llvm::object::SymbolRef& symbol = symbol_size.first;
+			llvm::Expected<llvm::object::SymbolRef::Type> type = symbol.getType();
+			llvm::Expected<llvm::StringRef> name = symbol.getName();
+			llvm::Expected<uint64_t> address = symbol.getAddress();
+
+			if (!type || !name || !address || *type != llvm::object::SymbolRef::ST_Function) {
+				llvm::consumeError(type.takeError());
+				llvm::consumeError(name.takeError());
+				llvm::consumeError(address.takeError());
+				continue;
+			}
+
+			*this->out << llvm::format_hex_no_prefix(*address, 1) << " "
+				<< llvm::format_hex_no_prefix(symbol_size.second, 1) << " " << *name << "\n";
+		}
+
+		// perf reads the map once the process is gone, and it may not exit
+		// cleanly
+		this->out->flush();
+	}
+
+private:
+
+	std::string path;
+	std::unique_ptr<llvm::raw_fd_ostream> out;
+	std::mutex mutex;
+};
+
+// -----------------------------------------------------
+// JIT
+
+// wraps ORC's LLJIT. symbols that the module does not define (sin, ...)
+// are looked up in the host process.
+class AchillesJIT {
+public:
+
+	static void initialize_native_target() {
+		llvm::InitializeNativeTarget();
+		llvm::InitializeNativeTargetAsmPrinter();
+	}
+
+	// with a listener, every object the jit loads is reported to it. the
+	// listener has to outlive the jit.
+	AchillesJIT(llvm::JITEventListener *listener = nullptr) : num_dylibs(0) {
+		llvm::orc::LLJITBuilder builder;
+
+		// the same linking layer LLJIT uses by default on ELF, plus the listener
+		if (listener) {
+			builder.setObjectLinkingLayerCreator([listener](llvm::orc::ExecutionSession& session,
+															const llvm::Triple& triple) {
+				std::unique_ptr<llvm::orc::RTDyldObjectLinkingLayer> layer(
+					new llvm::orc::RTDyldObjectLinkingLayer(session, []() {
+						return std::unique_ptr<llvm::RuntimeDyld::MemoryManager>(new llvm::SectionMemoryManager());
+					}));
+				layer->registerJITEventListener(*listener);
+				return std::unique_ptr<llvm::orc::ObjectLayer>(std::move(layer));
+			});
+		}
+
+		this->jit = this->exit_on_error(builder.create());
+
+		char global_prefix = this->jit->getDataLayout().getGlobalPrefix();
+		this->jit->getMainJITDylib().addGenerator(this->exit_on_error(
+			llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(global_prefix)));
+	}
+
+	// makes a function of this process available to jitted code under name
+	void define_host_function(const std::string& name, void *address) {
+		llvm::orc::SymbolMap symbols;
+		symbols[this->jit->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(
+			llvm::pointerToJITTargetAddress(address), llvm::JITSymbolFlags::Exported);
+		this->exit_on_error(this->jit->getMainJITDylib().define(llvm::orc::absoluteSymbols(symbols)));
+	}
+
+	const llvm::DataLayout& get_data_layout() const {
+		return this->jit->getDataLayout();
+	}
+
+	const llvm::Triple& get_target_triple() const {
+		return this->jit->getTargetTriple();
+	}
+
+	void add_module(std::unique_ptr<llvm::LLVMContext> ctx, std::unique_ptr<llvm::Module> module) {
+		module->setDataLayout(this->jit->getDataLayout());
+		this->exit_on_error(this->jit->addIRModule(
+			llvm::orc::ThreadSafeModule(std::move(module), std::move(ctx))));
+	}
+
+	// adds module to a JITDylib of its own, so that it can define the same
+	// functions as other modules, and returns the entry of fn_name in it.
+	// the symbols it does not define are looked up in the main JITDylib,
+	// and so in the process. safe to call from any thread.
+	JITEntryFn add_module_in_own_dylib(std::unique_ptr<llvm::LLVMContext> ctx, std::unique_ptr<llvm::Module> module,
+									   const std::string& fn_name) {
+		std::string dylib_name = "dylib_" + std::to_string(this->num_dylibs.fetch_add(1));
+		llvm::orc::JITDylib &dylib = this->exit_on_error(this->jit->createJITDylib(dylib_name));
+		dylib.addToLinkOrder(this->jit->getMainJITDylib());
+
+		module->setDataLayout(this->jit->getDataLayout());
+		this->exit_on_error(this->jit->addIRModule(
+			dylib, llvm::orc::ThreadSafeModule(std::move(module), std::move(ctx))));
+
+		auto symbol = this->exit_on_error(this->jit->lookup(dylib, llvm_get_jit_entry_name(fn_name)));
+		return reinterpret_cast<JITEntryFn>(symbol.getAddress());
+	}
+
+	// an object compiled ahead of time. it is only linked in, nothing is
+	// compiled.
+	void add_object_file(const std::string& path) {
+		std::unique_ptr<llvm::MemoryBuffer> object = this->exit_on_error(
+			llvm::errorOrToExpected(llvm::MemoryBuffer::getFile(path)));
+		this->exit_on_error(this->jit->addObjectFile(std::move(object)));
+	}
+
+	// LLJIT compiles a module the first time a symbol in it is looked up,
+	// so this is where the compile latency is paid.
+	JITEntryFn lookup_entry(const std::string& fn_name) {
+		auto symbol = this->exit_on_error(this->jit->lookup(llvm_get_jit_entry_name(fn_name)));
+		return reinterpret_cast<JITEntryFn>(symbol.getAddress());
+	}
+
+private:
+
+	std::unique_ptr<llvm::orc::LLJIT> jit;
+	llvm::ExitOnError exit_on_error;
+	std::atomic<unsigned> num_dylibs;
+};
+
+// -----------------------------------------------------
+// DRIVER
+
+struct JITRunOptions {
+	std::string entry_name;
+
+	// one per argument of the entry function
+	std::vector<std::string> args;
+
+	// if non zero, time this many calls after the first one
+	uint64_t bench_calls;
+
+	// shared libraries loaded into the process before compiling, so that
+	// the module can call into them, eg. libmvec.so.1
+	std::vector<std::string> libraries;
+
+	// --perf=: tell perf where the jitted functions are
+	PerfSupport perf;
+
+	JITRunOptions() : entry_name("main"), bench_calls(0), perf(PerfSupport::None) {}
+};
+
+// the arguments and result of a call to an entry function
+struct JITEntryCall {
+	std::vector<JITValue> args;
+	std::vector<void *> arg_ptrs;
+	JITValue result;
+};
+
+// checks that the entry function can be called with the given arguments,
+// adds its trampoline to the module and loads the libraries. prints why
+// and returns false if it can not be called.
+bool llvm_prepare_jit_entry(llvm::Module& module, const JITRunOptions& options, const char *tier,
+							JITEntryCall& call) {
+	llvm::Function *fn = module.getFunction(options.entry_name);
+
+	if (!fn || fn->isDeclaration()) {
+		std::cerr << "\n" << tier << ": no function with a body named: " << options.entry_name << "\n";
+		return false;
+	}
+
+	if (fn->arg_size() != options.args.size()) {
+		std::cerr << "\n" << tier << ": " << options.entry_name << " takes " << fn->arg_size()
+			<< " arguments, " << options.args.size() << " given\n";
+		return false;
+	}
+
+	for (auto& library : options.libraries) {
+		std::string load_error;
+
+		if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(library.c_str(), &load_error)) {
+			std::cerr << "\n" << tier << ": unable to load " << library << ": " << load_error << "\n";
+			return false;
+		}
+	}
+
+	JITSignature signature;
+	for (unsigned i = 0; i < fn->arg_size(); ++i) {
+		signature.args.push_back(llvm_get_jit_value_kind(fn->getFunctionType()->getParamType(i)));
+	}
+	signature.return_kind = llvm_get_jit_value_kind(fn->getReturnType());
+
+	llvm_create_jit_entry_trampoline(module, fn);
+
+	for (unsigned i = 0; i < options.args.size(); ++i) {
+		JITValue arg;
+
+		if (!parse_jit_value(signature.args[i], options.args[i], arg)) {
+			std::cerr << "\n" << tier << ": argument " << i << " to " << options.entry_name << " is not a valid "
+				<< get_jit_value_kind_name(signature.args[i]) << ": " << options.args[i] << "\n";
+			return false;
+		}
+		call.args.push_back(arg);
+	}
+
+	for (auto& arg : call.args) {
+		call.arg_ptrs.push_back(arg.get_storage());
+	}
+
+	call.result.kind = signature.return_kind;
+	return true;
+}
+
+// calls the entry function once and prints the result
+void call_jit_entry(JITEntryFn entry, JITEntryCall& call, const JITRunOptions& options, const char *tier) {
+	entry(call.arg_ptrs.data(), call.result.get_storage());
+
+	std::cout << "\n-------\n\n" << tier << ": " << options.entry_name << "(";
+	for (unsigned i = 0; i < call.args.size(); ++i) {
+		std::cout << (i == 0 ? "" : ", ") << call.args[i];
+	}
+	std::cout << ") = " << call.result << "\n";
+}
+
+// times options.bench_calls more calls through the trampoline
+void bench_jit_entry(JITEntryFn entry, JITEntryCall& call, const JITRunOptions& options, const char *tier) {
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point calls_start = Clock::now();
+
+	for (uint64_t i = 0; i < options.bench_calls; ++i) {
+		entry(call.arg_ptrs.data(), call.result.get_storage());
+	}
+
+	Clock::time_point calls_end = Clock::now();
+	double calls_ns = std::chrono::duration<double, std::nano>(calls_end - calls_start).count();
+
+	std::cout << tier << " calls: " << options.bench_calls << " | " <<
+		calls_ns / options.bench_calls << " ns per call\n";
+}
+
+// compiles the module, calls the entry function once and prints the
+// result. with bench_calls set, also reports the compile latency and the
+// cost of a call through the trampoline.
+int run_jit(std::unique_ptr<llvm::LLVMContext> ctx, std::unique_ptr<llvm::Module> module,
+			const JITRunOptions& options) {
+	JITEntryCall call;
+
+	// the order parameters are destroyed in is up to the compiler, and the
+	// module has to go before its context
+	if (!llvm_prepare_jit_entry(*module, options, "jit", call)) {
+		module.reset();
+		return 1;
+	}
+
+	std::unique_ptr<PerfMapEventListener> perf_map;
+	llvm::JITEventListener *listener = nullptr;
+
+	if (options.perf == PerfSupport::Map) {
+		perf_map.reset(new PerfMapEventListener());
+		listener = perf_map.get();
+	}
+	else if (options.perf == PerfSupport::JITDump) {
+		// owned by LLVM, and only there if LLVM was built with LLVM_USE_PERF
+		listener = llvm::JITEventListener::createPerfJITEventListener();
+
+		if (!listener) {
+			std::cerr << "\njit: this LLVM was built without jitdump support (LLVM_USE_PERF)\n";
+			module.reset();
+			return 1;
+		}
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point compile_start = Clock::now();
+
+	AchillesJIT jit(listener);
+	jit.add_module(std::move(ctx), std::move(module));
+	JITEntryFn entry = jit.lookup_entry(options.entry_name);
+
+	Clock::time_point compile_end = Clock::now();
+
+	call_jit_entry(entry, call, options, "jit");
+
+	if (perf_map) {
+		std::cout << "jit: perf map: " << perf_map->get_path() << "\n";
+	}
+
+	if (options.bench_calls > 0) {
+		double compile_ms = std::chrono::duration<double, std::milli>(compile_end - compile_start).count();
+		std::cout << "jit compile latency: " << compile_ms << " ms\n";
+		bench_jit_entry(entry, call, options, "jit");
+	}
+
+	return 0;
+}
+
+// the entry function of a copy of the module, compiled to an object with
+// target_machine the way --emit=obj does it, and only then loaded to be
+// called. loading is all it costs to start, the compile happened ahead of
+// time. module has to be optimized already.
+int run_aot(const llvm::Module& module, llvm::TargetMachine& target_machine, const JITRunOptions& options) {
+	std::unique_ptr<llvm::Module> aot_module = llvm::CloneModule(module);
+	JITEntryCall call;
+
+	if (!llvm_prepare_jit_entry(*aot_module, options, "aot", call)) {
+		return 1;
+	}
+
+	std::string object_path = create_temporary_object_path();
+	llvm::FileRemover remove_object(object_path);
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point compile_start = Clock::now();
+
+	llvm_emit_machine_code(*aot_module, target_machine, llvm::CGFT_ObjectFile, object_path);
+
+	Clock::time_point load_start = Clock::now();
+
+	AchillesJIT jit;
+	jit.add_object_file(object_path);
+	JITEntryFn entry = jit.lookup_entry(options.entry_name);
+
+	Clock::time_point load_end = Clock::now();
+
+	call_jit_entry(entry, call, options, "aot");
+
+	if (options.bench_calls > 0) {
+		auto milliseconds = [](Clock::time_point from, Clock::time_point to) {
+			return std::chrono::duration<double, std::milli>(to - from).count();
+		};
+
+		std::cout << "aot compile (ahead of time): " << milliseconds(compile_start, load_start) << " ms\n";
+		std::cout << "aot load latency: " << milliseconds(load_start, load_end) << " ms\n";
+		bench_jit_entry(entry, call, options, "aot");
+	}
+
+	return 0;
+}
@@ -0,0 +1,276 @@
+#pragma once
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/LTO/Config.h"
+#include "llvm/LTO/LTO.h"
+#include "llvm/Support/Caching.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "llvm_codegen.h"
+#include "llvm_optimizer.h"
+#include "llvm_emit.h"
+#include "llvm_parallel.h"
+
+// -----------------------------------------------------
+// OPTIONS
+
+enum class LTOKind {
+	None,
+	// every module is optimized on its own first and summarized. a thin
+	// link over the summaries decides what to import where, then the
+	// modules are optimized again and compiled in parallel, each with the
+	// functions it calls from the others.
+	Thin,
+};
+
+// parses the value of --lto=. returns false for anything unknown.
+bool parse_lto_kind(const std::string& name, LTOKind& kind) {
+	if (name == "none") { kind = LTOKind::None; }
+	else if (name == "thin") { kind = LTOKind::Thin; }
+	else { return false; }
+
+	return true;
+}
+
+// -----------------------------------------------------
+// PRE-LINK
+
+// like compile_module_to_object, but stops after the ThinLTO pre-link
+// pipeline and returns the module as bitcode with its summary.
+std::string compile_module_to_thin_lto_bitcode(const std::vector<std::shared_ptr<IAST> >& top_level,
+											   const std::string& name, const CodegenOptions& codegen_options,
+											   const OptimizerOptions& optimizer_options,
+											   const TargetSelection& target) {
+	llvm::LLVMContext ctx;
+	std::unique_ptr<llvm::Module> module = generate_llvm_module(top_level, name, ctx, codegen_options);
+	llvm_verify_module(*module);
+
+	std::unique_ptr<llvm::TargetMachine> target_machine =
+		llvm_create_host_target_machine(optimizer_options.level, target);
+
+	std::string bitcode;
+	llvm::raw_string_ostream bitcode_stream(bitcode);
+	llvm_optimize_module(*module, *target_machine, optimizer_options, &bitcode_stream);
+	bitcode_stream.flush();
+
+	return bitcode;
+}
+
+// like compile_to_object, but stops after the ThinLTO pre-link pipeline
+// and returns the module as bitcode with its summary.
+std::string compile_to_thin_lto_bitcode(const std::vector<std::shared_ptr<IAST> >& top_level,
+										const std::string& name, const CodegenOptions& codegen_options,
+										const OptimizerOptions& optimizer_options,
+										const TargetSelection& target) {
+	// the rest of the program is in other modules
+	CodegenOptions module_codegen_options = codegen_options;
+	module_codegen_options.whole_program = false;
+
+	return compile_module_to_thin_lto_bitcode(top_level, name, module_codegen_options, optimizer_options, target);
+}
+
+// -----------------------------------------------------
+// THIN LINK
+
+// -Os has no LTO equivalent, the backends get -O2
+unsigned llvm_get_lto_opt_level(OptLevel level) {
+	switch (level) {
+	case OptLevel::O0:
+		return 0;
+	case OptLevel::O1:
+		return 1;
+	case OptLevel::O3:
+		return 3;
+	case OptLevel::O2:
+	case OptLevel::Os:
+		return 2;
+	}
+
+	assert(false && "unknown optimization level");
+	return 0;
+}
+
+// the post-link half of the pipeline builds its own library info, so
+// --veclib only reaches the pre-link half.
+llvm::lto::Config llvm_create_thin_lto_config(const OptimizerOptions& options, const TargetSelection& target) {
+	llvm::lto::Config config;
+	config.DefaultTriple = llvm::sys::getDefaultTargetTriple();
+	config.CPU = target.cpu;
+
+	// one feature per entry, not a comma separated list
+	llvm::SmallVector<llvm::StringRef, 16> features;
+	llvm::StringRef(target.features).split(features, ",", -1, false);
+
+	for (auto& feature : features) {
+		config.MAttrs.push_back(feature.str());
+	}
+
+	config.RelocModel = llvm::Reloc::PIC_;
+	config.OptLevel = llvm_get_lto_opt_level(options.level);
+	config.CGOptLevel = llvm_get_codegen_opt_level(options.level);
+	config.OptPipeline = options.passes;
+	config.UseNewPM = true;
+	config.PTO = llvm_get_pipeline_tuning_options(options.level);
+
+	config.DiagHandler = [](const llvm::DiagnosticInfo& info) {
+		llvm::DiagnosticPrinterRawOStream printer(llvm::errs());
+		info.print(printer);
+		llvm::errs() << "\n";
+	};
+
+	return config;
+}
+
+// runs the thin link over bitcode modules from compile_to_thin_lto_bitcode,
+// then the backends, on num_threads threads (0 = one per core).
+//
+// the modules are the whole program. a function is only visible outside of
+// it if it is exported, everything else may be internalized once it has
+// been imported where it is needed, and dropped if it is not.
+//
+// returns the object files. the caller removes them.
+std::vector<std::string> thin_link_to_objects(const std::vector<std::string>& bitcode,
+											  const OptimizerOptions& optimizer_options,
+											  const TargetSelection& target, unsigned num_threads) {
+	llvm::lto::LTO lto(llvm_create_thin_lto_config(optimizer_options, target),
+					   llvm::lto::createInProcessThinBackend(llvm::heavyweight_hardware_concurrency(num_threads)));
+
+	// the summary refers to modules by these names, they have to be unique
+	// and outlive the link
+	std::vector<std::string> module_names;
+	for (unsigned i = 0; i < bitcode.size(); ++i) {
+		module_names.push_back("shard_" + std::to_string(i) + ".bc");
+	}
+
+	for (unsigned i = 0; i < bitcode.size(); ++i) {
+		llvm::Expected<std::unique_ptr<llvm::lto::InputFile> > input =
+			llvm::lto::InputFile::create(llvm::MemoryBufferRef(bitcode[i], module_names[i]));
+
+		if (!input) {
+			throw std::runtime_error("thin lto: " + llvm::toString(input.takeError()));
+		}
+
+		std::vector<llvm::lto::SymbolResolution> resolutions;
+
+		for (const llvm::lto::InputFile::Symbol& symbol : (*input)->symbols()) {
+			llvm::lto::SymbolResolution resolution;
+
+			// every function is defined exactly once in the program
+			if (!symbol.isUndefined()) {
+				resolution.Prevailing = true;
+				resolution.FinalDefinitionInLinkageUnit = true;
+				resolution.VisibleToRegularObj = symbol.getVisibility() == llvm::GlobalValue::DefaultVisibility;
+			}
+			resolutions.push_back(resolution);
+		}
+
+		if (llvm::Error error = lto.add(std::move(*input), resolutions)) {
+			throw std::runtime_error("thin lto: " + llvm::toString(std::move(error)));
+		}
+	}
+
+	// a task per module, and one for the regular LTO partition, which
+	// stays empty. only the tasks that produce code open their stream.
+	unsigned num_tasks = lto.getMaxTasks();
+	std::vector<std::string> object_paths(num_tasks);
+	std::vector<char> written(num_tasks, false);
+
+	for (unsigned i = 0; i < num_tasks; ++i) {
+		object_paths[i] = create_temporary_object_path();
+	}
+
+	std::vector<std::unique_ptr<llvm::FileRemover> > remove_objects;
+	for (auto& path : object_paths) {
+		remove_objects.emplace_back(new llvm::FileRemover(path));
+	}
+
+	// called from the backend threads
+	auto add_stream = [&object_paths, &written](unsigned task)
+		-> llvm::Expected<std::unique_ptr<llvm::CachedFileStream> > {
+		std::error_code open_error;
+		std::unique_ptr<llvm::raw_fd_ostream> out(
+			new llvm::raw_fd_ostream(object_paths[task], open_error, llvm::sys::fs::OF_None));
+
+		if (open_error) {
+			return llvm::errorCodeToError(open_error);
+		}
+
+		written[task] = true;
+		return std::unique_ptr<llvm::CachedFileStream>(
+			new llvm::CachedFileStream(std::move(out), object_paths[task]));
+	};
+
+	if (llvm::Error error = lto.run(add_stream)) {
+		throw std::runtime_error("thin lto: " + llvm::toString(std::move(error)));
+	}
+
+	std::vector<std::string> written_paths;
+
+	for (unsigned i = 0; i < num_tasks; ++i) {
+		if (written[i]) {
+			remove_objects[i]->releaseFile();
+			written_paths.push_back(object_paths[i]);
+		}
+	}
+
+	return written_paths;
+}
+
+// -----------------------------------------------------
+// DRIVER
+
+// emit_parallel, with the shards as ThinLTO modules. the shards are
+// pre-linked in parallel, then the thin link imports what is worth inlining
+// across shards, and the backends run in parallel again.
+void emit_thin_lto(ASTRoot &root, const ParallelBackendOptions& options, EmitKind kind,
+				   const std::string& output_path) {
+	if (kind != EmitKind::Object && kind != EmitKind::Executable) {
+		throw std::runtime_error("thin lto can only emit obj or exe");
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	std::vector<CodegenShard> shards = partition_into_shards(root, options);
+
+	// the timing report is not thread safe, and one per shard is noise anyway
+	OptimizerOptions optimizer_options = options.optimizer;
+	optimizer_options.time_passes = false;
+
+	std::vector<std::string> bitcode(shards.size());
+
+	compile_shards(shards, [&shards, &bitcode, &options, &optimizer_options](unsigned i) {
+		bitcode[i] = compile_to_thin_lto_bitcode(shards[i].top_level, "shard_" + std::to_string(i),
+												 options.codegen, optimizer_options, options.target);
+	});
+
+	Clock::time_point pre_linked = Clock::now();
+
+	std::vector<std::string> object_paths =
+		thin_link_to_objects(bitcode, optimizer_options, options.target, options.num_shards);
+
+	std::vector<std::unique_ptr<llvm::FileRemover> > remove_objects;
+	for (auto& path : object_paths) {
+		remove_objects.emplace_back(new llvm::FileRemover(path));
+	}
+
+	Clock::time_point compiled = Clock::now();
+
+	link_objects(object_paths, kind, output_path, options.link_args);
+
+	Clock::time_point linked = Clock::now();
+
+	std::cout << "\n-------\n\nthin lto: " << shards.size() << " modules | pre-link "
+		<< std::chrono::duration<double, std::milli>(pre_linked - start).count() << " ms | thin link and backends "
+		<< std::chrono::duration<double, std::milli>(compiled - pre_linked).count() << " ms | link "
+		<< std::chrono::duration<double, std::milli>(linked - compiled).count() << " ms\n";
+}
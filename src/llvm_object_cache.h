@@ -0,0 +1,332 @@
+#pragma once
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <utime.h>
+
+#include "ast.h"
+#include "pretty_print.h"
+#include "type_system.h"
+#include "llvm_parallel.h"
+
+// -----------------------------------------------------
+// KEYS
+
+// bump when codegen changes in a way that makes old objects wrong
+static const char *const object_cache_version = "achilles-object-cache-6";
+
+// every function the body calls, with the type it is called through. a
+// caller's code depends on its callees' signatures, not their bodies.
+struct CalleeSignatureCollector : public IASTGenericVisitor {
+	std::set<std::string> signatures;
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::FunctionCall) {
+			ASTFunctionCall &fn_call = dynamic_cast<ASTFunctionCall&>(ast);
+			const std::string &name = *dynamic_cast<ASTLiteral&>(*fn_call.name).token.value.ptr_s;
+			const TSVariable *fn = fn_call.ts_data->scope->get_variable(name);
+
+			std::stringstream signature;
+			signature << name << ":" << *fn->type << (fn->decl_pos.is_valid() ? "" : ":builtin");
+			this->signatures.insert(signature.str());
+		}
+		ast.traverse_inner(*this);
+	}
+};
+
+// pretty printing a typed tree prints the types too, so the printed
+// function stands in for its typed AST.
+uint64_t get_function_cache_key(ASTFunctionDefinition &fn_defn, const CodegenOptions& codegen,
+								const OptimizerOptions& optimizer, const TargetSelection& target) {
+	CalleeSignatureCollector callees;
+	fn_defn.dispatch(callees);
+
+	std::stringstream key;
+	key << object_cache_version << "\n";
+	key << pretty_print(fn_defn) << "\n";
+
+	for (auto& signature : callees.signatures) {
+		key << signature << "\n";
+	}
+
+	//line tables also depend on where the function is. the same text at the
+	//same line and file gives the same lines.
+	if (codegen.debug_info) {
+		const SourceManager &sources = *codegen.source_manager;
+		FileID file = sources.get_file_id(fn_defn.position.start);
+		PositionIndex start = sources.get_file_offset(fn_defn.position.start);
+		PositionIndex end = sources.get_file_offset(fn_defn.position.end);
+
+		key << "debug-info " << sources.get_file_path(file) << ":"
+			<< sources.get_line_table(file).get_line_col(start).first << "\n";
+		key << sources.get_file_data(file).substr(start, end - start) << "\n";
+	}
+
+	key << "fast-math " << codegen.fast_math << "\n";
+	key << "O" << (int)optimizer.level << " " << optimizer.passes << " veclib "
+		<< (int)optimizer.vector_library << "\n";
+	key << llvm::sys::getDefaultTargetTriple() << " " << target.cpu << " " << target.features << "\n";
+
+	return llvm::xxHash64(key.str());
+}
+
+// -----------------------------------------------------
+// CACHE
+
+struct ObjectCacheStats {
+	unsigned hits;
+	unsigned misses;
+	unsigned evictions;
+
+	// size of the cache directory after pruning
+	uint64_t size_bytes;
+
+	ObjectCacheStats() : hits(0), misses(0), evictions(0), size_bytes(0) {}
+};
+
+std::ostream& operator<<(std::ostream& out, const ObjectCacheStats& stats) {
+	out << "hits: " << stats.hits;
+	out << " | misses: " << stats.misses;
+	out << " | evicted: " << stats.evictions;
+	out << " | size: " << stats.size_bytes / 1024 << " KiB";
+	return out;
+}
+
+// one object file per key in a directory. objects are written to a
+// temporary name and renamed into place, so concurrent compilers sharing
+// a directory never see half written objects. the least recently used
+// objects are removed once the directory grows past max_size_bytes.
+class FunctionObjectCache {
+public:
+
+	ObjectCacheStats stats;
+
+	FunctionObjectCache(const std::string& directory, uint64_t max_size_bytes) :
+		directory(directory), max_size_bytes(max_size_bytes) {
+		std::error_code error = llvm::sys::fs::create_directories(directory);
+
+		if (error) {
+			throw std::runtime_error("unable to create object cache " + directory + ": " + error.message());
+		}
+	}
+
+	std::string get_object_path(uint64_t key) const {
+		std::stringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << key << ".o";
+
+		llvm::SmallString<128> path(this->directory);
+		llvm::sys::path::append(path, name.str());
+		return path.str().str();
+	}
+
+	// on a hit, marks the object as used and stores its path in object_path
+	bool lookup(uint64_t key, std::string& object_path) {
+		std::string path = this->get_object_path(key);
+
+		if (!llvm::sys::fs::exists(path)) {
+			this->stats.misses++;
+			return false;
+		}
+
+		// the modification time doubles as the last use time for pruning
+		::utime(path.c_str(), nullptr);
+
+		this->stats.hits++;
+		object_path = path;
+		return true;
+	}
+
+	void store(uint64_t key, const std::string& compiled_object_path) {
+		llvm::SmallString<128> temp_path;
+		llvm::sys::fs::createUniquePath(this->get_object_path(key) + ".tmp-%%%%%%%%", temp_path, false);
+
+		std::error_code error = llvm::sys::fs::copy_file(compiled_object_path, temp_path);
+
+		if (!error) {
+			error = llvm::sys::fs::rename(temp_path, this->get_object_path(key));
+		}
+
+		// a cache that can not be written to only costs time
+		if (error) {
+			llvm::sys::fs::remove(temp_path);
+		}
+	}
+
+	// removes least recently used objects until the cache fits
+	void prune() {
+		struct CachedObject {
+			std::string path;
+			uint64_t size;
+			llvm::sys::TimePoint<> last_use;
+		};
+
+		std::vector<CachedObject> objects;
+		uint64_t total_size = 0;
+		std::error_code error;
+
+		for (llvm::sys::fs::directory_iterator it(this->directory, error), end; it != end && !error;
+			 it.increment(error)) {
+			if (llvm::sys::path::extension(it->path()) != ".o") {
+				continue;
+			}
+
+			llvm::ErrorOr<llvm::sys::fs::basic_file_status> status = it->status();
+			if (!status) {
+				continue;
+			}
+
+			objects.push_back({ it->path(), status->getSize(), status->getLastModificationTime() });
+			total_size += status->getSize();
+		}
+
+		std::sort(objects.begin(), objects.end(), [](const CachedObject& a, const CachedObject& b) {
+			return a.last_use < b.last_use;
+		});
+
+		for (auto& object : objects) {
+			if (total_size <= this->max_size_bytes) {
+				break;
+			}
+
+			if (!llvm::sys::fs::remove(object.path)) {
+				total_size -= object.size;
+				this->stats.evictions++;
+			}
+		}
+
+		this->stats.size_bytes = total_size;
+	}
+
+private:
+
+	std::string directory;
+	uint64_t max_size_bytes;
+};
+
+// -----------------------------------------------------
+// DRIVER
+
+// like emit_parallel, but every function with a body gets its own object,
+// which is looked up in the cache first. only the misses are generated,
+// optimized and compiled, on num_shards threads. everything else at the
+// top level is compiled into one more object every time.
+//
+// every function is compiled on its own, so nothing is inlined across
+// functions in this mode.
+void emit_cached(ASTRoot &root, const ParallelBackendOptions& options, FunctionObjectCache& cache,
+				 EmitKind kind, const std::string& output_path) {
+	if (kind != EmitKind::Object && kind != EmitKind::Executable) {
+		throw std::runtime_error("the object cache can only emit obj or exe");
+	}
+
+	struct CompileJob {
+		std::vector<std::shared_ptr<IAST> > top_level;
+		std::string object_path;
+
+		bool cacheable;
+		uint64_t key;
+	};
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	OptimizerOptions optimizer_options = options.optimizer;
+	optimizer_options.time_passes = false;
+
+	std::vector<std::string> object_paths;
+	std::vector<CompileJob> jobs;
+	CompileJob uncached_job;
+	uncached_job.cacheable = false;
+	uncached_job.key = 0;
+
+	for (auto child : root.children) {
+		ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+		if (!fn_defn || !fn_defn->body) {
+			uncached_job.top_level.push_back(child);
+			continue;
+		}
+
+		uint64_t key = get_function_cache_key(*fn_defn, options.codegen, optimizer_options, options.target);
+		std::string cached_path;
+
+		if (cache.lookup(key, cached_path)) {
+			object_paths.push_back(cached_path);
+		}
+		else {
+			CompileJob job;
+			job.top_level.push_back(child);
+			job.cacheable = true;
+			job.key = key;
+			jobs.push_back(job);
+		}
+	}
+
+	if (!uncached_job.top_level.empty()) {
+		jobs.push_back(uncached_job);
+	}
+
+	std::vector<std::unique_ptr<llvm::FileRemover> > remove_objects;
+	for (auto& job : jobs) {
+		job.object_path = create_temporary_object_path();
+		remove_objects.emplace_back(new llvm::FileRemover(job.object_path));
+	}
+
+	std::vector<std::string> errors(jobs.size());
+
+	{
+		unsigned max_threads = options.num_shards == 0 ? std::thread::hardware_concurrency() : options.num_shards;
+		unsigned num_threads = std::min<unsigned>(std::max<size_t>(1, jobs.size()), std::max(1u, max_threads));
+
+		// llvm_codegen.h pulls in llvm::ThreadPool
+		::ThreadPool pool(num_threads);
+
+		for (unsigned i = 0; i < jobs.size(); ++i) {
+			pool.submit([&jobs, &errors, &options, &optimizer_options, i]() {
+				try {
+					compile_to_object(jobs[i].top_level, "object_" + std::to_string(i), options.codegen,
+									  optimizer_options, options.target, jobs[i].object_path);
+				}
+				catch (std::exception& error) {
+					errors[i] = error.what();
+				}
+			});
+		}
+		pool.wait_idle();
+	}
+
+	for (unsigned i = 0; i < jobs.size(); ++i) {
+		if (!errors[i].empty()) {
+			throw std::runtime_error(errors[i]);
+		}
+
+		if (jobs[i].cacheable) {
+			cache.store(jobs[i].key, jobs[i].object_path);
+		}
+		object_paths.push_back(jobs[i].object_path);
+	}
+
+	Clock::time_point compiled = Clock::now();
+
+	link_objects(object_paths, kind, output_path, options.link_args);
+	cache.prune();
+
+	Clock::time_point linked = Clock::now();
+
+	std::cout << "\n-------\n\nobject cache: " << cache.stats << "\n";
+	std::cout << "cached backend: compile "
+		<< std::chrono::duration<double, std::milli>(compiled - start).count() << " ms | link "
+		<< std::chrono::duration<double, std::milli>(linked - compiled).count() << " ms\n";
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include "llvm/ADT/Optional.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/IPO/ThinLTOBitcodeWriter.h"
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+// -----------------------------------------------------
+// OPTIONS
+
+enum class OptLevel {
+	O0,
+	O1,
+	O2,
+	O3,
+	Os,
+};
+
+// a library of vector versions of the math functions. with one, the loop
+// vectorizer can vectorize loops that call sin & co. instead of giving up.
+enum class VectorLibrary {
+	None,
+	// glibc's libmvec. -lm pulls it in when linking, the jit loads it.
+	LibMVec,
+	// intel's short vector math library, which has to be linked by hand
+	SVML,
+};
+
+struct OptimizerOptions {
+	OptLevel level;
+	VectorLibrary vector_library;
+
+	// a custom pipeline in opt's -passes= syntax, eg. "mem2reg,instcombine".
+	// replaces the default pipeline for the level when set.
+	std::string passes;
+
+	// print how long each pass took once the pipeline has run
+	bool time_passes;
+
+	// --profile-generate: instrument the code to count how often every
+	// branch is taken and every function called. the program writes the
+	// counts to this file when it exits (llvm's %p / %m patterns work), to
+	// be merged with llvm-profdata. needs the profile runtime, see
+	// find_profile_runtime. empty = off.
+	std::string profile_generate_path;
+
+	// --profile-use: an indexed profile from llvm-profdata merge. the
+	// branch weights and entry counts in it drive inlining, block layout
+	// and hot/cold splitting. empty = off.
+	std::string profile_use_path;
+
+	OptimizerOptions() : level(OptLevel::O0), vector_library(VectorLibrary::None), time_passes(false) {}
+};
+
+// parses -O0, -O1, -O2, -O3 and -Os. returns false for anything else.
+bool parse_opt_level(const std::string& arg, OptLevel& level) {
+	if (arg == "-O0") { level = OptLevel::O0; }
+	else if (arg == "-O1") { level = OptLevel::O1; }
+	else if (arg == "-O2") { level = OptLevel::O2; }
+	else if (arg == "-O3") { level = OptLevel::O3; }
+	else if (arg == "-Os") { level = OptLevel::Os; }
+	else { return false; }
+
+	return true;
+}
+
+// parses the value of --veclib=: none, libmvec or svml
+bool parse_vector_library(const std::string& name, VectorLibrary& library) {
+	if (name == "none") { library = VectorLibrary::None; }
+	else if (name == "libmvec") { library = VectorLibrary::LibMVec; }
+	else if (name == "svml") { library = VectorLibrary::SVML; }
+	else { return false; }
+
+	return true;
+}
+
+// the shared library the jit has to load for library's symbols, or an empty
+// string if there is none
+std::string get_vector_library_runtime(VectorLibrary library) {
+	return library == VectorLibrary::LibMVec ? "libmvec.so.1" : "";
+}
+
+llvm::TargetLibraryInfoImpl::VectorLibrary llvm_get_vector_library(VectorLibrary library) {
+	switch (library) {
+	case VectorLibrary::None:
+		return llvm::TargetLibraryInfoImpl::NoLibrary;
+	case VectorLibrary::LibMVec:
+		return llvm::TargetLibraryInfoImpl::LIBMVEC_X86;
+	case VectorLibrary::SVML:
+		return llvm::TargetLibraryInfoImpl::SVML;
+	}
+
+	assert(false && "unknown vector library");
+	return llvm::TargetLibraryInfoImpl::NoLibrary;
+}
+
+llvm::OptimizationLevel llvm_get_optimization_level(OptLevel level) {
+	switch (level) {
+	case OptLevel::O0:
+		return llvm::OptimizationLevel::O0;
+	case OptLevel::O1:
+		return llvm::OptimizationLevel::O1;
+	case OptLevel::O2:
+		return llvm::OptimizationLevel::O2;
+	case OptLevel::O3:
+		return llvm::OptimizationLevel::O3;
+	case OptLevel::Os:
+		return llvm::OptimizationLevel::Os;
+	}
+
+	assert(false && "unknown optimization level");
+	return llvm::OptimizationLevel::O0;
+}
+
+llvm::CodeGenOpt::Level llvm_get_codegen_opt_level(OptLevel level) {
+	switch (level) {
+	case OptLevel::O0:
+		return llvm::CodeGenOpt::None;
+	case OptLevel::O1:
+		return llvm::CodeGenOpt::Less;
+	case OptLevel::O3:
+		return llvm::CodeGenOpt::Aggressive;
+	// clang also uses the default backend level for -Os
+	case OptLevel::O2:
+	case OptLevel::Os:
+		return llvm::CodeGenOpt::Default;
+	}
+
+	assert(false && "unknown optimization level");
+	return llvm::CodeGenOpt::None;
+}
+
+// -----------------------------------------------------
+// TARGET
+
+// the cpu to generate code for. "generic" runs on every cpu of the host's
+// architecture, but can only use its baseline instructions.
+struct TargetSelection {
+	std::string cpu;
+
+	// in llvm's -mattr syntax, eg. "+avx2,+fma,-avx512f"
+	std::string features;
+
+	TargetSelection() : cpu("generic") {}
+};
+
+// -march=native: the host's cpu, with every feature it reports
+TargetSelection llvm_get_native_target_selection() {
+	TargetSelection selection;
+	selection.cpu = llvm::sys::getHostCPUName().str();
+
+	llvm::StringMap<bool> host_features;
+	if (llvm::sys::getHostCPUFeatures(host_features)) {
+		std::string features;
+
+		for (auto& feature : host_features) {
+			features += features.empty() ? "" : ",";
+			features += (feature.getValue() ? "+" : "-") + feature.getKey().str();
+		}
+		selection.features = features;
+	}
+
+	return selection;
+}
+
+// the pipeline queries the target for things like vector widths and
+// instruction costs, without it the vectorizers and the inliner fall
+// back to generic guesses. needs the native target to be initialized.
+std::unique_ptr<llvm::TargetMachine> llvm_create_host_target_machine(OptLevel level,
+																	 const TargetSelection& selection) {
+	std::string triple = llvm::sys::getDefaultTargetTriple();
+
+	std::string lookup_error;
+	const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, lookup_error);
+
+	if (!target) {
+		throw std::runtime_error("unable to find target for " + triple + ": " + lookup_error);
+	}
+
+	llvm::TargetOptions target_options;
+	llvm::Optional<llvm::Reloc::Model> reloc_model = llvm::Reloc::PIC_;
+
+	return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+		triple, selection.cpu, selection.features, target_options, reloc_model, llvm::None,
+		llvm_get_codegen_opt_level(level)));
+}
+
+// -----------------------------------------------------
+// PIPELINE
+
+llvm::PipelineTuningOptions llvm_get_pipeline_tuning_options(OptLevel level) {
+	llvm::PipelineTuningOptions tuning;
+	// clang only turns these on above -O1
+	tuning.LoopVectorization = level == OptLevel::O2 || level == OptLevel::O3;
+	tuning.SLPVectorization = level == OptLevel::O2 || level == OptLevel::O3;
+	return tuning;
+}
+
+// runs the new pass manager over the module. the module is retargeted at
+// target_machine first, so that the data layout the passes see is the one
+// the code will be emitted with.
+//
+// with thin_lto_bitcode set, only the ThinLTO pre-link half of the pipeline
+// runs, and the module is written to thin_lto_bitcode with the summary the
+// thin link needs. the rest runs after importing, see llvm_lto.h.
+void llvm_optimize_module(llvm::Module& module, llvm::TargetMachine& target_machine,
+						  const OptimizerOptions& options, llvm::raw_ostream *thin_lto_bitcode = nullptr) {
+	module.setTargetTriple(target_machine.getTargetTriple().str());
+	module.setDataLayout(target_machine.createDataLayout());
+
+	llvm::Optional<llvm::PGOOptions> pgo_options;
+
+	if (!options.profile_generate_path.empty()) {
+		pgo_options = llvm::PGOOptions(options.profile_generate_path, "", "", llvm::PGOOptions::IRInstr);
+	}
+	else if (!options.profile_use_path.empty()) {
+		pgo_options = llvm::PGOOptions(options.profile_use_path, "", "", llvm::PGOOptions::IRUse);
+	}
+
+	// nothing to do. skip building the analysis managers at all.
+	if (options.level == OptLevel::O0 && options.passes.empty() && !options.time_passes && !thin_lto_bitcode &&
+		!pgo_options) {
+		return;
+	}
+
+	llvm::PassInstrumentationCallbacks instrumentation;
+	llvm::TimePassesHandler time_passes(options.time_passes);
+	time_passes.setOutStream(llvm::outs());
+	time_passes.registerCallbacks(instrumentation);
+
+	llvm::LoopAnalysisManager loop_analyses;
+	llvm::FunctionAnalysisManager function_analyses;
+	llvm::CGSCCAnalysisManager cgscc_analyses;
+	llvm::ModuleAnalysisManager module_analyses;
+
+	llvm::PassBuilder pass_builder(&target_machine, llvm_get_pipeline_tuning_options(options.level), pgo_options,
+								   &instrumentation);
+
+	// same order as clang: the alias analysis pipeline is registered
+	// first so it is the one that includes the target's alias analyses
+	function_analyses.registerPass([&] { return pass_builder.buildDefaultAAPipeline(); });
+
+	// the library info tells the vectorizer which vector function to call
+	// for which scalar one. registered before the defaults, like clang does,
+	// so that it wins over the plain library info.
+	llvm::TargetLibraryInfoImpl library_info(target_machine.getTargetTriple());
+	library_info.addVectorizableFunctionsFromVecLib(llvm_get_vector_library(options.vector_library));
+	function_analyses.registerPass([&] { return llvm::TargetLibraryAnalysis(library_info); });
+
+	pass_builder.registerModuleAnalyses(module_analyses);
+	pass_builder.registerCGSCCAnalyses(cgscc_analyses);
+	pass_builder.registerFunctionAnalyses(function_analyses);
+	pass_builder.registerLoopAnalyses(loop_analyses);
+	pass_builder.crossRegisterProxies(loop_analyses, function_analyses, cgscc_analyses, module_analyses);
+
+	llvm::ModulePassManager module_passes;
+
+	if (!options.passes.empty()) {
+		if (llvm::Error error = pass_builder.parsePassPipeline(module_passes, options.passes)) {
+			std::stringstream message;
+			message << "invalid pass pipeline \"" << options.passes << "\": "
+				<< llvm::toString(std::move(error));
+			throw std::runtime_error(message.str());
+		}
+	}
+	else if (options.level == OptLevel::O0) {
+		module_passes = pass_builder.buildO0DefaultPipeline(llvm::OptimizationLevel::O0, thin_lto_bitcode != nullptr);
+	}
+	else if (thin_lto_bitcode) {
+		module_passes = pass_builder.buildThinLTOPreLinkDefaultPipeline(
+			llvm_get_optimization_level(options.level));
+	}
+	else {
+		module_passes = pass_builder.buildPerModuleDefaultPipeline(
+			llvm_get_optimization_level(options.level));
+	}
+
+	if (thin_lto_bitcode) {
+		module_passes.addPass(llvm::ThinLTOBitcodeWriterPass(*thin_lto_bitcode, nullptr));
+	}
+
+	module_passes.run(module, module_analyses);
+
+	if (options.time_passes) {
+		std::cout << "\n-------\n\npass timings:\n";
+		std::cout.flush();
+		time_passes.print();
+		llvm::outs().flush();
+	}
+}
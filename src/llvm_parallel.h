@@ -0,0 +1,244 @@
+#pragma once
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileUtilities.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "thread_pool.h"
+#include "llvm_codegen.h"
+#include "llvm_optimizer.h"
+#include "llvm_emit.h"
+
+// -----------------------------------------------------
+// PARTITIONING
+
+struct ASTSizeEstimator : public IASTGenericVisitor {
+	unsigned num_nodes;
+
+	ASTSizeEstimator() : num_nodes(0) {}
+
+	virtual void inspect_ast(IAST &ast) {
+		this->num_nodes++;
+		ast.traverse_inner(*this);
+	}
+};
+
+// a group of top level nodes that is generated, optimized and compiled
+// on its own, in its own LLVMContext.
+struct CodegenShard {
+	std::vector<std::shared_ptr<IAST> > top_level;
+
+	// sum of the sizes of top_level, in AST nodes
+	unsigned cost;
+
+	CodegenShard() : cost(0) {}
+};
+
+// spreads the top level nodes over at most num_shards shards. biggest
+// first onto the cheapest shard, so that one huge function does not end up
+// sharing its shard with a lot of others. order within a shard is source
+// order.
+std::vector<CodegenShard> partition_into_shards(ASTRoot &root, unsigned num_shards) {
+	assert(num_shards > 0);
+
+	std::vector<std::pair<unsigned, unsigned> > costs;
+
+	for (unsigned i = 0; i < root.children.size(); ++i) {
+		ASTSizeEstimator estimator;
+		root.children[i]->dispatch(estimator);
+		costs.push_back(std::make_pair(estimator.num_nodes, i));
+	}
+
+	std::stable_sort(costs.begin(), costs.end(),
+					 [](const std::pair<unsigned, unsigned>& a, const std::pair<unsigned, unsigned>& b) {
+		return a.first > b.first;
+	});
+
+	num_shards = std::min<unsigned>(num_shards, std::max<unsigned>(1, root.children.size()));
+	std::vector<CodegenShard> shards(num_shards);
+	std::vector<std::vector<unsigned> > shard_indices(num_shards);
+
+	for (auto& cost : costs) {
+		auto cheapest = std::min_element(shards.begin(), shards.end(),
+										 [](const CodegenShard& a, const CodegenShard& b) {
+			return a.cost < b.cost;
+		});
+
+		cheapest->cost += cost.first;
+		shard_indices[cheapest - shards.begin()].push_back(cost.second);
+	}
+
+	for (unsigned i = 0; i < num_shards; ++i) {
+		std::sort(shard_indices[i].begin(), shard_indices[i].end());
+
+		for (unsigned index : shard_indices[i]) {
+			shards[i].top_level.push_back(root.children[index]);
+		}
+	}
+
+	return shards;
+}
+
+// -----------------------------------------------------
+// BACKEND
+
+struct ParallelBackendOptions {
+	// 0 = one per core
+	unsigned num_shards;
+
+	CodegenOptions codegen;
+	OptimizerOptions optimizer;
+	TargetSelection target;
+
+	// passed on to link_executable
+	std::vector<std::string> link_args;
+
+	ParallelBackendOptions() : num_shards(0) {}
+};
+
+// the whole backend for one module, in a fresh context, with the linkage
+// codegen_options asks for. safe to call from several threads at once.
+void compile_module_to_object(const std::vector<std::shared_ptr<IAST> >& top_level, const std::string& name,
+							  const CodegenOptions& codegen_options, const OptimizerOptions& optimizer_options,
+							  const TargetSelection& target, const std::string& object_path) {
+	llvm::LLVMContext ctx;
+	std::unique_ptr<llvm::Module> module = generate_llvm_module(top_level, name, ctx, codegen_options);
+	llvm_verify_module(*module);
+
+	std::unique_ptr<llvm::TargetMachine> target_machine =
+		llvm_create_host_target_machine(optimizer_options.level, target);
+	llvm_optimize_module(*module, *target_machine, optimizer_options);
+	llvm_emit_machine_code(*module, *target_machine, llvm::CGFT_ObjectFile, object_path);
+}
+
+// the backend for one group of top level nodes of a program that is split
+// over several modules
+void compile_to_object(const std::vector<std::shared_ptr<IAST> >& top_level, const std::string& name,
+					   const CodegenOptions& codegen_options, const OptimizerOptions& optimizer_options,
+					   const TargetSelection& target, const std::string& object_path) {
+	//the rest of the program is in other modules
+	CodegenOptions module_codegen_options = codegen_options;
+	module_codegen_options.whole_program = false;
+
+	compile_module_to_object(top_level, name, module_codegen_options, optimizer_options, target, object_path);
+}
+
+// runs compile_shard(i) for every shard, one shard per thread, and throws
+// the first error once all of them are done. LLVM types and values belong
+// to a context, and a context can only be used by one thread at a time, so
+// every shard needs a context, module and target machine of its own.
+void compile_shards(const std::vector<CodegenShard>& shards, std::function<void(unsigned)> compile_shard) {
+	std::vector<std::string> errors(shards.size());
+
+	{
+		// llvm_codegen.h pulls in llvm::ThreadPool
+		::ThreadPool pool(shards.size());
+
+		for (unsigned i = 0; i < shards.size(); ++i) {
+			pool.submit([&compile_shard, &errors, i]() {
+				try {
+					compile_shard(i);
+				}
+				catch (std::exception& error) {
+					errors[i] = error.what();
+				}
+			});
+		}
+		pool.wait_idle();
+	}
+
+	for (unsigned i = 0; i < shards.size(); ++i) {
+		if (!errors[i].empty()) {
+			throw std::runtime_error("shard " + std::to_string(i) + ": " + errors[i]);
+		}
+	}
+}
+
+// the shards for options.num_shards threads
+std::vector<CodegenShard> partition_into_shards(ASTRoot &root, const ParallelBackendOptions& options) {
+	unsigned num_threads = options.num_shards == 0 ? std::thread::hardware_concurrency() : options.num_shards;
+	return partition_into_shards(root, std::max(1u, num_threads));
+}
+
+// generates, optimizes and compiles every shard to its own temporary object
+// file. calls between shards are external declarations, resolved by the
+// linker.
+//
+// returns the object files, in shard order. the caller removes them.
+std::vector<std::string> compile_shards_to_objects(ASTRoot &root, const ParallelBackendOptions& options) {
+	std::vector<CodegenShard> shards = partition_into_shards(root, options);
+
+	// the timing report is not thread safe, and one per shard is noise anyway
+	OptimizerOptions optimizer_options = options.optimizer;
+	optimizer_options.time_passes = false;
+
+	std::vector<std::string> object_paths(shards.size());
+
+	for (unsigned i = 0; i < shards.size(); ++i) {
+		object_paths[i] = create_temporary_object_path();
+	}
+
+	try {
+		compile_shards(shards, [&shards, &object_paths, &options, &optimizer_options](unsigned i) {
+			compile_to_object(shards[i].top_level, "shard_" + std::to_string(i), options.codegen,
+							  optimizer_options, options.target, object_paths[i]);
+		});
+	}
+	catch (std::runtime_error&) {
+		for (auto& path : object_paths) {
+			llvm::sys::fs::remove(path);
+		}
+		throw;
+	}
+
+	return object_paths;
+}
+
+// objects are combined with ld -r, executables linked with cc. link_args
+// only apply to executables.
+void link_objects(const std::vector<std::string>& object_paths, EmitKind kind,
+				  const std::string& output_path, const std::vector<std::string>& link_args = {}) {
+	if (kind == EmitKind::Object) {
+		link_relocatable_object(object_paths, output_path);
+	}
+	else {
+		assert(kind == EmitKind::Executable);
+		link_executable(object_paths, output_path, link_args);
+	}
+}
+
+// the parallel equivalent of llvm_emit_module, for objects and executables.
+void emit_parallel(ASTRoot &root, const ParallelBackendOptions& options, EmitKind kind,
+				   const std::string& output_path) {
+	if (kind != EmitKind::Object && kind != EmitKind::Executable) {
+		throw std::runtime_error("parallel code generation can only emit obj or exe");
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	std::vector<std::string> object_paths = compile_shards_to_objects(root, options);
+
+	std::vector<std::unique_ptr<llvm::FileRemover> > remove_objects;
+	for (auto& path : object_paths) {
+		remove_objects.emplace_back(new llvm::FileRemover(path));
+	}
+
+	Clock::time_point compiled = Clock::now();
+
+	link_objects(object_paths, kind, output_path, options.link_args);
+
+	Clock::time_point linked = Clock::now();
+
+	std::cout << "\n-------\n\nparallel backend: " << object_paths.size() << " shards | compile "
+		<< std::chrono::duration<double, std::milli>(compiled - start).count() << " ms | link "
+		<< std::chrono::duration<double, std::milli>(linked - compiled).count() << " ms\n";
+}
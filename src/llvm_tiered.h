@@ -0,0 +1,283 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "bytecode.h"
+#include "thread_pool.h"
+#include "llvm_codegen.h"
+#include "llvm_jit.h"
+#include "llvm_optimizer.h"
+
+// tiered execution: every function starts out in the bytecode interpreter,
+// which counts its calls and loop iterations. the ones that get hot are
+// generated, optimized and jitted on a background thread, while the
+// interpreter keeps going, and calls to them go to the compiled code as
+// soon as it is there. programs start as fast as the interpreter does, and
+// the code they spend their time in still runs at the speed of the JIT.
+
+// -----------------------------------------------------
+// COMPILE UNITS
+
+// a hot function is compiled together with every function it calls,
+// directly or not, so that the compiled code never has to call back into
+// the interpreter, and LLVM can inline what it calls.
+class TierUpUnitCollector : public IASTGenericVisitor {
+public:
+
+	// every top level function with a body, by name
+	TierUpUnitCollector(const std::map<std::string, std::shared_ptr<IAST> >& definitions) :
+		definitions(definitions) {}
+
+	std::vector<std::shared_ptr<IAST> > collect(const std::string& name) {
+		std::vector<std::shared_ptr<IAST> > top_level;
+		this->visited.clear();
+		this->add(name);
+
+		while (!this->pending.empty()) {
+			std::shared_ptr<IAST> fn_defn = this->definitions.at(this->pending.back());
+			this->pending.pop_back();
+
+			top_level.push_back(fn_defn);
+			fn_defn->dispatch(*this);
+		}
+		return top_level;
+	}
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::FunctionCall) {
+			ASTFunctionCall &fn_call = dynamic_cast<ASTFunctionCall&>(ast);
+			this->add(*dynamic_cast<ASTLiteral&>(*fn_call.name).token.value.ptr_s);
+		}
+		ast.traverse_inner(*this);
+	}
+
+private:
+
+	const std::map<std::string, std::shared_ptr<IAST> >& definitions;
+	std::set<std::string> visited;
+	std::vector<std::string> pending;
+
+	// builtins and extern fns are only declared
+	void add(const std::string& name) {
+		if (this->definitions.count(name) && this->visited.insert(name).second) {
+			this->pending.push_back(name);
+		}
+	}
+};
+
+// -----------------------------------------------------
+// BACKGROUND COMPILER
+
+struct TierUpStats {
+	std::string name;
+
+	// since the compiler was created, when the function got hot
+	double hot_after_ms;
+	// on the compile thread, including the time it waited there
+	double compile_ms;
+
+	// empty if it was compiled
+	std::string error;
+};
+
+class TieredCompiler : public BCTierUpHandler {
+public:
+
+	TieredCompiler(ASTRoot& root, const BCModule& module, BCInterpreter& interpreter,
+				   const CodegenOptions& codegen, const OptimizerOptions& optimizer, const TargetSelection& target) :
+		module(module), interpreter(interpreter), codegen(codegen), optimizer(optimizer),
+		target_machine(llvm_create_host_target_machine(optimizer.level, target)), start(Clock::now()),
+		compile_thread(1) {
+		for (auto child : root.children) {
+			ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+			if (fn_defn && fn_defn->body) {
+				this->definitions[*fn_defn->fn_name.value.ptr_s] = child;
+			}
+		}
+
+		// the entry is called through a trampoline that is added after
+		// optimizing, and the rest are in the same module
+		this->codegen.whole_program = true;
+		this->optimizer.time_passes = false;
+
+		// a division the interpreter traps on fails the same way once it
+		// is compiled, instead of being undefined
+		this->codegen.checked_division = true;
+		this->jit.define_host_function(llvm_division_trap_name, reinterpret_cast<void*>(&bc_division_trap));
+	}
+
+	virtual void function_is_hot(uint32_t function) {
+		Clock::time_point hot = Clock::now();
+
+		this->compile_thread.submit([this, function, hot]() {
+			this->compile(function, hot);
+		});
+	}
+
+	// blocks until every function that got hot so far is compiled
+	void wait_idle() {
+		this->compile_thread.wait_idle();
+	}
+
+	std::vector<TierUpStats> get_stats() {
+		std::lock_guard<std::mutex> lock(this->stats_mutex);
+		return this->stats;
+	}
+
+private:
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	const BCModule& module;
+	BCInterpreter& interpreter;
+	CodegenOptions codegen;
+	OptimizerOptions optimizer;
+
+	// only used on the compile thread
+	std::unique_ptr<llvm::TargetMachine> target_machine;
+	AchillesJIT jit;
+	std::map<std::string, std::shared_ptr<IAST> > definitions;
+
+	Clock::time_point start;
+	std::mutex stats_mutex;
+	std::vector<TierUpStats> stats;
+
+	// declared last, so that it is destroyed first, once it has compiled
+	// everything that is queued
+	::ThreadPool compile_thread;
+
+	void compile(uint32_t function, Clock::time_point hot) {
+		TierUpStats stats;
+		stats.name = this->module.functions[function].name;
+		stats.hot_after_ms = std::chrono::duration<double, std::milli>(hot - this->start).count();
+
+		try {
+			TierUpUnitCollector collector(this->definitions);
+			std::vector<std::shared_ptr<IAST> > top_level = collector.collect(stats.name);
+
+			CodegenOptions codegen = this->codegen;
+			codegen.exported_names.insert(stats.name);
+
+			std::unique_ptr<llvm::LLVMContext> ctx(new llvm::LLVMContext());
+			std::unique_ptr<llvm::Module> module = generate_llvm_module(top_level, "tier_up_" + stats.name, *ctx,
+																		codegen);
+			llvm_verify_module(*module);
+			llvm_optimize_module(*module, *this->target_machine, this->optimizer);
+			llvm_create_jit_entry_trampoline(*module, module->getFunction(stats.name));
+
+			BCNativeEntry entry = this->jit.add_module_in_own_dylib(std::move(ctx), std::move(module), stats.name);
+			this->interpreter.set_native_entry(function, entry);
+		}
+		catch (std::exception& error) {
+			// it just stays in the interpreter
+			stats.error = error.what();
+		}
+
+		stats.compile_ms = std::chrono::duration<double, std::milli>(Clock::now() - hot).count();
+
+		std::lock_guard<std::mutex> lock(this->stats_mutex);
+		this->stats.push_back(stats);
+	}
+};
+
+// -----------------------------------------------------
+// DRIVER
+
+struct TieredRunOptions {
+	InterpreterRunOptions interpreter;
+
+	// calls plus loop iterations after which a function is compiled
+	uint32_t threshold;
+
+	CodegenOptions codegen;
+	OptimizerOptions optimizer;
+	TargetSelection target;
+
+	TieredRunOptions() : threshold(1000) {}
+};
+
+// like run_interpreter, with the hot functions compiled in the background.
+// with bench_calls set, also reports how many calls ran in the interpreter
+// before the entry function was compiled, and the cost of a call before
+// and after.
+int run_tiered(ASTRoot& root, const TieredRunOptions& options) {
+	typedef std::chrono::high_resolution_clock Clock;
+
+	BCCompileStats compile_stats;
+	BCModule module = compile_program_to_bytecode(root, options.interpreter.optimize, compile_stats);
+
+	std::cout << "\n-------\n\nbytecode:\n" << module;
+
+	std::vector<BCValue> args;
+	int entry = prepare_bc_entry(module, options.interpreter, "tiered", args);
+
+	if (entry < 0) {
+		return 1;
+	}
+
+	BCInterpreter interpreter(module);
+	TieredCompiler compiler(root, module, interpreter, options.codegen, options.optimizer, options.target);
+	interpreter.set_tier_up(&compiler, options.threshold);
+
+	BCValue result = interpreter.call(entry, args);
+	print_bc_entry_call(module, entry, args, result, "tiered");
+	std::cout << "tiered startup latency: " << compile_stats << "\n";
+
+	if (options.interpreter.bench_calls > 0) {
+		// the calls made before the entry function was compiled
+		uint64_t interpreted_calls = options.interpreter.bench_calls;
+		Clock::time_point calls_start = Clock::now();
+		Clock::time_point compiled;
+
+		for (uint64_t i = 0; i < options.interpreter.bench_calls; ++i) {
+			if (interpreted_calls == options.interpreter.bench_calls && interpreter.has_native_entry(entry)) {
+				interpreted_calls = i;
+				compiled = Clock::now();
+			}
+			interpreter.call(entry, args);
+		}
+
+		Clock::time_point calls_end = Clock::now();
+		if (interpreted_calls == options.interpreter.bench_calls) {
+			compiled = calls_end;
+		}
+
+		auto nanoseconds = [](Clock::time_point from, Clock::time_point to) {
+			return std::chrono::duration<double, std::nano>(to - from).count();
+		};
+		uint64_t compiled_calls = options.interpreter.bench_calls - interpreted_calls;
+
+		std::cout << "tiered calls: " << options.interpreter.bench_calls << " | "
+			<< nanoseconds(calls_start, calls_end) / options.interpreter.bench_calls << " ns per call\n";
+		std::cout << "tiered interpreted calls: " << interpreted_calls;
+		if (interpreted_calls > 0) {
+			std::cout << " | " << nanoseconds(calls_start, compiled) / interpreted_calls << " ns per call";
+		}
+		std::cout << "\ntiered compiled calls: " << compiled_calls;
+		if (compiled_calls > 0) {
+			std::cout << " | " << nanoseconds(compiled, calls_end) / compiled_calls << " ns per call";
+		}
+		std::cout << "\n";
+	}
+
+	compiler.wait_idle();
+
+	for (auto& stats : compiler.get_stats()) {
+		if (stats.error.empty()) {
+			std::cout << "tiered: compiled " << stats.name << " | hot after " << stats.hot_after_ms
+				<< " ms | compiled in " << stats.compile_ms << " ms\n";
+		}
+		else {
+			std::cout << "tiered: unable to compile " << stats.name << ": " << stats.error << "\n";
+		}
+	}
+
+	return 0;
+}
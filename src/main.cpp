@@ -6,27 +6,450 @@
 #include <assert.h>
 #include <map>
 #include <fstream>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <cstdint>
+#include <chrono>
+#include <thread>
 
 #include "tokenizer.h"
 #include "file_handling.h"
 #include "ast.h"
 #include "pretty_print.h"
 #include "type_system.h"
+#include "diagnostics.h"
+#include "constant_folding.h"
+#include "intermediate.h"
+#include "bytecode.h"
 #include "llvm_codegen.h"
+#include "llvm_jit.h"
+#include "llvm_optimizer.h"
+#include "llvm_emit.h"
+#include "llvm_parallel.h"
+#include "llvm_object_cache.h"
+#include "llvm_lto.h"
+#include "llvm_tiered.h"
+#include "llvm_driver.h"
+#include "c_codegen.h"
 
 
 // #include "codegen.h"
 
+// if arg is <name><value>, stores <value> and returns true
+static bool get_option_value(const std::string& arg, const std::string& name, std::string& value) {
+    if (arg.compare(0, name.size(), name) != 0) {
+        return false;
+    }
+    value = arg.substr(name.size());
+    return true;
+}
+
+static std::vector<std::string> split_comma_list(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+// explicit --mcpu / --mattr win over -march=native
+static void apply_native_target(TargetSelection& target_selection) {
+    TargetSelection native = llvm_get_native_target_selection();
+
+    if (target_selection.cpu == "generic") {
+        target_selection.cpu = native.cpu;
+    }
+    if (target_selection.features.empty()) {
+        target_selection.features = native.features;
+    }
+}
+
+static void print_usage(std::ostream& out) {
+    out << "usage: achilles <file.acl>... [options]\n"
+        << "\n"
+        << "  -O0 -O1 -O2 -O3 -Os       optimization level\n"
+        << "  --emit=obj|asm|bc|exe|c   write the program out, to -o <path>\n"
+        << "  -o <path>                 output path\n"
+        << "  -j <n>                    threads for several input files, 0 = one per core\n"
+        << "  --jit                     run --entry=<fn> with --args=<a,b,...> in the jit\n"
+        << "  --interpret               run the entry in the bytecode interpreter\n"
+        << "  --tiered                  interpret, and jit the functions that get hot\n"
+        << "  --tier-threshold=<n>      calls plus loop iterations before a function is jitted\n"
+        << "  --bench-tiers             run the entry in every tier\n"
+        << "  --bench-calls=<n>         time n more calls of the entry\n"
+        << "  --watch                   type check the file again every time it changes\n"
+        << "  --backend=llvm|c          code generator\n"
+        << "  --codegen-threads=<n>     split the backend into n shards, 0 = one per core\n"
+        << "  --cache-dir=<dir>         cache compiled functions, see --cache-size-mb=<n>\n"
+        << "  --lto=none|thin           thin lto over the shards\n"
+        << "  --profile-generate[=<path>] --profile-use=<path> --profile-runtime=<path>\n"
+        << "  --fast-math --veclib=none|libmvec|svml --passes=<pipeline> --time-passes\n"
+        << "  -march=native --mcpu=<cpu> --mattr=<features>\n"
+        << "  -g --perf=map|jitdump     debug info, and perf support for jitted code\n"
+        << "  --print-ir                print the IR before and after its passes\n"
+        << "  --const-eval-steps=<n>    budget of a const fn call at compile time\n"
+        << "  --error-limit=<n>         stop after n errors, 0 = report every error\n";
+}
+
+// the most threads -j and --codegen-threads accept
+static const uint64_t max_option_threads = 1024;
+
+// parses the value of a numeric option: a whole decimal number from 0 to
+// max, and nothing else. anything else is reported with the usage, like an
+// unknown option.
+template <typename T>
+static bool parse_number_option(const std::string& option, const std::string& value, uint64_t max, T& result) {
+    const char *start = value.c_str();
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long number = std::strtoull(start, &end, 10);
+
+    // strtoull skips spaces and negates a leading -
+    if (value.empty() || !std::isdigit((unsigned char)value[0]) || *end != '\0' || errno == ERANGE || number > max) {
+        std::cerr << "invalid value for " << option << ": " << value << " | expected a number from 0 to " << max << "\n\n";
+        print_usage(std::cerr);
+        return false;
+    }
+    result = (T)number;
+    return true;
+}
+
+static bool read_file(const std::string& path, std::string& file_data) {
+    std::ifstream input_file(path);
+
+    if (!input_file) {
+        return false;
+    }
+    file_data.assign((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// --watch: type checks the file every time it changes, until interrupted.
+// only the functions that changed, or that use a signature that changed,
+// are checked again.
+static int watch_file(const std::string& input_path, unsigned error_limit) {
+    TSIncrementalState state;
+    std::string checked_data;
+    bool first = true;
+
+    while (true) {
+        std::string file_data;
+
+        if (!read_file(input_path, file_data)) {
+            std::cerr << "unable to read " << input_path << "\n";
+            return 1;
+        }
+
+        if (first || file_data != checked_data) {
+            first = false;
+            checked_data = file_data;
+
+            typedef std::chrono::high_resolution_clock Clock;
+            Clock::time_point start = Clock::now();
+
+            // a fresh one every time, or every version of the file would be
+            // kept. the cached data of unchanged functions still has
+            // positions in older versions, but only the functions that are
+            // checked again report anything.
+            SourceManager source_manager;
+            FileID file = source_manager.add_file(input_path, file_data);
+            SourceRange file_range = source_manager.get_file_range(file);
+
+            std::vector<Token> tokens = tokenize_string(source_manager.get_file_data(file), file_range.start);
+            DiagnosticEngine diagnostics(error_limit);
+            std::shared_ptr<IAST> ast = parse(tokens, file_range, diagnostics);
+
+            // a tree with parse errors has holes, which would be cached
+            bool checked = !diagnostics.has_errors();
+            if (checked) {
+                type_system_type_check_incremental(ast, state, diagnostics);
+            }
+
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+            if (diagnostics.has_errors()) {
+                diagnostics.render(std::cerr, source_manager);
+            }
+            std::cout << "\nwatch: " << input_path << (diagnostics.has_errors() ? " has errors" : " ok");
+            if (checked) {
+                std::cout << " | rechecked fns: " << state.num_rechecked << " | reused: " << state.num_reused;
+            }
+            std::cout << " | " << ms << " ms\n";
+            std::cout.flush();
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
 int main(int argc, char **argv) {
-	assert(argc == 2
-           && "expected input file path");
+    // more than one is compiled by the multi file driver
+    std::vector<std::string> input_paths;
+    // -j: threads of the multi file driver, 0 = one per core
+    unsigned num_jobs = 0;
+    unsigned error_limit = 20;
+    CodegenOptions codegen_options;
+    bool jit = false;
+    JITRunOptions jit_options;
+    OptimizerOptions optimizer_options;
+    TargetSelection target_selection;
+    bool native_target = false;
+    EmitKind emit_kind = EmitKind::None;
+    std::string output_path;
+    // 1 = everything in one module, 0 = one shard per core
+    unsigned codegen_threads = 1;
+    std::string cache_dir;
+    LTOKind lto_kind = LTOKind::None;
+    uint64_t cache_size_mb = 1024;
+    // empty = look for it next to clang
+    std::string profile_runtime;
+    // --backend=c, or --emit=c
+    bool c_backend = false;
+    // the C compiler gets the same -O, but defaults to -O2
+    std::string c_opt_level = "-O2";
+    bool print_ir = false;
+    // run the program in the bytecode interpreter instead of compiling it
+    bool interpret = false;
+    // run the entry point in the interpreter, compiled ahead of time and jitted
+    bool bench_tiers = false;
+    // start in the interpreter, and jit the functions that get hot
+    bool tiered = false;
+    uint32_t tier_threshold = 1000;
+    // ast nodes a const fn call can evaluate before it is left for runtime
+    uint64_t const_eval_steps = default_const_eval_steps;
+    // only type check, again every time the file changes
+    bool watch = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+
+        if (get_option_value(arg, "--error-limit=", value)) {
+            // 0 = report every error
+            if (!parse_number_option("--error-limit", value, UINT32_MAX, error_limit)) {
+                return 1;
+            }
+        }
+        else if (parse_opt_level(arg, optimizer_options.level)) {
+            c_opt_level = arg;
+        }
+        else if (arg == "--fast-math") {
+            codegen_options.fast_math = true;
+        }
+        else if (get_option_value(arg, "--veclib=", value)) {
+            if (!parse_vector_library(value, optimizer_options.vector_library)) {
+                std::cerr << "unknown vector library: " << value << " | expected none, libmvec or svml\n";
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "--passes=", value)) {
+            optimizer_options.passes = value;
+        }
+        else if (arg == "--time-passes") {
+            optimizer_options.time_passes = true;
+        }
+        else if (arg == "-march=native") {
+            native_target = true;
+        }
+        else if (get_option_value(arg, "--mcpu=", value)) {
+            target_selection.cpu = value;
+        }
+        else if (get_option_value(arg, "--mattr=", value)) {
+            target_selection.features = value;
+        }
+        else if (get_option_value(arg, "--emit=", value)) {
+            if (!parse_emit_kind(value, emit_kind)) {
+                std::cerr << "unknown --emit kind: " << value << " | expected obj, asm, bc, exe or c\n";
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "--backend=", value)) {
+            if (value != "llvm" && value != "c") {
+                std::cerr << "unknown --backend: " << value << " | expected llvm or c\n";
+                return 1;
+            }
+            c_backend = value == "c";
+        }
+        else if (arg == "-o" && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+        else if (get_option_value(arg, "--codegen-threads=", value)) {
+            if (!parse_number_option("--codegen-threads", value, max_option_threads, codegen_threads)) {
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "--lto=", value)) {
+            if (!parse_lto_kind(value, lto_kind)) {
+                std::cerr << "unknown --lto kind: " << value << " | expected none or thin\n";
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "--cache-dir=", value)) {
+            cache_dir = value;
+        }
+        else if (get_option_value(arg, "--cache-size-mb=", value)) {
+            // the cache takes the size in bytes
+            if (!parse_number_option("--cache-size-mb", value, UINT64_MAX >> 20, cache_size_mb)) {
+                return 1;
+            }
+        }
+        else if (arg == "--profile-generate") {
+            optimizer_options.profile_generate_path = "default_%m.profraw";
+        }
+        else if (get_option_value(arg, "--profile-generate=", value)) {
+            optimizer_options.profile_generate_path = value;
+        }
+        else if (get_option_value(arg, "--profile-use=", value)) {
+            optimizer_options.profile_use_path = value;
+        }
+        else if (get_option_value(arg, "--profile-runtime=", value)) {
+            profile_runtime = value;
+        }
+        else if (arg == "--jit") {
+            jit = true;
+        }
+        else if (get_option_value(arg, "--entry=", value)) {
+            jit_options.entry_name = value;
+        }
+        else if (get_option_value(arg, "--args=", value)) {
+            jit_options.args = split_comma_list(value);
+        }
+        else if (get_option_value(arg, "--bench-calls=", value)) {
+            if (!parse_number_option("--bench-calls", value, UINT64_MAX, jit_options.bench_calls)) {
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "--perf=", value)) {
+            if (!parse_perf_support(value, jit_options.perf)) {
+                std::cerr << "unknown --perf kind: " << value << " | expected map or jitdump\n";
+                return 1;
+            }
+        }
+        else if (arg == "--print-ir") {
+            print_ir = true;
+        }
+        else if (arg == "--interpret") {
+            interpret = true;
+        }
+        else if (arg == "--bench-tiers") {
+            bench_tiers = true;
+        }
+        else if (arg == "--tiered") {
+            tiered = true;
+        }
+        else if (get_option_value(arg, "--tier-threshold=", value)) {
+            if (!parse_number_option("--tier-threshold", value, UINT32_MAX, tier_threshold)) {
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "--const-eval-steps=", value)) {
+            if (!parse_number_option("--const-eval-steps", value, UINT64_MAX, const_eval_steps)) {
+                return 1;
+            }
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
+        else if (arg == "-g") {
+            codegen_options.debug_info = true;
+        }
+        else if (arg == "-j" && i + 1 < argc) {
+            if (!parse_number_option("-j", argv[++i], max_option_threads, num_jobs)) {
+                return 1;
+            }
+        }
+        else if (get_option_value(arg, "-j", value)) {
+            if (!parse_number_option("-j", value, max_option_threads, num_jobs)) {
+                return 1;
+            }
+        }
+        else if (arg == "--help" || arg == "-h") {
+            print_usage(std::cout);
+            return 0;
+        }
+        else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "unknown option: " << arg << "\n\n";
+            print_usage(std::cerr);
+            return 1;
+        }
+        else {
+            input_paths.push_back(argv[i]);
+        }
+    }
+
+    if (input_paths.empty()) {
+        std::cerr << "expected an input file\n\n";
+        print_usage(std::cerr);
+        return 1;
+    }
+
+    if (watch) {
+        if (input_paths.size() != 1) {
+            std::cerr << "--watch checks exactly one input file\n";
+            return 1;
+        }
+        return watch_file(input_paths[0], error_limit);
+    }
+
+    SourceManager source_manager;
+    codegen_options.source_manager = &source_manager;
+
+    // every file on its own, in parallel, then linked. only the backends
+    // that write an object per module can do that.
+    if (input_paths.size() > 1) {
+        if (emit_kind == EmitKind::None) {
+            emit_kind = EmitKind::Executable;
+        }
+
+        bool profile = !optimizer_options.profile_generate_path.empty() ||
+            !optimizer_options.profile_use_path.empty();
 
-    std::ifstream input_file(argv[1]);
+        if ((emit_kind != EmitKind::Object && emit_kind != EmitKind::Executable) || c_backend || jit ||
+            interpret || bench_tiers || tiered || print_ir || !cache_dir.empty() || profile) {
+            std::cerr << "several input files can only be compiled with --emit=obj or --emit=exe, "
+                << "and not with --backend=c, --jit, --interpret, --bench-tiers, --tiered, --print-ir, "
+                << "--cache-dir or profiles\n";
+            return 1;
+        }
+
+        AchillesJIT::initialize_native_target();
+
+        if (native_target) {
+            apply_native_target(target_selection);
+        }
+
+        if (output_path.empty()) {
+            output_path = get_default_output_path(input_paths[0], emit_kind);
+        }
+
+        DriverOptions driver_options;
+        driver_options.num_threads = num_jobs;
+        driver_options.error_limit = error_limit;
+        driver_options.const_eval_steps = const_eval_steps;
+        driver_options.codegen = codegen_options;
+        driver_options.optimizer = optimizer_options;
+        driver_options.target = target_selection;
+        driver_options.lto = lto_kind;
+
+        return compile_files(input_paths, source_manager, driver_options, emit_kind, output_path);
+    }
+
+    const char *input_path = input_paths[0].c_str();
+
+    std::ifstream input_file(input_path);
     std::string   file_data((std::istreambuf_iterator<char>(
                                  input_file)),
                             (std::istreambuf_iterator<char>()));
-    
-    std::vector<Token>tokens = tokenize_string(file_data);
+
+    FileID file = source_manager.add_file(input_path, file_data);
+    SourceRange file_range = source_manager.get_file_range(file);
+
+    std::vector<Token>tokens = tokenize_string(
+        source_manager.get_file_data(file), file_range.start);
     std::cout << "tokens:\n";
 
     for (auto& token : tokens) {
@@ -35,17 +458,336 @@ int main(int argc, char **argv) {
 
     std::cout << "\n-------\n\nparse tree:\n";
 
+    // keep going after errors, so that one run reports as many of them as
+    // possible. nothing is printed until the end.
+    DiagnosticEngine diagnostics(error_limit);
+    std::shared_ptr<IAST>ast = parse(tokens, file_range, diagnostics);
+    TSContext ctx = type_system_type_check(ast, diagnostics);
 
-    std::shared_ptr<IAST>ast = parse(tokens, file_data);
-    qehoqhoij2ij
+    if (diagnostics.has_errors()) {
+        diagnostics.render(std::cerr, source_manager);
+        return 1;
+    }
+
+    // has to live as long as the tree, since it owns the folded tokens
+    ::ConstantFolder constant_folder(const_eval_steps); // llvm_codegen.h pulls in llvm::ConstantFolder
+    ConstantFoldingStats folding_stats = constant_folder.fold(ast);
+    std::cout << "\n-------\n\nconstant folding: " << folding_stats << "\n";
 
-    try:
-        TSContext ctx = type_system_type_check(ast);
-        ctx.get_root_scope();
-    catch e:
-	std::cout << "\ntype checking error: " << e.what();
     std::cout << pretty_print(*ast);
-	generate_llvm_code(*ast, ctx);
+
+    // the IR before and after its own passes, verified after every pass
+    if (print_ir) {
+        try {
+            IRModule ir = lower_to_ir(dynamic_cast<ASTRoot&>(*ast), codegen_options.exported_names);
+            for (auto& fn : ir.functions) {
+                verify_ir(fn);
+            }
+            std::cout << "\n-------\n\nIR:\n" << ir;
+
+            IRPassManager ir_passes;
+            add_default_ir_passes(ir_passes);
+            IRPipelineStats ir_stats = ir_passes.run(ir, true);
+
+            std::cout << "\n-------\n\noptimized IR:\n" << ir;
+            std::cout << "\n-------\n\nIR passes: " << ir_stats << "\n";
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (emit_kind == EmitKind::C) {
+        c_backend = true;
+    }
+
+    bool tier_conflicts = c_backend || emit_kind != EmitKind::None || interpret || bench_tiers || jit ||
+        !optimizer_options.profile_generate_path.empty() || !optimizer_options.profile_use_path.empty();
+
+    if (tiered && tier_conflicts) {
+        std::cerr << "--tiered can not be used with --backend=c, --emit, --interpret, --bench-tiers, --jit "
+            << "or profiles\n";
+        return 1;
+    }
+
+    // the interpreter starts right away, without LLVM. --bench-tiers runs
+    // it first, and then the same entry point compiled ahead of time and
+    // jitted.
+    if (interpret || bench_tiers) {
+        if (c_backend || emit_kind != EmitKind::None || (interpret && (jit || bench_tiers))) {
+            std::cerr << "--interpret and --bench-tiers can not be used with --backend=c or --emit, "
+                << "and --interpret not with --jit\n";
+            return 1;
+        }
+
+        if (bench_tiers && jit_options.bench_calls == 0) {
+            jit_options.bench_calls = 1000000;
+        }
+
+        InterpreterRunOptions interpreter_options;
+        interpreter_options.entry_name = jit_options.entry_name;
+        interpreter_options.args = jit_options.args;
+        interpreter_options.bench_calls = jit_options.bench_calls;
+        interpreter_options.optimize = optimizer_options.level != OptLevel::O0;
+
+        try {
+            int status = run_interpreter(dynamic_cast<ASTRoot&>(*ast), interpreter_options);
+
+            if (interpret || status != 0) {
+                return status;
+            }
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+        jit = true;
+    }
+
+    // C source, compiled by the system's C compiler. everything that is
+    // done by LLVM itself is not available.
+    if (c_backend) {
+        bool profile = !optimizer_options.profile_generate_path.empty() ||
+            !optimizer_options.profile_use_path.empty();
+
+        if (jit || emit_kind == EmitKind::Bitcode || lto_kind != LTOKind::None || !cache_dir.empty() || profile ||
+            !optimizer_options.passes.empty() || optimizer_options.vector_library != VectorLibrary::None ||
+            !target_selection.features.empty()) {
+            std::cerr << "the C backend can not be used with --jit, --emit=bc, --lto, --cache-dir, profiles, "
+                << "--passes, --veclib or --mattr\n";
+            return 1;
+        }
+
+        CBackendOptions c_options;
+        c_options.compiler_args = { c_opt_level };
+        c_options.debug_info = codegen_options.debug_info;
+        c_options.source_manager = &source_manager;
+
+        if (native_target) {
+            c_options.compiler_args.push_back("-march=native");
+        }
+        else if (target_selection.cpu != "generic") {
+            c_options.compiler_args.push_back("-march=" + target_selection.cpu);
+        }
+
+        if (codegen_options.fast_math) {
+            c_options.compiler_args.push_back("-ffast-math");
+        }
+
+        try {
+            std::cout << "\n-------\n\nC code:\n" << generate_c_code(*ast, c_options);
+
+            if (emit_kind == EmitKind::None) {
+                return 0;
+            }
+
+            if (output_path.empty()) {
+                output_path = get_default_output_path(input_path, emit_kind);
+            }
+
+            COutputKind kind = emit_kind == EmitKind::Object ? COutputKind::Object :
+                emit_kind == EmitKind::Assembly ? COutputKind::Assembly :
+                emit_kind == EmitKind::Executable ? COutputKind::Executable : COutputKind::Source;
+            emit_c(*ast, c_options, kind, output_path);
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+        std::cout << "\n-------\n\nwrote: " << output_path << "\n";
+        return 0;
+    }
+
+    AchillesJIT::initialize_native_target();
+
+    if (native_target) {
+        apply_native_target(target_selection);
+    }
+
+    // the hot functions are compiled to be fast, so they are optimized even
+    // without -O
+    if (tiered) {
+        TieredRunOptions tiered_options;
+        tiered_options.interpreter.entry_name = jit_options.entry_name;
+        tiered_options.interpreter.args = jit_options.args;
+        tiered_options.interpreter.bench_calls = jit_options.bench_calls;
+        tiered_options.interpreter.optimize = optimizer_options.level != OptLevel::O0;
+        tiered_options.threshold = tier_threshold;
+        tiered_options.codegen = codegen_options;
+        tiered_options.optimizer = optimizer_options;
+        tiered_options.target = target_selection;
+
+        if (tiered_options.optimizer.level == OptLevel::O0) {
+            tiered_options.optimizer.level = OptLevel::O2;
+        }
+
+        try {
+            return run_tiered(dynamic_cast<ASTRoot&>(*ast), tiered_options);
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (emit_kind != EmitKind::None && output_path.empty()) {
+        output_path = get_default_output_path(input_path, emit_kind);
+    }
+
+    // the sharded, cached and thin lto backends write objects directly,
+    // without a combined module
+    bool emits_objects = emit_kind == EmitKind::Object || emit_kind == EmitKind::Executable;
+
+    if (lto_kind != LTOKind::None && (!emits_objects || !cache_dir.empty())) {
+        std::cerr << "--lto=thin needs --emit=obj or --emit=exe, and can not be used with --cache-dir\n";
+        return 1;
+    }
+
+    // the sharded backends only link objects, so main is checked up front
+    if (emit_kind == EmitKind::Executable) {
+        try {
+            ts_check_executable_main(ts_get_main_type(dynamic_cast<ASTRoot&>(*ast).children));
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+    }
+
+    bool profile_generate = !optimizer_options.profile_generate_path.empty();
+    bool profile_use = !optimizer_options.profile_use_path.empty();
+
+    // the cache key only covers the source, not the profile
+    if ((profile_generate || profile_use) && (jit || !cache_dir.empty())) {
+        std::cerr << "profiles can not be used with --jit or --cache-dir\n";
+        return 1;
+    }
+
+    // ahead of time compiled code is in a file, which perf reads the symbols
+    // (and with -g, the lines) from
+    if (jit_options.perf != PerfSupport::None && !jit) {
+        std::cerr << "--perf is only needed with --jit\n";
+        return 1;
+    }
+
+    if (profile_generate && profile_use) {
+        std::cerr << "--profile-generate and --profile-use can not be used together\n";
+        return 1;
+    }
+
+    if (profile_use && !llvm::sys::fs::exists(optimizer_options.profile_use_path)) {
+        std::cerr << "unable to find profile: " << optimizer_options.profile_use_path << "\n";
+        return 1;
+    }
+
+    // instrumented executables need the runtime that writes the profile
+    std::vector<std::string> link_args;
+
+    if (profile_generate && emit_kind == EmitKind::Executable) {
+        if (profile_runtime.empty()) {
+            profile_runtime = find_profile_runtime();
+        }
+
+        if (profile_runtime.empty()) {
+            std::cerr << "unable to find clang's profile runtime (libclang_rt.profile) | "
+                << "pass its path with --profile-runtime=\n";
+            return 1;
+        }
+        link_args = get_profile_runtime_link_args(profile_runtime);
+    }
+
+    if (emits_objects && (codegen_threads != 1 || !cache_dir.empty() || lto_kind != LTOKind::None)) {
+        ParallelBackendOptions parallel_options;
+        parallel_options.num_shards = codegen_threads;
+        parallel_options.codegen = codegen_options;
+        parallel_options.optimizer = optimizer_options;
+        parallel_options.target = target_selection;
+        parallel_options.link_args = link_args;
+
+        try {
+            if (lto_kind == LTOKind::Thin) {
+                emit_thin_lto(dynamic_cast<ASTRoot&>(*ast), parallel_options, emit_kind, output_path);
+            }
+            else if (!cache_dir.empty()) {
+                FunctionObjectCache cache(cache_dir, cache_size_mb * 1024 * 1024);
+                emit_cached(dynamic_cast<ASTRoot&>(*ast), parallel_options, cache, emit_kind, output_path);
+            }
+            else {
+                emit_parallel(dynamic_cast<ASTRoot&>(*ast), parallel_options, emit_kind, output_path);
+            }
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+        std::cout << "\n-------\n\nwrote: " << output_path << "\n";
+        return 0;
+    }
+
+    // the entry point is called through a trampoline that is only added
+    // after optimizing, so it has to survive as it is
+    if (jit) {
+        codegen_options.exported_names.insert(jit_options.entry_name);
+    }
+
+    std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext());
+    std::unique_ptr<llvm::Module> module;
+
+    // generating also verifies the module
+    try {
+        module = generate_llvm_code(*ast, ctx, *llvm_ctx, codegen_options);
+    }
+    catch (std::runtime_error& error) {
+        std::cerr << "\n" << error.what() << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<llvm::TargetMachine> target_machine =
+        llvm_create_host_target_machine(optimizer_options.level, target_selection);
+
+    try {
+        llvm_optimize_module(*module, *target_machine, optimizer_options);
+    }
+    catch (std::runtime_error& error) {
+        std::cerr << "\n" << error.what() << "\n";
+        return 1;
+    }
+
+    if (optimizer_options.level != OptLevel::O0 || !optimizer_options.passes.empty()) {
+        std::cout << "\n-------\n\noptimized module dump: \n";
+        std::cout.flush();
+        module->print(llvm::outs(), nullptr);
+        llvm::outs().flush();
+    }
+
+    if (emit_kind != EmitKind::None) {
+        try {
+            llvm_emit_module(*module, *target_machine, emit_kind, output_path, link_args);
+        }
+        catch (std::runtime_error& error) {
+            std::cerr << "\n" << error.what() << "\n";
+            return 1;
+        }
+        std::cout << "\n-------\n\nwrote: " << output_path << "\n";
+    }
+
+    if (jit) {
+        std::string vector_library_runtime = get_vector_library_runtime(optimizer_options.vector_library);
+
+        if (!vector_library_runtime.empty()) {
+            jit_options.libraries.push_back(vector_library_runtime);
+        }
+
+        if (bench_tiers) {
+            int status = run_aot(*module, *target_machine, jit_options);
+
+            if (status != 0) {
+                return status;
+            }
+        }
+        return run_jit(std::move(llvm_ctx), std::move(module), jit_options);
+    }
 
     return 0;
 }
@@ -1,4 +1,3 @@
-#pragma once
 #include "pretty_print.h"
 #include <sstream>
 #include <iostream>
@@ -47,6 +46,10 @@ void ASTPrettyPrinter::inspect_block(ASTBlock& block) {
         statement->dispatch(*this);
     }
 
+    if (block.return_expr) {
+        block.return_expr->dispatch(*this);
+    }
+
     this->depth--;
     out << "\n";
     this->print_indent();
@@ -75,6 +78,15 @@ void ASTPrettyPrinter::inspect_statement(ASTStatement& statement) {
 }
 
 void ASTPrettyPrinter::inspect_fn_definition(ASTFunctionDefinition& fn_defn) {
+    if (fn_defn.linkage == ASTLinkage::Export) {
+        out << "export ";
+    }
+    else if (fn_defn.linkage == ASTLinkage::Extern) {
+        out << "extern ";
+    }
+    if (fn_defn.is_const) {
+        out << "const ";
+    }
     out << "fn ";
     out << fn_defn.fn_name;
     out << "(";
@@ -111,6 +123,47 @@ void ASTPrettyPrinter::inspect_variable_definition(ASTVariableDefinition& defn)
     }
 }
 
+void ASTPrettyPrinter::inspect_for_loop(ASTForLoop& for_loop)
+{
+    out << "for ";
+    for_loop.induction_var->dispatch(*this);
+    out << " = ";
+    for_loop.start->dispatch(*this);
+    out << ", ";
+    for_loop.end->dispatch(*this);
+
+    if (for_loop.step) {
+        out << ", ";
+        for_loop.step->dispatch(*this);
+    }
+
+    for (unsigned i = 0; i < for_loop.hints.size(); ++i) {
+        out << (i == 0 ? " : " : ", ") << *for_loop.hints[i].name.value.ptr_s;
+
+        if (for_loop.hints[i].value != 0) {
+            out << "(" << for_loop.hints[i].value << ")";
+        }
+    }
+
+    for_loop.body->dispatch(*this);
+}
+
+void ASTPrettyPrinter::inspect_if(ASTIf& if_expr)
+{
+    out << "if ";
+    if_expr.condition->dispatch(*this);
+    if_expr.then_block->dispatch(*this);
+
+    if (if_expr.else_branch) {
+        out << " else ";
+        if_expr.else_branch->dispatch(*this);
+    }
+
+    if (if_expr.ts_data) {
+        out << "@" << *if_expr.ts_data->type;
+    }
+}
+
 void ASTPrettyPrinter::inspect_fn_call(ASTFunctionCall& fn_call) {
 	fn_call.name->dispatch(*this);
 	out << "(";
@@ -24,6 +24,8 @@ public:
     void inspect_fn_definition(ASTFunctionDefinition& fn_defn);
     void inspect_fn_call(ASTFunctionCall& fn_call);
     void inspect_variable_definition(ASTVariableDefinition& variable_defn);
+    void inspect_for_loop(ASTForLoop& for_loop);
+    void inspect_if(ASTIf& if_expr);
 };
 
 void pretty_print_to_stream(IAST& ast, std::ostream& out);
@@ -0,0 +1,206 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(unsigned num_threads) : pending(0), shutting_down(false) {
+	if (num_threads == 0) {
+		num_threads = std::thread::hardware_concurrency();
+	}
+
+	// hardware_concurrency is allowed to return 0 if it does not know
+	if (num_threads == 0) {
+		num_threads = 1;
+	}
+
+	for (unsigned i = 0; i < num_threads; ++i) {
+		this->workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->shutting_down = true;
+	}
+	this->task_available.notify_all();
+
+	for (auto &worker : this->workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::submit(Task task) {
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->tasks.push_back(task);
+		this->pending++;
+	}
+	this->task_available.notify_one();
+}
+
+void ThreadPool::wait_idle() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+
+	while (this->pending != 0) {
+		this->idle.wait(lock);
+	}
+}
+
+void ThreadPool::worker_loop() {
+	while (true) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+
+			while (this->tasks.empty() && !this->shutting_down) {
+				this->task_available.wait(lock);
+			}
+
+			if (this->tasks.empty()) {
+				// shutting down and nothing left to run
+				return;
+			}
+
+			task = this->tasks.front();
+			this->tasks.pop_front();
+		}
+
+		task();
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->pending--;
+
+			if (this->pending == 0) {
+				this->idle.notify_all();
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------
+// WORK STEALING
+
+// the pool and worker of the current thread, if it is a worker
+static thread_local WorkStealingPool *current_pool = nullptr;
+static thread_local unsigned current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned num_threads) :
+	next_worker(0), num_steals(0), queued(0), pending(0), shutting_down(false) {
+	if (num_threads == 0) {
+		num_threads = std::thread::hardware_concurrency();
+	}
+
+	if (num_threads == 0) {
+		num_threads = 1;
+	}
+
+	// every deque exists before any worker looks for something to steal
+	for (unsigned i = 0; i < num_threads; ++i) {
+		this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+	}
+
+	for (unsigned i = 0; i < num_threads; ++i) {
+		this->workers[i]->thread = std::thread(&WorkStealingPool::worker_loop, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->shutting_down = true;
+	}
+	this->task_available.notify_all();
+
+	for (auto &worker : this->workers) {
+		worker->thread.join();
+	}
+}
+
+void WorkStealingPool::submit(Task task) {
+	unsigned index = current_pool == this ? current_worker :
+		this->next_worker.fetch_add(1) % this->workers.size();
+
+	// counted first, so that pending can not drop to 0 while the task is
+	// queued. a worker that sees the count before the task spins briefly.
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->queued++;
+		this->pending++;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(this->workers[index]->mutex);
+		this->workers[index]->tasks.push_back(task);
+	}
+	this->task_available.notify_one();
+}
+
+void WorkStealingPool::wait_idle() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+
+	while (this->pending != 0) {
+		this->idle.wait(lock);
+	}
+}
+
+bool WorkStealingPool::pop_task(unsigned index, Task& task) {
+	{
+		Worker &own = *this->workers[index];
+		std::unique_lock<std::mutex> lock(own.mutex);
+
+		if (!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned i = 1; i < this->workers.size(); ++i) {
+		Worker &victim = *this->workers[(index + i) % this->workers.size()];
+		std::unique_lock<std::mutex> lock(victim.mutex);
+
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			this->num_steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingPool::worker_loop(unsigned index) {
+	current_pool = this;
+	current_worker = index;
+
+	while (true) {
+		Task task;
+
+		if (this->pop_task(index, task)) {
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->queued--;
+			}
+
+			task();
+
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->pending--;
+
+			if (this->pending == 0) {
+				this->idle.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+
+		while (this->queued == 0 && !this->shutting_down) {
+			this->task_available.wait(lock);
+		}
+
+		if (this->queued == 0) {
+			// shutting down and nothing left to run
+			return;
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <stdint.h>
+
+// fixed size pool of workers pulling tasks off a shared queue.
+class ThreadPool {
+public:
+
+	typedef std::function<void()> Task;
+
+	// num_threads == 0 picks std::thread::hardware_concurrency()
+	ThreadPool(unsigned num_threads = 0);
+	~ThreadPool();
+
+	void submit(Task task);
+
+	// blocks until every submitted task has finished running
+	void wait_idle();
+
+	unsigned get_num_threads() const {
+		return this->workers.size();
+	}
+
+private:
+
+	void worker_loop();
+
+	std::vector<std::thread> workers;
+	std::deque<Task> tasks;
+
+	std::mutex mutex;
+	std::condition_variable task_available;
+	std::condition_variable idle;
+
+	// tasks that are either queued or currently running
+	unsigned pending;
+	bool shutting_down;
+};
+
+// fixed size pool where every worker has a deque of its own. a task that
+// is submitted by one of the pool's tasks goes onto the deque of the worker
+// running it, which runs its newest task first, so follow up work runs
+// while the data it needs is still in the cache. tasks submitted from
+// outside are spread over the workers. a worker whose deque is empty
+// steals the oldest task of another one, so uneven tasks still keep every
+// worker busy.
+class WorkStealingPool {
+public:
+
+	typedef std::function<void()> Task;
+
+	// num_threads == 0 picks std::thread::hardware_concurrency()
+	WorkStealingPool(unsigned num_threads = 0);
+	~WorkStealingPool();
+
+	void submit(Task task);
+
+	// blocks until every submitted task, and everything they submitted, has
+	// finished running. can not be called from one of the pool's tasks.
+	void wait_idle();
+
+	unsigned get_num_threads() const {
+		return this->workers.size();
+	}
+
+	// tasks that ran on another worker than the one they were queued on
+	uint64_t get_num_steals() const {
+		return this->num_steals.load();
+	}
+
+private:
+
+	struct Worker {
+		std::thread thread;
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	// the own deque from the back, then the others from the front
+	bool pop_task(unsigned index, Task& task);
+	void worker_loop(unsigned index);
+
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::atomic<unsigned> next_worker;
+	std::atomic<uint64_t> num_steals;
+
+	// guards the counts, the deques have their own locks
+	std::mutex mutex;
+	std::condition_variable task_available;
+	std::condition_variable idle;
+
+	// tasks in any deque, and tasks that are either queued or running
+	unsigned queued;
+	unsigned pending;
+	bool shutting_down;
+};
@@ -110,6 +110,14 @@ std::ostream & operator<<(std::ostream& out, const TokenType& token_type) {
         out << "extern";
         break;
 
+    case TokenType::Export:
+        out << "export";
+        break;
+
+    case TokenType::Const:
+        out << "const";
+        break;
+
 
     case TokenType::Let:
         out << "let";
@@ -179,7 +187,7 @@ bool is_whitespace(char c) {
            || c == '\t';
 }
 
-PositionIndex strip_whitespace(std::string s, PositionIndex i) {
+PositionIndex strip_whitespace(const std::string& s, PositionIndex i) {
     while (is_whitespace(s[i])) {
         ++i;
     }
@@ -189,7 +197,6 @@ PositionIndex strip_whitespace(std::string s, PositionIndex i) {
 
 const std::vector<std::pair<std::string, TokenType> >sigil_map =
 {
-    { "=",  TokenType::Equals            },
     { "->", TokenType::ThinArrow         },
     { "(",  TokenType::OpenBracket       },
     { ")",  TokenType::CloseBracket      },
@@ -214,6 +221,9 @@ const std::vector<std::pair<std::string, TokenType> >sigil_map =
     { "<",  TokenType::CondL             },
     { "!",  TokenType::CondNot           },
 
+    // sigils are matched in order, so = has to come after ==, <= ...
+    { "=",  TokenType::Equals            },
+
     // conditional terms
     { "&&", TokenType::CondAnd           },
     { "||", TokenType::CondOr            }
@@ -227,10 +237,12 @@ const std::map<std::string, TokenType>keywords_map =
     { "for",  TokenType::For  },
     { "fn",   TokenType::Fn   },
     { "extern",   TokenType::Extern   },
+    { "export",   TokenType::Export   },
+    { "const",    TokenType::Const    },
 };
 
 
-std::vector<Token>tokenize_string(std::string& s) {
+std::vector<Token>tokenize_string(const std::string& s, SourceLoc file_start) {
     std::vector<Token>tokens;
     PositionIndex      i     = 0;
     PositionIndex      begin = 0;
@@ -244,9 +256,10 @@ std::vector<Token>tokenize_string(std::string& s) {
 
             // if we find a sigil, split it out
             if (s.substr(i, sigil_str.size()) == sigil_str) {
-                tokens.push_back(Token(sigil_token_type,
-                                       PositionRange(begin, i, s)));
                 i += sigil_str.size();
+                tokens.push_back(Token(sigil_token_type,
+                                       SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
 
                 // strip whitespace and get back to tokenization
                 goto TOKENIZATION_END;
@@ -284,7 +297,8 @@ std::vector<Token>tokenize_string(std::string& s) {
             // skip over the closing quotes
             i++;
             tokens.push_back(Token(TokenType::LiteralString, string,
-                                   PositionRange(begin, i, s)));
+                                   SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
         }
 
         // numbers
@@ -303,11 +317,13 @@ std::vector<Token>tokenize_string(std::string& s) {
             if (is_int) {
                 long long num_i = std::stoll(number_string.c_str());
                 tokens.push_back(Token(TokenType::LiteralInt, num_i,
-                                       PositionRange(begin, i, s)));
+                                       SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
             } else {
                 long double num_f = std::stold(number_string.c_str());
                 tokens.push_back(Token(TokenType::LiteralFloat, num_f,
-                                       PositionRange(begin, i, s)));
+                                       SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
             }
         }
 
@@ -331,14 +347,16 @@ std::vector<Token>tokenize_string(std::string& s) {
                 if (name == identifier_name) {
                     TokenType identifier_token_type = it.second;
                     tokens.push_back(Token(identifier_token_type,
-                                           PositionRange(begin, i, s)));
+                                           SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
                     goto TOKENIZATION_END;
                 }
             }
 
             // not a keyword, it's an identifier:
             tokens.push_back(Token(TokenType::Identifier, identifier_name,
-                                   PositionRange(begin, i, s)));
+                                   SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
         }
 
         // undecided strings
@@ -351,7 +369,8 @@ std::vector<Token>tokenize_string(std::string& s) {
             }
 
             tokens.push_back(Token(TokenType::Undecided, undecided_string,
-                                   PositionRange(begin, i, s)));
+                                   SourceRange(file_start.get_loc_with_offset(begin),
+                                   file_start.get_loc_with_offset(i))));
         }
         TOKENIZATION_END:
         i = strip_whitespace(s, i);
@@ -42,6 +42,8 @@ enum class TokenType
 	Let,
 	Fn,
 	Extern,
+	Export,
+	Const,
 
 	// identifiers
 	Identifier,
@@ -98,18 +100,18 @@ struct Token
 {
 	TokenType     type;
 	TokenValue    value;
-	PositionRange pos;
+	SourceRange   pos;
 
-	Token(TokenType type, PositionRange pos) : type(type), pos(pos) {}
+	Token(TokenType type, SourceRange pos) : type(type), pos(pos) {}
 
-	Token(TokenType type, std::string string, PositionRange pos) : type(type),
+	Token(TokenType type, std::string string, SourceRange pos) : type(type),
 		value(string), pos(pos) {}
 
-	Token(TokenType type, long long i, PositionRange pos) : type(type),
+	Token(TokenType type, long long i, SourceRange pos) : type(type),
 		value(i),
 		pos(pos) {}
 
-	Token(TokenType type, long double f, PositionRange pos) : type(type),
+	Token(TokenType type, long double f, SourceRange pos) : type(type),
 		value(f), pos(pos) {}
 };
 
@@ -120,4 +122,6 @@ std::ostream& operator<<(std::ostream& out,
 std::ostream& operator<<(std::ostream& out,
 	const Token & token);
 
-std::vector<Token>tokenize_string(std::string& file_data);
+// file_start is the location of file_data's first char
+std::vector<Token>tokenize_string(const std::string& file_data,
+	SourceLoc file_start);
@@ -3,18 +3,82 @@
 #include <sstream>
 #include <iostream>
 #include "pretty_print.h"
-/*
-   TSType *int_type = new TSType(TSType::Variant::Int, nullptr);
-   TSType *float_type = new TSType(TSType::Variant::Float, nullptr);
-   TSType *string_type = new TSType(TSType::Variant::String, nullptr);
-   */
+#include "thread_pool.h"
+#include "diagnostics.h"
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+const TSType *const int_type = new TSType(TSType::Variant::Int, SourceRange());
+const TSType *const float_type = new TSType(TSType::Variant::Float, SourceRange());
+const TSType *const string_type = new TSType(TSType::Variant::String, SourceRange());
+const TSType *const void_type = new TSType(TSType::Variant::Void, SourceRange());
+
+const TSType *const i32_type = new TSType(TSType::Variant::Int32, SourceRange());
+const TSType *const f32_type = new TSType(TSType::Variant::Float32, SourceRange());
+const TSType *const bool_type = new TSType(TSType::Variant::Bool, SourceRange());
+
+const TSType *const error_type = new TSType(TSType::Variant::Error, SourceRange());
 
 TSType::TSType(const TSFunctionTypeData func_data,
-			   PositionRange            *decl_pos) : decl_pos(decl_pos) {
+			   SourceRange              decl_pos) : decl_pos(decl_pos) {
 	this->variant = Variant::Function;
 	this->func_data = std::make_shared<TSFunctionTypeData>(func_data);
 }
 
+const TSType* get_function_type(const std::vector<const TSType *>& args,
+								const TSType                     *return_type) {
+	typedef std::pair<std::vector<const TSType *>, const TSType *> FunctionTypeKey;
+
+	static std::mutex interning_mutex;
+	static std::map<FunctionTypeKey, const TSType *> interned_function_types;
+
+	std::lock_guard<std::mutex> lock(interning_mutex);
+	FunctionTypeKey key = std::make_pair(args, return_type);
+	auto it = interned_function_types.find(key);
+
+	if (it != interned_function_types.end()) {
+		return it->second;
+	}
+
+	const TSType *fn_type = new TSType(TSFunctionTypeData(args, return_type), SourceRange());
+	interned_function_types[key] = fn_type;
+	return fn_type;
+}
+
+const std::map<std::string, std::string>& ts_get_math_library_functions() {
+	static const std::map<std::string, std::string> functions = {
+		{ "sin", "sinf" }, { "cos", "cosf" }, { "sqrt", "sqrtf" }, { "exp", "expf" },
+		{ "exp2", "exp2f" }, { "log", "logf" }, { "log2", "log2f" }, { "log10", "log10f" },
+		{ "fabs", "fabsf" }, { "floor", "floorf" }, { "ceil", "ceilf" }, { "trunc", "truncf" },
+		{ "round", "roundf" }, { "pow", "powf" }, { "fmin", "fminf" }, { "fmax", "fmaxf" },
+		{ "copysign", "copysignf" }, { "fma", "fmaf" },
+	};
+	return functions;
+}
+
+const TSType* ts_get_main_type(const std::vector<std::shared_ptr<IAST> >& top_level) {
+	for (auto child : top_level) {
+		ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+		// not type checked if the file has errors
+		if (fn_defn && fn_defn->body && fn_defn->ts_data && *fn_defn->fn_name.value.ptr_s == "main") {
+			return fn_defn->ts_data->type;
+		}
+	}
+	return nullptr;
+}
+
+void ts_check_executable_main(const TSType *main_type) {
+	if (!main_type) {
+		throw std::runtime_error("an executable needs a fn main() -> i32");
+	}
+	if (main_type != get_function_type({}, i32_type)) {
+		throw std::runtime_error("an executable needs a fn main() -> i32 | main takes arguments or does not "
+								 "return an i32");
+	}
+}
+
 std::ostream& operator<<(std::ostream& out, const TSType& type) {
 	out << "t-";
 
@@ -31,6 +95,10 @@ std::ostream& operator<<(std::ostream& out, const TSType& type) {
 		out << "f32";
 		break;
 
+	case TSType::Variant::Bool:
+		out << "bool";
+		break;
+
 	case TSType::Variant::Int:
 		out << "i_";
 		break;
@@ -43,6 +111,10 @@ std::ostream& operator<<(std::ostream& out, const TSType& type) {
 		out << "string";
 		break;
 
+	case TSType::Variant::Error:
+		out << "error";
+		break;
+
 	case TSType::Variant::Function:
 		assert(type.func_data);
 
@@ -64,56 +136,76 @@ std::ostream& operator<<(std::ostream& out, const TSType& type) {
 	return out;
 }
 
+static bool is_number(const TSType *type) {
+	return type == i32_type ||
+		type == f32_type;
+}
+
+static bool is_comparison(TokenType op) {
+	return op == TokenType::CondL ||
+		op == TokenType::CondG ||
+		op == TokenType::CondLEQ ||
+		op == TokenType::CondGEQ ||
+		op == TokenType::CondEQ ||
+		op == TokenType::CondNEQ;
+}
+
+static bool is_logical(TokenType op) {
+	return op == TokenType::CondAnd ||
+		op == TokenType::CondOr;
+}
+
 struct TSDataCreator : public IASTVisitor {
-	TSContext &ctx;
+	TSScopeStorage &storage;
 	TSScope  *scope;
-	TSDataCreator(TSContext &ctx, TSScope *scope) : ctx(ctx), scope(scope) {};
+	DiagnosticEngine &diagnostics;
+	TSDataCreator(TSScopeStorage &storage, TSScope *scope, DiagnosticEngine &diagnostics) :
+		storage(storage), scope(scope), diagnostics(diagnostics) {};
 
-	static void setup_variable_use(ASTLiteral &literal, TSScope *scope) {
+	void setup_variable_use(ASTLiteral &literal, TSScope *scope) {
 		assert(literal.token.type == TokenType::Identifier);
 		const std::string &name = *literal.token.value.ptr_s;
 
 		if (!scope->has_variable(name)) {
-			std::stringstream error;
-			error << "undefined variable: " << name;
-			error << literal.position;
-
-			throw std::runtime_error(error.str());
+			this->diagnostics.report(DiagnosticCode::UndefinedVariable, literal.position, { name });
+			literal.ts_data = std::make_shared<TSASTData>(scope, error_type);
+			return;
 		}
 
 		const TSVariable *variable = scope->get_variable(name);
 		literal.ts_data = std::make_shared<TSASTData>(scope, variable->type);
 	};
 
-	static void setup_variable_definition(ASTLiteral &literal, const TSType *type, TSScope *scope) {
+	void setup_variable_definition(ASTLiteral &literal, const TSType *type, TSScope *scope) {
 		assert(literal.token.type == TokenType::Identifier);
 		const std::string &name = *literal.token.value.ptr_s;
 
 		if (scope->has_variable(name)) {
 			const TSVariable *variable_definition = scope->get_variable(name);
-			std::stringstream error;
-			error << "multiple variable definition: " << name;
-			error << *variable_definition->decl_pos << " originial definition";
-			error << literal.position << " multiple definition";
+			this->diagnostics.report(DiagnosticCode::MultipleVariableDefinition, literal.position, { name });
 
-			throw std::runtime_error(error.str());
+			//builtins do not have a position
+			if (variable_definition->decl_pos.is_valid()) {
+				this->diagnostics.report(DiagnosticCode::NoteOriginalDefinition, variable_definition->decl_pos);
+			}
+
+			//keep the original definition, but still type the literal
+			literal.ts_data = std::make_shared<TSASTData>(scope, type);
+			return;
 		}
 
-		TSVariable *new_var = new TSVariable(name, type, &literal.position);
+		TSVariable *new_var = new TSVariable(name, type, literal.position);
 		scope->add_variable(name, new_var);
 		literal.ts_data = std::make_shared<TSASTData>(scope, type);
 	}
 
-	static const TSType* get_type_for_literal(ASTLiteral &literal, TSScope *scope) {
+	const TSType* get_type_for_literal(ASTLiteral &literal, TSScope *scope) {
 		assert(literal.token.type == TokenType::Identifier);
 		const std::string &name = *literal.token.value.ptr_s;
 
 		if (!scope->has_type(name)) {
-			std::stringstream error;
-			error << "unable to find type: " << name;
-			error << literal.position;
-
-			throw std::runtime_error(error.str());
+			this->diagnostics.report(DiagnosticCode::UnknownType, literal.position, { name });
+			return error_type;
 		};
 
 		return scope->get_type(name);
@@ -152,20 +244,18 @@ struct TSDataCreator : public IASTVisitor {
 		if (block.return_expr) {
 			//generate a return type using the *inner* block
 			block.return_expr->dispatch(inner_creator);
-			//copy the type
-			//the *entire* block belongs to the outer scope
-			const TSType *return_type = block.return_expr->ts_data->type;
-			block.ts_data = std::make_shared<TSASTData>(outer_creator.scope, return_type);
-		}
-		else {
-			//the *entire* block belongs to the outer scope
-			block.ts_data = std::make_shared<TSASTData>(outer_creator.scope, void_type);
 		}
+
+		//the block evaluates to its last expression. the *entire* block
+		//belongs to the outer scope
+		IAST *value_expr = get_block_value_expr(block);
+		const TSType *return_type = value_expr && value_expr->ts_data ? value_expr->ts_data->type : void_type;
+		block.ts_data = std::make_shared<TSASTData>(outer_creator.scope, return_type);
 	};
 
 	virtual void inspect_block(ASTBlock& block) {
-		TSScope *block_scope = ctx.create_child_scope(this->scope);
-		TSDataCreator block_tsdata_creator(ctx, block_scope);
+		TSScope *block_scope = storage.create_child_scope(this->scope);
+		TSDataCreator block_tsdata_creator(storage, block_scope, this->diagnostics);
 
 		TSDataCreator::setup_block(block, block_tsdata_creator, *this);
 	};
@@ -175,8 +265,35 @@ struct TSDataCreator : public IASTVisitor {
 		statement.inner->dispatch(*this);
 	};
 
-	//we don't need to do anything for these. just let the
-	//default instance of ASTVisitor which "does the right thing"
+	//whether a value of type from can be used where to is expected
+	static bool can_convert_implicitly(const TSType *from, const TSType *to) {
+		return from == i32_type && to == f32_type;
+	}
+
+	//mixing i32 and f32 gives f32, with the i32 side converted. anything
+	//that is not a number is reported by TSArithTypeChecker.
+	static const TSType* unify_arith_operands(IAST &left, IAST &right) {
+		const TSType *left_type = left.ts_data->type;
+		const TSType *right_type = right.ts_data->type;
+
+		if (!is_number(left_type) || !is_number(right_type)) {
+			return error_type;
+		}
+
+		if (left_type == right_type) {
+			return left_type;
+		}
+
+		if (can_convert_implicitly(left_type, right_type)) {
+			left.ts_data->implicit_conversion = right_type;
+			return right_type;
+		}
+
+		assert(can_convert_implicitly(right_type, left_type));
+		right.ts_data->implicit_conversion = left_type;
+		return left_type;
+	}
+
 	virtual void inspect_infix_expr(ASTInfixExpr& infix){
 		infix.left->dispatch(*this);
 		infix.right->dispatch(*this);
@@ -187,29 +304,102 @@ struct TSDataCreator : public IASTVisitor {
 			infix.op.type == TokenType::Multiply ||
 			infix.op.type == TokenType::Divide) {
 
-			//HACK!
-			const TSType *unified_type = f32_type;
+			const TSType *unified_type = unify_arith_operands(*infix.left, *infix.right);
 			infix.ts_data = std::make_shared<TSASTData>(scope, unified_type);
 		};
+
+		//an assignment evaluates to the value stored, typed as the target.
+		//mismatches are reported by TSEqualityTypeChecker.
+		if (infix.op.type == TokenType::Equals) {
+			infix.ts_data = std::make_shared<TSASTData>(scope, infix.left->ts_data->type);
+		}
+
+		//numbers compare like arith operands, bools only with == and !=.
+		//a comparison is a bool even if its operands are wrong, the
+		//operands are reported by TSArithTypeChecker.
+		if (is_comparison(infix.op.type)) {
+			if (is_number(infix.left->ts_data->type) && is_number(infix.right->ts_data->type)) {
+				unify_arith_operands(*infix.left, *infix.right);
+			}
+			infix.ts_data = std::make_shared<TSASTData>(scope, bool_type);
+		}
+
+		if (is_logical(infix.op.type)) {
+			infix.ts_data = std::make_shared<TSASTData>(scope, bool_type);
+		}
 	};
 
-	//virtual void inspect_prefix_expr(ASTPrefixExpr& prefix){};
+	virtual void inspect_prefix_expr(ASTPrefixExpr& prefix){
+		prefix.expr->dispatch(*this);
 
-	virtual void inspect_fn_definition(ASTFunctionDefinition& fn_defn) {
-		fn_defn.ts_data = std::make_shared<TSASTData>(scope, void_type);
+		//unary - keeps the type of its operand, ! is always a bool
+		const TSType *type = prefix.op.type == TokenType::CondNot ? bool_type : prefix.expr->ts_data->type;
+		prefix.ts_data = std::make_shared<TSASTData>(scope, type);
+	};
+
+	//types the arguments and return type, and binds the function's name in
+	//the current scope so that every body can call it.
+	void setup_fn_signature(ASTFunctionDefinition& fn_defn) {
+		const std::string &name = *fn_defn.fn_name.value.ptr_s;
 
-		TSScope *fn_scope = ctx.create_child_scope(this->scope);
-		TSDataCreator fn_defn_data_creator(this->ctx, fn_scope);
+		//the math builtins would call it instead of the C library. extern
+		//declarations of them are the C library's.
+		if (fn_defn.body) {
+			for (auto &function : ts_get_math_library_functions()) {
+				if (function.second == name) {
+					this->diagnostics.report(DiagnosticCode::ReservedFunctionName, fn_defn.fn_name.pos,
+											 { name, function.first });
+				}
+			}
+		}
 
+		bool is_redefinition = this->scope->has_variable(name);
+
+		if (is_redefinition) {
+			const TSVariable *original = this->scope->get_variable(name);
+			this->diagnostics.report(DiagnosticCode::MultipleFunctionDefinition, fn_defn.fn_name.pos, { name });
+
+			if (original->decl_pos.is_valid()) {
+				this->diagnostics.report(DiagnosticCode::NoteOriginalDefinition, original->decl_pos);
+			}
+		}
 
 		std::vector<const TSType*> arg_types;
-		//fill in the args
 		for (auto arg : fn_defn.args) {
-			ASTLiteral &arg_name = *reinterpret_cast<ASTLiteral*>(arg.first.get());
 			ASTLiteral &type_name = *reinterpret_cast<ASTLiteral*>(arg.second.get());
 
-			const TSType *arg_type = TSDataCreator::get_type_for_literal(type_name, fn_scope);
+			const TSType *arg_type = TSDataCreator::get_type_for_literal(type_name, this->scope);
+			type_name.ts_data = std::make_shared<TSASTData>(this->scope, arg_type);
 			arg_types.push_back(arg_type);
+		}
+
+		//type the return type
+		ASTLiteral &return_name = *reinterpret_cast<ASTLiteral*>(fn_defn.return_type.get());
+		const TSType *return_type = TSDataCreator::get_type_for_literal(return_name, this->scope);
+		fn_defn.return_type->ts_data = std::make_shared<TSASTData>(this->scope, return_type);
+
+		//construct fn type
+		const TSType *fn_type = get_function_type(arg_types, return_type);
+		fn_defn.ts_data = std::make_shared<TSASTData>(this->scope, fn_type);
+
+		//a redefinition is still typed, so that its body can be checked
+		if (!is_redefinition) {
+			TSVariable *fn = new TSVariable(name, fn_type, fn_defn.position);
+			fn->is_const_fn = fn_defn.is_const;
+			this->scope->add_variable(name, fn);
+		}
+	}
+
+	//needs setup_fn_signature to have run on fn_defn. only touches the
+	//function's own scopes, so bodies can be checked concurrently.
+	void setup_fn_body(ASTFunctionDefinition& fn_defn) {
+		TSScope *fn_scope = storage.create_child_scope(this->scope);
+		TSDataCreator fn_defn_data_creator(this->storage, fn_scope, this->diagnostics);
+
+		//fill in the args
+		for (unsigned i = 0; i < fn_defn.args.size(); ++i) {
+			ASTLiteral &arg_name = *reinterpret_cast<ASTLiteral*>(fn_defn.args[i].first.get());
+			const TSType *arg_type = fn_defn.ts_data->type->func_data->args[i];
 			TSDataCreator::setup_variable_definition(arg_name, arg_type, fn_scope);
 		}
 
@@ -218,35 +408,223 @@ struct TSDataCreator : public IASTVisitor {
 			//now type the block
 			ASTBlock &fn_body = *reinterpret_cast<ASTBlock*>(fn_defn.body.get());
 			TSDataCreator::setup_block(fn_body, fn_defn_data_creator, *this);
+			this->check_fn_body_type(fn_defn, fn_body);
 		}
-		//type the return type
-		ASTLiteral &return_name = *reinterpret_cast<ASTLiteral*>(fn_defn.return_type.get());
-		const TSType *return_type = TSDataCreator::get_type_for_literal(return_name, this->scope);
-		fn_defn.return_type->ts_data = std::make_shared<TSASTData>(this->scope, return_type);
+	}
 
-		//construct fn type
-		const TSType *fn_type = new TSType(TSFunctionTypeData(arg_types, return_type), &fn_defn.position);
-		fn_defn.ts_data = std::make_shared<TSASTData>(this->scope, fn_type);
+	//the body's value is returned, so it has to fit the return type. a
+	//void function throws its body's value away.
+	void check_fn_body_type(ASTFunctionDefinition& fn_defn, ASTBlock& fn_body) {
+		const TSType *return_type = fn_defn.ts_data->type->func_data->return_type;
+		const TSType *body_type = fn_body.ts_data->type;
+
+		if (return_type == void_type || return_type == error_type ||
+			body_type == return_type || body_type == error_type) {
+			return;
+		}
+
+		IAST *value_expr = get_block_value_expr(fn_body);
+		if (value_expr && can_convert_implicitly(body_type, return_type)) {
+			value_expr->ts_data->implicit_conversion = return_type;
+			return;
+		}
+
+		const std::string &name = *fn_defn.fn_name.value.ptr_s;
+		SourceRange position = value_expr ? value_expr->position : fn_body.position;
+		this->diagnostics.report(DiagnosticCode::ReturnTypeMismatch, position,
+								 { name, return_type, body_type });
+	}
+
+	virtual void inspect_fn_definition(ASTFunctionDefinition& fn_defn) {
+		this->setup_fn_signature(fn_defn);
+		this->setup_fn_body(fn_defn);
 	};
 
 	virtual void inspect_fn_call(ASTFunctionCall& fn_call) {
-		std::string fn_name = *reinterpret_cast<ASTLiteral*>(fn_call.name.get())->token.value.ptr_s;
+		//only functions can be called by name, not the values of expressions
+		ASTLiteral *fn_literal = dynamic_cast<ASTLiteral*>(fn_call.name.get());
 
-		if (!this->scope->has_variable(fn_name)) {
-			std::stringstream error;
-			error << fn_call.position;
-			error << "unknown function: " << fn_name;
+		if (!fn_literal || fn_literal->token.type != TokenType::Identifier) {
+			this->diagnostics.report(DiagnosticCode::CalleeNotAFunction, fn_call.name->position);
+			fn_call.ts_data = std::make_shared<TSASTData>(this->scope, error_type);
 
-			throw std::runtime_error(error.str());
+			for (auto param : fn_call.params) {
+				param->dispatch(*this);
+			}
+			return;
+		}
+
+		std::string fn_name = *fn_literal->token.value.ptr_s;
+
+		if (!this->scope->has_variable(fn_name)) {
+			this->diagnostics.report(DiagnosticCode::UnknownFunction, fn_call.position, { fn_name });
+			fn_call.ts_data = std::make_shared<TSASTData>(this->scope, error_type);
 		}
+		else {
+			const TSVariable *fn = this->scope->get_variable(fn_name);
 
-		const TSVariable *fn = this->scope->get_variable(fn_name);
-		fn_call.ts_data = std::make_shared<TSASTData>(this->scope, fn->type);
+			if (fn->type->variant != TSType::Variant::Function) {
+				this->diagnostics.report(DiagnosticCode::NotAFunction, fn_call.position, { fn_name, fn->type });
+				fn_call.ts_data = std::make_shared<TSASTData>(this->scope, error_type);
+			}
+			else {
+				//a call evaluates to whatever the function returns
+				fn_call.ts_data = std::make_shared<TSASTData>(this->scope, fn->type->func_data->return_type);
+			}
+		}
 
 
 		for (auto param : fn_call.params) {
 			param->dispatch(*this);
 		}
+
+		if (fn_call.ts_data->type != error_type) {
+			const TSVariable *fn = this->scope->get_variable(fn_name);
+			this->check_call_arguments(fn_call, fn_name, *fn->type->func_data);
+		}
+	};
+
+	void check_call_arguments(ASTFunctionCall &fn_call, const std::string &fn_name,
+							  const TSFunctionTypeData &fn_type) {
+		if (fn_call.params.size() != fn_type.args.size()) {
+			this->diagnostics.report(DiagnosticCode::ArgumentCountMismatch, fn_call.position,
+									 { fn_name, std::to_string(fn_type.args.size()),
+									   std::to_string(fn_call.params.size()) });
+			return;
+		}
+
+		for (unsigned i = 0; i < fn_call.params.size(); ++i) {
+			IAST &param = *fn_call.params[i];
+			const TSType *expected = fn_type.args[i];
+			const TSType *received = param.ts_data->type;
+
+			if (received == expected || received == error_type) {
+				continue;
+			}
+
+			if (can_convert_implicitly(received, expected)) {
+				param.ts_data->implicit_conversion = expected;
+				continue;
+			}
+
+			this->diagnostics.report(DiagnosticCode::ArgumentTypeMismatch, param.position,
+									 { std::to_string(i + 1), fn_name, expected, received });
+		}
+	}
+
+	void check_loop_bound(IAST &bound, const std::string &which) {
+		const TSType *type = bound.ts_data->type;
+
+		if (type != i32_type && type != error_type) {
+			this->diagnostics.report(DiagnosticCode::ExpectedIntLoopBound, bound.position, { which, type });
+		}
+	}
+
+	//the value of a step written as an int literal, or a negated one
+	static bool get_literal_step(IAST &step, long long &value) {
+		if (step.type == ASTType::Literal) {
+			const Token &token = dynamic_cast<ASTLiteral&>(step).token;
+			if (token.type != TokenType::LiteralInt) {
+				return false;
+			}
+			value = *token.value.ptr_i;
+			return true;
+		}
+		if (step.type == ASTType::PrefixExpr) {
+			ASTPrefixExpr &prefix = dynamic_cast<ASTPrefixExpr&>(step);
+			if (prefix.op.type == TokenType::Minus && get_literal_step(*prefix.expr, value)) {
+				value = -value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	virtual void inspect_for_loop(ASTForLoop& for_loop) {
+		//the bounds are evaluated once, outside of the loop
+		for_loop.start->dispatch(*this);
+		for_loop.end->dispatch(*this);
+		this->check_loop_bound(*for_loop.start, "start");
+		this->check_loop_bound(*for_loop.end, "end");
+
+		if (for_loop.step) {
+			for_loop.step->dispatch(*this);
+			this->check_loop_bound(*for_loop.step, "step");
+
+			//the loop only ends by counting up to its end
+			long long step = 0;
+			if (get_literal_step(*for_loop.step, step) && step <= 0) {
+				this->diagnostics.report(DiagnosticCode::NonPositiveLoopStep, for_loop.step->position, { std::to_string(step) });
+			}
+		}
+
+		//the loop variable is only visible in the body
+		TSScope *loop_scope = storage.create_child_scope(this->scope);
+		TSDataCreator loop_creator(this->storage, loop_scope, this->diagnostics);
+
+		ASTLiteral &induction_var = *reinterpret_cast<ASTLiteral*>(for_loop.induction_var.get());
+		TSDataCreator::setup_variable_definition(induction_var, i32_type, loop_scope);
+
+		for_loop.body->dispatch(loop_creator);
+		for_loop.ts_data = std::make_shared<TSASTData>(this->scope, void_type);
+	};
+
+	//the expression a branch of an if evaluates to
+	static IAST* get_branch_value_expr(IAST &branch) {
+		if (branch.type == ASTType::Block) {
+			return get_block_value_expr(dynamic_cast<ASTBlock&>(branch));
+		}
+		return &branch;
+	}
+
+	//an if with an else evaluates to the type of its branches, f32 if one
+	//is i32 and the other f32. branches of different types, or a missing
+	//else, make it evaluate to nothing, so that an if whose value is not
+	//used can end its branches with anything.
+	const TSType* unify_if_branches(IAST &then_branch, IAST &else_branch) {
+		const TSType *then_type = then_branch.ts_data->type;
+		const TSType *else_type = else_branch.ts_data->type;
+
+		if (then_type == error_type || else_type == error_type) {
+			return error_type;
+		}
+
+		if (then_type == else_type) {
+			return then_type;
+		}
+
+		if (can_convert_implicitly(then_type, else_type)) {
+			get_branch_value_expr(then_branch)->ts_data->implicit_conversion = else_type;
+			return else_type;
+		}
+
+		if (can_convert_implicitly(else_type, then_type)) {
+			get_branch_value_expr(else_branch)->ts_data->implicit_conversion = then_type;
+			return then_type;
+		}
+
+		return void_type;
+	}
+
+	virtual void inspect_if(ASTIf& if_expr) {
+		if_expr.condition->dispatch(*this);
+
+		const TSType *condition_type = if_expr.condition->ts_data->type;
+		if (condition_type != bool_type && condition_type != error_type) {
+			this->diagnostics.report(DiagnosticCode::ExpectedBoolCondition, if_expr.condition->position,
+									 { condition_type });
+		}
+
+		//every branch is a block, with a scope of its own
+		if_expr.then_block->dispatch(*this);
+
+		const TSType *type = void_type;
+		if (if_expr.else_branch) {
+			if_expr.else_branch->dispatch(*this);
+			type = this->unify_if_branches(*if_expr.then_block, *if_expr.else_branch);
+		}
+
+		if_expr.ts_data = std::make_shared<TSASTData>(this->scope, type);
 	};
 
 	virtual void inspect_variable_definition(ASTVariableDefinition& variable_defn) {
@@ -268,10 +646,8 @@ struct TSDataCreator : public IASTVisitor {
 };
 
 struct TSArithTypeChecker : public IASTVisitor {
-	static bool is_number(const TSType *type) {
-		return type == i32_type ||
-			type == f32_type;
-	}
+	DiagnosticEngine &diagnostics;
+	TSArithTypeChecker(DiagnosticEngine &diagnostics) : diagnostics(diagnostics) {}
 
 	static TSType* coerce_safely_to(const TSType *to, const TSType *from) {
 		assert(is_number(to) && is_number(from));
@@ -288,79 +664,440 @@ struct TSArithTypeChecker : public IASTVisitor {
 			infix.op.type == TokenType::Multiply ||
 			infix.op.type == TokenType::Divide) {
 
-			if (!infix.left->ts_data) {
-				std::cout << "\n" << infix.position << "\nleft: " << infix.left->position << "\nright: " << infix.right->position;
-				std::cout << "\n" <<pretty_print(*infix.left);
-				infix.left->dispatch(*this);
-			}
 			assert(infix.left->ts_data);
 
-			if (!is_number(infix.left->ts_data->type)) {
-				std::stringstream error;
-				error << "expected a number as a left operand to " << infix.op.type;
-				error << infix.left->position << "expected number";
-				error << "\nreceived: " << *infix.left->ts_data->type;
+			//errors have already been reported for the operands themselves
+			const TSType *left_type = infix.left->ts_data->type;
+			if (left_type != error_type && !is_number(left_type)) {
+				this->diagnostics.report(DiagnosticCode::ExpectedNumberOperand, infix.left->position,
+										 { "left", infix.op.type, left_type });
+			}
 
-				throw std::runtime_error(error.str());
+			const TSType *right_type = infix.right->ts_data->type;
+			if (right_type != error_type && !is_number(right_type)) {
+				this->diagnostics.report(DiagnosticCode::ExpectedNumberOperand, infix.right->position,
+										 { "right", infix.op.type, right_type });
 			}
 
-			if (!is_number(infix.right->ts_data->type)) {
-				std::stringstream error;
-				error << "expected a number as a right operand to " << infix.op.type;
-				error << infix.right->position << "expected number";
-				error << "\nreceived: " << *infix.right->ts_data->type;
 
-				throw std::runtime_error(error.str());
+		};
+
+		if (is_comparison(infix.op.type)) {
+			const TSType *left_type = infix.left->ts_data->type;
+			const TSType *right_type = infix.right->ts_data->type;
+
+			bool is_equality = infix.op.type == TokenType::CondEQ || infix.op.type == TokenType::CondNEQ;
+			bool numbers = is_number(left_type) && is_number(right_type);
+			bool bools = is_equality && left_type == bool_type && right_type == bool_type;
+
+			if (left_type != error_type && right_type != error_type && !numbers && !bools) {
+				this->diagnostics.report(DiagnosticCode::ComparisonTypeMismatch, infix.position,
+										 { infix.op.type, left_type, right_type });
 			}
+		}
 
+		if (is_logical(infix.op.type)) {
+			const TSType *left_type = infix.left->ts_data->type;
+			if (left_type != error_type && left_type != bool_type) {
+				this->diagnostics.report(DiagnosticCode::ExpectedBoolOperand, infix.left->position,
+										 { "left", infix.op.type, left_type });
+			}
 
-		};
+			const TSType *right_type = infix.right->ts_data->type;
+			if (right_type != error_type && right_type != bool_type) {
+				this->diagnostics.report(DiagnosticCode::ExpectedBoolOperand, infix.right->position,
+										 { "right", infix.op.type, right_type });
+			}
+		}
 	};
 
-	//TO IMPLEMENT
 	virtual void inspect_prefix_expr(ASTPrefixExpr& prefix) {
+		prefix.expr->dispatch(*this);
+		const TSType *type = prefix.expr->ts_data->type;
+
 		if (prefix.op.type == TokenType::Minus) {
-			if (!is_number(prefix.expr->ts_data->type)) {
-				std::stringstream error;
-				error << "expected number for unary -";
-				error << prefix.position;
+			if (type != error_type && !is_number(type)) {
+				this->diagnostics.report(DiagnosticCode::ExpectedNumberPrefix, prefix.position,
+										 { prefix.op.type, type });
+			}
+		}
 
-				throw std::runtime_error(error.str());
+		if (prefix.op.type == TokenType::CondNot) {
+			if (type != error_type && type != bool_type) {
+				this->diagnostics.report(DiagnosticCode::ExpectedBoolPrefix, prefix.position,
+										 { prefix.op.type, type });
 			}
 		}
 	};
 };
 
 struct TSEqualityTypeChecker : public IASTVisitor {
+	DiagnosticEngine &diagnostics;
+	TSEqualityTypeChecker(DiagnosticEngine &diagnostics) : diagnostics(diagnostics) {}
+
 	virtual void inspect_infix_expr(ASTInfixExpr& infix){
 		if (infix.op.type == TokenType::Equals) {
+			const TSType *left_type = infix.left->ts_data->type;
+			const TSType *right_type = infix.right->ts_data->type;
 
-			if (infix.left->ts_data->type != infix.right->ts_data->type) {
-				std::stringstream error;
-				error << "types do not match on \"=\" |";
-				error << "left: " << *infix.left->ts_data->type;
-				error << " | right: " << *infix.right->ts_data->type;
-
-				error << infix.left->position << " type: " << *infix.left->ts_data->type;
-				error << infix.right->position << " type: " << *infix.right->ts_data->type;
-
-				throw std::runtime_error(error.str());
+			if (!is_assignment_target(*infix.left)) {
+				this->diagnostics.report(DiagnosticCode::InvalidAssignmentTarget, infix.left->position);
+			}
+			else if (left_type != error_type && right_type != error_type && left_type != right_type) {
+				this->diagnostics.report(DiagnosticCode::AssignmentTypeMismatch, infix.position,
+										 { left_type, right_type });
 			}
 
 		}
+		infix.traverse_inner(*this);
 	};
+
+	//a let, or the name of a variable. functions can not be assigned to.
+	static bool is_assignment_target(IAST &target) {
+		if (target.type == ASTType::VariableDefinition) {
+			return true;
+		}
+
+		if (target.type != ASTType::Literal ||
+			dynamic_cast<ASTLiteral&>(target).token.type != TokenType::Identifier) {
+			return false;
+		}
+
+		const TSType *type = target.ts_data->type;
+		return type == error_type || type->variant != TSType::Variant::Function;
+	}
+};
+
+//a const fn is evaluated at compile time, so everything it calls has to
+//be too. the math builtins are evaluated with the C library.
+struct TSConstFnChecker : public IASTGenericVisitor {
+	DiagnosticEngine &diagnostics;
+	const std::string &fn_name;
+
+	TSConstFnChecker(DiagnosticEngine &diagnostics, const std::string &fn_name) :
+		diagnostics(diagnostics), fn_name(fn_name) {}
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::FunctionCall && ast.ts_data->type != error_type) {
+			ASTFunctionCall &fn_call = dynamic_cast<ASTFunctionCall&>(ast);
+			const std::string &name = *dynamic_cast<ASTLiteral&>(*fn_call.name).token.value.ptr_s;
+			const TSVariable *fn = fn_call.ts_data->scope->get_variable(name);
+
+			if (fn->decl_pos.is_valid() && !fn->is_const_fn) {
+				this->diagnostics.report(DiagnosticCode::ConstFunctionCallsNonConst, fn_call.position,
+										 { this->fn_name, name });
+			}
+		}
+		ast.traverse_inner(*this);
+	}
 };
 
-TSContext type_system_type_check(std::shared_ptr<IAST>root) {
+static void run_checkers(IAST &ast, DiagnosticEngine &diagnostics) {
+	TSArithTypeChecker ts_arith_checker(diagnostics);
+	ast.dispatch(ts_arith_checker);
+
+	TSEqualityTypeChecker equality_checker(diagnostics);
+	ast.dispatch(equality_checker);
+
+	if (ast.type == ASTType::FunctionDefinition) {
+		ASTFunctionDefinition &fn_defn = dynamic_cast<ASTFunctionDefinition&>(ast);
+
+		if (fn_defn.is_const && fn_defn.body) {
+			TSConstFnChecker const_fn_checker(diagnostics, *fn_defn.fn_name.value.ptr_s);
+			fn_defn.body->dispatch(const_fn_checker);
+		}
+	}
+}
+
+//phase one: bring every top level function into the root scope, so that
+//bodies can be checked in any order. everything else at the top level
+//is cheap and checked serially, in source order.
+static std::vector<ASTFunctionDefinition*> collect_signatures(TSContext &ctx, ASTRoot &ast_root,
+															  DiagnosticEngine &diagnostics) {
+	TSScope *root_scope = ctx.get_root_scope();
+	ast_root.ts_data = std::make_shared<TSASTData>(root_scope, void_type);
+
+	TSDataCreator root_creator(ctx.get_storage(), root_scope, diagnostics);
+	std::vector<ASTFunctionDefinition*> fn_defns;
+	std::vector<std::shared_ptr<IAST> > other_children;
+
+	for (auto child : ast_root.children) {
+		ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+		if (fn_defn) {
+			root_creator.setup_fn_signature(*fn_defn);
+			fn_defns.push_back(fn_defn);
+
+			if (child->type == ASTType::Statement) {
+				child->ts_data = std::make_shared<TSASTData>(root_scope, void_type);
+			}
+		}
+		else {
+			other_children.push_back(child);
+		}
+	}
+
+	for (auto child : other_children) {
+		child->dispatch(root_creator);
+		run_checkers(*child, diagnostics);
+	}
+
+	return fn_defns;
+}
+
+//phase two: the bodies. every function reports into its own engine, and
+//the engines are merged in source order, however the threads got scheduled.
+//its scopes go to a storage of its own, which ctx takes over at the end.
+//the root scope is only read.
+static std::vector<std::unique_ptr<DiagnosticEngine> > check_fn_bodies(
+	TSContext &ctx,
+	const std::vector<ASTFunctionDefinition*> &fn_defns,
+	DiagnosticEngine &diagnostics,
+	unsigned num_threads) {
+	TSScope *root_scope = ctx.get_root_scope();
+	std::vector<std::unique_ptr<DiagnosticEngine> > fn_diagnostics;
+	std::vector<TSScopeStorage> fn_storages(fn_defns.size());
+
+	for (unsigned i = 0; i < fn_defns.size(); ++i) {
+		fn_diagnostics.push_back(std::unique_ptr<DiagnosticEngine>(
+			new DiagnosticEngine(diagnostics.get_error_limit())));
+	}
+
+	if (num_threads == 0) {
+		num_threads = std::thread::hardware_concurrency();
+	}
+	num_threads = std::max<unsigned>(1, std::min<unsigned>(num_threads, fn_defns.size()));
+
+	{
+		ThreadPool pool(num_threads);
+
+		for (unsigned i = 0; i < fn_defns.size(); ++i) {
+			DiagnosticEngine *local_diagnostics = fn_diagnostics[i].get();
+			TSScopeStorage *local_storage = &fn_storages[i];
+
+			pool.submit([&fn_defns, local_diagnostics, local_storage, root_scope, i]() {
+				TSDataCreator fn_creator(*local_storage, root_scope, *local_diagnostics);
+				fn_creator.setup_fn_body(*fn_defns[i]);
+				run_checkers(*fn_defns[i], *local_diagnostics);
+			});
+		}
+		pool.wait_idle();
+	}
+
+	for (auto &local_storage : fn_storages) {
+		ctx.adopt_scopes(local_storage);
+	}
+
+	for (auto &local_diagnostics : fn_diagnostics) {
+		diagnostics.merge(*local_diagnostics);
+	}
+
+	return fn_diagnostics;
+}
+
+TSContext type_system_type_check(std::shared_ptr<IAST>root, DiagnosticEngine &diagnostics,
+								  unsigned num_threads) {
 	TSContext ctx;
-	TSDataCreator ts_data_creator(ctx, ctx.get_root_scope());
-	root->dispatch(ts_data_creator);
+	ASTRoot &ast_root = dynamic_cast<ASTRoot&>(*root);
+
+	std::vector<ASTFunctionDefinition*> fn_defns = collect_signatures(ctx, ast_root, diagnostics);
+	check_fn_bodies(ctx, fn_defns, diagnostics, num_threads);
+
+	return ctx;
+}
+
+// -----------------------------------------------------
+// INCREMENTAL CHECKING
 
-	TSArithTypeChecker ts_arith_checker;
-	root->dispatch(ts_arith_checker);
+//flattens a subtree in pre-order, so that the ts_data of an unchanged
+//function can be moved over to its freshly parsed copy node by node.
+struct TSPreorderCollector : public IASTGenericVisitor {
+	std::vector<IAST*> nodes;
 
-	TSEqualityTypeChecker equality_checker;
-	root->dispatch(equality_checker);
+	virtual void inspect_ast(IAST &ast) {
+		this->nodes.push_back(&ast);
+		ast.traverse_inner(*this);
+	}
+};
+
+//collects every identifier a function binds or uses: its arguments, lets,
+//loop variables, the variables it reads and the fns it calls. a name that
+//is not a top level symbol yet still matters, since adding one changes
+//what the body means (a let of the same name becomes a redefinition).
+struct TSReferenceCollector : public IASTGenericVisitor {
+	std::set<std::string> references;
+
+	virtual void inspect_ast(IAST &ast) {
+		if (ast.type == ASTType::Literal) {
+			const Token &token = dynamic_cast<ASTLiteral&>(ast).token;
+
+			if (token.type == TokenType::Identifier) {
+				this->references.insert(*token.value.ptr_s);
+			}
+		}
+		ast.traverse_inner(*this);
+	}
+};
+
+//the cache and the trees never share ts_data
+static std::shared_ptr<TSASTData> copy_ts_data(const std::shared_ptr<TSASTData> &ts_data) {
+	if (!ts_data) {
+		return nullptr;
+	}
+	return std::make_shared<TSASTData>(*ts_data);
+}
+
+static std::string get_signature_key(ASTFunctionDefinition &fn_defn) {
+	std::stringstream key;
+
+	//callers of a const fn are checked against its constness
+	if (fn_defn.is_const) {
+		key << "const ";
+	}
+
+	for (auto arg : fn_defn.args) {
+		key << pretty_print(*arg.first) << ":" << pretty_print(*arg.second) << ",";
+	}
+	key << "->" << pretty_print(*fn_defn.return_type);
+	return key.str();
+}
+
+static std::string get_body_key(ASTFunctionDefinition &fn_defn) {
+	if (!fn_defn.body) {
+		return "";
+	}
+	return pretty_print(*fn_defn.body);
+}
+
+std::shared_ptr<TSContext> type_system_type_check_incremental(std::shared_ptr<IAST>root,
+															  TSIncrementalState &state,
+															  DiagnosticEngine &diagnostics,
+															  unsigned num_threads) {
+	std::shared_ptr<TSContext> ctx(new TSContext());
+	ASTRoot &ast_root = dynamic_cast<ASTRoot&>(*root);
+
+	//the keys have to be taken before checking, since pretty printing a
+	//typed tree also prints the types
+	std::map<ASTFunctionDefinition*, std::pair<std::string, std::string> > keys;
+	std::stringstream globals_key;
+
+	for (auto child : ast_root.children) {
+		ASTFunctionDefinition *fn_defn = get_top_level_fn_defn(*child);
+
+		if (fn_defn) {
+			keys[fn_defn] = std::make_pair(get_signature_key(*fn_defn), get_body_key(*fn_defn));
+		}
+		else {
+			globals_key << pretty_print(*child) << "\n";
+		}
+	}
+
+	//everything outside of functions is checked every time. we do not track
+	//who uses what in there, so any change to it throws the cache away.
+	if (globals_key.str() != state.globals_key) {
+		state.functions.clear();
+		state.globals_key = globals_key.str();
+	}
+
+	std::vector<ASTFunctionDefinition*> fn_defns = collect_signatures(*ctx, ast_root, diagnostics);
+
+	//find every function whose signature is not what it was the last time:
+	//new ones, deleted ones and changed ones.
+	std::set<std::string> changed_signatures;
+	std::set<std::string> current_names;
+
+	for (auto fn_defn : fn_defns) {
+		const std::string &name = *fn_defn->fn_name.value.ptr_s;
+		current_names.insert(name);
+
+		auto it = state.functions.find(name);
+		if (it == state.functions.end() || it->second.signature_key != keys[fn_defn].first) {
+			changed_signatures.insert(name);
+		}
+	}
+
+	for (auto it = state.functions.begin(); it != state.functions.end();) {
+		if (current_names.find(it->first) == current_names.end()) {
+			changed_signatures.insert(it->first);
+			it = state.functions.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	//a function's type is its signature alone, so only the functions that
+	//refer to a changed signature need a recheck. if those have changed
+	//signatures themselves, their own dependents follow.
+	std::vector<ASTFunctionDefinition*> dirty_fns;
+
+	for (auto fn_defn : fn_defns) {
+		const std::string &name = *fn_defn->fn_name.value.ptr_s;
+		auto it = state.functions.find(name);
+
+		bool is_dirty = it == state.functions.end()
+			|| it->second.signature_key != keys[fn_defn].first
+			|| it->second.body_key != keys[fn_defn].second;
+
+		if (!is_dirty) {
+			for (auto &reference : it->second.references) {
+				if (changed_signatures.count(reference)) {
+					is_dirty = true;
+					break;
+				}
+			}
+		}
+
+		if (!is_dirty) {
+			//reuse the cached data. the body is unchanged, so both trees
+			//have the same shape. every tree gets copies of its own, since
+			//later passes change the ts_data of the tree they work on.
+			TSPreorderCollector collector;
+			fn_defn->dispatch(collector);
+			assert(collector.nodes.size() == it->second.ts_data.size());
+
+			for (unsigned i = 0; i < collector.nodes.size(); ++i) {
+				collector.nodes[i]->ts_data = copy_ts_data(it->second.ts_data[i]);
+			}
+		}
+		else {
+			dirty_fns.push_back(fn_defn);
+		}
+	}
+
+	std::vector<std::unique_ptr<DiagnosticEngine> > fn_diagnostics =
+		check_fn_bodies(*ctx, dirty_fns, diagnostics, num_threads);
+	state.num_rechecked = dirty_fns.size();
+	state.num_reused = fn_defns.size() - dirty_fns.size();
+
+	for (unsigned i = 0; i < dirty_fns.size(); ++i) {
+		ASTFunctionDefinition *fn_defn = dirty_fns[i];
+		const std::string &name = *fn_defn->fn_name.value.ptr_s;
+
+		//functions with errors are not cached, so they are rechecked the
+		//next time around
+		if (fn_diagnostics[i]->has_errors()) {
+			state.functions.erase(name);
+			continue;
+		}
+
+		TSFunctionSummary &summary = state.functions[name];
+		summary.signature_key = keys[fn_defn].first;
+		summary.body_key = keys[fn_defn].second;
+		summary.ctx = ctx;
+
+		TSReferenceCollector reference_collector;
+		fn_defn->dispatch(reference_collector);
+		summary.references = reference_collector.references;
+
+		TSPreorderCollector collector;
+		fn_defn->dispatch(collector);
+		summary.ts_data.clear();
+
+		for (auto node : collector.nodes) {
+			summary.ts_data.push_back(copy_ts_data(node->ts_data));
+		}
+	}
 
 	return ctx;
 }
@@ -1,10 +1,13 @@
 #pragma once
 #include <map>
+#include <set>
+#include <string>
 #include <vector>
 #include <memory>
 #include "file_handling.h"
 
 class IAST;
+class DiagnosticEngine;
 
 struct TSType;
 struct TSScope;
@@ -25,26 +28,38 @@ public:
         Float,   // abstract float to be unified
         Float32,
         Int32,
+        Bool,
         Function,
+        Error,   // given to expressions that failed to type check
     } variant;
 
     std::shared_ptr<TSFunctionTypeData>func_data;
-    PositionRange *decl_pos;
+    SourceRange decl_pos;
 
-    TSType(Variant variant, PositionRange *decl_pos) : variant(variant) {}
+    TSType(Variant variant, SourceRange decl_pos) : variant(variant),
+        decl_pos(decl_pos) {}
 
     TSType(const TSFunctionTypeData func_data,
-           PositionRange            *decl_pos);
+           SourceRange              decl_pos);
 };
 
 
-static const TSType *int_type = new TSType(TSType::Variant::Int, nullptr);
-static const TSType *float_type = new TSType(TSType::Variant::Float, nullptr);
-static const TSType *string_type = new TSType(TSType::Variant::String, nullptr);
-static const TSType *void_type = new TSType(TSType::Variant::Void, nullptr);
+// defined once in type_system.cpp, so that every translation unit sees the
+// same pointers and types can be compared by pointer.
+extern const TSType *const int_type;
+extern const TSType *const float_type;
+extern const TSType *const string_type;
+extern const TSType *const void_type;
 
-static const TSType *i32_type = new TSType(TSType::Variant::Int32, nullptr);
-static const TSType *f32_type = new TSType(TSType::Variant::Float32, nullptr);
+extern const TSType *const i32_type;
+extern const TSType *const f32_type;
+
+// what comparisons evaluate to, and if conditions have to be
+extern const TSType *const bool_type;
+
+// checks that see an error_type operand stay quiet, since the error has
+// already been reported where it was created
+extern const TSType *const error_type;
 
 std::ostream& operator<<(std::ostream& out,
                          const TSType& type);
@@ -59,15 +74,25 @@ struct TSFunctionTypeData
         args(args), return_type(return_type) {}
 };
 
+// function types are interned, so two function types are equal iff their
+// pointers are equal (the same way the primitive types above work).
+// safe to call from multiple threads.
+const TSType* get_function_type(const std::vector<const TSType *>& args,
+                                const TSType                     *return_type);
+
 struct TSVariable {
     std::string name;
     const TSType *type;
 
-    PositionRange *decl_pos;
+    // invalid for builtins
+    SourceRange decl_pos;
+
+    // a function defined with const fn
+    bool is_const_fn;
 
     TSVariable(std::string name, const TSType *type,
-               PositionRange *decl_pos) : name(
-            name), type(type), decl_pos(decl_pos) {}
+               SourceRange decl_pos) : name(
+            name), type(type), decl_pos(decl_pos), is_const_fn(false) {}
 };
 
 struct TSScope
@@ -155,44 +180,82 @@ private:
 
 
     friend struct TSContext;
+    friend struct TSScopeStorage;
 };
 
-struct TSContext
+// owns scopes. function bodies are checked in parallel, so each body gets
+// a storage of its own, without locking, and the storages are moved into
+// the TSContext once every body is checked.
+struct TSScopeStorage
 {
-private:
-
     // we need to store a vector of pointers since references to a frikkin
     // STL vector may get invalidated.
     std::vector<std::shared_ptr<TSScope> >scopes;
 
+    TSScope* create_child_scope(TSScope *parent) {
+        this->scopes.push_back(std::shared_ptr<TSScope>(new TSScope(parent)));
+        return this->scopes.back().get();
+    }
+};
+
+struct TSContext
+{
+private:
+
+    // the root scope, the top level and the storages of the bodies
+    TSScopeStorage storage;
+
+    // cached, since the storage of the root scope keeps growing
+    TSScope *root_scope;
+
 public:
 
     TSContext() {
         auto root_scope = std::shared_ptr<TSScope>(new TSScope(nullptr));
 
 
-        TSType *sin_type =
-            new TSType(TSFunctionTypeData({ f32_type }, f32_type),
-                       nullptr);
+        // the math library. codegen maps every one of these to an llvm
+        // intrinsic, see llvm_get_builtin_intrinsic.
+        const TSType *f32_unary_type = get_function_type({ f32_type }, f32_type);
+        const TSType *f32_binary_type = get_function_type({ f32_type, f32_type }, f32_type);
+        const TSType *f32_ternary_type = get_function_type({ f32_type, f32_type, f32_type }, f32_type);
+
+        for (const char *name : { "sin", "cos", "sqrt", "exp", "exp2", "log", "log2", "log10",
+                                  "fabs", "floor", "ceil", "trunc", "round" }) {
+            root_scope->add_variable(name, new TSVariable(name, f32_unary_type, SourceRange()));
+        }
+
+        for (const char *name : { "pow", "fmin", "fmax", "copysign" }) {
+            root_scope->add_variable(name, new TSVariable(name, f32_binary_type, SourceRange()));
+        }
 
-        root_scope->add_variable("sin",
-                                 new TSVariable("sin", sin_type, nullptr));
+        root_scope->add_variable("fma", new TSVariable("fma", f32_ternary_type, SourceRange()));
         root_scope->add_type("i32", i32_type);
         root_scope->add_type("f32", f32_type);
+        root_scope->add_type("bool", bool_type);
         root_scope->add_type("void", void_type);
         root_scope->add_type("string", string_type);
 
 
-        scopes.push_back(root_scope);
+        this->storage.scopes.push_back(root_scope);
+        this->root_scope = root_scope.get();
     }
 
     TSScope* get_root_scope() {
-        return this->scopes.at(0).get();
+        return this->root_scope;
     }
 
-    TSScope* create_child_scope(TSScope *parent) {
-        scopes.push_back(std::shared_ptr<TSScope>(new TSScope(parent)));
-        return this->scopes[this->scopes.size() - 1].get();
+    // for the scopes that are created outside of the parallel body checks
+    TSScopeStorage& get_storage() {
+        return this->storage;
+    }
+
+    // takes over the scopes of a body once it is checked
+    void adopt_scopes(TSScopeStorage& body_storage) {
+        for (auto& scope : body_storage.scopes) {
+            this->storage.scopes.push_back(std::move(scope));
+        }
+        body_storage.scopes.clear();
     }
 };
 
@@ -201,7 +264,74 @@ struct TSASTData
     TSScope *scope;
     const TSType  *type;
 
-    TSASTData(TSScope *scope, const TSType *type) : scope(scope), type(type) {}
+    // set when the surrounding expression uses this one as a different
+    // type, eg. the i32 side of an i32 + f32. the only implicit conversion
+    // is i32 -> f32. nullptr if the value is used as is.
+    const TSType *implicit_conversion;
+
+    TSASTData(TSScope *scope, const TSType *type) : scope(scope), type(type),
+        implicit_conversion(nullptr) {}
+};
+
+// math builtin -> the C library's f32 function that implements it (sin ->
+// sinf). the LLVM backend lowers what is left of its intrinsics to calls
+// to these, and the C backend calls them directly, so a program can not
+// define functions with these names.
+const std::map<std::string, std::string>& ts_get_math_library_functions();
+
+// the type of the fn main that top_level defines, or nullptr if it does
+// not define one
+const TSType* ts_get_main_type(const std::vector<std::shared_ptr<IAST> >& top_level);
+
+// throws unless main_type, from ts_get_main_type, is () -> i32. the C
+// runtime calls the main of an executable as int main(void), so any
+// other signature links but runs with garbage.
+void ts_check_executable_main(const TSType *main_type);
+
+// top level function signatures are collected into the root scope first,
+// then the function bodies are checked on num_threads threads
+// (0 = one per core). errors are reported to diagnostics.
+TSContext type_system_type_check(std::shared_ptr<IAST>root,
+                                 DiagnosticEngine & diagnostics,
+                                 unsigned num_threads = 0);
+
+// what the incremental checker remembers about a top level function
+struct TSFunctionSummary
+{
+    std::string signature_key;
+    std::string body_key;
+
+    // every name the function binds or uses
+    std::set<std::string> references;
+
+    // ts_data of the function's subtree in pre-order
+    std::vector<std::shared_ptr<TSASTData> > ts_data;
+
+    // owns the scopes that ts_data points into
+    std::shared_ptr<TSContext> ctx;
+};
+
+struct TSIncrementalState
+{
+    std::map<std::string, TSFunctionSummary> functions;
+
+    // everything at the top level that is not a function
+    std::string globals_key;
+
+    // statistics of the last check
+    unsigned num_rechecked;
+    unsigned num_reused;
+
+    TSIncrementalState() : num_rechecked(0), num_reused(0) {}
 };
 
-TSContext type_system_type_check(std::shared_ptr<IAST>root);
+// like type_system_type_check, but only rechecks the functions whose body
+// changed since the last call with the same state, or that refer to a top
+// level function whose signature changed. everything else gets a copy of
+// the TSASTData of the previous check. its scopes are owned by state, so
+// the tree has to be done with before the next check with the same state.
+std::shared_ptr<TSContext> type_system_type_check_incremental(
+    std::shared_ptr<IAST>root,
+    TSIncrementalState & state,
+    DiagnosticEngine & diagnostics,
+    unsigned num_threads = 0);